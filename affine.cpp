@@ -0,0 +1,202 @@
+#include <cmath>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "affine.h"
+
+// The sincos below is written once against these helpers and instantiated for plain doubles,
+// SSE2 and AVX registers. Masks are bool for doubles and all-ones lanes for the registers.
+template <class V>
+V splat(double v);
+
+template <>
+inline double splat<double>(double v) { return v; }
+static inline double vadd(double a, double b) { return a + b; }
+static inline double vsub(double a, double b) { return a - b; }
+static inline double vmul(double a, double b) { return a * b; }
+static inline double vround(double a) { return std::nearbyint(a); }
+static inline bool vequal(double a, double b) { return a == b; }
+static inline bool vgreaterEqual(double a, double b) { return a >= b; }
+static inline bool vor(bool a, bool b) { return a || b; }
+static inline double vselect(bool mask, double a, double b) { return mask ? b : a; }
+static inline double vnegateIf(bool mask, double a) { return mask ? -a : a; }
+
+#if defined(__SSE2__)
+template <>
+inline __m128d splat<__m128d>(double v) { return _mm_set1_pd(v); }
+static inline __m128d vadd(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+static inline __m128d vsub(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+static inline __m128d vmul(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+static inline __m128d vround(__m128d a)
+{
+    // adding 1.5 * 2^52 pushes the fraction out of the mantissa, rounding to nearest (|a| < 2^51)
+    const __m128d magic = _mm_set1_pd(6755399441055744.0);
+    return _mm_sub_pd(_mm_add_pd(a, magic), magic);
+}
+static inline __m128d vequal(__m128d a, __m128d b) { return _mm_cmpeq_pd(a, b); }
+static inline __m128d vgreaterEqual(__m128d a, __m128d b) { return _mm_cmpge_pd(a, b); }
+static inline __m128d vor(__m128d a, __m128d b) { return _mm_or_pd(a, b); }
+static inline __m128d vselect(__m128d mask, __m128d a, __m128d b) { return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a)); }
+static inline __m128d vnegateIf(__m128d mask, __m128d a) { return _mm_xor_pd(a, _mm_and_pd(mask, _mm_set1_pd(-0.0))); }
+#endif
+
+#if defined(__AVX__)
+template <>
+inline __m256d splat<__m256d>(double v) { return _mm256_set1_pd(v); }
+static inline __m256d vadd(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+static inline __m256d vsub(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+static inline __m256d vmul(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+static inline __m256d vround(__m256d a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline __m256d vequal(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+static inline __m256d vgreaterEqual(__m256d a, __m256d b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+static inline __m256d vor(__m256d a, __m256d b) { return _mm256_or_pd(a, b); }
+static inline __m256d vselect(__m256d mask, __m256d a, __m256d b) { return _mm256_blendv_pd(a, b, mask); }
+static inline __m256d vnegateIf(__m256d mask, __m256d a) { return _mm256_xor_pd(a, _mm256_and_pd(mask, _mm256_set1_pd(-0.0))); }
+#endif
+
+// fdlibm's range reduction and kernels: x = q * pi/2 + r with |r| <= pi/4, pi/2 split in three
+// parts so q * part stays exact, then odd/even polynomials for sin and cos of r
+template <class V>
+static inline void sincosLanes(V x, V &s, V &c)
+{
+    V q = vround(vmul(x, splat<V>(0.63661977236758134308)));
+    V r = vsub(x, vmul(q, splat<V>(1.57079632673412561417e+00)));
+    r = vsub(r, vmul(q, splat<V>(6.07710050630396597660e-11)));
+    r = vsub(r, vmul(q, splat<V>(2.02226624879595063154e-21)));
+    V z = vmul(r, r);
+
+    V ps = splat<V>(1.58969099521155010221e-10);
+    ps = vadd(vmul(ps, z), splat<V>(-2.50507602534068634195e-08));
+    ps = vadd(vmul(ps, z), splat<V>(2.75573137070700676789e-06));
+    ps = vadd(vmul(ps, z), splat<V>(-1.98412698298579493134e-04));
+    ps = vadd(vmul(ps, z), splat<V>(8.33333333332248946124e-03));
+    ps = vadd(vmul(ps, z), splat<V>(-1.66666666666666324348e-01));
+    ps = vadd(r, vmul(vmul(ps, z), r));
+
+    V pc = splat<V>(-1.13596475577881948265e-11);
+    pc = vadd(vmul(pc, z), splat<V>(2.08757232129817482790e-09));
+    pc = vadd(vmul(pc, z), splat<V>(-2.75573143513906633035e-07));
+    pc = vadd(vmul(pc, z), splat<V>(2.48015872894767294178e-05));
+    pc = vadd(vmul(pc, z), splat<V>(-1.38888888888741095749e-03));
+    pc = vadd(vmul(pc, z), splat<V>(4.16666666666666019037e-02));
+    pc = vadd(vsub(splat<V>(1.0), vmul(z, splat<V>(0.5))), vmul(vmul(pc, z), z));
+
+    // quadrant k = q mod 4, floor(q / 4) computed as a rounding since q is whole
+    V k = vsub(q, vmul(splat<V>(4.0), vround(vsub(vmul(q, splat<V>(0.25)), splat<V>(0.375)))));
+    auto odd = vor(vequal(k, splat<V>(1.0)), vequal(k, splat<V>(3.0)));
+    auto sinNegative = vgreaterEqual(k, splat<V>(2.0));
+    auto cosNegative = vor(vequal(k, splat<V>(1.0)), vequal(k, splat<V>(2.0)));
+    s = vnegateIf(sinNegative, vselect(odd, ps, pc));
+    c = vnegateIf(cosNegative, vselect(odd, pc, ps));
+}
+
+void sincosArray(const double *angles, size_t count, double *sines, double *cosines)
+{
+    size_t i = 0;
+#if defined(__AVX__)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d s, c;
+        sincosLanes(_mm256_loadu_pd(angles + i), s, c);
+        _mm256_storeu_pd(sines + i, s);
+        _mm256_storeu_pd(cosines + i, c);
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128d s, c;
+        sincosLanes(_mm_loadu_pd(angles + i), s, c);
+        _mm_storeu_pd(sines + i, s);
+        _mm_storeu_pd(cosines + i, c);
+    }
+#endif
+    for (; i < count; ++i)
+        sincosLanes(angles[i], sines[i], cosines[i]);
+}
+
+void OrbitArrays::resize(size_t count)
+{
+    parent.resize(count, -1);
+    orbitAngle.resize(count, 0.0);
+    orbitRadius.resize(count, 0.0);
+    spinAngle.resize(count, 0.0);
+    scale.resize(count, 1.0);
+}
+
+void composeOrbitPositions(const OrbitArrays &bodies, OrbitWorkspace &work)
+{
+    const size_t count = bodies.size();
+    work.frameAngle.resize(count);
+    work.bodyAngle.resize(count);
+    work.frameSin.resize(count);
+    work.frameCos.resize(count);
+    work.bodySin.resize(count);
+    work.bodyCos.resize(count);
+    work.x.resize(count);
+    work.z.resize(count);
+
+    // a satellite's orbit is measured in its parent's turning frame, so the angles add up down the chain
+    for (size_t i = 0; i < count; ++i)
+    {
+        int p = bodies.parent[i];
+        work.frameAngle[i] = bodies.orbitAngle[i] + (p >= 0 ? work.frameAngle[p] : 0.0);
+        work.bodyAngle[i] = work.frameAngle[i] + bodies.spinAngle[i];
+    }
+    sincosArray(work.frameAngle.data(), count, work.frameSin.data(), work.frameCos.data());
+    sincosArray(work.bodyAngle.data(), count, work.bodySin.data(), work.bodyCos.data());
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        int p = bodies.parent[i];
+        double r = bodies.orbitRadius[i];
+        work.x[i] = (p >= 0 ? work.x[p] : 0.0) + r * work.frameCos[i];
+        work.z[i] = (p >= 0 ? work.z[p] : 0.0) - r * work.frameSin[i];
+    }
+}
+
+void composeOrbitModels(const OrbitArrays &bodies, const glm::dvec3 &origin, float *out, OrbitWorkspace &work)
+{
+    composeOrbitPositions(bodies, work);
+
+    // rotate(angle, y) * scale, then the translation, column by column
+    for (size_t i = 0; i < bodies.size(); ++i, out += 16)
+    {
+        float s = static_cast<float>(bodies.scale[i]);
+        float sc = s * static_cast<float>(work.bodyCos[i]);
+        float ss = s * static_cast<float>(work.bodySin[i]);
+        out[0] = sc, out[1] = 0.0f, out[2] = -ss, out[3] = 0.0f;
+        out[4] = 0.0f, out[5] = s, out[6] = 0.0f, out[7] = 0.0f;
+        out[8] = ss, out[9] = 0.0f, out[10] = sc, out[11] = 0.0f;
+        out[12] = static_cast<float>(work.x[i] - origin.x);
+        out[13] = static_cast<float>(-origin.y);
+        out[14] = static_cast<float>(work.z[i] - origin.z);
+        out[15] = 1.0f;
+    }
+}
+
+void composeOrbitModelViewProjections(const OrbitArrays &bodies, const glm::dvec3 &origin, const glm::mat4 &viewProjection,
+                                      float *out, OrbitWorkspace &work)
+{
+    composeOrbitPositions(bodies, work);
+
+    // the model's zero entries make each column a combination of at most four columns of viewProjection
+    const glm::vec4 v0 = viewProjection[0], v1 = viewProjection[1], v2 = viewProjection[2], v3 = viewProjection[3];
+    for (size_t i = 0; i < bodies.size(); ++i, out += 16)
+    {
+        float s = static_cast<float>(bodies.scale[i]);
+        float sc = s * static_cast<float>(work.bodyCos[i]);
+        float ss = s * static_cast<float>(work.bodySin[i]);
+        float tx = static_cast<float>(work.x[i] - origin.x);
+        float ty = static_cast<float>(-origin.y);
+        float tz = static_cast<float>(work.z[i] - origin.z);
+        for (int k = 0; k < 4; ++k)
+        {
+            out[k] = sc * v0[k] - ss * v2[k];
+            out[4 + k] = s * v1[k];
+            out[8 + k] = ss * v0[k] + sc * v2[k];
+            out[12 + k] = tx * v0[k] + ty * v1[k] + tz * v2[k] + v3[k];
+        }
+    }
+}
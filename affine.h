@@ -0,0 +1,43 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// sines and cosines of count angles, 4 (AVX) or 2 (SSE2) at a time.
+// Within 2 ulp of std::sin/std::cos for |angle| < 1e6.
+void sincosArray(const double *angles, size_t count, double *sines, double *cosines);
+
+// Bodies orbiting in the xz plane, in structure-of-arrays form, parents before their satellites.
+// Same transform as the glm chain the scene used to build per body:
+// for each ancestor rotate(orbitAngle, y) * translate(orbitRadius, 0, 0), then rotate(spinAngle, y) * scale.
+struct OrbitArrays
+{
+    std::vector<int> parent; // -1 for a root
+    std::vector<double> orbitAngle;
+    std::vector<double> orbitRadius;
+    std::vector<double> spinAngle;
+    std::vector<double> scale;
+
+    size_t size() const { return parent.size(); }
+    void resize(size_t count);
+};
+
+// intermediate arrays, kept between calls so a frame allocates nothing
+struct OrbitWorkspace
+{
+    std::vector<double> frameAngle, bodyAngle; // accumulated down the chain, and with the spin added
+    std::vector<double> frameSin, frameCos, bodySin, bodyCos;
+    std::vector<double> x, z; // world position
+};
+
+// World positions of every body, left in work.x and work.z (y is 0)
+void composeOrbitPositions(const OrbitArrays &bodies, OrbitWorkspace &work);
+
+// Model matrices relative to origin (e.g. the camera, see Camera::RelativePosition), written as
+// column-major 4x4 floats ready for a uniform or instance buffer. Every matrix is assembled
+// straight from the sines and cosines, there is no general 4x4 product.
+void composeOrbitModels(const OrbitArrays &bodies, const glm::dvec3 &origin, float *out, OrbitWorkspace &work);
+// same, premultiplied by viewProjection
+void composeOrbitModelViewProjections(const OrbitArrays &bodies, const glm::dvec3 &origin, const glm::mat4 &viewProjection,
+                                      float *out, OrbitWorkspace &work);
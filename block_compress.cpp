@@ -0,0 +1,437 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "block_compress.h"
+#include "jobs.h"
+
+// A block as float planes, so the per-pixel loops vectorize 8 pixels at a time
+struct BlockPixels
+{
+    alignas(32) float channel[4][16]; // r, g, b, a
+};
+
+static void loadBlock(const unsigned char rgba[64], BlockPixels &block)
+{
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 4; ++c)
+            block.channel[c][i] = rgba[4 * i + c];
+}
+
+// principal axis of the block's colors over the first channelCount channels: the endpoints are
+// the extremes of the pixels projected on it
+static void principalEndpoints(const BlockPixels &block, int channelCount, float e0[4], float e1[4])
+{
+    float mean[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    for (int c = 0; c < channelCount; ++c)
+    {
+        for (int i = 0; i < 16; ++i)
+            mean[c] += block.channel[c][i];
+        mean[c] /= 16.0f;
+    }
+    float covariance[4][4] = {};
+    for (int i = 0; i < 16; ++i)
+        for (int a = 0; a < channelCount; ++a)
+            for (int b = a; b < channelCount; ++b)
+                covariance[a][b] += (block.channel[a][i] - mean[a]) * (block.channel[b][i] - mean[b]);
+    for (int a = 0; a < channelCount; ++a)
+        for (int b = 0; b < a; ++b)
+            covariance[a][b] = covariance[b][a];
+
+    // power iteration, from the diagonal which is never orthogonal to the axis of a real block
+    float axis[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+    for (int c = 0; c < channelCount; ++c)
+        axis[c] = covariance[c][c] + 1e-3f;
+    for (int iteration = 0; iteration < 8; ++iteration)
+    {
+        float next[4] = {0.0f, 0.0f, 0.0f, 0.0f}, largest = 0.0f;
+        for (int a = 0; a < channelCount; ++a)
+        {
+            for (int b = 0; b < channelCount; ++b)
+                next[a] += covariance[a][b] * axis[b];
+            largest = std::max(largest, std::fabs(next[a]));
+        }
+        if (largest < 1e-6f)
+            break; // flat block, any axis does
+        for (int c = 0; c < channelCount; ++c)
+            axis[c] = next[c] / largest;
+    }
+
+    float lowest = 1e30f, highest = -1e30f;
+    for (int i = 0; i < 16; ++i)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < channelCount; ++c)
+            t += (block.channel[c][i] - mean[c]) * axis[c];
+        lowest = std::min(lowest, t);
+        highest = std::max(highest, t);
+    }
+    float length = 0.0f;
+    for (int c = 0; c < channelCount; ++c)
+        length += axis[c] * axis[c];
+    length = length > 0.0f ? length : 1.0f;
+    for (int c = 0; c < 4; ++c)
+    {
+        float a = c < channelCount ? axis[c] / length : 0.0f;
+        e0[c] = std::clamp(mean[c] + lowest * a, 0.0f, 255.0f);
+        e1[c] = std::clamp(mean[c] + highest * a, 0.0f, 255.0f);
+    }
+    for (int c = channelCount; c < 4; ++c)
+        e0[c] = e1[c] = 255.0f;
+}
+
+// index of the nearest of steps + 1 evenly spaced colors from e0 to e1 for every pixel, by
+// projection on the segment
+static void projectIndices(const BlockPixels &block, int channelCount, const float e0[4], const float e1[4], int steps, int indices[16])
+{
+    float direction[4] = {0.0f, 0.0f, 0.0f, 0.0f}, lengthSquared = 0.0f;
+    for (int c = 0; c < channelCount; ++c)
+    {
+        direction[c] = e1[c] - e0[c];
+        lengthSquared += direction[c] * direction[c];
+    }
+    if (lengthSquared < 1e-6f)
+    {
+        std::fill(indices, indices + 16, 0);
+        return;
+    }
+    float scale = steps / lengthSquared;
+#if defined(__AVX2__)
+    for (int i = 0; i < 16; i += 8)
+    {
+        __m256 t = _mm256_setzero_ps();
+        for (int c = 0; c < channelCount; ++c)
+        {
+            __m256 offset = _mm256_sub_ps(_mm256_load_ps(block.channel[c] + i), _mm256_set1_ps(e0[c]));
+            t = _mm256_add_ps(t, _mm256_mul_ps(offset, _mm256_set1_ps(direction[c] * scale)));
+        }
+        t = _mm256_min_ps(_mm256_max_ps(t, _mm256_setzero_ps()), _mm256_set1_ps(float(steps)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(indices + i), _mm256_cvtps_epi32(t)); // rounds to nearest
+    }
+#else
+    for (int i = 0; i < 16; ++i)
+    {
+        float t = 0.0f;
+        for (int c = 0; c < channelCount; ++c)
+            t += (block.channel[c][i] - e0[c]) * direction[c] * scale;
+        indices[i] = static_cast<int>(std::nearbyint(std::clamp(t, 0.0f, float(steps))));
+    }
+#endif
+}
+
+// endpoints that best fit the pixels in the least squares sense for the given indices
+static bool refineEndpoints(const BlockPixels &block, int channelCount, const int indices[16], int steps, float e0[4], float e1[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < 16; ++i)
+    {
+        float w = float(indices[i]) / steps, v = 1.0f - w;
+        aa += v * v;
+        ab += v * w;
+        bb += w * w;
+        for (int c = 0; c < channelCount; ++c)
+        {
+            ax[c] += v * block.channel[c][i];
+            bx[c] += w * block.channel[c][i];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (std::fabs(determinant) < 1e-6f)
+        return false; // every pixel on one index
+    for (int c = 0; c < channelCount; ++c)
+    {
+        e0[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+        e1[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+static uint16_t packRgb565(const float color[4])
+{
+    int r = static_cast<int>(color[0] * 31.0f / 255.0f + 0.5f);
+    int g = static_cast<int>(color[1] * 63.0f / 255.0f + 0.5f);
+    int b = static_cast<int>(color[2] * 31.0f / 255.0f + 0.5f);
+    return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+static void unpackRgb565(uint16_t packed, float color[4])
+{
+    int r = packed >> 11 & 31, g = packed >> 5 & 63, b = packed & 31;
+    color[0] = float(r << 3 | r >> 2);
+    color[1] = float(g << 2 | g >> 4);
+    color[2] = float(b << 3 | b >> 2);
+    color[3] = 255.0f;
+}
+
+void compressBlockBC1(const unsigned char rgba[64], unsigned char out[8])
+{
+    BlockPixels block;
+    loadBlock(rgba, block);
+    float e0[4], e1[4];
+    int indices[16];
+    principalEndpoints(block, 3, e0, e1);
+    projectIndices(block, 3, e0, e1, 3, indices);
+    if (refineEndpoints(block, 3, indices, 3, e0, e1))
+        projectIndices(block, 3, e0, e1, 3, indices);
+
+    // the 4 color mode needs color0 > color1; indices are then re-projected on the quantized colors
+    uint16_t c0 = packRgb565(e0), c1 = packRgb565(e1);
+    if (c0 < c1)
+        std::swap(c0, c1);
+    uint32_t bits = 0;
+    if (c0 != c1)
+    {
+        float q0[4], q1[4];
+        unpackRgb565(c0, q0);
+        unpackRgb565(c1, q1);
+        projectIndices(block, 3, q0, q1, 3, indices);
+        // along the segment: c0, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1, c1
+        static const uint32_t code[4] = {0, 2, 3, 1};
+        for (int i = 0; i < 16; ++i)
+            bits |= code[indices[i]] << (2 * i);
+    }
+    out[0] = c0 & 0xFF;
+    out[1] = c0 >> 8;
+    out[2] = c1 & 0xFF;
+    out[3] = c1 >> 8;
+    for (int i = 0; i < 4; ++i)
+        out[4 + i] = static_cast<unsigned char>(bits >> (8 * i));
+}
+
+void decompressBlockBC1(const unsigned char block[8], unsigned char rgba[64])
+{
+    uint16_t c0 = block[0] | block[1] << 8, c1 = block[2] | block[3] << 8;
+    float palette[4][4];
+    unpackRgb565(c0, palette[0]);
+    unpackRgb565(c1, palette[1]);
+    for (int c = 0; c < 4; ++c)
+    {
+        if (c0 > c1)
+        {
+            palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+            palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+        }
+        else
+        {
+            palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+            palette[3][c] = 0.0f; // transparent black
+        }
+    }
+    uint32_t bits = block[4] | block[5] << 8 | block[6] << 16 | uint32_t(block[7]) << 24;
+    for (int i = 0; i < 16; ++i)
+        for (int c = 0; c < 4; ++c)
+            rgba[4 * i + c] = static_cast<unsigned char>(palette[bits >> (2 * i) & 3][c] + 0.5f);
+}
+
+// BC7 interpolation weights of 4-bit indices, out of 64
+static const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// 7 bits per channel plus a p-bit shared by the four: the better of the two p-bits for color
+static void quantizeBC7Endpoint(const float color[4], int quantized[4], int &pbit)
+{
+    float bestError = 1e30f;
+    for (int p = 0; p < 2; ++p)
+    {
+        int q[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            q[c] = std::clamp(static_cast<int>(std::nearbyint((color[c] - p) / 2.0f)), 0, 127);
+            float d = float(q[c] << 1 | p) - color[c];
+            error += d * d;
+        }
+        if (error < bestError)
+        {
+            bestError = error;
+            pbit = p;
+            std::copy(q, q + 4, quantized);
+        }
+    }
+}
+
+// little-endian bit stream of a 128-bit block
+struct BlockBits
+{
+    uint64_t word[2] = {0, 0};
+    int position = 0;
+
+    void put(uint32_t value, int count)
+    {
+        for (int i = 0; i < count; ++i, ++position)
+            word[position >> 6] |= uint64_t(value >> i & 1) << (position & 63);
+    }
+    uint32_t get(int count)
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < count; ++i, ++position)
+            value |= uint32_t(word[position >> 6] >> (position & 63) & 1) << i;
+        return value;
+    }
+};
+
+void compressBlockBC7(const unsigned char rgba[64], unsigned char out[16])
+{
+    BlockPixels block;
+    loadBlock(rgba, block);
+    float e0[4], e1[4];
+    int indices[16];
+    principalEndpoints(block, 4, e0, e1);
+    projectIndices(block, 4, e0, e1, 15, indices);
+    if (refineEndpoints(block, 4, indices, 15, e0, e1))
+        projectIndices(block, 4, e0, e1, 15, indices);
+
+    int q0[4], q1[4], p0 = 0, p1 = 0;
+    quantizeBC7Endpoint(e0, q0, p0);
+    quantizeBC7Endpoint(e1, q1, p1);
+    float r0[4], r1[4];
+    for (int c = 0; c < 4; ++c)
+    {
+        r0[c] = float(q0[c] << 1 | p0);
+        r1[c] = float(q1[c] << 1 | p1);
+    }
+    projectIndices(block, 4, r0, r1, 15, indices);
+    // the first pixel's index has an implied top bit of 0: swap the endpoints if it's set
+    if (indices[0] >= 8)
+    {
+        std::swap(q0, q1);
+        std::swap(p0, p1);
+        for (int &index : indices)
+            index = 15 - index;
+    }
+
+    BlockBits bits;
+    bits.put(1 << 6, 7); // mode 6
+    for (int c = 0; c < 4; ++c)
+    {
+        bits.put(q0[c], 7);
+        bits.put(q1[c], 7);
+    }
+    bits.put(p0, 1);
+    bits.put(p1, 1);
+    bits.put(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        bits.put(indices[i], 4);
+    memcpy(out, bits.word, 16);
+}
+
+void decompressBlockBC7(const unsigned char block[16], unsigned char rgba[64])
+{
+    BlockBits bits;
+    memcpy(bits.word, block, 16);
+    if (bits.get(7) != 1 << 6)
+    {
+        memset(rgba, 0, 64); // not mode 6
+        return;
+    }
+    int q[2][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        q[0][c] = bits.get(7);
+        q[1][c] = bits.get(7);
+    }
+    int p0 = bits.get(1), p1 = bits.get(1);
+    for (int i = 0; i < 16; ++i)
+    {
+        int index = bits.get(i == 0 ? 3 : 4), w = BC7_WEIGHTS[index];
+        for (int c = 0; c < 4; ++c)
+        {
+            int a = q[0][c] << 1 | p0, b = q[1][c] << 1 | p1;
+            rgba[4 * i + c] = static_cast<unsigned char>(((64 - w) * a + w * b + 32) >> 6);
+        }
+    }
+}
+
+// the 4x4 block at (bx, by) of a level as RGBA, edge pixels repeated past the border
+static void fetchBlock(const unsigned char *pixels, int width, int height, int channels, int bx, int by, unsigned char rgba[64])
+{
+    for (int y = 0; y < 4; ++y)
+    {
+        const unsigned char *row = pixels + size_t(std::min(4 * by + y, height - 1)) * width * channels;
+        for (int x = 0; x < 4; ++x)
+        {
+            const unsigned char *p = row + size_t(std::min(4 * bx + x, width - 1)) * channels;
+            unsigned char *dst = rgba + 4 * (4 * y + x);
+            if (channels >= 3)
+            {
+                dst[0] = p[0];
+                dst[1] = p[1];
+                dst[2] = p[2];
+            }
+            else
+                dst[0] = dst[1] = dst[2] = p[0];
+            dst[3] = channels == 4 ? p[3] : channels == 2 ? p[1] : 255;
+        }
+    }
+}
+
+void compressMipChain(const MipChain &raw, TextureCompression compression, JobSystem &jobs, MipChain &out)
+{
+    out.width = raw.width;
+    out.height = raw.height;
+    out.channels = raw.channels;
+    out.compression = compression;
+    const int levels = raw.levels();
+    out.data.resize(MipChain::levelOffset(raw.width, raw.height, raw.channels, levels, compression));
+    const size_t blockBytes = compression == COMPRESSION_BC1 ? 8 : 16;
+
+    for (int level = 0; level < levels; ++level)
+    {
+        int w = MipChain::levelWidth(raw.width, level), h = MipChain::levelWidth(raw.height, level);
+        int blocksWide = (w + 3) / 4, blocksHigh = (h + 3) / 4;
+        const unsigned char *pixels = raw.data.data() + MipChain::levelOffset(raw.width, raw.height, raw.channels, level);
+        unsigned char *blocks = out.data.data() + MipChain::levelOffset(raw.width, raw.height, raw.channels, level, compression);
+        // rows of blocks per job: about 1024 blocks
+        size_t grain = size_t(std::max(1, 1024 / blocksWide));
+        jobs.parallelFor(0, size_t(blocksHigh), grain, [&](size_t first, size_t last)
+                         {
+                             unsigned char rgba[64];
+                             for (size_t by = first; by < last; ++by)
+                             {
+                                 for (int bx = 0; bx < blocksWide; ++bx)
+                                 {
+                                     fetchBlock(pixels, w, h, raw.channels, bx, int(by), rgba);
+                                     unsigned char *block = blocks + (by * blocksWide + bx) * blockBytes;
+                                     if (compression == COMPRESSION_BC1)
+                                         compressBlockBC1(rgba, block);
+                                     else
+                                         compressBlockBC7(rgba, block);
+                                 }
+                             } });
+    }
+
+    // quality of level 0, what is seen up close
+    int blocksWide = (raw.width + 3) / 4, blocksHigh = (raw.height + 3) / 4;
+    std::vector<double> rowError(blocksHigh, 0.0);
+    jobs.parallelFor(0, size_t(blocksHigh), size_t(std::max(1, 1024 / blocksWide)), [&](size_t first, size_t last)
+                     {
+                         unsigned char original[64], decoded[64];
+                         for (size_t by = first; by < last; ++by)
+                         {
+                             for (int bx = 0; bx < blocksWide; ++bx)
+                             {
+                                 const unsigned char *block = out.data.data() + (by * blocksWide + bx) * blockBytes;
+                                 fetchBlock(raw.data.data(), raw.width, raw.height, raw.channels, bx, int(by), original);
+                                 if (compression == COMPRESSION_BC1)
+                                     decompressBlockBC1(block, decoded);
+                                 else
+                                     decompressBlockBC7(block, decoded);
+                                 for (int y = 0; y < 4 && 4 * int(by) + y < raw.height; ++y)
+                                     for (int x = 0; x < 4 && 4 * bx + x < raw.width; ++x)
+                                         for (int c = 0; c < 3; ++c)
+                                         {
+                                             double d = double(original[4 * (4 * y + x) + c]) - decoded[4 * (4 * y + x) + c];
+                                             rowError[by] += d * d;
+                                         }
+                             }
+                         } });
+    double squared = 0.0;
+    for (double e : rowError)
+        squared += e;
+    double meanSquared = squared / (double(raw.width) * raw.height * 3.0);
+    out.psnr = meanSquared > 0.0 ? 10.0 * log10(255.0 * 255.0 / meanSquared) : 99.0;
+}
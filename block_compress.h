@@ -0,0 +1,19 @@
+#pragma once
+#include "mipmaps.h"
+
+class JobSystem;
+
+// Block compression of 4x4 pixel blocks, pixels given as 16 RGBA quadruplets in row order.
+// BC1: two RGB565 endpoints and 2-bit indices into 4 colors between them (8 bytes, no alpha).
+// BC7: mode 6 only, one RGBA 7.7.7.7 + p-bit endpoint pair and 4-bit indices (16 bytes); the
+// other modes split blocks into subsets, which costs far more search for photographic textures.
+// Endpoints come from the principal axis of the block's colors, refined once by least squares.
+void compressBlockBC1(const unsigned char rgba[64], unsigned char out[8]);
+void compressBlockBC7(const unsigned char rgba[64], unsigned char out[16]);
+// the reverse, for measuring quality (BC7 blocks must be mode 6)
+void decompressBlockBC1(const unsigned char block[8], unsigned char rgba[64]);
+void decompressBlockBC7(const unsigned char block[16], unsigned char rgba[64]);
+
+// every level of an uncompressed chain, rows of blocks split over jobs. out.psnr compares level 0
+// with raw's, colour channels only.
+void compressMipChain(const MipChain &raw, TextureCompression compression, JobSystem &jobs, MipChain &out);
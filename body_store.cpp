@@ -0,0 +1,514 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/quaternion.hpp>
+
+#include "body_store.h"
+#include "simulation.h"
+#include "ephemeris.h"
+#include "jobs.h"
+
+// rows handed to a job at a time by the per-row passes
+static const size_t ROW_GRAIN = 1024;
+
+// angular radius (radians) above which a body gets each lod, finest first
+static const double LOD_ANGLES[LOD_COUNT - 1] = {0.05, 0.01};
+// screen motion, in pixels, a body may build up between two updates
+static const double MOTION_PIXELS = 1.0;
+// radius on screen, in pixels, from which surface detail moving with the spin shows
+static const double SPIN_VISIBLE_PIXELS = 4.0;
+
+template <class F>
+void BodyArchetype::forEachColumn(F &&f)
+{
+    f(handle);
+    f(simulationBody);
+    f(orbitNode);
+    f(bodyNode);
+    if (has(COMPONENT_ORBIT))
+    {
+        f(parent);
+        f(orbitRadius);
+        f(orbitAngle);
+    }
+    if (has(COMPONENT_EPHEMERIS))
+        f(ephemerisBody);
+    if (has(COMPONENT_SPIN))
+        f(spinAngle);
+    if (has(COMPONENT_RENDER))
+    {
+        f(scale);
+        f(texture);
+        f(textureLayer);
+        f(lod);
+    }
+    if (has(COMPONENT_BOUNDS))
+    {
+        f(center);
+        f(boundRadius);
+        f(visible);
+        f(sampled);
+        f(velocity);
+        f(sampleFrame);
+        f(updateInterval);
+    }
+}
+
+uint32_t BodyStore::findArchetype(uint32_t components)
+{
+    for (size_t i = 0; i < archetypes.size(); ++i)
+    {
+        if (archetypes[i].components == components)
+            return static_cast<uint32_t>(i);
+    }
+    archetypes.push_back(BodyArchetype());
+    archetypes.back().components = components;
+    return static_cast<uint32_t>(archetypes.size() - 1);
+}
+
+BodyHandle BodyStore::create(uint32_t components)
+{
+    uint32_t index;
+    if (!freeSlots.empty())
+    {
+        index = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(slots.size());
+        slots.push_back(Slot());
+    }
+
+    Slot &slot = slots[index];
+    slot.archetype = findArchetype(components);
+    BodyArchetype &archetype = archetypes[slot.archetype];
+    slot.row = static_cast<uint32_t>(archetype.size());
+    slot.used = true;
+
+    // a new row with every component at its default
+    archetype.forEachColumn([](auto &column)
+                            { column.emplace_back(); });
+    archetype.handle.back() = index;
+    archetype.simulationBody.back() = -1;
+    archetype.orbitNode.back() = -1;
+    archetype.bodyNode.back() = -1;
+    if (archetype.has(COMPONENT_EPHEMERIS))
+        archetype.ephemerisBody.back() = -1;
+    if (archetype.has(COMPONENT_RENDER))
+        archetype.scale.back() = 1.0;
+    if (archetype.has(COMPONENT_BOUNDS))
+    {
+        archetype.boundRadius.back() = 1.0;
+        archetype.visible.back() = 1;
+        archetype.updateInterval.back() = 1;
+    }
+
+    count++;
+    structureChanged = true;
+    return {index, slot.generation};
+}
+
+void BodyStore::remove(BodyHandle body)
+{
+    if (!alive(body))
+        return;
+
+    // swap-remove: the last row moves into the hole, its slot follows it
+    Slot &slot = slots[body.index];
+    BodyArchetype &archetype = archetypes[slot.archetype];
+    size_t row = slot.row;
+    archetype.forEachColumn([row](auto &column)
+                            {
+                                column[row] = column.back();
+                                column.pop_back();
+                            });
+    if (row < archetype.size())
+        slots[archetype.handle[row]].row = static_cast<uint32_t>(row);
+
+    slot.used = false;
+    slot.generation++;
+    freeSlots.push_back(body.index);
+    count--;
+    structureChanged = true;
+}
+
+bool BodyStore::alive(BodyHandle body) const
+{
+    return body.index < slots.size() && slots[body.index].used && slots[body.index].generation == body.generation;
+}
+
+void BodyStore::setParent(BodyHandle body, BodyHandle parent)
+{
+    BodyArchetype &archetype = archetypeOf(body);
+    if (!archetype.has(COMPONENT_ORBIT))
+        return;
+    archetype.parent[rowOf(body)] = parent;
+    structureChanged = true;
+}
+
+void BodyStore::rebuildHierarchy()
+{
+    // depth of every body along its chain of live orbit parents, so parents get their nodes first
+    struct Entry
+    {
+        int depth;
+        uint32_t archetype, row;
+    };
+    std::vector<Entry> order;
+    order.reserve(count);
+    for (uint32_t a = 0; a < archetypes.size(); ++a)
+    {
+        BodyArchetype &archetype = archetypes[a];
+        for (uint32_t row = 0; row < archetype.size(); ++row)
+        {
+            int depth = 0;
+            BodyHandle parent = archetype.has(COMPONENT_ORBIT) ? archetype.parent[row] : BodyHandle();
+            while (alive(parent) && depth <= static_cast<int>(count))
+            {
+                depth++;
+                BodyArchetype &above = archetypeOf(parent);
+                parent = above.has(COMPONENT_ORBIT) ? above.parent[rowOf(parent)] : BodyHandle();
+            }
+            order.push_back({depth, a, row});
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [](const Entry &l, const Entry &r)
+                     { return l.depth < r.depth; });
+
+    hierarchy = TransformHierarchy();
+    for (const Entry &entry : order)
+    {
+        BodyArchetype &archetype = archetypes[entry.archetype];
+        int parentNode = -1;
+        if (archetype.has(COMPONENT_ORBIT) && alive(archetype.parent[entry.row]))
+        {
+            BodyHandle parent = archetype.parent[entry.row];
+            parentNode = archetypeOf(parent).orbitNode[rowOf(parent)];
+        }
+        archetype.orbitNode[entry.row] = hierarchy.add(parentNode);
+        archetype.bodyNode[entry.row] = hierarchy.add(archetype.orbitNode[entry.row]);
+    }
+
+    // the scripted chains, in the same parents first order
+    const uint32_t scripted = COMPONENT_ORBIT | COMPONENT_SPIN | COMPONENT_RENDER | COMPONENT_BOUNDS;
+    scriptedIndex.assign(slots.size(), -1);
+    scriptedRows.clear();
+    std::vector<int> scriptedParents;
+    for (const Entry &entry : order)
+    {
+        BodyArchetype &archetype = archetypes[entry.archetype];
+        if (!archetype.has(scripted))
+            continue;
+        int parent = -1;
+        BodyHandle parentHandle = archetype.parent[entry.row];
+        if (alive(parentHandle))
+        {
+            parent = scriptedIndex[parentHandle.index];
+            if (parent < 0)
+                continue;
+        }
+        scriptedIndex[archetype.handle[entry.row]] = static_cast<int>(scriptedRows.size());
+        scriptedRows.push_back({0, entry.archetype, entry.row});
+        scriptedParents.push_back(parent);
+    }
+    scriptedParent = scriptedParents;
+
+    // the kernel doesn't set hierarchy nodes, chains above bodies that hang off them still need theirs
+    scriptedInHierarchy.assign(scriptedRows.size(), 0);
+    for (const Entry &entry : order)
+    {
+        BodyArchetype &archetype = archetypes[entry.archetype];
+        if (!archetype.has(COMPONENT_ORBIT) || scriptedIndex[archetype.handle[entry.row]] >= 0)
+            continue;
+        BodyHandle parent = archetype.parent[entry.row];
+        for (int up = alive(parent) ? scriptedIndex[parent.index] : -1; up >= 0 && !scriptedInHierarchy[up]; up = scriptedParent[up])
+            scriptedInHierarchy[up] = 1;
+    }
+    scriptedPosition.assign(scriptedRows.size(), glm::dvec3(0.0));
+    scriptedCos.assign(scriptedRows.size(), 1.0);
+    scriptedSin.assign(scriptedRows.size(), 0.0);
+    scriptedDue.resize(scriptedRows.size());
+    scriptedPacked.resize(scriptedRows.size());
+    scriptedPicked.resize(scriptedRows.size());
+    structureChanged = false;
+}
+
+void BodyStore::syncSimulation(const SimSnapshot &snapshot)
+{
+    for (BodyArchetype &archetype : archetypes)
+    {
+        bool orbit = archetype.has(COMPONENT_ORBIT), spin = archetype.has(COMPONENT_SPIN);
+        for (size_t row = 0; row < archetype.size(); ++row)
+        {
+            int body = archetype.simulationBody[row];
+            if (body < 0 || body >= static_cast<int>(snapshot.orbitAngle.size()))
+                continue;
+            if (orbit)
+                archetype.orbitAngle[row] = snapshot.orbitAngle[body];
+            if (spin)
+                archetype.spinAngle[row] = snapshot.spinAngle[body];
+        }
+    }
+}
+
+void BodyStore::updateTransforms(const Ephemeris *ephemeris, double time)
+{
+    // a rebuilt hierarchy starts from identity locals, every body has to be set again
+    bool everyone = structureChanged;
+    if (structureChanged)
+        rebuildHierarchy();
+    frame++;
+
+    const glm::dvec3 yAxis(0.0, 1.0, 0.0);
+    for (BodyArchetype &archetype : archetypes)
+    {
+        // round-robin: with an interval of n, a body updates on the frames where frame + handle is a multiple of n
+        bool scheduled = archetype.has(COMPONENT_BOUNDS) && !everyone;
+        auto due = [&](size_t row)
+        { return !scheduled || ((frame + archetype.handle[row]) & (archetype.updateInterval[row] - 1u)) == 0; };
+
+        if (archetype.has(COMPONENT_ORBIT))
+        {
+            // rotate around the parent, then move away from it
+            for (size_t row = 0; row < archetype.size(); ++row)
+            {
+                int scripted = scriptedIndex[archetype.handle[row]];
+                if (!due(row) || (scripted >= 0 && !scriptedInHierarchy[scripted]))
+                    continue;
+                double angle = archetype.orbitAngle[row];
+                hierarchy.setLocal(archetype.orbitNode[row], glm::dvec3(cos(angle), 0.0, -sin(angle)) * archetype.orbitRadius[row],
+                                   glm::angleAxis(angle, yAxis), glm::dvec3(1.0));
+            }
+        }
+        else if (archetype.has(COMPONENT_EPHEMERIS) && ephemeris && ephemeris->isOpen())
+        {
+            for (size_t row = 0; row < archetype.size(); ++row)
+            {
+                if (archetype.ephemerisBody[row] >= 0 && due(row))
+                    hierarchy.setTranslation(archetype.orbitNode[row], ephemeris->position(archetype.ephemerisBody[row], time));
+            }
+        }
+
+        // self-rotation and size, not passed on to satellites
+        bool spin = archetype.has(COMPONENT_SPIN), render = archetype.has(COMPONENT_RENDER);
+        if ((!spin && !render) || archetype.has(COMPONENT_GPU_ORBIT))
+            continue;
+        for (size_t row = 0; row < archetype.size(); ++row)
+        {
+            if (!due(row) || scriptedIndex[archetype.handle[row]] >= 0)
+                continue;
+            hierarchy.setLocal(archetype.bodyNode[row], glm::dvec3(0.0),
+                               glm::angleAxis(spin ? archetype.spinAngle[row] : 0.0, yAxis),
+                               glm::dvec3(render ? archetype.scale[row] : 1.0));
+        }
+    }
+
+    // skipped bodies below a dirty parent are still recomputed here, with their last local transform
+    hierarchy.update();
+
+    // scripted rows on their turn, with the parents their chains go through, packed for the kernel
+    for (size_t i = 0; i < scriptedRows.size(); ++i)
+    {
+        const BodyArchetype &archetype = archetypes[scriptedRows[i].archetype];
+        uint32_t row = scriptedRows[i].row;
+        scriptedDue[i] = everyone || ((frame + archetype.handle[row]) & (archetype.updateInterval[row] - 1u)) == 0 ? 2 : 0;
+    }
+    for (size_t i = scriptedRows.size(); i-- > 0;)
+    {
+        int parent = scriptedParent[i];
+        if (scriptedDue[i] && parent >= 0 && !scriptedDue[parent])
+            scriptedDue[parent] = 1;
+    }
+    size_t packed = 0;
+    for (size_t i = 0; i < scriptedRows.size(); ++i)
+    {
+        if (scriptedDue[i])
+        {
+            scriptedPacked[i] = static_cast<int>(packed);
+            scriptedPicked[packed++] = static_cast<int>(i);
+        }
+    }
+    scriptedOrbits.resize(packed);
+    for (size_t k = 0; k < packed; ++k)
+    {
+        int i = scriptedPicked[k];
+        const BodyArchetype &archetype = archetypes[scriptedRows[i].archetype];
+        uint32_t row = scriptedRows[i].row;
+        scriptedOrbits.parent[k] = scriptedParent[i] >= 0 ? scriptedPacked[scriptedParent[i]] : -1;
+        scriptedOrbits.orbitAngle[k] = archetype.orbitAngle[row];
+        scriptedOrbits.orbitRadius[k] = archetype.orbitRadius[row];
+        scriptedOrbits.spinAngle[k] = archetype.spinAngle[row];
+    }
+    if (packed > 0)
+        composeOrbitPositions(scriptedOrbits, scriptedWork);
+    for (size_t k = 0; k < packed; ++k)
+    {
+        int i = scriptedPicked[k];
+        if (scriptedDue[i] != 2)
+            continue;
+        scriptedPosition[i] = glm::dvec3(scriptedWork.x[k], 0.0, scriptedWork.z[k]);
+        scriptedCos[i] = scriptedWork.bodyCos[k];
+        scriptedSin[i] = scriptedWork.bodySin[k];
+    }
+
+    for (BodyArchetype &archetype : archetypes)
+    {
+        if (!archetype.has(COMPONENT_BOUNDS))
+            continue;
+        for (size_t row = 0; row < archetype.size(); ++row)
+        {
+            int scripted = scriptedIndex[archetype.handle[row]];
+            glm::dvec3 position = scripted >= 0 ? scriptedPosition[scripted] : hierarchy.worldPosition(archetype.bodyNode[row]);
+            uint32_t elapsed = frame - archetype.sampleFrame[row];
+            if (everyone)
+            {
+                archetype.velocity[row] = glm::dvec3(0.0);
+                archetype.sampled[row] = archetype.center[row] = position;
+                archetype.sampleFrame[row] = frame;
+            }
+            else if (((frame + archetype.handle[row]) & (archetype.updateInterval[row] - 1u)) == 0)
+            {
+                archetype.velocity[row] = (position - archetype.sampled[row]) / double(elapsed);
+                archetype.sampled[row] = archetype.center[row] = position;
+                archetype.sampleFrame[row] = frame;
+            }
+            else if (position == archetype.sampled[row])
+                archetype.center[row] = position + archetype.velocity[row] * double(elapsed);
+            else
+                archetype.center[row] = position; // moved with its parent
+        }
+    }
+}
+
+void BodyStore::scheduleUpdates(const glm::dvec3 &cameraPosition, double pixelsPerRadian)
+{
+    for (BodyArchetype &archetype : archetypes)
+    {
+        if (!archetype.has(COMPONENT_BOUNDS))
+            continue;
+        defaultJobSystem().parallelFor(0, archetype.size(), ROW_GRAIN, [&](size_t first, size_t last)
+                                       {
+                                           for (size_t row = first; row < last; ++row)
+                                           {
+                                               double distance = glm::length(archetype.center[row] - cameraPosition);
+                                               uint8_t interval = 1;
+                                               if (distance > archetype.boundRadius[row] &&
+                                                   archetype.boundRadius[row] / distance * pixelsPerRadian < SPIN_VISIBLE_PIXELS)
+                                               {
+                                                   double pixelsPerFrame = glm::length(archetype.velocity[row]) / distance * pixelsPerRadian;
+                                                   while (interval < MAX_UPDATE_INTERVAL && pixelsPerFrame * interval * 2 <= MOTION_PIXELS)
+                                                       interval *= 2;
+                                               }
+                                               archetype.updateInterval[row] = interval;
+                                           } });
+    }
+}
+
+void BodyStore::cull(const glm::mat4 &viewProjection, const glm::dvec3 &cameraPosition)
+{
+    // frustum planes from the rows of the matrix (Gribb & Hartmann), pointing inwards.
+    // With reverse-Z the near plane is z <= w and the far plane z >= 0, which for an infinite
+    // projection has no direction and is skipped.
+    glm::vec4 rows[4];
+    for (int r = 0; r < 4; ++r)
+        rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+    glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0], rows[3] + rows[1], rows[3] - rows[1], rows[3] - rows[2], rows[2]};
+    int planeCount = 0;
+    for (const glm::vec4 &plane : planes)
+    {
+        double length = sqrt(double(plane.x) * plane.x + double(plane.y) * plane.y + double(plane.z) * plane.z);
+        if (length > 0.0)
+            planes[planeCount++] = plane * static_cast<float>(1.0 / length);
+    }
+
+    for (BodyArchetype &archetype : archetypes)
+    {
+        if (!archetype.has(COMPONENT_BOUNDS))
+            continue;
+        defaultJobSystem().parallelFor(0, archetype.size(), ROW_GRAIN, [&](size_t first, size_t last)
+                                       {
+                                           for (size_t row = first; row < last; ++row)
+                                           {
+                                               glm::vec3 c(archetype.center[row] - cameraPosition);
+                                               float radius = static_cast<float>(archetype.boundRadius[row]);
+                                               uint8_t inside = 1;
+                                               for (int p = 0; p < planeCount && inside; ++p)
+                                                   inside = planes[p].x * c.x + planes[p].y * c.y + planes[p].z * c.z + planes[p].w >= -radius;
+                                               archetype.visible[row] = inside;
+                                           } });
+    }
+}
+
+void BodyStore::selectLod(const glm::dvec3 &cameraPosition)
+{
+    for (BodyArchetype &archetype : archetypes)
+    {
+        if (!archetype.has(COMPONENT_RENDER | COMPONENT_BOUNDS))
+            continue;
+        defaultJobSystem().parallelFor(0, archetype.size(), ROW_GRAIN, [&](size_t first, size_t last)
+                                       {
+                                           for (size_t row = first; row < last; ++row)
+                                           {
+                                               double distance = glm::length(archetype.center[row] - cameraPosition);
+                                               double angle = distance > archetype.boundRadius[row] ? archetype.boundRadius[row] / distance : 1.0;
+                                               uint8_t lod = 0;
+                                               while (lod < LOD_COUNT - 1 && angle < LOD_ANGLES[lod])
+                                                   lod++;
+                                               archetype.lod[row] = lod;
+                                           } });
+    }
+}
+
+void BodyStore::fillInstances(const glm::dvec3 &cameraPosition, BodyInstances &out)
+{
+    // visible rows sorted by batch, then the matrices in parallel
+    instanceOrder.clear();
+    for (uint32_t a = 0; a < archetypes.size(); ++a)
+    {
+        const BodyArchetype &archetype = archetypes[a];
+        if (!archetype.has(COMPONENT_RENDER | COMPONENT_BOUNDS))
+            continue;
+        for (uint32_t row = 0; row < archetype.size(); ++row)
+        {
+            if (archetype.visible[row])
+                instanceOrder.push_back({(uint64_t(archetype.lod[row]) << 32) | archetype.texture[row], a, row});
+        }
+    }
+    std::sort(instanceOrder.begin(), instanceOrder.end(), [](const InstanceEntry &l, const InstanceEntry &r)
+              { return l.batch < r.batch; });
+
+    out.batches.clear();
+    for (uint32_t i = 0; i < instanceOrder.size(); ++i)
+    {
+        uint64_t batch = instanceOrder[i].batch;
+        if (i == 0 || batch != instanceOrder[i - 1].batch)
+            out.batches.push_back({static_cast<int>(batch >> 32), static_cast<GLuint>(batch & 0xffffffffu), i, 0});
+        out.batches.back().count++;
+    }
+
+    // the subtraction happens in double, so a body at Neptune's distance is as steady as one at the origin
+    out.models.resize(instanceOrder.size());
+    out.layers.resize(instanceOrder.size());
+    defaultJobSystem().parallelFor(0, instanceOrder.size(), ROW_GRAIN, [&](size_t first, size_t last)
+                                   {
+                                       for (size_t i = first; i < last; ++i)
+                                       {
+                                           const InstanceEntry &entry = instanceOrder[i];
+                                           const BodyArchetype &archetype = archetypes[entry.archetype];
+                                           int scripted = scriptedIndex[archetype.handle[entry.row]];
+                                           glm::dmat4 relative;
+                                           if (scripted >= 0)
+                                           {
+                                               // rotate(angle, y) * scale, as the kernel composes it
+                                               double s = archetype.scale[entry.row], c = s * scriptedCos[scripted], n = s * scriptedSin[scripted];
+                                               relative = glm::dmat4(glm::dvec4(c, 0.0, -n, 0.0), glm::dvec4(0.0, s, 0.0, 0.0),
+                                                                     glm::dvec4(n, 0.0, c, 0.0), glm::dvec4(0.0, 0.0, 0.0, 1.0));
+                                           }
+                                           else
+                                               relative = hierarchy.world(archetype.bodyNode[entry.row]);
+                                           relative[3] = glm::dvec4(archetype.center[entry.row] - cameraPosition, 1.0);
+                                           out.models[i] = glm::mat4(relative);
+                                           out.layers[i] = float(archetype.textureLayer[entry.row]);
+                                       } });
+}
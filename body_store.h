@@ -0,0 +1,171 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "transform.h"
+#include "affine.h"
+
+struct SimSnapshot;
+class Ephemeris;
+
+// Survives other bodies being added and removed; a handle to a removed body stops being alive()
+// even if its slot is reused, thanks to the generation
+struct BodyHandle
+{
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+enum BodyComponent : uint32_t
+{
+    COMPONENT_ORBIT = 1 << 0,     // circles a parent body (parent, orbitRadius, orbitAngle)
+    COMPONENT_EPHEMERIS = 1 << 1, // replays a trajectory from the ephemeris file (ephemerisBody)
+    COMPONENT_SPIN = 1 << 2,      // turns around its y axis (spinAngle)
+    COMPONENT_RENDER = 1 << 3,    // drawn as a textured sphere (scale, texture, textureLayer, lod)
+    COMPONENT_BOUNDS = 1 << 4,    // bounding sphere in world space, for culling and update rates (center, boundRadius, visible, ...)
+    COMPONENT_GPU_ORBIT = 1 << 5  // animated by the orbit shader (see GpuOrbits) from simulationBody, the CPU passes skip it
+};
+
+const int LOD_COUNT = 3; // sphere meshes from finest (0) to coarsest
+const int MAX_UPDATE_INTERVAL = 8; // frames between transform updates of the slowest bodies on screen
+
+// All the bodies that have exactly the same components. Every component is a set of parallel arrays
+// indexed by row, the arrays of components the archetype lacks stay empty. Rows are packed: removing
+// a body moves the last row into its place.
+struct BodyArchetype
+{
+    uint32_t components = 0;
+
+    std::vector<uint32_t> handle;       // slot in the store's handle table
+    std::vector<int> simulationBody;    // index into Simulation::bodies (and its snapshots) the angles come from, -1 for none
+    std::vector<int> orbitNode;         // nodes in the store's transform hierarchy
+    std::vector<int> bodyNode;
+
+    // COMPONENT_ORBIT
+    std::vector<BodyHandle> parent;
+    std::vector<double> orbitRadius;
+    std::vector<double> orbitAngle;
+    // COMPONENT_EPHEMERIS
+    std::vector<int> ephemerisBody;
+    // COMPONENT_SPIN
+    std::vector<double> spinAngle;
+    // COMPONENT_RENDER
+    std::vector<double> scale;
+    std::vector<GLuint> texture;
+    std::vector<int> textureLayer; // when texture is an array (see TextureArrays)
+    std::vector<uint8_t> lod;
+    // COMPONENT_BOUNDS
+    std::vector<glm::dvec3> center; // predicted between updates
+    std::vector<double> boundRadius;
+    std::vector<uint8_t> visible;
+    std::vector<glm::dvec3> sampled;     // world position at the last update
+    std::vector<glm::dvec3> velocity;    // world units per frame, between the last two updates
+    std::vector<uint32_t> sampleFrame;   // frame of the last update
+    std::vector<uint8_t> updateInterval; // 1, 2, 4 or 8 frames
+
+    size_t size() const { return handle.size(); }
+    bool has(uint32_t component) const { return (components & component) == component; }
+
+    template <class F>
+    void forEachColumn(F &&f);
+};
+
+// Visible bodies grouped by lod and texture, one instanced draw per batch. Bodies in the layers of
+// the same texture array share a batch.
+struct BodyInstances
+{
+    struct Batch
+    {
+        int lod;
+        GLuint texture;
+        uint32_t first, count; // range of models
+    };
+    std::vector<glm::mat4> models; // camera-relative, see Camera::RelativePosition
+    std::vector<float> layers;     // texture array layer of each model, as the vertex attribute takes it
+    std::vector<Batch> batches;
+};
+
+// Data-oriented body storage: bodies grouped into archetypes, each pass walks the rows of every
+// archetype it cares about in order
+class BodyStore
+{
+public:
+    BodyHandle create(uint32_t components);
+    void remove(BodyHandle body);
+    bool alive(BodyHandle body) const;
+    size_t size() const { return count; }
+
+    // where a live body's components are: archetypeOf(body).orbitAngle[rowOf(body)] and so on
+    BodyArchetype &archetypeOf(BodyHandle body) { return archetypes[slots[body.index].archetype]; }
+    size_t rowOf(BodyHandle body) const { return slots[body.index].row; }
+    // the parent of a body or its hierarchy changed, the transform hierarchy is rebuilt on the next update
+    void setParent(BodyHandle body, BodyHandle parent);
+
+    std::vector<BodyArchetype> archetypes;
+
+    // passes, in frame order. cull and selectLod only depend on updateTransforms and may run at
+    // the same time, the per-row passes split the rows over the default job system
+    // copies the orbit and spin angles of the bodies that have a simulationBody
+    void syncSimulation(const SimSnapshot &snapshot);
+    // world transforms and bounding sphere centers, ephemeris may be null. Bodies with bounds only
+    // update on their turn (see scheduleUpdates), staggered over frames by handle; in between, a body
+    // whose world position hasn't moved with its parent is carried along its last velocity.
+    // Bodies on scripted orbits all the way up to their root go through the SIMD orbit kernel (see
+    // affine.h) instead of the hierarchy, the ones due this frame and their parents in one pass.
+    void updateTransforms(const Ephemeris *ephemeris, double time);
+    // update interval from the screen-space motion: the longest (up to MAX_UPDATE_INTERVAL) over
+    // which a body moves less than a pixel. Bodies showing a disc big enough to see spin update every frame.
+    void scheduleUpdates(const glm::dvec3 &cameraPosition, double pixelsPerRadian);
+    // visible = bounding sphere touches the view frustum, viewProjection is camera-relative (camera at the origin)
+    void cull(const glm::mat4 &viewProjection, const glm::dvec3 &cameraPosition);
+    // lod from the angular radius of the bounding sphere
+    void selectLod(const glm::dvec3 &cameraPosition);
+    // model matrices of the visible bodies, after cull and selectLod, placed at their predicted centers
+    void fillInstances(const glm::dvec3 &cameraPosition, BodyInstances &out);
+
+    const TransformHierarchy &transforms() const { return hierarchy; }
+
+private:
+    struct Slot
+    {
+        uint32_t archetype = 0;
+        uint32_t row = 0;
+        uint32_t generation = 0;
+        bool used = false;
+    };
+
+    uint32_t findArchetype(uint32_t components);
+    void rebuildHierarchy();
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    size_t count = 0;
+    TransformHierarchy hierarchy;
+    bool structureChanged = true;
+    uint32_t frame = 0;
+    struct InstanceEntry
+    {
+        uint64_t batch; // lod and texture
+        uint32_t archetype, row;
+    };
+    std::vector<InstanceEntry> instanceOrder; // fillInstances scratch
+
+    // rows with orbit, spin, render and bounds whose parents are all the same, parents first, as
+    // the orbit kernel takes them; rebuilt with the hierarchy
+    std::vector<int> scriptedIndex; // per slot: index in scriptedRows, or -1
+    std::vector<InstanceEntry> scriptedRows;
+    std::vector<int> scriptedParent;
+    std::vector<uint8_t> scriptedInHierarchy; // a body outside the kernel hangs below it, its orbit node is kept set too
+    // per scripted row, from its last update: world position, cosine and sine of its total angle
+    std::vector<glm::dvec3> scriptedPosition;
+    std::vector<double> scriptedCos, scriptedSin;
+    // updateTransforms scratch: the rows due and the parents they need, packed for the kernel
+    std::vector<uint8_t> scriptedDue; // 2 due, 1 only a parent of one
+    std::vector<int> scriptedPacked;  // per scripted row: index in scriptedOrbits
+    std::vector<int> scriptedPicked;  // per scriptedOrbits row: the scripted row
+    OrbitArrays scriptedOrbits;
+    OrbitWorkspace scriptedWork;
+};
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "broadphase.h"
+#include "jobs.h"
+
+// spheres per job when refreshing boxes
+static const size_t BOX_GRAIN = 4096;
+// cells per job when sorting and sweeping
+static const size_t CELL_GRAIN = 16;
+// boxes a cell should hold at least on average, and a cap on the cell count
+static const size_t CELL_SIZE = 16;
+static const size_t MAX_CELLS = size_t(1) << 20;
+
+static uint64_t pairKey(uint32_t a, uint32_t b)
+{
+    return (uint64_t(a) << 32) | b;
+}
+
+void SweepAndPrune::update(const glm::dvec3 *centers, const double *radii, size_t count)
+{
+    update(centers, radii, count, nullptr, 0.0, 0);
+}
+
+void SweepAndPrune::update(const glm::dvec3 *centers, const double *radii, size_t count,
+                           const glm::dvec3 *sharedCenters, double sharedRadius, size_t sharedCount)
+{
+    const Spheres spheres = {centers, radii, count, sharedCenters, sharedRadius};
+    count += sharedCount;
+
+    if (count < ranges.size())
+        sorted = false; // removed without swapRemove(), ids are no longer trustworthy
+    else if (count - ranges.size() > ranges.size() / 8)
+        sorted = false; // a big batch of new spheres, cheaper to start over
+
+    if (!sorted)
+        rebuild(spheres, count);
+    else
+        migrate(spheres, count);
+    sweep(spheres);
+}
+
+SweepAndPrune::Box SweepAndPrune::makeBox(const Spheres &spheres, uint32_t id) const
+{
+    const glm::dvec3 &c = spheres.center(id);
+    double r = spheres.radius(id);
+    Box box;
+    for (int k = 0; k < 3; ++k)
+    {
+        box.lo[k] = c[axis[k]] - r;
+        box.hi[k] = c[axis[k]] + r;
+    }
+    box.id = id;
+    return box;
+}
+
+uint32_t SweepAndPrune::gridIndex(double x, int k) const
+{
+    double index = floor((x - gridStart[k]) / cellSize);
+    if (!(index > 0.0))
+        return 0; // also catches nan
+    return static_cast<uint32_t>(std::min(index, double(gridSize[k] - 1)));
+}
+
+void SweepAndPrune::rebuild(const Spheres &spheres, size_t count)
+{
+    // sweep along the longest axis, grid the other two
+    glm::dvec3 lo(HUGE_VAL), hi(-HUGE_VAL);
+    double diameters = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const glm::dvec3 &c = spheres.center(static_cast<uint32_t>(i));
+        double r = spheres.radius(static_cast<uint32_t>(i));
+        lo = glm::min(lo, c - r);
+        hi = glm::max(hi, c + r);
+        diameters += 2.0 * r;
+    }
+    glm::dvec3 extent = count > 0 ? hi - lo : glm::dvec3(0.0);
+    axis[0] = 0;
+    axis[1] = 1;
+    axis[2] = 2;
+    std::sort(axis, axis + 3, [&extent](int l, int r)
+              { return extent[l] > extent[r]; });
+
+    // cells about twice the typical box keep the copies of boxes straddling cells low,
+    // bigger ones when there are too few boxes to fill them
+    size_t maxCells = std::min(MAX_CELLS, std::max<size_t>(1, count / CELL_SIZE));
+    cellSize = std::max(count > 0 ? 2.0 * diameters / count : 1.0, 1e-9);
+    for (;;)
+    {
+        for (int k = 0; k < 2; ++k)
+            gridSize[k] = static_cast<uint32_t>(std::min(extent[axis[k + 1]] / cellSize, double(MAX_CELLS))) + 1;
+        if (size_t(gridSize[0]) * gridSize[1] <= maxCells)
+            break;
+        cellSize *= 1.5;
+    }
+    for (int k = 0; k < 2; ++k)
+        gridStart[k] = count > 0 ? lo[axis[k + 1]] : 0.0;
+
+    cells.assign(size_t(gridSize[0]) * gridSize[1], Cell());
+    ranges.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        Box box = makeBox(spheres, static_cast<uint32_t>(i));
+        ranges[i] = cellRange(box);
+        for (uint32_t u = ranges[i].u0; u <= ranges[i].u1; ++u)
+        {
+            for (uint32_t v = ranges[i].v0; v <= ranges[i].v1; ++v)
+                cells[u * gridSize[1] + v].boxes.push_back(box);
+        }
+    }
+
+    defaultJobSystem().parallelFor(0, cells.size(), CELL_GRAIN, [&](size_t first, size_t last)
+                                   {
+                                       for (size_t c = first; c < last; ++c)
+                                       {
+                                           std::sort(cells[c].boxes.begin(), cells[c].boxes.end(), [](const Box &l, const Box &r)
+                                                     { return l.lo[0] < r.lo[0]; });
+                                           cells[c].swaps = 0;
+                                       }
+                                   });
+    swaps = 0;
+    sorted = true;
+}
+
+void SweepAndPrune::migrate(const Spheres &spheres, size_t count)
+{
+    JobSystem &jobs = defaultJobSystem();
+
+    // new boxes in id order, which is how the caller's arrays are laid out
+    current.resize(count);
+    nextRanges.resize(count);
+    jobs.parallelFor(0, count, BOX_GRAIN, [&](size_t first, size_t last)
+                     {
+                         for (size_t i = first; i < last; ++i)
+                         {
+                             current[i] = makeBox(spheres, static_cast<uint32_t>(i));
+                             nextRanges[i] = cellRange(current[i]);
+                         }
+                     });
+
+    // refresh the boxes in their sorted order, dropping the ones that left the cell
+    jobs.parallelFor(0, cells.size(), CELL_GRAIN, [&](size_t first, size_t last)
+                     {
+                         for (size_t c = first; c < last; ++c)
+                         {
+                             uint32_t u = static_cast<uint32_t>(c / gridSize[1]), v = static_cast<uint32_t>(c % gridSize[1]);
+                             std::vector<Box> &boxes = cells[c].boxes;
+                             size_t kept = 0;
+                             for (size_t i = 0; i < boxes.size(); ++i)
+                             {
+                                 if (nextRanges[boxes[i].id].contains(u, v))
+                                     boxes[kept++] = current[boxes[i].id];
+                             }
+                             boxes.resize(kept);
+                         }
+                     });
+
+    // boxes that entered a cell (or are new) go at its end
+    std::vector<size_t> settled(cells.size());
+    for (size_t c = 0; c < cells.size(); ++c)
+        settled[c] = cells[c].boxes.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const CellRange &now = nextRanges[i];
+        CellRange before = i < ranges.size() ? ranges[i] : CellRange{1, 0, 1, 0};
+        if (now == before)
+            continue;
+        const Box &box = current[i];
+        for (uint32_t u = now.u0; u <= now.u1; ++u)
+        {
+            for (uint32_t v = now.v0; v <= now.v1; ++v)
+            {
+                if (!before.contains(u, v))
+                    cells[u * gridSize[1] + v].boxes.push_back(box);
+            }
+        }
+    }
+    ranges.swap(nextRanges);
+
+    // insertion sort what was already there, linear when the order barely changed since the
+    // last update, then merge the newcomers in
+    jobs.parallelFor(0, cells.size(), CELL_GRAIN, [&](size_t first, size_t last)
+                     {
+                         for (size_t c = first; c < last; ++c)
+                         {
+                             std::vector<Box> &boxes = cells[c].boxes;
+                             auto byStart = [](const Box &l, const Box &r)
+                             { return l.lo[0] < r.lo[0]; };
+                             size_t moved = 0;
+                             for (size_t i = 1; i < settled[c]; ++i)
+                             {
+                                 if (boxes[i - 1].lo[0] <= boxes[i].lo[0])
+                                     continue;
+                                 Box box = boxes[i];
+                                 size_t j = i;
+                                 while (j > 0 && boxes[j - 1].lo[0] > box.lo[0])
+                                 {
+                                     boxes[j] = boxes[j - 1];
+                                     --j;
+                                 }
+                                 moved += i - j;
+                                 boxes[j] = box;
+                             }
+                             if (settled[c] < boxes.size())
+                             {
+                                 std::sort(boxes.begin() + settled[c], boxes.end(), byStart);
+                                 std::inplace_merge(boxes.begin(), boxes.begin() + settled[c], boxes.end(), byStart);
+                             }
+                             cells[c].swaps = moved;
+                         }
+                     });
+
+    swaps = 0;
+    for (const Cell &cell : cells)
+        swaps += cell.swaps;
+}
+
+void SweepAndPrune::sweep(const Spheres &spheres)
+{
+    contactList.clear();
+    std::mutex contactsMutex;
+
+    defaultJobSystem().parallelFor(0, cells.size(), CELL_GRAIN, [&](size_t first, size_t last)
+                                   {
+                                       std::vector<ContactEvent> local;
+                                       for (size_t cell = first; cell < last; ++cell)
+                                       {
+                                           uint32_t u = static_cast<uint32_t>(cell / gridSize[1]), v = static_cast<uint32_t>(cell % gridSize[1]);
+                                           const std::vector<Box> &boxes = cells[cell].boxes;
+                                           for (size_t i = 0; i < boxes.size(); ++i)
+                                           {
+                                               const Box &box = boxes[i];
+                                               // every box starting inside this one along the sweep axis, then the other two
+                                               for (size_t j = i + 1; j < boxes.size() && boxes[j].lo[0] <= box.hi[0]; ++j)
+                                               {
+                                                   const Box &other = boxes[j];
+                                                   if (other.lo[1] > box.hi[1] || other.hi[1] < box.lo[1] ||
+                                                       other.lo[2] > box.hi[2] || other.hi[2] < box.lo[2])
+                                                       continue;
+                                                   // a pair sharing several cells is reported by the one holding the corner of their overlap
+                                                   if (gridIndex(std::max(box.lo[1], other.lo[1]), 0) != u ||
+                                                       gridIndex(std::max(box.lo[2], other.lo[2]), 1) != v)
+                                                       continue;
+
+                                                   // narrowphase, exact sphere-sphere
+                                                   uint32_t a = std::min(box.id, other.id), c = std::max(box.id, other.id);
+                                                   double ra = spheres.radius(a), rc = spheres.radius(c);
+                                                   glm::dvec3 d = spheres.center(c) - spheres.center(a);
+                                                   double distance2 = glm::dot(d, d);
+                                                   if (distance2 > (ra + rc) * (ra + rc))
+                                                       continue;
+
+                                                   ContactEvent contact;
+                                                   contact.a = a;
+                                                   contact.b = c;
+                                                   double distance = sqrt(distance2);
+                                                   contact.normal = distance > 0.0 ? d / distance : glm::dvec3(0.0, 1.0, 0.0);
+                                                   contact.depth = ra + rc - distance;
+                                                   contact.point = spheres.center(a) + contact.normal * (ra - 0.5 * contact.depth);
+                                                   contact.began = true;
+                                                   local.push_back(contact);
+                                               }
+                                           }
+                                       }
+                                       if (local.empty())
+                                           return;
+                                       std::lock_guard<std::mutex> lock(contactsMutex);
+                                       contactList.insert(contactList.end(), local.begin(), local.end());
+                                   });
+
+    // stable order regardless of threading, and mark the pairs that were already touching
+    std::sort(contactList.begin(), contactList.end(), [](const ContactEvent &l, const ContactEvent &r)
+              { return pairKey(l.a, l.b) < pairKey(r.a, r.b); });
+    size_t previous = 0;
+    for (ContactEvent &contact : contactList)
+    {
+        uint64_t key = pairKey(contact.a, contact.b);
+        while (previous < previousPairs.size() && previousPairs[previous] < key)
+            ++previous;
+        contact.began = previous == previousPairs.size() || previousPairs[previous] != key;
+    }
+    previousPairs.resize(contactList.size());
+    for (size_t i = 0; i < contactList.size(); ++i)
+        previousPairs[i] = pairKey(contactList[i].a, contactList[i].b);
+}
+
+void SweepAndPrune::swapRemove(const std::vector<uint32_t> &ids)
+{
+    if (ids.empty() || !sorted)
+        return;
+
+    // replay the removals on the id space: slot[k] is the original id now at index k
+    size_t count = ranges.size();
+    std::vector<uint32_t> slot(count);
+    std::vector<uint32_t> renamed(count, UINT32_MAX);
+    for (size_t k = 0; k < count; ++k)
+        slot[k] = static_cast<uint32_t>(k);
+    for (uint32_t id : ids)
+    {
+        slot[id] = slot[count - 1];
+        --count;
+    }
+    for (size_t k = 0; k < count; ++k)
+        renamed[slot[k]] = static_cast<uint32_t>(k);
+
+    // drop the removed boxes without disturbing the sorted order
+    for (Cell &cell : cells)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < cell.boxes.size(); ++i)
+        {
+            uint32_t id = renamed[cell.boxes[i].id];
+            if (id == UINT32_MAX)
+                continue;
+            cell.boxes[kept] = cell.boxes[i];
+            cell.boxes[kept].id = id;
+            ++kept;
+        }
+        cell.boxes.resize(kept);
+    }
+    nextRanges.resize(count);
+    for (size_t k = 0; k < count; ++k)
+        nextRanges[k] = ranges[slot[k]];
+    ranges.swap(nextRanges);
+
+    // carry the touching pairs over to the new ids
+    size_t kept = 0;
+    for (size_t i = 0; i < previousPairs.size(); ++i)
+    {
+        uint32_t a = renamed[previousPairs[i] >> 32], b = renamed[previousPairs[i] & 0xffffffffu];
+        if (a != UINT32_MAX && b != UINT32_MAX)
+            previousPairs[kept++] = pairKey(std::min(a, b), std::max(a, b));
+    }
+    previousPairs.resize(kept);
+    std::sort(previousPairs.begin(), previousPairs.end());
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Two spheres found touching. Ids are the indices of the spheres passed to update().
+struct ContactEvent
+{
+    uint32_t a, b;     // a < b
+    glm::dvec3 normal; // from a towards b
+    glm::dvec3 point;  // middle of the overlap
+    double depth;      // how far the spheres interpenetrate
+    bool began;        // not touching at the previous update
+};
+
+// Incremental sweep and prune over sphere bounding boxes, followed by an exact sphere-sphere test.
+// The two shorter axes are cut into a coarse grid and every cell keeps its boxes sorted along the
+// longest axis between updates, so when the spheres move a little per frame the insertion sorts
+// only do a handful of swaps. The cells keep the sweep from comparing every box against all the
+// others that merely share its range along the sweep axis, and are sorted and swept in parallel.
+class SweepAndPrune
+{
+public:
+    // finds every touching pair among count spheres, ids are indices into the arrays
+    void update(const glm::dvec3 *centers, const double *radii, size_t count);
+    // same over a few spheres with their own radius (ids 0..count-1) followed by many
+    // sharing one radius, e.g. bodies and particles (ids count..count+sharedCount-1)
+    void update(const glm::dvec3 *centers, const double *radii, size_t count,
+                const glm::dvec3 *sharedCenters, double sharedRadius, size_t sharedCount);
+
+    // the spheres were swap-removed in the given order (each id replaced by the current last one),
+    // keeps the sorted order valid
+    void swapRemove(const std::vector<uint32_t> &ids);
+    // the spheres were reordered or replaced wholesale, the next update rebuilds the grid
+    void invalidate() { sorted = false; }
+
+    const std::vector<ContactEvent> &contacts() const { return contactList; }
+    // element swaps done by the last insertion sorts, a measure of frame-to-frame coherence
+    size_t lastSwaps() const { return swaps; }
+    size_t cellCount() const { return cells.size(); }
+
+private:
+    // coordinates are permuted so that 0 is the sweep axis and 1, 2 the grid axes
+    struct Box
+    {
+        double lo[3];
+        double hi[3];
+        uint32_t id;
+    };
+
+    struct Cell
+    {
+        std::vector<Box> boxes; // sorted by lo[0]
+        size_t swaps = 0;
+    };
+
+    // first and last grid row and column a box overlaps
+    struct CellRange
+    {
+        uint32_t u0, u1;
+        uint32_t v0, v1;
+
+        bool contains(uint32_t u, uint32_t v) const { return u >= u0 && u <= u1 && v >= v0 && v <= v1; }
+        bool operator==(const CellRange &o) const { return u0 == o.u0 && u1 == o.u1 && v0 == o.v0 && v1 == o.v1; }
+    };
+
+    struct Spheres
+    {
+        const glm::dvec3 *centers;
+        const double *radii;
+        size_t count;
+        const glm::dvec3 *sharedCenters;
+        double sharedRadius;
+
+        const glm::dvec3 &center(uint32_t id) const { return id < count ? centers[id] : sharedCenters[id - count]; }
+        double radius(uint32_t id) const { return id < count ? radii[id] : sharedRadius; }
+    };
+
+    Box makeBox(const Spheres &spheres, uint32_t id) const;
+    uint32_t gridIndex(double x, int k) const;
+    CellRange cellRange(const Box &box) const
+    {
+        return {gridIndex(box.lo[1], 0), gridIndex(box.hi[1], 0), gridIndex(box.lo[2], 1), gridIndex(box.hi[2], 1)};
+    }
+
+    void rebuild(const Spheres &spheres, size_t count);
+    void migrate(const Spheres &spheres, size_t count);
+    void sweep(const Spheres &spheres);
+
+    int axis[3] = {0, 1, 2}; // world axis behind each box coordinate
+    double gridStart[2] = {0.0, 0.0};
+    double cellSize = 1.0;
+    uint32_t gridSize[2] = {1, 1};
+    std::vector<Cell> cells; // row major, gridSize[0] rows of gridSize[1]
+    std::vector<CellRange> ranges; // per id, as of the last update
+    std::vector<CellRange> nextRanges;
+    std::vector<Box> current; // per id, scratch for the update
+    std::vector<ContactEvent> contactList;
+    std::vector<uint64_t> previousPairs; // sorted pair keys of the last update, for ContactEvent::began
+    bool sorted = false;
+    size_t swaps = 0;
+};
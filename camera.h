@@ -26,7 +26,7 @@ class Camera
 {
 public:
     // camera Attributes
-    glm::vec3 Position;
+    glm::dvec3 Position; // double, so the camera can sit anywhere in a solar-system sized scene
     glm::vec3 Front;
     glm::vec3 Up;
     glm::vec3 Right;
@@ -40,7 +40,7 @@ public:
     float Zoom;
 
     // constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
+    Camera(glm::dvec3 position = glm::dvec3(0.0, 0.0, 0.0), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
         Position = position;
         WorldUp = up;
@@ -51,31 +51,39 @@ public:
     // constructor with scalar values
     Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM)
     {
-        Position = glm::vec3(posX, posY, posZ);
+        Position = glm::dvec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
         Yaw = yaw;
         Pitch = pitch;
         updateCameraVectors();
     }
 
-    // returns the view matrix calculated using Euler Angles and the LookAt Matrix
+    // returns the view matrix calculated using Euler Angles and the LookAt Matrix.
+    // The camera sits at the origin of view space: models are placed with RelativePosition, so the
+    // big world coordinates cancel out in double before anything reaches a float.
     glm::mat4 GetViewMatrix()
     {
-        return glm::lookAt(Position, Position + Front, Up);
+        return glm::lookAt(glm::vec3(0.0f), Front, Up);
+    }
+
+    // offset of a world position from the camera, small enough near the camera to be exact as a float
+    glm::vec3 RelativePosition(const glm::dvec3 &worldPosition) const
+    {
+        return glm::vec3(worldPosition - Position);
     }
 
     // processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime)
     {
-        float velocity = MovementSpeed * deltaTime;
+        double velocity = MovementSpeed * deltaTime;
         if (direction == FORWARD)
-            Position += Front * velocity;
+            Position += glm::dvec3(Front) * velocity;
         if (direction == BACKWARD)
-            Position -= Front * velocity;
+            Position -= glm::dvec3(Front) * velocity;
         if (direction == LEFT)
-            Position -= Right * velocity;
+            Position -= glm::dvec3(Right) * velocity;
         if (direction == RIGHT)
-            Position += Right * velocity;
+            Position += glm::dvec3(Right) * velocity;
     }
 
     // processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "checkpoint.h"
+#include "simulation.h"
+
+// every snapshot starts with this, followed by
+// double orbitAngle[bodyCount], spinAngle[bodyCount], particlePosition[3 * particleCount], particleVelocity[3 * particleCount]
+struct CheckpointHeader
+{
+    uint64_t step;
+    double time;
+    uint32_t bodyCount;
+    uint32_t particleCount;
+};
+
+CheckpointLog::CheckpointLog(double interval, size_t memoryBudget, const std::string &spillPath)
+    : interval(interval), memoryBudget(memoryBudget), spillPath(spillPath)
+{
+}
+
+uint64_t CheckpointLog::stepsPerCheckpoint(const Simulation &simulation) const
+{
+    return std::max<uint64_t>(1, static_cast<uint64_t>(llround(interval / simulation.stepSize)));
+}
+
+const char *CheckpointLog::log() const
+{
+    return spill.isOpen() ? spill.data() : memory.data();
+}
+
+char *CheckpointLog::reserve(size_t size)
+{
+    if (!spill.isOpen() && !spillPath.empty() && used + size > memoryBudget)
+    {
+        // move the log into the spill file, the OS pages it from here on
+        if (spill.create(spillPath, std::max(used + size, memoryBudget) * 2))
+        {
+            memcpy(spill.data(), memory.data(), used);
+            std::vector<char>().swap(memory);
+        }
+        else
+        {
+            std::cerr << "Error::Checkpoint could not spill to " << spillPath << ", staying in memory" << std::endl;
+            spillPath.clear();
+        }
+    }
+
+    if (spill.isOpen())
+    {
+        if (used + size > spill.size() && !spill.resize(std::max(used + size, spill.size() * 2)))
+            return nullptr;
+        return spill.data() + used;
+    }
+
+    memory.resize(used + size);
+    return memory.data() + used;
+}
+
+void CheckpointLog::record(const Simulation &simulation)
+{
+    const SimState &state = simulation.state;
+    const uint64_t spacing = stepsPerCheckpoint(simulation);
+    // only append in order, checkpoints that are already logged stay valid since stepping is deterministic
+    if (state.step % spacing != 0 || state.step / spacing != offsets.size())
+        return;
+
+    CheckpointHeader header;
+    header.step = state.step;
+    header.time = state.time;
+    header.bodyCount = static_cast<uint32_t>(state.orbitAngle.size());
+    header.particleCount = static_cast<uint32_t>(state.particlePosition.size());
+
+    const size_t angleBytes = header.bodyCount * sizeof(double);
+    const size_t particleBytes = header.particleCount * sizeof(glm::dvec3);
+    char *out = reserve(sizeof(header) + 2 * angleBytes + 2 * particleBytes);
+    if (!out)
+    {
+        std::cerr << "Error::Checkpoint log is out of space" << std::endl;
+        return;
+    }
+
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+    memcpy(out, state.orbitAngle.data(), angleBytes);
+    out += angleBytes;
+    memcpy(out, state.spinAngle.data(), angleBytes);
+    out += angleBytes;
+    memcpy(out, state.particlePosition.data(), particleBytes);
+    out += particleBytes;
+    memcpy(out, state.particleVelocity.data(), particleBytes);
+
+    offsets.push_back(used);
+    used += sizeof(header) + 2 * angleBytes + 2 * particleBytes;
+}
+
+void CheckpointLog::restore(size_t index, SimState &state) const
+{
+    const char *in = log() + offsets[index];
+    CheckpointHeader header;
+    memcpy(&header, in, sizeof(header));
+    in += sizeof(header);
+
+    state.step = header.step;
+    state.time = header.time;
+    state.orbitAngle.resize(header.bodyCount);
+    state.spinAngle.resize(header.bodyCount);
+    state.particlePosition.resize(header.particleCount);
+    state.particleVelocity.resize(header.particleCount);
+
+    const size_t angleBytes = header.bodyCount * sizeof(double);
+    const size_t particleBytes = header.particleCount * sizeof(glm::dvec3);
+    memcpy(state.orbitAngle.data(), in, angleBytes);
+    in += angleBytes;
+    memcpy(state.spinAngle.data(), in, angleBytes);
+    in += angleBytes;
+    memcpy(state.particlePosition.data(), in, particleBytes);
+    in += particleBytes;
+    memcpy(state.particleVelocity.data(), in, particleBytes);
+}
+
+void CheckpointLog::seek(Simulation &simulation, double time)
+{
+    const uint64_t spacing = stepsPerCheckpoint(simulation);
+    const uint64_t target = time > 0.0 ? static_cast<uint64_t>(llround(time / simulation.stepSize)) : 0;
+    const uint64_t current = simulation.state.step;
+
+    if (!offsets.empty() && (target < current || target - current > spacing))
+    {
+        size_t index = std::min<size_t>(target / spacing, offsets.size() - 1);
+        // going forward, a checkpoint only helps if it is past the current step
+        if (target < current || index * spacing > current)
+        {
+            restore(index, simulation.state);
+            simulation.invalidateBroadphase();
+        }
+    }
+
+    // integrate only the remainder, logging any checkpoint we pass that is still missing
+    while (simulation.state.step < target)
+    {
+        simulation.step();
+        record(simulation);
+    }
+}
+
+void CheckpointLog::clear()
+{
+    offsets.clear();
+    memory.clear();
+    spill.close();
+    used = 0;
+}
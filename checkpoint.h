@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+class Simulation;
+struct SimState;
+
+// Snapshots of the simulation state taken every `interval` seconds of simulated time, packed
+// back to back in one log. Seeking restores the nearest snapshot and only integrates the rest,
+// so jumping anywhere on the timeline costs at most one interval of stepping.
+// Once the log grows past memoryBudget it moves into a memory-mapped spill file (if one is set).
+class CheckpointLog
+{
+public:
+    explicit CheckpointLog(double interval = 10.0,
+                           size_t memoryBudget = size_t(256) << 20,
+                           const std::string &spillPath = "");
+
+    // stores a snapshot if the simulation sits on a checkpoint step that is not logged yet
+    void record(const Simulation &simulation);
+    // moves the simulation to the step nearest to time, restoring a checkpoint when that is
+    // closer than stepping from the current state
+    void seek(Simulation &simulation, double time);
+    // drops every snapshot, needed when the simulation is changed outside of step()
+    void clear();
+
+    size_t count() const { return offsets.size(); }
+    size_t bytes() const { return used; }
+    bool spilled() const { return spill.isOpen(); }
+
+private:
+    uint64_t stepsPerCheckpoint(const Simulation &simulation) const;
+    void restore(size_t index, SimState &state) const;
+    char *reserve(size_t size);
+    const char *log() const;
+
+    double interval;
+    size_t memoryBudget;
+    std::string spillPath;
+
+    std::vector<uint64_t> offsets; // checkpoint i holds step i * stepsPerCheckpoint
+    std::vector<char> memory;
+    MappedFile spill;
+    size_t used = 0;
+};
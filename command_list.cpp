@@ -0,0 +1,155 @@
+#include <chrono>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include "command_list.h"
+
+void CommandList::clear()
+{
+    commands.clear();
+    payloads.clear();
+    program = UNKNOWN_STATE;
+    vertexArray = UNKNOWN_STATE;
+    textures[0] = textures[1] = textures[2] = UNKNOWN_STATE;
+}
+
+void CommandList::useProgram(uint32_t program)
+{
+    if (program == this->program)
+        return;
+    this->program = program;
+    commands.push_back({COMMAND_USE_PROGRAM, program, 0, 0});
+}
+
+void CommandList::bindVertexArray(uint32_t vertexArray)
+{
+    if (vertexArray == this->vertexArray)
+        return;
+    this->vertexArray = vertexArray;
+    commands.push_back({COMMAND_BIND_VERTEX_ARRAY, vertexArray, 0, 0});
+}
+
+void CommandList::bindTexture(TextureTarget target, uint32_t unit, uint32_t texture)
+{
+    // only unit 0 is tracked, that is the only one the scene uses
+    if (unit == 0)
+    {
+        if (texture == textures[target])
+            return;
+        textures[target] = texture;
+    }
+    commands.push_back({COMMAND_BIND_TEXTURE, target, unit, texture});
+}
+
+void CommandList::uniformMatrix(int location, const glm::mat4 &matrix)
+{
+    commands.push_back({COMMAND_UNIFORM_MATRIX, static_cast<uint32_t>(location), static_cast<uint32_t>(payloads.size()), 0});
+    const float *values = &matrix[0][0];
+    payloads.insert(payloads.end(), values, values + 16);
+}
+
+void CommandList::uniformInt(int location, int value)
+{
+    commands.push_back({COMMAND_UNIFORM_INT, static_cast<uint32_t>(location), static_cast<uint32_t>(value), 0});
+}
+
+void CommandList::uniformFloat(int location, float value)
+{
+    commands.push_back({COMMAND_UNIFORM_FLOAT, static_cast<uint32_t>(location), static_cast<uint32_t>(payloads.size()), 0});
+    payloads.push_back(value);
+}
+
+void CommandList::uniformVec3(int location, const glm::vec3 &value)
+{
+    commands.push_back({COMMAND_UNIFORM_VEC3, static_cast<uint32_t>(location), static_cast<uint32_t>(payloads.size()), 0});
+    payloads.insert(payloads.end(), {value.x, value.y, value.z});
+}
+
+void CommandList::instanceMatrices(uint32_t buffer, uint32_t firstAttribute, size_t offset)
+{
+    commands.push_back({COMMAND_INSTANCE_MATRICES, buffer, firstAttribute, static_cast<uint32_t>(offset)});
+}
+
+void CommandList::instanceFloats(uint32_t buffer, uint32_t attribute, size_t offset)
+{
+    commands.push_back({COMMAND_INSTANCE_FLOATS, buffer, attribute, static_cast<uint32_t>(offset)});
+}
+
+void CommandList::depthState(DepthTest test, bool write)
+{
+    commands.push_back({COMMAND_DEPTH_STATE, test, write ? 1u : 0u, 0});
+}
+
+void CommandList::drawArrays(uint32_t vertexCount)
+{
+    commands.push_back({COMMAND_DRAW_ARRAYS, vertexCount, 0, 0});
+}
+
+void CommandList::drawElementsInstanced(uint32_t indexCount, uint32_t instanceCount)
+{
+    commands.push_back({COMMAND_DRAW_ELEMENTS_INSTANCED, indexCount, instanceCount, 0});
+}
+
+void replayCommands(const CommandList &list, ReplayStats *stats)
+{
+    static const GLenum targets[] = {GL_TEXTURE_2D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_ARRAY};
+    static const GLenum depthTests[] = {GL_GREATER, GL_GEQUAL};
+
+    auto start = std::chrono::steady_clock::now();
+    const float *payload = list.payload().data();
+    for (const Command &command : list.stream())
+    {
+        switch (command.type)
+        {
+        case COMMAND_USE_PROGRAM:
+            glUseProgram(command.a);
+            break;
+        case COMMAND_BIND_VERTEX_ARRAY:
+            glBindVertexArray(command.a);
+            break;
+        case COMMAND_BIND_TEXTURE:
+            glActiveTexture(GL_TEXTURE0 + command.b);
+            glBindTexture(targets[command.a], command.c);
+            break;
+        case COMMAND_UNIFORM_MATRIX:
+            glUniformMatrix4fv(static_cast<GLint>(command.a), 1, GL_FALSE, payload + command.b);
+            break;
+        case COMMAND_UNIFORM_INT:
+            glUniform1i(static_cast<GLint>(command.a), static_cast<GLint>(command.b));
+            break;
+        case COMMAND_UNIFORM_FLOAT:
+            glUniform1f(static_cast<GLint>(command.a), payload[command.b]);
+            break;
+        case COMMAND_UNIFORM_VEC3:
+            glUniform3fv(static_cast<GLint>(command.a), 1, payload + command.b);
+            break;
+        case COMMAND_INSTANCE_MATRICES:
+            glBindBuffer(GL_ARRAY_BUFFER, command.a);
+            for (GLuint column = 0; column < 4; ++column)
+                glVertexAttribPointer(command.b + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                      (void *)(size_t(command.c) + column * sizeof(glm::vec4)));
+            break;
+        case COMMAND_INSTANCE_FLOATS:
+            glBindBuffer(GL_ARRAY_BUFFER, command.a);
+            glVertexAttribPointer(command.b, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)size_t(command.c));
+            break;
+        case COMMAND_DEPTH_STATE:
+            glDepthFunc(depthTests[command.a]);
+            glDepthMask(command.b ? GL_TRUE : GL_FALSE);
+            break;
+        case COMMAND_DRAW_ARRAYS:
+            glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(command.a));
+            break;
+        case COMMAND_DRAW_ELEMENTS_INSTANCED:
+            glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(command.a), GL_UNSIGNED_INT, 0, static_cast<GLsizei>(command.b));
+            break;
+        }
+    }
+
+    if (stats)
+    {
+        stats->commands += list.size();
+        stats->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Draw stream recorded on any thread and replayed in order on the thread that owns the GL context.
+// Commands are fixed-size records with plain handles and enums, no GL types or calls, so lists can be
+// filled in parallel (one per pass or per range of batches) and replay is a switch per command.
+// Float uniforms go to a separate payload array the commands index into.
+enum CommandType : uint8_t
+{
+    COMMAND_USE_PROGRAM,              // a = program
+    COMMAND_BIND_VERTEX_ARRAY,        // a = vertex array
+    COMMAND_BIND_TEXTURE,             // a = TextureTarget, b = unit, c = texture
+    COMMAND_UNIFORM_MATRIX,           // a = location, b = payload offset of 16 floats
+    COMMAND_UNIFORM_INT,              // a = location, b = value
+    COMMAND_UNIFORM_FLOAT,            // a = location, b = payload offset of 1 float
+    COMMAND_UNIFORM_VEC3,             // a = location, b = payload offset of 3 floats
+    COMMAND_INSTANCE_MATRICES,        // a = buffer, b = first attribute, c = byte offset of the first mat4
+    COMMAND_INSTANCE_FLOATS,          // a = buffer, b = attribute, c = byte offset of the first float
+    COMMAND_DEPTH_STATE,              // a = DepthTest, b = depth writes on
+    COMMAND_DRAW_ARRAYS,              // a = vertex count
+    COMMAND_DRAW_ELEMENTS_INSTANCED   // a = index count (32-bit triangles), b = instance count
+};
+
+enum TextureTarget : uint32_t
+{
+    TEXTURE_TARGET_2D,
+    TEXTURE_TARGET_CUBE,
+    TEXTURE_TARGET_2D_ARRAY
+};
+
+enum DepthTest : uint32_t
+{
+    DEPTH_GREATER,      // reverse-Z, nearer is bigger
+    DEPTH_GREATER_EQUAL // lets the skybox pass at depth 0
+};
+
+struct Command
+{
+    CommandType type;
+    uint32_t a, b, c;
+};
+
+class CommandList
+{
+public:
+    void clear();
+    size_t size() const { return commands.size(); }
+
+    // redundant program, vertex array and texture binds within the list are dropped while recording
+    void useProgram(uint32_t program);
+    void bindVertexArray(uint32_t vertexArray);
+    void bindTexture(TextureTarget target, uint32_t unit, uint32_t texture);
+    void uniformMatrix(int location, const glm::mat4 &matrix);
+    void uniformInt(int location, int value);
+    void uniformFloat(int location, float value);
+    void uniformVec3(int location, const glm::vec3 &value);
+    // points the 4 attributes starting at firstAttribute at consecutive mat4s of buffer, from offset
+    void instanceMatrices(uint32_t buffer, uint32_t firstAttribute, size_t offset);
+    // points a float attribute at consecutive floats of buffer, from offset
+    void instanceFloats(uint32_t buffer, uint32_t attribute, size_t offset);
+    void depthState(DepthTest test, bool write);
+    void drawArrays(uint32_t vertexCount);
+    void drawElementsInstanced(uint32_t indexCount, uint32_t instanceCount);
+
+    const std::vector<Command> &stream() const { return commands; }
+    const std::vector<float> &payload() const { return payloads; }
+
+private:
+    std::vector<Command> commands;
+    std::vector<float> payloads;
+    // what the list has bound so far. Lists replay back to back, so nothing is known at the start
+    // and the first bind of each is always recorded, binding 0 included
+    static const uint32_t UNKNOWN_STATE = ~0u;
+    uint32_t program = UNKNOWN_STATE, vertexArray = UNKNOWN_STATE;
+    uint32_t textures[3] = {UNKNOWN_STATE, UNKNOWN_STATE, UNKNOWN_STATE}; // unit 0, per target
+};
+
+// CPU time spent replaying (GL queues most work, the GPU side is not included)
+struct ReplayStats
+{
+    uint64_t commands = 0;
+    double seconds = 0.0;
+};
+
+// issues the GL calls of list, on the context thread
+void replayCommands(const CommandList &list, ReplayStats *stats = nullptr);
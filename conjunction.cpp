@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+#include "conjunction.h"
+#include "solver.h"
+#include "jobs.h"
+
+namespace
+{
+    struct SweptVolume
+    {
+        glm::dvec3 center;
+        double extent; // half size of the box, also the radius of the swept sphere
+        int body;
+    };
+
+    struct CandidatePair
+    {
+        int a, b;
+        int slab;
+        bool operator<(const CandidatePair &o) const
+        {
+            if (a != o.a)
+                return a < o.a;
+            if (b != o.b)
+                return b < o.b;
+            return slab < o.slab;
+        }
+    };
+
+    class ApproachSearch
+    {
+    public:
+        ApproachSearch(const std::vector<TrajectoryBody> &bodies, const BodyPositionFunction &position, const ApproachQuery &query)
+            : bodies(bodies), position(position), query(query)
+        {
+        }
+
+        double slabStart(int slab) const { return query.startTime + slab * query.slabLength; }
+        double slabEnd(int slab) const { return std::min(query.endTime, slabStart(slab) + query.slabLength); }
+
+        // distance between the surfaces, negative when they intersect
+        double separation(int a, int b, double t) const
+        {
+            return glm::length(position(a, t) - position(b, t)) - bodies[a].radius - bodies[b].radius;
+        }
+
+        void broadphase(const std::vector<int> &set, int slab, std::vector<CandidatePair> &out) const
+        {
+            double t0 = slabStart(slab), t1 = slabEnd(slab);
+            double t = 0.5 * (t0 + t1);
+            double halfSpan = 0.5 * (t1 - t0);
+
+            // everywhere a body can be during the slab, plus half the threshold so two volumes
+            // touch exactly when the bodies may come within the threshold
+            std::vector<SweptVolume> volumes(set.size());
+            for (size_t i = 0; i < set.size(); ++i)
+            {
+                int body = set[i];
+                volumes[i].center = position(body, t);
+                volumes[i].extent = bodies[body].radius + bodies[body].maxSpeed * halfSpan + 0.5 * query.threshold;
+                volumes[i].body = body;
+            }
+            std::sort(volumes.begin(), volumes.end(), [](const SweptVolume &l, const SweptVolume &r)
+                      { return l.center.x - l.extent < r.center.x - r.extent; });
+
+            std::vector<const SweptVolume *> active;
+            for (const SweptVolume &volume : volumes)
+            {
+                double minX = volume.center.x - volume.extent;
+                size_t kept = 0;
+                for (size_t i = 0; i < active.size(); ++i)
+                {
+                    const SweptVolume *other = active[i];
+                    if (other->center.x + other->extent < minX)
+                        continue; // drops out of the sweep
+                    active[kept++] = other;
+
+                    double reach = volume.extent + other->extent;
+                    glm::dvec3 d = volume.center - other->center;
+                    if (fabs(d.y) > reach || fabs(d.z) > reach || glm::dot(d, d) > reach * reach)
+                        continue;
+                    out.push_back({std::min(volume.body, other->body), std::max(volume.body, other->body), slab});
+                }
+                active.resize(kept);
+                active.push_back(&volume);
+            }
+        }
+
+        // candidates holds every surviving slab of one pair, in time order
+        void refinePair(const CandidatePair *candidates, size_t count, std::vector<ApproachEvent> &events) const
+        {
+            int a = candidates[0].a, b = candidates[0].b;
+            std::function<double(double)> f = [this, a, b](double t)
+            { return separation(a, b, t); };
+
+            double lastTime = -HUGE_VAL;
+            for (size_t i = 0; i < count; ++i)
+            {
+                double t0 = slabStart(candidates[i].slab), t1 = slabEnd(candidates[i].slab);
+                double time;
+                double closest = brentMinimize(f, t0, t1, query.tolerance, time);
+                if (closest >= query.threshold)
+                    continue;
+
+                // a minimum pinned to the slab edge is only real if the distance rises on both sides
+                double step = std::max(1e3 * query.tolerance, 1e-6 * (t1 - t0));
+                if (time - t0 < step || t1 - time < step)
+                {
+                    if (f(time - step) < closest || f(time + step) < closest)
+                        continue;
+                }
+                // the same minimum seen from both slabs around a boundary
+                if (time - lastTime < step)
+                    continue;
+                lastTime = time;
+
+                events.push_back({a, b, time, closest + bodies[a].radius + bodies[b].radius});
+            }
+        }
+
+        const std::vector<TrajectoryBody> &bodies;
+        const BodyPositionFunction &position;
+        const ApproachQuery &query;
+    };
+}
+
+std::vector<ApproachEvent> findClosestApproaches(const std::vector<TrajectoryBody> &bodies,
+                                                 const BodyPositionFunction &position,
+                                                 const ApproachQuery &query,
+                                                 ApproachStats *stats)
+{
+    std::vector<ApproachEvent> events;
+    if (query.endTime <= query.startTime || query.slabLength <= 0.0)
+        return events;
+
+    std::vector<int> set = query.bodies;
+    if (set.empty())
+    {
+        for (size_t i = 0; i < bodies.size(); ++i)
+            set.push_back(static_cast<int>(i));
+    }
+    if (set.size() < 2)
+        return events;
+
+    JobSystem &jobs = defaultJobSystem();
+    uint64_t stealsBefore = jobs.steals();
+    ApproachSearch search(bodies, position, query);
+
+    // broadphase, parallel over time slabs
+    auto start = std::chrono::steady_clock::now();
+    int slabCount = static_cast<int>(ceil((query.endTime - query.startTime) / query.slabLength));
+    std::vector<std::vector<CandidatePair>> found(slabCount);
+    jobs.parallelFor(0, slabCount, 1, [&](size_t first, size_t last)
+                     {
+                         for (size_t slab = first; slab < last; ++slab)
+                             search.broadphase(set, static_cast<int>(slab), found[slab]);
+                     });
+
+    std::vector<CandidatePair> candidates;
+    for (const std::vector<CandidatePair> &list : found)
+        candidates.insert(candidates.end(), list.begin(), list.end());
+    std::vector<std::vector<CandidatePair>>().swap(found);
+    std::sort(candidates.begin(), candidates.end());
+    auto broadphaseDone = std::chrono::steady_clock::now();
+
+    // refinement, parallel over pairs
+    std::vector<size_t> pairStart;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (i == 0 || candidates[i].a != candidates[i - 1].a || candidates[i].b != candidates[i - 1].b)
+            pairStart.push_back(i);
+    }
+    pairStart.push_back(candidates.size());
+
+    std::mutex eventsMutex;
+    jobs.parallelFor(0, pairStart.size() - 1, 64, [&](size_t first, size_t last)
+                     {
+                         std::vector<ApproachEvent> local;
+                         for (size_t pair = first; pair < last; ++pair)
+                             search.refinePair(&candidates[pairStart[pair]], pairStart[pair + 1] - pairStart[pair], local);
+                         std::lock_guard<std::mutex> lock(eventsMutex);
+                         events.insert(events.end(), local.begin(), local.end());
+                     });
+    std::sort(events.begin(), events.end(), [](const ApproachEvent &l, const ApproachEvent &r)
+              { return l.time < r.time; });
+
+    if (stats)
+    {
+        stats->pairs = uint64_t(set.size()) * (set.size() - 1) / 2;
+        stats->pairSlabs = stats->pairs * slabCount;
+        stats->candidates = candidates.size();
+        stats->broadphaseSeconds = std::chrono::duration<double>(broadphaseDone - start).count();
+        stats->refineSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - broadphaseDone).count();
+        stats->steals = jobs.steals() - stealsBefore;
+    }
+    return events;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "trajectory.h"
+
+struct ApproachQuery
+{
+    double startTime = 0.0;
+    double endTime = 0.0;
+    std::vector<int> bodies;  // bodies to consider, empty for all of them
+    double threshold = 1.0;   // report approaches whose surfaces come closer than this
+    double slabLength = 1.0;  // keep well below the shortest relative orbital period, each slab
+                              // is searched for one minimum per pair
+    double tolerance = 1e-9;  // time tolerance of the minimization
+};
+
+// a local minimum of the distance between two bodies
+struct ApproachEvent
+{
+    int a, b;
+    double time;
+    double distance; // between the centers
+};
+
+struct ApproachStats
+{
+    uint64_t pairs = 0;      // distinct body pairs in the query
+    uint64_t pairSlabs = 0;  // pairs x time slabs the broadphase had to decide on
+    uint64_t candidates = 0; // pair slabs that survived the broadphase and were minimized
+    double broadphaseSeconds = 0.0;
+    double refineSeconds = 0.0;
+    uint64_t steals = 0; // jobs moved between threads by the scheduler
+};
+
+// Finds the closest approaches between bodies over [startTime, endTime], sorted by time.
+// Each time slab is pruned with a sweep and prune over the bodies' swept volumes (bounding
+// boxes grown by maxSpeed over the slab), then every surviving pair is minimized with Brent's
+// method. Both phases run on the default work-stealing job system.
+std::vector<ApproachEvent> findClosestApproaches(const std::vector<TrajectoryBody> &bodies,
+                                                 const BodyPositionFunction &position,
+                                                 const ApproachQuery &query,
+                                                 ApproachStats *stats = nullptr);
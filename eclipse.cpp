@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <mutex>
+
+#include "eclipse.h"
+#include "solver.h"
+#include "jobs.h"
+
+namespace
+{
+    struct Cone
+    {
+        glm::dvec3 direction;
+        double halfAngle;
+        double chord; // radius of the cone's cap on the unit sphere, 2 sin(halfAngle / 2)
+        int body;
+    };
+
+    // slabs swept at once, their lists are merged before the next batch
+    const int64_t SLAB_BATCH = 4096;
+
+    struct CandidatePair
+    {
+        int a, b;
+        int64_t slab;
+        bool operator<(const CandidatePair &o) const
+        {
+            if (a != o.a)
+                return a < o.a;
+            if (b != o.b)
+                return b < o.b;
+            return slab < o.slab;
+        }
+    };
+
+    double angleBetween(const glm::dvec3 &a, const glm::dvec3 &b)
+    {
+        return atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+    }
+
+    // cone a sphere covers as seen from the origin, false if the origin may be inside it
+    bool makeCone(const glm::dvec3 &center, double radius, Cone &cone)
+    {
+        double distance = glm::length(center);
+        if (distance <= radius)
+            return false;
+        cone.direction = center / distance;
+        cone.halfAngle = asin(radius / distance);
+        cone.chord = 2.0 * sin(0.5 * cone.halfAngle);
+        return true;
+    }
+
+    class OcclusionSearch
+    {
+    public:
+        OcclusionSearch(const std::vector<TrajectoryBody> &bodies, const BodyPositionFunction &position, const OcclusionQuery &query,
+                        const std::vector<int> &set)
+            : bodies(bodies), position(position), query(query)
+        {
+            observerSpeed = query.observerBody >= 0 ? bodies[query.observerBody].maxSpeed : 0.0;
+            slabLength = query.slabLength > 0.0 ? query.slabLength : deriveSlabLength(set);
+        }
+
+        // the median over the bodies of the time to move twice the radius, no shorter than the
+        // resolution; the whole span if nothing moves
+        double deriveSlabLength(const std::vector<int> &set) const
+        {
+            std::vector<double> times;
+            for (int body : set)
+            {
+                double speed = bodies[body].maxSpeed + observerSpeed;
+                if (speed > 0.0)
+                    times.push_back(2.0 * bodies[body].radius / speed);
+            }
+            if (times.empty())
+                return query.endTime - query.startTime;
+            std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+            return std::max(times[times.size() / 2], query.resolution);
+        }
+
+        double slabStart(int64_t slab) const { return query.startTime + double(slab) * slabLength; }
+        double slabEnd(int64_t slab) const { return std::min(query.endTime, slabStart(slab) + slabLength); }
+        int64_t slabCount() const { return static_cast<int64_t>(ceil((query.endTime - query.startTime) / slabLength)); }
+
+        glm::dvec3 observerAt(double t) const
+        {
+            return query.observerBody >= 0 ? position(query.observerBody, t) : query.observerPosition;
+        }
+
+        // separation of the two discs minus their angular radii, negative while they overlap
+        double overlap(int a, int b, double t) const
+        {
+            glm::dvec3 observer = observerAt(t);
+            Cone ca, cb;
+            if (!makeCone(position(a, t) - observer, bodies[a].radius, ca) ||
+                !makeCone(position(b, t) - observer, bodies[b].radius, cb))
+                return 1.0; // observer inside a body, nothing to see
+            return angleBetween(ca.direction, cb.direction) - ca.halfAngle - cb.halfAngle;
+        }
+
+        // bounding spheres of both bodies over [t0, t1], grown by how far they can move relative to the observer
+        bool mayOverlap(int a, int b, double t0, double t1) const
+        {
+            double t = 0.5 * (t0 + t1);
+            double halfSpan = 0.5 * (t1 - t0);
+            glm::dvec3 observer = observerAt(t);
+            Cone ca, cb;
+            if (!makeCone(position(a, t) - observer, bodies[a].radius + (bodies[a].maxSpeed + observerSpeed) * halfSpan, ca) ||
+                !makeCone(position(b, t) - observer, bodies[b].radius + (bodies[b].maxSpeed + observerSpeed) * halfSpan, cb))
+                return true;
+            return angleBetween(ca.direction, cb.direction) < ca.halfAngle + cb.halfAngle;
+        }
+
+        // the same spheres shrunk instead of grown: while they overlap the discs do over all of [t0, t1]
+        bool mustOverlap(int a, int b, double t0, double t1) const
+        {
+            double t = 0.5 * (t0 + t1);
+            double halfSpan = 0.5 * (t1 - t0);
+            double ra = bodies[a].radius - (bodies[a].maxSpeed + observerSpeed) * halfSpan;
+            double rb = bodies[b].radius - (bodies[b].maxSpeed + observerSpeed) * halfSpan;
+            if (ra <= 0.0 || rb <= 0.0)
+                return false;
+            glm::dvec3 observer = observerAt(t);
+            Cone ca, cb;
+            if (!makeCone(position(a, t) - observer, ra, ca) || !makeCone(position(b, t) - observer, rb, cb))
+                return false;
+            return angleBetween(ca.direction, cb.direction) < ca.halfAngle + cb.halfAngle;
+        }
+
+        // sweep and prune over the cones' caps on the unit sphere for one time slab
+        void broadphase(const std::vector<int> &set, int64_t slab, std::vector<CandidatePair> &out) const
+        {
+            double t0 = slabStart(slab);
+            double t1 = slabEnd(slab);
+            double t = 0.5 * (t0 + t1);
+            double halfSpan = 0.5 * (t1 - t0);
+            glm::dvec3 observer = observerAt(t);
+
+            std::vector<Cone> cones;
+            std::vector<int> unbounded; // the observer may be inside, pair with everything
+            cones.reserve(set.size());
+            for (int body : set)
+            {
+                Cone cone;
+                cone.body = body;
+                if (makeCone(position(body, t) - observer, bodies[body].radius + (bodies[body].maxSpeed + observerSpeed) * halfSpan, cone))
+                    cones.push_back(cone);
+                else
+                    unbounded.push_back(body);
+            }
+
+            std::sort(cones.begin(), cones.end(), [](const Cone &l, const Cone &r)
+                      { return l.direction.x - l.chord < r.direction.x - r.chord; });
+
+            // caps that overlap on the sphere have chord distance below the chord radii sum
+            std::vector<const Cone *> active;
+            for (const Cone &cone : cones)
+            {
+                double minX = cone.direction.x - cone.chord;
+                size_t kept = 0;
+                for (size_t i = 0; i < active.size(); ++i)
+                {
+                    const Cone *other = active[i];
+                    if (other->direction.x + other->chord < minX)
+                        continue; // drops out of the sweep
+                    active[kept++] = other;
+
+                    double reach = cone.chord + other->chord;
+                    if (fabs(cone.direction.y - other->direction.y) > reach || fabs(cone.direction.z - other->direction.z) > reach)
+                        continue;
+                    if (angleBetween(cone.direction, other->direction) < cone.halfAngle + other->halfAngle)
+                        out.push_back({std::min(cone.body, other->body), std::max(cone.body, other->body), slab});
+                }
+                active.resize(kept);
+                active.push_back(&cone);
+            }
+
+            for (int body : unbounded)
+            {
+                for (int other : set)
+                {
+                    if (other != body)
+                        out.push_back({std::min(body, other), std::max(body, other), slab});
+                }
+            }
+        }
+
+        struct PairState
+        {
+            int a, b;
+            std::function<double(double)> f; // overlap of the pair over time
+            bool inEvent = false;
+            double start = 0.0;
+            double lastTime = -HUGE_VAL; // neighbouring leaves share an end point, keep its value
+            double lastValue = 0.0;
+            std::vector<OcclusionEvent> *events;
+        };
+
+        void closeEvent(PairState &state, double end) const
+        {
+            state.inEvent = false;
+
+            OcclusionEvent event;
+            event.start = state.start;
+            event.end = end;
+            brentMinimize(state.f, state.start, end, query.tolerance, event.maximum);
+
+            glm::dvec3 observer = observerAt(event.maximum);
+            glm::dvec3 da = position(state.a, event.maximum) - observer;
+            glm::dvec3 db = position(state.b, event.maximum) - observer;
+            bool aInFront = glm::length(da) < glm::length(db);
+            event.front = aInFront ? state.a : state.b;
+            event.back = aInFront ? state.b : state.a;
+
+            Cone front, back;
+            makeCone(aInFront ? da : db, bodies[event.front].radius, front);
+            makeCone(aInFront ? db : da, bodies[event.back].radius, back);
+            double separation = angleBetween(front.direction, back.direction);
+            if (separation + back.halfAngle <= front.halfAngle)
+                event.kind = OCCLUSION_TOTAL;
+            else if (separation + front.halfAngle <= back.halfAngle)
+                event.kind = OCCLUSION_ANNULAR;
+            else
+                event.kind = OCCLUSION_PARTIAL;
+            state.events->push_back(event);
+        }
+
+        // leaf interval: find the contacts with Brent's method
+        void refineLeaf(PairState &state, double t0, double t1) const
+        {
+            double f0 = t0 == state.lastTime ? state.lastValue : state.f(t0);
+            double f1 = state.f(t1);
+            state.lastTime = t1;
+            state.lastValue = f1;
+
+            if (f0 < 0.0 && !state.inEvent)
+            {
+                // already overlapping at the start of the query
+                state.inEvent = true;
+                state.start = t0;
+            }
+
+            if (f0 < 0.0 && f1 < 0.0)
+                return;
+            if (f0 < 0.0)
+            {
+                closeEvent(state, brentRoot(state.f, t0, t1, f0, f1, query.tolerance));
+                return;
+            }
+            if (f1 < 0.0)
+            {
+                state.inEvent = true;
+                state.start = brentRoot(state.f, t0, t1, f0, f1, query.tolerance);
+                return;
+            }
+
+            // both ends clear, look for a contact shorter than the leaf
+            double tm;
+            double fm = brentMinimize(state.f, t0, t1, query.tolerance, tm);
+            if (fm < 0.0)
+            {
+                state.inEvent = true;
+                state.start = brentRoot(state.f, t0, tm, f0, fm, query.tolerance);
+                closeEvent(state, brentRoot(state.f, tm, t1, fm, f1, query.tolerance));
+            }
+        }
+
+        void refine(PairState &state, double t0, double t1) const
+        {
+            if (!mayOverlap(state.a, state.b, t0, t1))
+            {
+                if (state.inEvent)
+                    closeEvent(state, t0);
+                return;
+            }
+            if (mustOverlap(state.a, state.b, t0, t1))
+            {
+                // inside an event, nothing to bracket
+                if (!state.inEvent)
+                {
+                    state.inEvent = true;
+                    state.start = t0;
+                }
+                return;
+            }
+            if (t1 - t0 <= query.resolution)
+            {
+                refineLeaf(state, t0, t1);
+                return;
+            }
+            double mid = 0.5 * (t0 + t1);
+            refine(state, t0, mid);
+            refine(state, mid, t1);
+        }
+
+        // candidates holds every slab of one pair, in time order
+        void refinePair(const CandidatePair *candidates, size_t count, std::vector<OcclusionEvent> &events) const
+        {
+            PairState state;
+            state.a = candidates[0].a;
+            state.b = candidates[0].b;
+            state.f = [this, &state](double t)
+            { return overlap(state.a, state.b, t); };
+            state.events = &events;
+
+            int64_t previousSlab = -2;
+            for (size_t i = 0; i < count; ++i)
+            {
+                if (state.inEvent && candidates[i].slab != previousSlab + 1)
+                    closeEvent(state, slabStart(previousSlab + 1));
+                previousSlab = candidates[i].slab;
+                refine(state, slabStart(candidates[i].slab), slabEnd(candidates[i].slab));
+            }
+            if (state.inEvent)
+                closeEvent(state, slabEnd(previousSlab));
+        }
+
+        const std::vector<TrajectoryBody> &bodies;
+        const BodyPositionFunction &position;
+        const OcclusionQuery &query;
+        double observerSpeed;
+        double slabLength;
+    };
+}
+
+std::vector<OcclusionEvent> findOcclusions(const std::vector<TrajectoryBody> &bodies,
+                                           const BodyPositionFunction &position,
+                                           const OcclusionQuery &query)
+{
+    std::vector<OcclusionEvent> events;
+    if (query.endTime <= query.startTime || query.slabLength < 0.0)
+        return events;
+
+    std::vector<int> set = query.bodies;
+    if (set.empty())
+    {
+        for (size_t i = 0; i < bodies.size(); ++i)
+            set.push_back(static_cast<int>(i));
+    }
+    set.erase(std::remove(set.begin(), set.end(), query.observerBody), set.end());
+
+    JobSystem &jobs = defaultJobSystem();
+    OcclusionSearch search(bodies, position, query, set);
+
+    // broadphase, parallel over the time slabs of a batch
+    std::vector<CandidatePair> candidates;
+    std::vector<std::vector<CandidatePair>> found(size_t(std::min(SLAB_BATCH, search.slabCount())));
+    for (int64_t batch = 0; batch < search.slabCount(); batch += SLAB_BATCH)
+    {
+        size_t slabs = size_t(std::min(SLAB_BATCH, search.slabCount() - batch));
+        jobs.parallelFor(0, slabs, 1, [&](size_t first, size_t last)
+                         {
+                             for (size_t slab = first; slab < last; ++slab)
+                             {
+                                 found[slab].clear();
+                                 search.broadphase(set, batch + int64_t(slab), found[slab]);
+                             }
+                         });
+        for (size_t slab = 0; slab < slabs; ++slab)
+            candidates.insert(candidates.end(), found[slab].begin(), found[slab].end());
+    }
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end(), [](const CandidatePair &l, const CandidatePair &r)
+                                 { return l.a == r.a && l.b == r.b && l.slab == r.slab; }),
+                     candidates.end());
+
+    // group the slabs of each pair, then refine, parallel over pairs
+    std::vector<size_t> pairStart;
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        if (i == 0 || candidates[i].a != candidates[i - 1].a || candidates[i].b != candidates[i - 1].b)
+            pairStart.push_back(i);
+    }
+    pairStart.push_back(candidates.size());
+
+    std::mutex eventsMutex;
+    jobs.parallelFor(0, pairStart.size() - 1, 16, [&](size_t first, size_t last)
+                     {
+                         std::vector<OcclusionEvent> local;
+                         for (size_t pair = first; pair < last; ++pair)
+                             search.refinePair(&candidates[pairStart[pair]], pairStart[pair + 1] - pairStart[pair], local);
+                         std::lock_guard<std::mutex> lock(eventsMutex);
+                         events.insert(events.end(), local.begin(), local.end());
+                     });
+    std::sort(events.begin(), events.end(), [](const OcclusionEvent &l, const OcclusionEvent &r)
+              { return l.start < r.start; });
+    return events;
+}
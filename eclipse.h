@@ -0,0 +1,50 @@
+#pragma once
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "trajectory.h"
+
+// An occultation is one body passing in front of another as seen by the observer.
+// With the observer on a light source (e.g. the sun) the same event is an eclipse:
+// the front body shadows the back one (the source is treated as a point).
+struct OcclusionQuery
+{
+    double startTime = 0.0;
+    double endTime = 0.0;
+    int observerBody = -1;             // body the events are seen from, -1 for observerPosition
+    glm::dvec3 observerPosition{0.0};  // fixed observer, e.g. the camera
+    std::vector<int> bodies;           // bodies to consider, empty for all of them
+    double slabLength = 0.0;           // time slab used by the broadphase, 0 derives it from the bodies
+    double resolution = 1e-3;          // bracketing stops at intervals this short
+    double tolerance = 1e-9;           // root finding tolerance in time
+};
+
+enum OcclusionKind
+{
+    OCCLUSION_PARTIAL, // the discs overlap
+    OCCLUSION_TOTAL,   // the front disc hides the back one completely
+    OCCLUSION_ANNULAR  // the front disc sits entirely inside the back one (a transit)
+};
+
+struct OcclusionEvent
+{
+    int front; // nearer body at maximum
+    int back;
+    double start;
+    double maximum; // time of the smallest angular separation relative to the disc sizes
+    double end;
+    OcclusionKind kind;
+};
+
+// Lists every occultation between the query's bodies over [startTime, endTime], sorted by start time.
+// Candidates are bracketed with bounding spheres that grow with maxSpeed over each interval, so no
+// event longer than `resolution` is missed; contacts are then refined with Brent's method.
+// Work is spread over the default job system, by time slab and then by body pair. The derived slab
+// is the time the median body takes to move twice its radius relative to the observer, so its
+// bounding sphere over a slab is about three times its size; slabs are swept a batch at a time,
+// so memory follows the candidates found, not the length of the span.
+std::vector<OcclusionEvent> findOcclusions(const std::vector<TrajectoryBody> &bodies,
+                                           const BodyPositionFunction &position,
+                                           const OcclusionQuery &query);
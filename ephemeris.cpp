@@ -0,0 +1,498 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include <glm/gtc/constants.hpp> // Include for glm::pi
+
+#include "ephemeris.h"
+
+static const uint64_t SECTION_ALIGN = 64;
+
+static uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+double chebyshevNode(uint32_t k, uint32_t count)
+{
+    return cos(glm::pi<double>() * (k + 0.5) / count);
+}
+
+void fitChebyshev(const double *samples, uint32_t count, double *coefficients)
+{
+    for (uint32_t j = 0; j < count; ++j)
+    {
+        double sum = 0.0;
+        for (uint32_t k = 0; k < count; ++k)
+            sum += samples[k] * cos(glm::pi<double>() * j * (k + 0.5) / count);
+        coefficients[j] = 2.0 * sum / count;
+    }
+    coefficients[0] *= 0.5;
+}
+
+// T_j(tau) and dT_j/dtau for j < count, using T'_j = j * U_{j-1}
+static void chebyshevBasis(double tau, uint32_t count, double *T, double *dT)
+{
+    double u0 = 1.0, u1 = 2.0 * tau;
+    T[0] = 1.0;
+    dT[0] = 0.0;
+    if (count > 1)
+    {
+        T[1] = tau;
+        dT[1] = 1.0;
+    }
+    for (uint32_t j = 2; j < count; ++j)
+    {
+        T[j] = 2.0 * tau * T[j - 1] - T[j - 2];
+        dT[j] = j * u1;
+        double u2 = 2.0 * tau * u1 - u0;
+        u0 = u1;
+        u1 = u2;
+    }
+}
+
+// out[b] = sum_j weights[j] * rows[j * stride + b] for every body slot b.
+// rows is 32-byte aligned and stride is a multiple of EPHEMERIS_BODY_ALIGN.
+static void evaluateRows(const double *rows, uint32_t count, uint32_t stride, const double *weights, double *out)
+{
+    uint32_t b = 0;
+#if defined(__AVX__)
+    for (; b + 4 <= stride; b += 4)
+    {
+        __m256d sum = _mm256_setzero_pd();
+        for (uint32_t j = 0; j < count; ++j)
+            sum = _mm256_add_pd(sum, _mm256_mul_pd(_mm256_set1_pd(weights[j]), _mm256_load_pd(rows + j * stride + b)));
+        _mm256_storeu_pd(out + b, sum);
+    }
+#elif defined(__SSE2__)
+    for (; b + 2 <= stride; b += 2)
+    {
+        __m128d sum = _mm_setzero_pd();
+        for (uint32_t j = 0; j < count; ++j)
+            sum = _mm_add_pd(sum, _mm_mul_pd(_mm_set1_pd(weights[j]), _mm_load_pd(rows + j * stride + b)));
+        _mm_storeu_pd(out + b, sum);
+    }
+#endif
+    for (; b < stride; ++b)
+    {
+        double sum = 0.0;
+        for (uint32_t j = 0; j < count; ++j)
+            sum += weights[j] * rows[j * stride + b];
+        out[b] = sum;
+    }
+}
+
+Ephemeris::~Ephemeris()
+{
+    close();
+}
+
+bool Ephemeris::open(const std::string &path)
+{
+    close();
+
+    if (!file.openRead(path))
+        return false;
+
+    // validate the header only, the coefficients are used in place
+    const size_t mappingSize = file.size();
+    const EphemerisHeader *h = reinterpret_cast<const EphemerisHeader *>(file.data());
+    bool valid = mappingSize >= sizeof(EphemerisHeader) &&
+                 memcmp(h->magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC)) == 0 &&
+                 h->version == EPHEMERIS_VERSION &&
+                 h->fileSize == mappingSize &&
+                 h->bodyCount > 0 &&
+                 h->bodyStride >= h->bodyCount &&
+                 h->bodyStride % EPHEMERIS_BODY_ALIGN == 0 &&
+                 h->coefficientCount > 0 && h->coefficientCount <= EPHEMERIS_MAX_COEFFICIENTS &&
+                 h->intervalCount > 0 &&
+                 h->intervalLength > 0.0 &&
+                 h->namesOffset + uint64_t(h->bodyCount) * EPHEMERIS_NAME_LENGTH <= mappingSize &&
+                 h->coefficientsOffset % SECTION_ALIGN == 0 &&
+                 h->coefficientsOffset + h->intervalCount * 3 * h->coefficientCount * h->bodyStride * sizeof(double) <= mappingSize;
+    if (!valid)
+    {
+        std::cerr << "Error::Ephemeris invalid or corrupt file:" << path << std::endl;
+        close();
+        return false;
+    }
+
+    header = h;
+    names = file.data() + h->namesOffset;
+    coefficients = reinterpret_cast<const double *>(file.data() + h->coefficientsOffset);
+    return true;
+}
+
+void Ephemeris::close()
+{
+    file.close();
+    header = nullptr;
+    names = nullptr;
+    coefficients = nullptr;
+}
+
+std::string Ephemeris::bodyName(uint32_t body) const
+{
+    if (!header || body >= header->bodyCount)
+        return std::string();
+    const char *name = names + body * EPHEMERIS_NAME_LENGTH;
+    return std::string(name, strnlen(name, EPHEMERIS_NAME_LENGTH));
+}
+
+int Ephemeris::findBody(const std::string &name) const
+{
+    for (uint32_t i = 0; i < bodyCount(); ++i)
+    {
+        if (bodyName(i) == name)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+const double *Ephemeris::locate(double t, double &tau) const
+{
+    double s = (t - header->startTime) / header->intervalLength;
+    int64_t index = static_cast<int64_t>(floor(s));
+    if (index < 0)
+        index = 0;
+    if (index >= static_cast<int64_t>(header->intervalCount))
+        index = static_cast<int64_t>(header->intervalCount) - 1;
+
+    tau = 2.0 * (s - index) - 1.0;
+    tau = std::min(1.0, std::max(-1.0, tau)); // times outside the span hold the end points
+    return coefficients + index * 3 * header->coefficientCount * header->bodyStride;
+}
+
+void Ephemeris::evaluate(double t, double *x, double *y, double *z, double *vx, double *vy, double *vz) const
+{
+    if (!header)
+        return;
+
+    // every body shares the interval, so the basis is computed once for the whole batch
+    double tau;
+    const double *block = locate(t, tau);
+    const uint32_t count = header->coefficientCount;
+    const uint32_t stride = header->bodyStride;
+    double T[EPHEMERIS_MAX_COEFFICIENTS], dT[EPHEMERIS_MAX_COEFFICIENTS];
+    chebyshevBasis(tau, count, T, dT);
+
+    const double velocityScale = 2.0 / header->intervalLength; // dtau/dt
+    for (uint32_t j = 0; j < count; ++j)
+        dT[j] *= velocityScale;
+
+    double *positions[3] = {x, y, z};
+    double *velocities[3] = {vx, vy, vz};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const double *rows = block + axis * count * stride;
+        evaluateRows(rows, count, stride, T, positions[axis]);
+        if (velocities[axis])
+            evaluateRows(rows, count, stride, dT, velocities[axis]);
+    }
+}
+
+glm::dvec3 Ephemeris::position(uint32_t body, double t) const
+{
+    glm::dvec3 result(0.0);
+    if (!header || body >= header->bodyCount)
+        return result;
+
+    double tau;
+    const double *block = locate(t, tau);
+    const uint32_t count = header->coefficientCount;
+    const uint32_t stride = header->bodyStride;
+    double T[EPHEMERIS_MAX_COEFFICIENTS], dT[EPHEMERIS_MAX_COEFFICIENTS];
+    chebyshevBasis(tau, count, T, dT);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const double *rows = block + axis * count * stride + body;
+        for (uint32_t j = 0; j < count; ++j)
+            result[axis] += T[j] * rows[j * stride];
+    }
+    return result;
+}
+
+glm::dvec3 Ephemeris::velocity(uint32_t body, double t) const
+{
+    glm::dvec3 result(0.0);
+    if (!header || body >= header->bodyCount)
+        return result;
+
+    double tau;
+    const double *block = locate(t, tau);
+    const uint32_t count = header->coefficientCount;
+    const uint32_t stride = header->bodyStride;
+    double T[EPHEMERIS_MAX_COEFFICIENTS], dT[EPHEMERIS_MAX_COEFFICIENTS];
+    chebyshevBasis(tau, count, T, dT);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const double *rows = block + axis * count * stride + body;
+        for (uint32_t j = 0; j < count; ++j)
+            result[axis] += dT[j] * rows[j * stride];
+    }
+    return result * (2.0 / header->intervalLength);
+}
+
+double Ephemeris::maxSpeed(uint32_t body) const
+{
+    if (!header || body >= header->bodyCount)
+        return 0.0;
+
+    const uint32_t count = header->coefficientCount;
+    const uint32_t stride = header->bodyStride;
+    double speed = 0.0;
+    for (uint64_t k = 0; k < header->intervalCount; ++k)
+    {
+        const double *block = coefficients + k * 3 * count * stride;
+        double squared = 0.0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const double *rows = block + axis * count * stride + body;
+            double bound = 0.0;
+            for (uint32_t j = 1; j < count; ++j)
+                bound += double(j) * j * fabs(rows[j * stride]);
+            squared += bound * bound;
+        }
+        speed = std::max(speed, sqrt(squared));
+    }
+    return speed * (2.0 / header->intervalLength);
+}
+
+bool writeEphemeris(const std::string &path,
+                    const std::vector<std::string> &bodyNames,
+                    uint32_t coefficientCount,
+                    uint64_t intervalCount,
+                    double startTime,
+                    double intervalLength,
+                    const std::vector<double> &coefficients,
+                    std::string &error)
+{
+    const uint32_t bodyCount = static_cast<uint32_t>(bodyNames.size());
+    const uint32_t bodyStride = static_cast<uint32_t>(alignUp(bodyCount, EPHEMERIS_BODY_ALIGN));
+    if (bodyCount == 0 || coefficientCount == 0 || coefficientCount > EPHEMERIS_MAX_COEFFICIENTS || intervalCount == 0)
+    {
+        error = "nothing to write";
+        return false;
+    }
+    if (coefficients.size() != intervalCount * 3 * coefficientCount * bodyStride)
+    {
+        error = "coefficient array does not match the layout";
+        return false;
+    }
+
+    EphemerisHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, EPHEMERIS_MAGIC, sizeof(EPHEMERIS_MAGIC));
+    header.version = EPHEMERIS_VERSION;
+    header.bodyCount = bodyCount;
+    header.bodyStride = bodyStride;
+    header.coefficientCount = coefficientCount;
+    header.intervalCount = intervalCount;
+    header.startTime = startTime;
+    header.intervalLength = intervalLength;
+    header.namesOffset = alignUp(sizeof(EphemerisHeader), SECTION_ALIGN);
+    header.coefficientsOffset = alignUp(header.namesOffset + uint64_t(bodyCount) * EPHEMERIS_NAME_LENGTH, SECTION_ALIGN);
+    header.fileSize = header.coefficientsOffset + coefficients.size() * sizeof(double);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        error = "could not open " + path + " for writing";
+        return false;
+    }
+
+    std::vector<char> prefix(header.coefficientsOffset, 0);
+    memcpy(prefix.data(), &header, sizeof(header));
+    for (uint32_t i = 0; i < bodyCount; ++i)
+    {
+        // names are truncated to fit, one byte is kept for the terminator
+        size_t length = std::min<size_t>(bodyNames[i].size(), EPHEMERIS_NAME_LENGTH - 1);
+        memcpy(prefix.data() + header.namesOffset + i * EPHEMERIS_NAME_LENGTH, bodyNames[i].data(), length);
+    }
+    file.write(prefix.data(), prefix.size());
+    file.write(reinterpret_cast<const char *>(coefficients.data()), coefficients.size() * sizeof(double));
+    if (!file)
+    {
+        error = "write failed for " + path;
+        return false;
+    }
+    return true;
+}
+
+namespace
+{
+    struct TrajectorySample
+    {
+        double time;
+        glm::dvec3 position;
+        glm::dvec3 velocity;
+    };
+
+    struct Trajectory
+    {
+        std::vector<TrajectorySample> samples;
+        bool hasVelocity = true;
+
+        // cubic Hermite interpolation, tangents from the table or from finite differences
+        glm::dvec3 sample(double t) const
+        {
+            if (t <= samples.front().time)
+                return samples.front().position;
+            if (t >= samples.back().time)
+                return samples.back().position;
+
+            size_t i = std::upper_bound(samples.begin(), samples.end(), t,
+                                        [](double value, const TrajectorySample &s)
+                                        { return value < s.time; }) -
+                       samples.begin() - 1;
+            const TrajectorySample &a = samples[i];
+            const TrajectorySample &b = samples[i + 1];
+            double h = b.time - a.time;
+            double s = (t - a.time) / h;
+            double s2 = s * s, s3 = s2 * s;
+            return (2 * s3 - 3 * s2 + 1) * a.position + (s3 - 2 * s2 + s) * h * tangent(i) +
+                   (-2 * s3 + 3 * s2) * b.position + (s3 - s2) * h * tangent(i + 1);
+        }
+
+        glm::dvec3 tangent(size_t i) const
+        {
+            if (hasVelocity)
+                return samples[i].velocity;
+            size_t lo = i > 0 ? i - 1 : i;
+            size_t hi = i + 1 < samples.size() ? i + 1 : i;
+            return (samples[hi].position - samples[lo].position) / (samples[hi].time - samples[lo].time);
+        }
+    };
+}
+
+bool convertTrajectoryTable(const std::string &csvPath,
+                            const std::string &ephemerisPath,
+                            double intervalLength,
+                            int degree,
+                            std::string &error)
+{
+    if (intervalLength <= 0.0 || degree < 0 || degree + 1 > static_cast<int>(EPHEMERIS_MAX_COEFFICIENTS))
+    {
+        error = "interval length must be positive and degree in [0, 31]";
+        return false;
+    }
+
+    std::ifstream file(csvPath);
+    if (!file.is_open())
+    {
+        error = "could not open " + csvPath;
+        return false;
+    }
+
+    std::vector<std::string> bodyNames;
+    std::map<std::string, size_t> bodyIndex;
+    std::vector<Trajectory> trajectories;
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line))
+    {
+        ++lineNumber;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream fields(line);
+        std::string name;
+        TrajectorySample sample;
+        if (!(fields >> name >> sample.time >> sample.position.x >> sample.position.y >> sample.position.z))
+        {
+            if (bodyNames.empty())
+                continue; // column header
+            error = "malformed sample on line " + std::to_string(lineNumber);
+            return false;
+        }
+        bool velocity = static_cast<bool>(fields >> sample.velocity.x >> sample.velocity.y >> sample.velocity.z);
+
+        auto found = bodyIndex.find(name);
+        if (found == bodyIndex.end())
+        {
+            found = bodyIndex.emplace(name, bodyNames.size()).first;
+            bodyNames.push_back(name);
+            trajectories.emplace_back();
+        }
+        Trajectory &trajectory = trajectories[found->second];
+        trajectory.samples.push_back(sample);
+        trajectory.hasVelocity = trajectory.hasVelocity && velocity;
+    }
+
+    if (bodyNames.empty())
+    {
+        error = "no samples in " + csvPath;
+        return false;
+    }
+
+    // the file covers the span every body has samples for
+    double startTime = -HUGE_VAL, endTime = HUGE_VAL;
+    for (size_t i = 0; i < trajectories.size(); ++i)
+    {
+        std::vector<TrajectorySample> &samples = trajectories[i].samples;
+        std::stable_sort(samples.begin(), samples.end(),
+                         [](const TrajectorySample &a, const TrajectorySample &b)
+                         { return a.time < b.time; });
+        samples.erase(std::unique(samples.begin(), samples.end(),
+                                  [](const TrajectorySample &a, const TrajectorySample &b)
+                                  { return a.time == b.time; }),
+                      samples.end());
+        if (samples.size() < 2)
+        {
+            error = "body " + bodyNames[i] + " needs at least two samples";
+            return false;
+        }
+        startTime = std::max(startTime, samples.front().time);
+        endTime = std::min(endTime, samples.back().time);
+    }
+    if (endTime <= startTime)
+    {
+        error = "bodies do not share a common time span";
+        return false;
+    }
+
+    const uint32_t coefficientCount = static_cast<uint32_t>(degree + 1);
+    const uint32_t bodyCount = static_cast<uint32_t>(bodyNames.size());
+    const uint32_t bodyStride = static_cast<uint32_t>(alignUp(bodyCount, EPHEMERIS_BODY_ALIGN));
+    const uint64_t intervalCount = static_cast<uint64_t>(ceil((endTime - startTime) / intervalLength));
+
+    std::vector<double> coefficients(intervalCount * 3 * coefficientCount * bodyStride, 0.0);
+    double samples[3][EPHEMERIS_MAX_COEFFICIENTS];
+    double fitted[EPHEMERIS_MAX_COEFFICIENTS];
+    for (uint64_t k = 0; k < intervalCount; ++k)
+    {
+        double mid = startTime + (k + 0.5) * intervalLength;
+        for (uint32_t b = 0; b < bodyCount; ++b)
+        {
+            for (uint32_t n = 0; n < coefficientCount; ++n)
+            {
+                // the last interval may run past the table, it then holds the final sample
+                double t = std::min(endTime, mid + 0.5 * intervalLength * chebyshevNode(n, coefficientCount));
+                glm::dvec3 p = trajectories[b].sample(t);
+                samples[0][n] = p.x;
+                samples[1][n] = p.y;
+                samples[2][n] = p.z;
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                fitChebyshev(samples[axis], coefficientCount, fitted);
+                double *rows = &coefficients[((k * 3 + axis) * coefficientCount) * bodyStride];
+                for (uint32_t j = 0; j < coefficientCount; ++j)
+                    rows[j * bodyStride + b] = fitted[j];
+            }
+        }
+    }
+
+    return writeEphemeris(ephemerisPath, bodyNames, coefficientCount, intervalCount, startTime, intervalLength, coefficients, error);
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mapped_file.h"
+
+// Binary ephemeris file (.eph)
+// The file is used straight from a read-only memory mapping, nothing is parsed at startup.
+// Layout (little-endian, every section 64-byte aligned):
+//   EphemerisHeader
+//   char names[bodyCount][EPHEMERIS_NAME_LENGTH]
+//   double coefficients[intervalCount][3 (x,y,z)][coefficientCount][bodyStride]
+// Bodies are the innermost dimension so one interval/axis/degree row can be evaluated
+// for a whole batch of bodies with SIMD. bodyStride is bodyCount padded to EPHEMERIS_BODY_ALIGN.
+const char EPHEMERIS_MAGIC[8] = {'S', 'P', 'C', 'E', 'P', 'H', '0', '1'};
+const uint32_t EPHEMERIS_VERSION = 1;
+const uint32_t EPHEMERIS_NAME_LENGTH = 32;
+const uint32_t EPHEMERIS_BODY_ALIGN = 4;
+const uint32_t EPHEMERIS_MAX_COEFFICIENTS = 32;
+
+struct EphemerisHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t bodyStride;
+    uint32_t coefficientCount; // chebyshev degree + 1
+    uint64_t intervalCount;
+    double startTime;
+    double intervalLength; // every interval has the same length, so lookup by time is O(1)
+    uint64_t namesOffset;
+    uint64_t coefficientsOffset;
+    uint64_t fileSize;
+};
+
+// Precomputed trajectories stored as per-body, per-interval Chebyshev coefficients
+class Ephemeris
+{
+public:
+    Ephemeris() = default;
+    ~Ephemeris();
+    Ephemeris(const Ephemeris &) = delete;
+    Ephemeris &operator=(const Ephemeris &) = delete;
+
+    // maps the file and validates the header, returns false (and stays closed) on failure
+    bool open(const std::string &path);
+    void close();
+
+    bool isOpen() const { return header != nullptr; }
+    uint32_t bodyCount() const { return header ? header->bodyCount : 0; }
+    uint32_t bodyStride() const { return header ? header->bodyStride : 0; }
+    double startTime() const { return header ? header->startTime : 0.0; }
+    double endTime() const { return header ? header->startTime + header->intervalLength * header->intervalCount : 0.0; }
+
+    std::string bodyName(uint32_t body) const;
+    // returns -1 if no body has that name
+    int findBody(const std::string &name) const;
+
+    // Evaluates every body at time t (clamped to the covered span) in SIMD batches.
+    // Outputs are SoA arrays of at least bodyStride() elements; velocity pointers may be null.
+    void evaluate(double t,
+                  double *x, double *y, double *z,
+                  double *vx = nullptr, double *vy = nullptr, double *vz = nullptr) const;
+
+    // single body lookups
+    glm::dvec3 position(uint32_t body, double t) const;
+    glm::dvec3 velocity(uint32_t body, double t) const;
+    // upper bound on a body's speed over the whole file, from |dT_j/dtau| <= j^2
+    double maxSpeed(uint32_t body) const;
+
+private:
+    // finds the interval holding t and its normalized time in [-1, 1]
+    const double *locate(double t, double &tau) const;
+
+    const EphemerisHeader *header = nullptr;
+    const char *names = nullptr;
+    const double *coefficients = nullptr;
+
+    MappedFile file;
+};
+
+// k-th of count Chebyshev nodes on [-1, 1]
+double chebyshevNode(uint32_t k, uint32_t count);
+// Chebyshev coefficients of the function sampled at the count nodes (count <= EPHEMERIS_MAX_COEFFICIENTS)
+void fitChebyshev(const double *samples, uint32_t count, double *coefficients);
+
+// Fits Chebyshev coefficients to a plain text trajectory table and writes a .eph file.
+// The table is CSV with one sample per line: body,time,x,y,z[,vx,vy,vz]
+// Lines starting with '#' and a non-numeric header line are skipped. Every body must cover the
+// whole time span. Between samples the trajectory is interpolated with cubic Hermite splines
+// (using the velocity columns when present).
+bool convertTrajectoryTable(const std::string &csvPath,
+                            const std::string &ephemerisPath,
+                            double intervalLength,
+                            int degree,
+                            std::string &error);
+
+// Writes an ephemeris from already fitted coefficients laid out as in the file
+// ([interval][axis][coefficient][bodyStride]).
+bool writeEphemeris(const std::string &path,
+                    const std::vector<std::string> &bodyNames,
+                    uint32_t coefficientCount,
+                    uint64_t intervalCount,
+                    double startTime,
+                    double intervalLength,
+                    const std::vector<double> &coefficients,
+                    std::string &error);
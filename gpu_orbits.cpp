@@ -0,0 +1,230 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include <glm/gtc/constants.hpp> // Include for glm::two_pi
+
+#include "gpu_orbits.h"
+#include "body_store.h"
+
+// the origin moves after this much time, float angles then stay within about 1e-4 rad
+static const double REBASE_SECONDS = 600.0;
+static const char *GLSL_VERSION = "#version 430 core\n";
+
+static std::string readShaderFile(const char *path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Error::GpuOrbits could not open shader file: " << path << std::endl;
+        return "";
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+// version line, the shared orbit code, then the stage's own source
+static GLuint compileOrbitShader(GLenum type, const char *path)
+{
+    std::string source = GLSL_VERSION + readShaderFile("shaders/orbit_common.glsl") + readShaderFile(path);
+    const char *code = source.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Error::GpuOrbits " << path << " failed to compile: " << log << std::endl;
+    }
+    return shader;
+}
+
+static GLuint linkProgram(const std::vector<GLuint> &shaders)
+{
+    GLuint program = glCreateProgram();
+    for (GLuint shader : shaders)
+        glAttachShader(program, shader);
+    glLinkProgram(program);
+    for (GLuint shader : shaders)
+        glDeleteShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Error::GpuOrbits program failed to link: " << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool GpuOrbits::supported()
+{
+    return GLEW_VERSION_4_3 || GLEW_ARB_shader_storage_buffer_object;
+}
+
+bool GpuOrbits::create(const std::vector<SimBody> &bodies, double time)
+{
+    if (!supported())
+    {
+        std::cerr << "Error::GpuOrbits shader storage buffers need OpenGL 4.3" << std::endl;
+        return false;
+    }
+
+    std::string fragmentSource = readShaderFile("shaders/fragment_shader.glsl");
+    const char *fragmentCode = fragmentSource.c_str();
+    GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fragmentCode, NULL);
+    glCompileShader(fragmentShader);
+    drawProgram = linkProgram({compileOrbitShader(GL_VERTEX_SHADER, "shaders/orbit_vertex_shader.glsl"), fragmentShader});
+    checkProgram = linkProgram({compileOrbitShader(GL_COMPUTE_SHADER, "shaders/orbit_check_compute.glsl")});
+    if (!drawProgram || !checkProgram)
+    {
+        destroy();
+        return false;
+    }
+    viewLoc = glGetUniformLocation(drawProgram, "view");
+    projectionLoc = glGetUniformLocation(drawProgram, "projection");
+    timeLoc = glGetUniformLocation(drawProgram, "time");
+    originLoc = glGetUniformLocation(drawProgram, "origin");
+    cameraLoc = glGetUniformLocation(drawProgram, "camera");
+    firstBodyLoc = glGetUniformLocation(drawProgram, "firstBody");
+    glUseProgram(drawProgram);
+    glUniform1i(glGetUniformLocation(drawProgram, "baseTexture"), 0);
+
+    source = bodies;
+    orbits.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        GpuOrbit &orbit = orbits[i];
+        orbit.radius = static_cast<float>(bodies[i].orbitRadius);
+        orbit.speed = static_cast<float>(bodies[i].orbitSpeed);
+        orbit.spinSpeed = static_cast<float>(bodies[i].spinSpeed);
+        orbit.scale = static_cast<float>(bodies[i].radius);
+        orbit.parent = bodies[i].parent;
+        orbit.pad = 0;
+    }
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, orbits.size() * sizeof(GpuOrbit), nullptr, GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffer);
+    rebase(time);
+    return true;
+}
+
+void GpuOrbits::destroy()
+{
+    if (buffer)
+        glDeleteBuffers(1, &buffer);
+    if (drawProgram)
+        glDeleteProgram(drawProgram);
+    if (checkProgram)
+        glDeleteProgram(checkProgram);
+    buffer = drawProgram = checkProgram = 0;
+}
+
+void GpuOrbits::rebase(double time)
+{
+    // the angles at the new origin, from the exact time in double
+    origin = time;
+    const double twoPi = glm::two_pi<double>();
+    for (size_t i = 0; i < orbits.size(); ++i)
+    {
+        orbits[i].phase = static_cast<float>(fmod(source[i].orbitSpeed * time, twoPi));
+        orbits[i].spinPhase = static_cast<float>(fmod(source[i].spinSpeed * time, twoPi));
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, orbits.size() * sizeof(GpuOrbit), orbits.data());
+}
+
+float GpuOrbits::shaderTime(double time)
+{
+    if (fabs(time - origin) > REBASE_SECONDS)
+        rebase(time);
+    return static_cast<float>(time - origin);
+}
+
+void GpuOrbits::splitCamera(const glm::dvec3 &position, glm::vec3 &origin, glm::vec3 &camera)
+{
+    origin = glm::vec3(position);
+    camera = glm::vec3(position - glm::dvec3(origin));
+}
+
+// every body on its scripted orbit in a store of its own, world transforms from the hierarchy
+static void cpuModels(const Simulation &simulation, double time, std::vector<glm::dmat4> &out)
+{
+    BodyStore store;
+    std::vector<BodyHandle> handles(simulation.bodies.size());
+    for (size_t i = 0; i < simulation.bodies.size(); ++i)
+    {
+        const SimBody &body = simulation.bodies[i];
+        handles[i] = store.create(COMPONENT_ORBIT | COMPONENT_SPIN | COMPONENT_RENDER);
+        BodyArchetype &archetype = store.archetypeOf(handles[i]);
+        size_t row = store.rowOf(handles[i]);
+        archetype.simulationBody[row] = static_cast<int>(i);
+        archetype.scale[row] = body.radius;
+        archetype.parent[row] = body.parent >= 0 ? handles[body.parent] : BodyHandle();
+        archetype.orbitRadius[row] = body.orbitRadius;
+    }
+    SimSnapshot snapshot;
+    simulation.snapshotAt(time, snapshot);
+    store.syncSimulation(snapshot);
+    store.updateTransforms(nullptr, time);
+
+    out.resize(handles.size());
+    for (size_t i = 0; i < handles.size(); ++i)
+        out[i] = store.transforms().world(store.archetypeOf(handles[i]).bodyNode[store.rowOf(handles[i])]);
+}
+
+double GpuOrbits::selfCheck(const Simulation &simulation, double time)
+{
+    if (!checkProgram || orbits.empty() || simulation.bodies.size() != orbits.size())
+        return -1.0;
+    float shaderT = shaderTime(time);
+    GLint count = static_cast<GLint>(orbits.size());
+
+    GLuint output;
+    glGenBuffers(1, &output);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, output);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, count * sizeof(glm::mat4), nullptr, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output);
+
+    glUseProgram(checkProgram);
+    glUniform1f(glGetUniformLocation(checkProgram, "time"), shaderT);
+    glUniform1i(glGetUniformLocation(checkProgram, "count"), count);
+    glDispatchCompute((count + 63) / 64, 1, 1);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    std::vector<glm::mat4> models(count);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::mat4), models.data());
+    glDeleteBuffers(1, &output);
+
+    std::vector<glm::dmat4> cpu;
+    cpuModels(simulation, time, cpu);
+    double worst = 0.0;
+    for (int body = 0; body < count; ++body)
+    {
+        const glm::dmat4 &expected = cpu[body];
+        double size = 1.0 + glm::length(glm::dvec3(expected[3].x, expected[3].y, expected[3].z));
+        for (int c = 0; c < 4; ++c)
+        {
+            for (int r = 0; r < 4; ++r)
+                worst = std::max(worst, fabs(double(models[body][c][r]) - expected[c][r]) / size);
+        }
+    }
+    return worst;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "simulation.h"
+
+// One body's circular orbit in the std430 layout of shaders/orbit_common.glsl
+struct GpuOrbit
+{
+    float radius;
+    float speed;
+    float phase;
+    float spinSpeed;
+    float spinPhase;
+    float scale;
+    int32_t parent;
+    int32_t pad;
+};
+
+// Scripted bodies animated entirely on the GPU: their orbital parameters go up once into a shader
+// storage buffer and the orbit vertex shader builds each model matrix from a time uniform, so
+// those bodies cost no CPU work and no uploads per frame. Needs GL 4.3 (or the SSBO extension).
+// Times are relative to an origin that is moved forward every REBASE_SECONDS, the only time the
+// buffer is written again, keeping the float angles as precise at hour ten as at second one.
+class GpuOrbits
+{
+public:
+    static bool supported();
+
+    // compiles the programs and uploads the parameters of every body (index = simulation body)
+    bool create(const std::vector<SimBody> &bodies, double time);
+    void destroy();
+
+    // the shader's time uniform for time, rebasing when it has drifted too far from the origin
+    float shaderTime(double time);
+
+    GLuint program() const { return drawProgram; }
+    GLint viewLocation() const { return viewLoc; }
+    GLint projectionLocation() const { return projectionLoc; }
+    GLint timeLocation() const { return timeLoc; }
+    GLint originLocation() const { return originLoc; }
+    GLint cameraLocation() const { return cameraLoc; }
+    GLint firstBodyLocation() const { return firstBodyLoc; }
+
+    // the camera as the shader takes it: origin is the camera rounded to float, camera the rest,
+    // subtracted in double. Neither drops the bits a plain float camera would.
+    static void splitCamera(const glm::dvec3 &position, glm::vec3 &origin, glm::vec3 &camera);
+
+    // evaluates every body's model on the GPU with a compute shader and returns the largest
+    // difference from the world transforms a BodyStore builds from the simulation's state at
+    // time, relative to the size of the translation (negative on failure)
+    double selfCheck(const Simulation &simulation, double time);
+
+private:
+    void rebase(double time);
+
+    std::vector<SimBody> source; // double precision parameters the phases are derived from
+    std::vector<GpuOrbit> orbits;
+    double origin = 0.0;
+    GLuint buffer = 0;
+    GLuint drawProgram = 0;
+    GLuint checkProgram = 0;
+    GLint viewLoc = -1, projectionLoc = -1, timeLoc = -1, originLoc = -1, cameraLoc = -1, firstBodyLoc = -1;
+};
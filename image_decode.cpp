@@ -0,0 +1,3 @@
+// stb_image's implementation, shared by the program and the tools
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
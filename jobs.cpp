@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <chrono>
+
+#include "jobs.h"
+
+// which pool and deque the current thread belongs to, for workers
+static thread_local const JobSystem *currentSystem = nullptr;
+static thread_local int currentIndex = -1;
+// the deques an outside thread was given, by pool id (addresses can be reused)
+static thread_local std::vector<std::pair<uint64_t, void *>> ownQueues;
+static std::atomic<uint64_t> nextSystemId{1};
+
+JobSystem::JobSystem(int threadCount)
+    : id(nextSystemId.fetch_add(1, std::memory_order_relaxed))
+{
+    if (threadCount <= 0)
+        threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    // the waiting thread is one of the threads, but keep at least one worker so submitted jobs always run
+    int workerCount = std::max(1, threadCount - 1);
+
+    for (int i = 0; i < workerCount; ++i)
+        queues.emplace_back(new Queue());
+    for (int i = 0; i < workerCount; ++i)
+        workers.emplace_back(&JobSystem::workerLoop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+JobSystem::Queue &JobSystem::currentQueue()
+{
+    if (currentSystem == this)
+        return *queues[currentIndex];
+    for (const std::pair<uint64_t, void *> &queue : ownQueues)
+    {
+        if (queue.first == id)
+            return *static_cast<Queue *>(queue.second);
+    }
+    std::lock_guard<std::mutex> lock(outsideMutex);
+    outsideQueues.emplace_back(new Queue());
+    ownQueues.push_back({id, outsideQueues.back().get()});
+    return *outsideQueues.back();
+}
+
+void JobSystem::submit(std::function<void()> job, JobCounter *counter)
+{
+    if (counter)
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    Queue &queue = currentQueue();
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back({std::move(job), counter});
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    wake.notify_one();
+}
+
+bool JobSystem::runOne(Queue &own, bool waiting)
+{
+    Job job;
+    bool found = false;
+
+    // own jobs first, newest first
+    {
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.jobs.empty())
+        {
+            job = std::move(own.jobs.back());
+            own.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // then steal the oldest job of another worker's queue, starting after our own
+    auto steal = [&](Queue &victim)
+    {
+        if (&victim == &own)
+            return;
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.jobs.empty())
+        {
+            job = std::move(victim.jobs.front());
+            victim.jobs.pop_front();
+            found = true;
+            stealCount.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    bool worker = currentSystem == this;
+    size_t first = worker ? currentIndex + 1 : 0;
+    for (size_t i = 0; !found && i < queues.size(); ++i)
+        steal(*queues[(first + i) % queues.size()]);
+
+    // the outside threads' queues only go to idle workers. A thread waiting for its own jobs leaves
+    // them alone, what it takes there could be far bigger than what it waits for
+    if (!found && worker && !waiting)
+    {
+        std::lock_guard<std::mutex> lock(outsideMutex);
+        for (size_t i = 0; !found && i < outsideQueues.size(); ++i)
+            steal(*outsideQueues[i]);
+    }
+
+    if (!found)
+        return false;
+
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    job.run();
+    if (job.counter)
+        job.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+void JobSystem::wait(JobCounter &counter)
+{
+    Queue &self = currentQueue();
+    while (counter.pending.load(std::memory_order_acquire) > 0)
+    {
+        if (!runOne(self, true))
+            std::this_thread::yield();
+    }
+}
+
+void JobSystem::workerLoop(int index)
+{
+    currentSystem = this;
+    currentIndex = index;
+    while (!stopping)
+    {
+        if (runOne(*queues[index], false))
+            continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wake.wait_for(lock, std::chrono::milliseconds(1), [this]
+                      { return stopping || queued.load(std::memory_order_acquire) > 0; });
+    }
+}
+
+void JobSystem::splitRange(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body, JobCounter &counter)
+{
+    // hand the upper half to the deque and keep splitting the lower one
+    while (end - begin > grain)
+    {
+        size_t mid = begin + (end - begin) / 2;
+        submit([this, mid, end, grain, &body, &counter]
+               { splitRange(mid, end, grain, body, counter); },
+               &counter);
+        end = mid;
+    }
+    body(begin, end);
+}
+
+void JobSystem::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body)
+{
+    if (begin >= end)
+        return;
+    JobCounter counter;
+    splitRange(begin, end, std::max<size_t>(1, grain), body, counter);
+    wait(counter);
+}
+
+int JobGraph::add(std::function<void()> job, std::initializer_list<int> dependencies)
+{
+    int index = static_cast<int>(nodes.size());
+    nodes.emplace_back(new Node());
+    nodes.back()->run = std::move(job);
+    for (int dependency : dependencies)
+    {
+        nodes[dependency]->successors.push_back(index);
+        nodes.back()->dependencyCount++;
+    }
+    return index;
+}
+
+void JobGraph::launch(int node)
+{
+    // successors are submitted before this job is counted as done, so the counter can't reach zero early
+    system->submit([this, node]
+                   {
+                       Node &current = *nodes[node];
+                       current.run();
+                       for (int successor : current.successors)
+                       {
+                           if (nodes[successor]->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                               launch(successor);
+                       } },
+                   &counter);
+}
+
+void JobGraph::start(JobSystem &jobs)
+{
+    system = &jobs;
+    for (std::unique_ptr<Node> &node : nodes)
+        node->remaining.store(node->dependencyCount, std::memory_order_relaxed);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[i]->dependencyCount == 0)
+            launch(static_cast<int>(i));
+    }
+}
+
+void JobGraph::wait()
+{
+    if (system)
+        system->wait(counter);
+}
+
+JobSystem &defaultJobSystem()
+{
+    static JobSystem system;
+    return system;
+}
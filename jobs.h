@@ -0,0 +1,118 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts unfinished jobs, JobSystem::wait blocks until it drops to zero
+struct JobCounter
+{
+    std::atomic<int> pending{0};
+};
+
+// Work-stealing job scheduler. Every worker owns a deque: it pushes and pops its own jobs at
+// the back (newest first, cache friendly) while idle workers steal from the front of the others
+// (oldest first, which for recursive splits are the largest pieces of work).
+// Threads outside the pool (render, simulation, texture upload) get a deque of their own the first
+// time they submit or wait, kept for the pool's lifetime. Any thread calling wait() runs jobs too, but only
+// its own and the workers', never those an outside thread submitted: a frame waiting on its jobs
+// must not pick up a whole texture decode the upload thread queued. Idle workers take those.
+class JobSystem
+{
+public:
+    // 0 uses every hardware thread, counting the thread that waits
+    explicit JobSystem(int threadCount = 0);
+    ~JobSystem();
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    int threadCount() const { return static_cast<int>(workers.size()) + 1; }
+
+    void submit(std::function<void()> job, JobCounter *counter = nullptr);
+    // runs jobs on the calling thread until the counter reaches zero
+    void wait(JobCounter &counter);
+    // runs one queued job on the calling thread, false if there was none
+    bool runPending() { return runOne(currentQueue(), false); }
+
+    // body(first, last) over [begin, end) in chunks of at most grain indices. The range is split
+    // in halves recursively so a thief always takes the biggest remaining piece.
+    void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body);
+
+    // jobs taken from another thread's deque so far
+    uint64_t steals() const { return stealCount.load(std::memory_order_relaxed); }
+
+private:
+    struct Job
+    {
+        std::function<void()> run;
+        JobCounter *counter;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    Queue &currentQueue();
+    bool runOne(Queue &own, bool waiting);
+    void workerLoop(int index);
+    void splitRange(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)> &body, JobCounter &counter);
+
+    std::vector<std::unique_ptr<Queue>> queues; // one per worker
+    std::vector<std::thread> workers;
+    std::mutex outsideMutex;
+    std::vector<std::unique_ptr<Queue>> outsideQueues; // one per outside thread, grows under outsideMutex
+    uint64_t id;                                       // tells pools apart in the outside threads' queue lists
+    std::atomic<bool> stopping{false};
+    std::atomic<int> queued{0};
+    std::atomic<uint64_t> stealCount{0};
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+};
+
+// Jobs with dependencies, built once and run as many times as needed (e.g. every frame). A node
+// starts when all the nodes it depends on have finished: each node keeps a counter of unfinished
+// dependencies, and the predecessor that takes it to zero submits it. Nodes are free to call
+// parallelFor, the pool keeps running other ready nodes meanwhile.
+class JobGraph
+{
+public:
+    // dependencies must be nodes added before, returns the new node
+    int add(std::function<void()> job, std::initializer_list<int> dependencies = {});
+    size_t size() const { return nodes.size(); }
+
+    // submits the nodes without dependencies and returns, the calling thread is free until wait()
+    void start(JobSystem &jobs);
+    // runs jobs until every node has finished
+    void wait();
+    void run(JobSystem &jobs)
+    {
+        start(jobs);
+        wait();
+    }
+
+private:
+    struct Node
+    {
+        std::function<void()> run;
+        std::vector<int> successors;
+        int dependencyCount = 0;
+        std::atomic<int> remaining{0};
+    };
+
+    void launch(int node);
+
+    std::vector<std::unique_ptr<Node>> nodes;
+    JobSystem *system = nullptr;
+    JobCounter counter;
+};
+
+// process-wide pool sized to the machine, created on first use
+JobSystem &defaultJobSystem();
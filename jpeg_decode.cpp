@@ -0,0 +1,1184 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "jpeg_decode.h"
+#include "jobs.h"
+
+static thread_local const char *failureReason = "";
+
+static bool fail(const char *reason)
+{
+    failureReason = reason;
+    return false;
+}
+
+const char *jpegFailureReason()
+{
+    return failureReason;
+}
+
+// row major position of each coefficient, in the order they are coded
+static const uint8_t ZIGZAG[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+const int MAX_BLOCKS_PER_MCU = 10; // the standard's limit
+
+// codes up to FAST_BITS long are looked up in one go, longer ones are searched by length
+const int FAST_BITS = 9;
+
+struct Huffman
+{
+    uint8_t fastLength[1 << FAST_BITS]; // 0 for a longer code
+    uint8_t fastSymbol[1 << FAST_BITS];
+    int32_t fastAc[1 << FAST_BITS];     // code and coefficient bits together: value << 16 | run << 8 | bits used, or 0
+    uint8_t counts[16]; // codes of each length, as in the file
+    uint8_t symbols[256];
+    int32_t maxCode[18]; // codes of a length are below this, left-aligned to 16 bits
+    int32_t delta[17];   // index in symbols minus code, per length
+    bool defined = false;
+};
+
+static bool buildHuffman(Huffman &table, const uint8_t counts[16], const uint8_t *symbols, int total)
+{
+    memcpy(table.counts, counts, 16);
+    memcpy(table.symbols, symbols, total);
+    memset(table.fastLength, 0, sizeof(table.fastLength));
+    int code = 0, k = 0;
+    for (int length = 1; length <= 16; ++length)
+    {
+        // an over-subscribed length is rejected before its codes index the lookup
+        if (code + counts[length - 1] > 1 << length)
+            return fail("bad huffman table");
+        table.delta[length] = k - code;
+        for (int i = 0; i < counts[length - 1]; ++i, ++k, ++code)
+            if (length <= FAST_BITS)
+            {
+                int first = code << (FAST_BITS - length);
+                for (int j = 0; j < 1 << (FAST_BITS - length); ++j)
+                {
+                    table.fastLength[first + j] = uint8_t(length);
+                    table.fastSymbol[first + j] = symbols[k];
+                }
+            }
+        table.maxCode[length] = code << (16 - length);
+        code <<= 1;
+    }
+    table.maxCode[17] = INT32_MAX;
+
+    // as an AC table: short codes whose coefficient bits fit in the lookup too
+    for (int i = 0; i < 1 << FAST_BITS; ++i)
+    {
+        table.fastAc[i] = 0;
+        int length = table.fastLength[i], run = table.fastSymbol[i] >> 4, s = table.fastSymbol[i] & 15;
+        if (length && s && length + s <= FAST_BITS)
+        {
+            int value = (i << length & ((1 << FAST_BITS) - 1)) >> (FAST_BITS - s);
+            if (value < 1 << (s - 1))
+                value -= (1 << s) - 1;
+            table.fastAc[i] = int32_t(uint32_t(value) << 16 | uint32_t(run) << 8 | uint32_t(length + s));
+        }
+    }
+    table.defined = true;
+    return true;
+}
+
+// the entropy-coded data, with the 0xFF 0x00 stuffing taken out. At a marker it feeds zeros.
+struct BitReader
+{
+    const uint8_t *p, *end;
+    uint64_t bits = 0;
+    int count = 0;
+    bool atMarker = false;
+
+    // at least 32 bits: a code and its coefficient bits
+    void refill()
+    {
+        if (count >= 32)
+            return;
+        while (count <= 56)
+        {
+            uint32_t byte = 0;
+            if (!atMarker && p < end)
+            {
+                byte = *p;
+                if (byte != 0xFF)
+                    ++p;
+                else if (p + 1 < end && p[1] == 0x00)
+                    p += 2;
+                else
+                {
+                    atMarker = true;
+                    byte = 0;
+                }
+            }
+            bits |= uint64_t(byte) << (56 - count);
+            count += 8;
+        }
+    }
+
+    // n from 1 to 16, after a refill
+    uint32_t take(int n)
+    {
+        uint32_t value = uint32_t(bits >> (64 - n));
+        bits <<= n;
+        count -= n;
+        return value;
+    }
+
+    // the next s bits as a signed coefficient
+    int extend(int s)
+    {
+        int value = int(take(s));
+        return value < 1 << (s - 1) ? value - (1 << s) + 1 : value;
+    }
+
+    int decode(const Huffman &table)
+    {
+        uint32_t top = uint32_t(bits >> 48);
+        int fast = int(top >> (16 - FAST_BITS));
+        int length = table.fastLength[fast];
+        if (length)
+        {
+            take(length);
+            return table.fastSymbol[fast];
+        }
+        for (length = FAST_BITS + 1; length <= 16; ++length)
+            if (int32_t(top) < table.maxCode[length])
+                break;
+        if (length > 16)
+            return -1;
+        int index = int(top >> (16 - length)) + table.delta[length];
+        if (index < 0 || index > 255)
+            return -1;
+        take(length);
+        return table.symbols[index];
+    }
+
+    // past the restart marker that ends an interval, with nothing left over from before it
+    void restart()
+    {
+        bits = 0;
+        count = 0;
+        atMarker = false;
+        while (p + 1 < end && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7))
+            ++p;
+        if (p + 1 < end)
+            p += 2;
+    }
+};
+
+struct Component
+{
+    int id = 0, h = 1, v = 1, quant = 0;
+    int dcTable = 0, acTable = 0;
+    int size = 8; // inverse DCT size: pixels across a block in its plane
+};
+
+struct Decoder
+{
+    const uint8_t *p, *end;
+    uint16_t quant[4][64] = {}; // in coding order
+    Huffman dc[4], ac[4];
+    Component components[3];
+    int componentCount = 0, width = 0, height = 0, hmax = 1, vmax = 1;
+    int restartInterval = 0;
+    bool adobe = false;
+    int adobeTransform = 1;
+    const uint8_t *scan = nullptr; // the first scan's marker
+};
+
+static int read16(const uint8_t *p)
+{
+    return p[0] << 8 | p[1];
+}
+
+// everything up to the entropy-coded data of the first scan. supported is false, with the frame
+// size filled in, for a frame decodeJpegScaled can't do.
+static bool readHeaders(Decoder &d, bool &supported)
+{
+    supported = false;
+    bool frame = false;
+    if (d.end - d.p < 2 || d.p[0] != 0xFF || d.p[1] != 0xD8)
+        return fail("not a jpeg");
+    d.p += 2;
+    for (;;)
+    {
+        // a marker, after any number of 0xFF fill bytes
+        if (d.p >= d.end || *d.p != 0xFF)
+            return fail("bad marker");
+        while (d.p < d.end && *d.p == 0xFF)
+            ++d.p;
+        if (d.p >= d.end)
+            return fail("truncated");
+        int marker = *d.p++;
+        if (marker == 0xD9)
+            return fail("no scan");
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+            continue; // no segment
+        if (d.end - d.p < 2)
+            return fail("truncated");
+        int length = read16(d.p);
+        if (length < 2 || length > d.end - d.p)
+            return fail("bad segment length");
+        const uint8_t *segment = d.p + 2;
+        int size = length - 2;
+        d.p += length;
+
+        if (marker == 0xDB) // quantization tables
+        {
+            while (size > 0)
+            {
+                int precision = segment[0] >> 4, id = segment[0] & 15;
+                int bytes = 1 + (precision ? 128 : 64);
+                if (id > 3 || size < bytes)
+                    return fail("bad quantization table");
+                for (int i = 0; i < 64; ++i)
+                    d.quant[id][i] = uint16_t(precision ? read16(segment + 1 + 2 * i) : segment[1 + i]);
+                segment += bytes;
+                size -= bytes;
+            }
+        }
+        else if (marker == 0xC4) // huffman tables
+        {
+            while (size > 0)
+            {
+                int type = segment[0] >> 4, id = segment[0] & 15;
+                if (type > 1 || id > 3 || size < 17)
+                    return fail("bad huffman table");
+                int total = 0;
+                for (int i = 0; i < 16; ++i)
+                    total += segment[1 + i];
+                if (total > 256 || size < 17 + total)
+                    return fail("bad huffman table");
+                if (!buildHuffman(type ? d.ac[id] : d.dc[id], segment + 1, segment + 17, total))
+                    return false;
+                segment += 17 + total;
+                size -= 17 + total;
+            }
+        }
+        else if (marker == 0xDD) // restart interval
+        {
+            if (size < 2)
+                return fail("bad restart interval");
+            d.restartInterval = read16(segment);
+        }
+        else if (marker == 0xEE) // adobe: says whether three components are YCbCr or RGB
+        {
+            if (size >= 12 && memcmp(segment, "Adobe", 5) == 0)
+            {
+                d.adobe = true;
+                d.adobeTransform = segment[11];
+            }
+        }
+        else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC8 && marker != 0xCC) // a frame
+        {
+            if (frame || size < 6)
+                return fail("bad frame");
+            frame = true;
+            int precision = segment[0];
+            d.height = read16(segment + 1);
+            d.width = read16(segment + 3);
+            d.componentCount = segment[5];
+            // only huffman-coded sequential 8-bit frames (baseline and extended) of gray or colour
+            if (d.width == 0 || d.height == 0 || (marker != 0xC0 && marker != 0xC1) || precision != 8 ||
+                (d.componentCount != 1 && d.componentCount != 3) || size < 6 + 3 * d.componentCount)
+                return true;
+            for (int i = 0; i < d.componentCount; ++i)
+            {
+                Component &c = d.components[i];
+                const uint8_t *fields = segment + 6 + 3 * i;
+                c.id = fields[0];
+                c.h = fields[1] >> 4;
+                c.v = fields[1] & 15;
+                c.quant = fields[2];
+                if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4 || c.quant > 3)
+                    return fail("bad frame");
+                if (d.componentCount == 1)
+                    c.h = c.v = 1; // a lone component's blocks are the image's, whatever it says
+                d.hmax = c.h > d.hmax ? c.h : d.hmax;
+                d.vmax = c.v > d.vmax ? c.v : d.vmax;
+            }
+            int blocks = 0;
+            for (int i = 0; i < d.componentCount; ++i)
+            {
+                if (d.hmax % d.components[i].h || d.vmax % d.components[i].v)
+                    return true;
+                blocks += d.components[i].h * d.components[i].v;
+            }
+            if (blocks > MAX_BLOCKS_PER_MCU)
+                return fail("bad frame");
+        }
+        else if (marker == 0xDA) // the first scan
+        {
+            d.scan = segment - 4;
+            if (!frame)
+                return fail("scan before the frame");
+            int count = size > 0 ? segment[0] : 0;
+            if (count < 1 || size < 4 + 2 * count)
+                return fail("bad scan");
+            // all components interleaved in one scan: the usual baseline file, and what lets the
+            // rows go out as they are decoded
+            if (count != d.componentCount || segment[1 + 2 * count] != 0 || segment[2 + 2 * count] != 63 || segment[3 + 2 * count] != 0)
+                return true;
+            for (int i = 0; i < count; ++i)
+            {
+                int id = segment[1 + 2 * i], tables = segment[2 + 2 * i];
+                // the frame's component order, which is the scan's for an interleaved scan
+                Component &c = d.components[i];
+                if (c.id != id || tables >> 4 > 3 || (tables & 15) > 3)
+                    return fail("bad scan");
+                c.dcTable = tables >> 4;
+                c.acTable = tables & 15;
+                if (!d.dc[c.dcTable].defined || !d.ac[c.acTable].defined)
+                    return fail("missing huffman table");
+            }
+            supported = true;
+            return true;
+        }
+    }
+}
+
+bool readJpegInfo(const unsigned char *data, size_t size, JpegInfo &info)
+{
+    Decoder d;
+    d.p = data;
+    d.end = data + size;
+    bool supported;
+    if (!readHeaders(d, supported))
+        return false;
+    info.width = d.width;
+    info.height = d.height;
+    info.components = d.componentCount;
+    info.supported = supported;
+    return true;
+}
+
+int jpegScaleFor(int width, int minWidth)
+{
+    int scale = 1;
+    while (minWidth > 0 && scale < 8 && jpegScaledSize(width, scale * 2) >= minWidth)
+        scale *= 2;
+    return scale;
+}
+
+// marks a coefficient set: extent is one past the highest frequency, horizontal or vertical, among
+// the size x size lowest, the only ones the scaled inverse DCT looks at
+static inline void widenExtent(int position, int size, int &extent)
+{
+    int u = position & 7, v = position >> 3;
+    int highest = u > v ? u : v;
+    if (highest < size && highest >= extent)
+        extent = highest + 1;
+}
+
+// one block's coefficients, dequantized, in row major order, and their extent (1 when only the
+// DC is set)
+static bool decodeBlock(BitReader &reader, const Decoder &d, const Component &c, int &prediction, int32_t coefficients[64], int &extent)
+{
+    const uint16_t *quant = d.quant[c.quant];
+    int size = c.size;
+    memset(coefficients, 0, 64 * sizeof(int32_t));
+    extent = 1;
+    reader.refill();
+    int s = reader.decode(d.dc[c.dcTable]);
+    if (s < 0 || s > 11)
+        return fail("bad huffman code");
+    if (s)
+        prediction += reader.extend(s);
+    coefficients[0] = prediction * quant[0];
+    const Huffman &ac = d.ac[c.acTable];
+    for (int k = 1; k < 64;)
+    {
+        reader.refill();
+        int32_t fast = ac.fastAc[reader.bits >> (64 - FAST_BITS)];
+        if (fast)
+        {
+            reader.take(fast & 255);
+            k += fast >> 8 & 15;
+            if (k > 63)
+                return fail("bad coefficient run");
+            int position = ZIGZAG[k];
+            coefficients[position] = (fast >> 16) * quant[k];
+            widenExtent(position, size, extent);
+            ++k;
+            continue;
+        }
+        int rs = reader.decode(ac);
+        if (rs < 0)
+            return fail("bad huffman code");
+        int run = rs >> 4;
+        s = rs & 15;
+        if (s == 0)
+        {
+            if (run != 15)
+                break; // end of block
+            k += 16;
+            continue;
+        }
+        k += run;
+        if (k > 63)
+            return fail("bad coefficient run");
+        int position = ZIGZAG[k];
+        coefficients[position] = reader.extend(s) * quant[k];
+        widenExtent(position, size, extent);
+        ++k;
+    }
+    return true;
+}
+
+// basis[log2 size][x][u] = C(u) / 2 cos((2x + 1) u pi / 2 size): the 8 point inverse DCT's scale,
+// so a size point transform of the lowest size frequencies gives averages of 8 / size pixels.
+// aan[u] * aan[v] scales the coefficients for the full size AAN transform.
+struct InverseDctBasis
+{
+    float basis[4][8][8];
+    float aan[64];
+    InverseDctBasis()
+    {
+        const double PI = 3.14159265358979323846;
+        for (int level = 0; level < 4; ++level)
+        {
+            int size = 1 << level;
+            for (int x = 0; x < size; ++x)
+                for (int u = 0; u < size; ++u)
+                    basis[level][x][u] = float((u ? 0.5 : 0.5 / std::sqrt(2.0)) * std::cos((2 * x + 1) * u * PI / (2 * size)));
+        }
+        for (int v = 0; v < 8; ++v)
+            for (int u = 0; u < 8; ++u)
+            {
+                double su = u ? std::cos(u * PI / 16) * std::sqrt(2.0) : 1.0, sv = v ? std::cos(v * PI / 16) * std::sqrt(2.0) : 1.0;
+                aan[v * 8 + u] = float(su * sv / 8.0); // the 1/8 of the 2D transform folded in
+            }
+    }
+};
+static const InverseDctBasis inverseDct;
+
+static uint8_t clampPixel(float value)
+{
+    return value <= 0.0f ? 0 : value >= 255.0f ? 255 : uint8_t(value + 0.5f);
+}
+
+// Arai, Agui and Nakajima's 8 point transform (as in libjpeg's jidctflt), 5 multiplies per pass
+static inline void aan8(float &o0, float &o1, float &o2, float &o3, float &o4, float &o5, float &o6, float &o7,
+                        float i0, float i1, float i2, float i3, float i4, float i5, float i6, float i7)
+{
+    float tmp10 = i0 + i4, tmp11 = i0 - i4;
+    float tmp13 = i2 + i6, tmp12 = (i2 - i6) * 1.414213562f - tmp13;
+    float tmp0 = tmp10 + tmp13, tmp3 = tmp10 - tmp13, tmp1 = tmp11 + tmp12, tmp2 = tmp11 - tmp12;
+    float z13 = i5 + i3, z10 = i5 - i3, z11 = i1 + i7, z12 = i1 - i7;
+    float tmp7 = z11 + z13;
+    float tmp11b = (z11 - z13) * 1.414213562f;
+    float z5 = (z10 + z12) * 1.847759065f;
+    float tmp10b = 1.082392200f * z12 - z5;
+    float tmp12b = -2.613125930f * z10 + z5;
+    float tmp6 = tmp12b - tmp7, tmp5 = tmp11b - tmp6, tmp4 = tmp10b + tmp5;
+    o0 = tmp0 + tmp7;
+    o7 = tmp0 - tmp7;
+    o1 = tmp1 + tmp6;
+    o6 = tmp1 - tmp6;
+    o2 = tmp2 + tmp5;
+    o5 = tmp2 - tmp5;
+    o4 = tmp3 + tmp4;
+    o3 = tmp3 - tmp4;
+}
+
+#if defined(__AVX2__)
+// the AAN transform on 8 vectors at once, one lane per column (or row)
+static inline void aan8(__m256 v[8])
+{
+    const __m256 sqrt2 = _mm256_set1_ps(1.414213562f);
+    __m256 tmp10 = _mm256_add_ps(v[0], v[4]), tmp11 = _mm256_sub_ps(v[0], v[4]);
+    __m256 tmp13 = _mm256_add_ps(v[2], v[6]), tmp12 = _mm256_sub_ps(_mm256_mul_ps(_mm256_sub_ps(v[2], v[6]), sqrt2), tmp13);
+    __m256 tmp0 = _mm256_add_ps(tmp10, tmp13), tmp3 = _mm256_sub_ps(tmp10, tmp13);
+    __m256 tmp1 = _mm256_add_ps(tmp11, tmp12), tmp2 = _mm256_sub_ps(tmp11, tmp12);
+    __m256 z13 = _mm256_add_ps(v[5], v[3]), z10 = _mm256_sub_ps(v[5], v[3]);
+    __m256 z11 = _mm256_add_ps(v[1], v[7]), z12 = _mm256_sub_ps(v[1], v[7]);
+    __m256 tmp7 = _mm256_add_ps(z11, z13);
+    __m256 tmp11b = _mm256_mul_ps(_mm256_sub_ps(z11, z13), sqrt2);
+    __m256 z5 = _mm256_mul_ps(_mm256_add_ps(z10, z12), _mm256_set1_ps(1.847759065f));
+    __m256 tmp10b = _mm256_sub_ps(_mm256_mul_ps(z12, _mm256_set1_ps(1.082392200f)), z5);
+    __m256 tmp12b = _mm256_add_ps(_mm256_mul_ps(z10, _mm256_set1_ps(-2.613125930f)), z5);
+    __m256 tmp6 = _mm256_sub_ps(tmp12b, tmp7), tmp5 = _mm256_sub_ps(tmp11b, tmp6), tmp4 = _mm256_add_ps(tmp10b, tmp5);
+    v[0] = _mm256_add_ps(tmp0, tmp7);
+    v[7] = _mm256_sub_ps(tmp0, tmp7);
+    v[1] = _mm256_add_ps(tmp1, tmp6);
+    v[6] = _mm256_sub_ps(tmp1, tmp6);
+    v[2] = _mm256_add_ps(tmp2, tmp5);
+    v[5] = _mm256_sub_ps(tmp2, tmp5);
+    v[4] = _mm256_add_ps(tmp3, tmp4);
+    v[3] = _mm256_sub_ps(tmp3, tmp4);
+}
+
+static inline void transpose8(__m256 v[8])
+{
+    __m256 a0 = _mm256_unpacklo_ps(v[0], v[1]), a1 = _mm256_unpackhi_ps(v[0], v[1]);
+    __m256 a2 = _mm256_unpacklo_ps(v[2], v[3]), a3 = _mm256_unpackhi_ps(v[2], v[3]);
+    __m256 a4 = _mm256_unpacklo_ps(v[4], v[5]), a5 = _mm256_unpackhi_ps(v[4], v[5]);
+    __m256 a6 = _mm256_unpacklo_ps(v[6], v[7]), a7 = _mm256_unpackhi_ps(v[6], v[7]);
+    __m256 b0 = _mm256_shuffle_ps(a0, a2, 0x44), b1 = _mm256_shuffle_ps(a0, a2, 0xEE);
+    __m256 b2 = _mm256_shuffle_ps(a1, a3, 0x44), b3 = _mm256_shuffle_ps(a1, a3, 0xEE);
+    __m256 b4 = _mm256_shuffle_ps(a4, a6, 0x44), b5 = _mm256_shuffle_ps(a4, a6, 0xEE);
+    __m256 b6 = _mm256_shuffle_ps(a5, a7, 0x44), b7 = _mm256_shuffle_ps(a5, a7, 0xEE);
+    v[0] = _mm256_permute2f128_ps(b0, b4, 0x20);
+    v[1] = _mm256_permute2f128_ps(b1, b5, 0x20);
+    v[2] = _mm256_permute2f128_ps(b2, b6, 0x20);
+    v[3] = _mm256_permute2f128_ps(b3, b7, 0x20);
+    v[4] = _mm256_permute2f128_ps(b0, b4, 0x31);
+    v[5] = _mm256_permute2f128_ps(b1, b5, 0x31);
+    v[6] = _mm256_permute2f128_ps(b2, b6, 0x31);
+    v[7] = _mm256_permute2f128_ps(b3, b7, 0x31);
+}
+
+static void inverseDct8(const int32_t coefficients[64], int, uint8_t *out, int stride)
+{
+    // rows of coefficients: the first pass transforms all 8 columns at once, the second all rows
+    __m256 v[8];
+    for (int row = 0; row < 8; ++row)
+        v[row] = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(coefficients + row * 8))),
+                               _mm256_loadu_ps(inverseDct.aan + row * 8));
+    aan8(v);
+    transpose8(v);
+    aan8(v);
+    transpose8(v);
+    for (int y = 0; y < 8; ++y)
+    {
+        __m256i pixels = _mm256_cvtps_epi32(_mm256_add_ps(v[y], _mm256_set1_ps(128.0f))); // rounds to nearest
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(pixels), _mm256_extracti128_si256(pixels, 1));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + y * stride), _mm_packus_epi16(words, words));
+    }
+}
+#else
+static void inverseDct8(const int32_t coefficients[64], int extent, uint8_t *out, int stride)
+{
+    float scaled[64], columns[64];
+    for (int i = 0; i < 64; ++i)
+        scaled[i] = float(coefficients[i]) * inverseDct.aan[i];
+    for (int u = 0; u < extent; ++u)
+    {
+        const float *in = scaled + u;
+        float *column = columns + u;
+        aan8(column[0], column[8], column[16], column[24], column[32], column[40], column[48], column[56],
+             in[0], in[8], in[16], in[24], in[32], in[40], in[48], in[56]);
+    }
+    for (int u = extent; u < 8; ++u)
+        for (int y = 0; y < 8; ++y)
+            columns[y * 8 + u] = 0.0f;
+    for (int y = 0; y < 8; ++y)
+    {
+        const float *in = columns + y * 8;
+        float row[8];
+        aan8(row[0], row[1], row[2], row[3], row[4], row[5], row[6], row[7], in[0], in[1], in[2], in[3], in[4], in[5], in[6], in[7]);
+        for (int x = 0; x < 8; ++x)
+            out[y * stride + x] = clampPixel(row[x] + 128.0f);
+    }
+}
+#endif
+
+// separable, Size known at compile time so the output loops unroll. Frequencies past extent are
+// zero, quantization leaves most blocks with only a few low ones.
+template <int Size>
+static void inverseDctScaled(const int32_t coefficients[64], int extent, uint8_t *out, int stride)
+{
+    const float(*basis)[8] = inverseDct.basis[Size == 4 ? 2 : 1];
+    float rows[Size][Size];
+    for (int v = 0; v < extent; ++v)
+        for (int x = 0; x < Size; ++x)
+        {
+            float sum = 0.0f;
+            for (int u = 0; u < extent; ++u)
+                sum += float(coefficients[v * 8 + u]) * basis[x][u];
+            rows[v][x] = sum;
+        }
+    for (int y = 0; y < Size; ++y)
+    {
+        float sums[Size];
+        for (int x = 0; x < Size; ++x)
+            sums[x] = 128.0f;
+        for (int v = 0; v < extent; ++v)
+            for (int x = 0; x < Size; ++x)
+                sums[x] += basis[y][v] * rows[v][x];
+        for (int x = 0; x < Size; ++x)
+            out[y * stride + x] = clampPixel(sums[x]);
+    }
+}
+
+static void inverseDctScaled(const int32_t coefficients[64], int extent, int size, uint8_t *out, int stride)
+{
+    if (extent == 1)
+    {
+        uint8_t flat = clampPixel(coefficients[0] / 8.0f + 128.0f);
+        for (int y = 0; y < size; ++y)
+            memset(out + y * stride, flat, size);
+        return;
+    }
+    if (size == 8)
+        inverseDct8(coefficients, extent, out, stride);
+    else if (size == 4)
+        inverseDctScaled<4>(coefficients, extent, out, stride);
+    else
+        inverseDctScaled<2>(coefficients, extent, out, stride); // 1x1 blocks have only their DC
+}
+
+// how a frame decodes at one scale
+struct Layout
+{
+    int n = 8; // output pixels across a block of a full resolution component
+    int mcusX = 0, mcusY = 0;
+    int outWidth = 0, outHeight = 0, outChannels = 0;
+    int blocksPerMcu = 0;
+    bool rgb = false;
+    int strides[3] = {};
+    std::vector<int> columns[3]; // plane column of each output column, per component
+};
+
+// a component sampled at a fraction of the image's resolution decodes at a larger DCT size
+// when it can, 8x8 chroma blocks of 4:2:0 at half size need no upsampling; otherwise its
+// samples are repeated
+static void planLayout(Decoder &d, int scale, int channels, Layout &layout)
+{
+    layout.n = 8 / scale;
+    layout.mcusX = (d.width + 8 * d.hmax - 1) / (8 * d.hmax);
+    layout.mcusY = (d.height + 8 * d.vmax - 1) / (8 * d.vmax);
+    layout.outWidth = jpegScaledSize(d.width, scale);
+    layout.outHeight = jpegScaledSize(d.height, scale);
+    layout.outChannels = channels ? channels : d.componentCount;
+    layout.blocksPerMcu = 0;
+    for (int i = 0; i < d.componentCount; ++i)
+    {
+        Component &c = d.components[i];
+        int ratio = d.hmax / c.h;
+        c.size = ratio == d.vmax / c.v && layout.n * ratio <= 8 ? layout.n * ratio : layout.n;
+        layout.strides[i] = layout.mcusX * c.h * c.size;
+        layout.blocksPerMcu += c.h * c.v;
+        layout.columns[i].resize(layout.outWidth);
+        for (int x = 0; x < layout.outWidth; ++x)
+            layout.columns[i][x] = x * c.h * c.size / (d.hmax * layout.n);
+    }
+    layout.rgb = d.componentCount == 3 && ((d.adobe && d.adobeTransform == 0) ||
+                                           (d.components[0].id == 'R' && d.components[1].id == 'G' && d.components[2].id == 'B'));
+}
+
+// one row of MCUs after the inverse DCTs, per component
+struct RowPlanes
+{
+    std::vector<uint8_t> plane[3];
+    RowPlanes(const Decoder &d, const Layout &layout)
+    {
+        for (int i = 0; i < d.componentCount; ++i)
+            plane[i].resize(size_t(layout.strides[i]) * d.components[i].v * d.components[i].size);
+    }
+};
+
+// the blocks of one MCU, entropy decoding only
+static bool decodeMcu(BitReader &reader, const Decoder &d, int predictions[3], int32_t *coefficients, uint8_t *extents)
+{
+    for (int i = 0; i < d.componentCount; ++i)
+        for (int block = 0; block < d.components[i].h * d.components[i].v; ++block)
+        {
+            int extent;
+            if (!decodeBlock(reader, d, d.components[i], predictions[i], coefficients, extent))
+                return false;
+            *extents++ = uint8_t(extent);
+            coefficients += 64;
+        }
+    return true;
+}
+
+static void reconstructMcu(const Decoder &d, const Layout &layout, const int32_t *coefficients, const uint8_t *extents, int mcuX, RowPlanes &planes)
+{
+    for (int i = 0; i < d.componentCount; ++i)
+    {
+        const Component &c = d.components[i];
+        for (int by = 0; by < c.v; ++by)
+            for (int bx = 0; bx < c.h; ++bx)
+            {
+                inverseDctScaled(coefficients, *extents++, c.size,
+                                 planes.plane[i].data() + size_t(by) * c.size * layout.strides[i] + (mcuX * c.h + bx) * c.size, layout.strides[i]);
+                coefficients += 64;
+            }
+    }
+}
+
+// MCUs [firstX, lastX) of MCU row mcuY, straight out to destination
+static void convertRow(const Decoder &d, const Layout &layout, const RowPlanes &planes, int mcuY, int firstX, int lastX, uint8_t *destination)
+{
+    int n = layout.n, outChannels = layout.outChannels;
+    int firstRow = mcuY * d.vmax * n, lastRow = std::min(firstRow + d.vmax * n, layout.outHeight);
+    int firstColumn = firstX * d.hmax * n, lastColumn = std::min(lastX * d.hmax * n, layout.outWidth);
+    for (int y = firstRow; y < lastRow; ++y)
+    {
+        const uint8_t *source[3];
+        for (int i = 0; i < d.componentCount; ++i)
+        {
+            const Component &c = d.components[i];
+            source[i] = planes.plane[i].data() + size_t((y - firstRow) * c.v * c.size / (d.vmax * n)) * layout.strides[i];
+        }
+        uint8_t *out = destination + (size_t(y) * layout.outWidth + firstColumn) * outChannels;
+        for (int x = firstColumn; x < lastColumn; ++x, out += outChannels)
+        {
+            int r, g, b;
+            int luma = source[0][layout.columns[0][x]];
+            if (d.componentCount == 1)
+                r = g = b = luma;
+            else if (layout.rgb)
+            {
+                r = luma;
+                g = source[1][layout.columns[1][x]];
+                b = source[2][layout.columns[2][x]];
+                luma = (r * 77 + g * 150 + b * 29) >> 8;
+            }
+            else
+            {
+                // JFIF YCbCr, 16.16 fixed point
+                int cb = source[1][layout.columns[1][x]] - 128, cr = source[2][layout.columns[2][x]] - 128;
+                r = luma + ((91881 * cr + 32768) >> 16);
+                g = luma - ((22554 * cb + 46802 * cr + 32768) >> 16);
+                b = luma + ((116130 * cb + 32768) >> 16);
+                r = r < 0 ? 0 : r > 255 ? 255 : r;
+                g = g < 0 ? 0 : g > 255 ? 255 : g;
+                b = b < 0 ? 0 : b > 255 ? 255 : b;
+            }
+            if (outChannels < 3)
+            {
+                out[0] = uint8_t(luma);
+                if (outChannels == 2)
+                    out[1] = 255;
+            }
+            else
+            {
+                out[0] = uint8_t(r);
+                out[1] = uint8_t(g);
+                out[2] = uint8_t(b);
+                if (outChannels == 4)
+                    out[3] = 255;
+            }
+        }
+    }
+}
+
+// MCUs [first, last) in raster order, first starting a restart interval (or the scan) at reader.
+// Each row's run of MCUs goes out to destination as soon as it is decoded.
+static bool decodeMcus(const Decoder &d, const Layout &layout, BitReader &reader, int first, int last, uint8_t *destination)
+{
+    RowPlanes planes(d, layout);
+    int32_t coefficients[MAX_BLOCKS_PER_MCU * 64];
+    uint8_t extents[MAX_BLOCKS_PER_MCU];
+    int predictions[3] = {0, 0, 0};
+    int rowStart = first;
+    for (int mcu = first; mcu < last; ++mcu)
+    {
+        if (d.restartInterval && mcu != first && mcu % d.restartInterval == 0)
+        {
+            reader.restart();
+            predictions[0] = predictions[1] = predictions[2] = 0;
+        }
+        if (!decodeMcu(reader, d, predictions, coefficients, extents))
+            return false;
+        int mcuX = mcu % layout.mcusX;
+        reconstructMcu(d, layout, coefficients, extents, mcuX, planes);
+        if (mcuX == layout.mcusX - 1 || mcu == last - 1)
+        {
+            convertRow(d, layout, planes, mcu / layout.mcusX, rowStart % layout.mcusX, mcuX + 1, destination);
+            rowStart = mcu + 1;
+        }
+    }
+    return true;
+}
+
+// where each restart interval's entropy-coded data starts, the first at d.p. Fewer than expected
+// if the scan is damaged.
+static std::vector<const uint8_t *> findIntervals(const Decoder &d)
+{
+    std::vector<const uint8_t *> starts{d.p};
+    const uint8_t *p = d.p;
+    while (p + 1 < d.end)
+    {
+        p = static_cast<const uint8_t *>(memchr(p, 0xFF, d.end - p - 1));
+        if (!p)
+            break;
+        if (p[1] == 0x00)
+            p += 2; // stuffed
+        else if (p[1] >= 0xD0 && p[1] <= 0xD7)
+        {
+            p += 2;
+            starts.push_back(p);
+        }
+        else if (p[1] == 0xFF)
+            ++p; // fill
+        else
+            break; // the marker after the scan
+    }
+    return starts;
+}
+
+// Restart intervals are independent: DC prediction starts over and the data is byte aligned
+// after each marker, so runs of them decode on different threads. Without restart markers the
+// entropy decoding has to stay on one thread; it hands bands of MCU rows of coefficients to jobs
+// for the inverse DCTs and colour conversion, the bulk of the work at full size.
+static bool decodeParallel(const Decoder &d, const Layout &layout, uint8_t *destination, JobSystem &jobs)
+{
+    int mcuCount = layout.mcusX * layout.mcusY;
+    if (d.restartInterval)
+    {
+        int intervalCount = (mcuCount + d.restartInterval - 1) / d.restartInterval;
+        std::vector<const uint8_t *> starts = findIntervals(d);
+        if (int(starts.size()) >= intervalCount)
+        {
+            std::atomic<bool> ok{true};
+            // a couple of MCU rows per job at least
+            size_t grain = std::max(1, 2 * layout.mcusX / d.restartInterval);
+            jobs.parallelFor(0, size_t(intervalCount), grain, [&](size_t first, size_t last)
+                             {
+                                 BitReader reader{starts[first], d.end};
+                                 if (!decodeMcus(d, layout, reader, int(first) * d.restartInterval,
+                                                 std::min(int(last) * d.restartInterval, mcuCount), destination))
+                                     ok = false; });
+            return ok || fail("bad restart interval");
+        }
+        // damaged, the sequential decode finds the markers as it goes
+    }
+
+    const int BAND_ROWS = 4; // MCU rows
+    struct Band
+    {
+        std::vector<int32_t> coefficients;
+        std::vector<uint8_t> extents;
+        JobCounter done;
+    };
+    // enough bands in flight to keep every thread busy while the next one is entropy decoded
+    std::vector<Band> bands(2 * jobs.threadCount());
+    BitReader reader{d.p, d.end};
+    int predictions[3] = {0, 0, 0};
+    bool ok = true;
+    for (int firstRow = 0, index = 0; firstRow < layout.mcusY && ok; firstRow += BAND_ROWS, ++index)
+    {
+        Band &band = bands[index % bands.size()];
+        jobs.wait(band.done);
+        int rows = std::min(BAND_ROWS, layout.mcusY - firstRow);
+        size_t blocks = size_t(rows) * layout.mcusX * layout.blocksPerMcu;
+        band.coefficients.resize(blocks * 64);
+        band.extents.resize(blocks);
+        for (int mcu = 0; mcu < rows * layout.mcusX && ok; ++mcu)
+            ok = decodeMcu(reader, d, predictions, band.coefficients.data() + size_t(mcu) * layout.blocksPerMcu * 64,
+                           band.extents.data() + size_t(mcu) * layout.blocksPerMcu);
+        if (!ok)
+            break;
+        jobs.submit([&d, &layout, &band, firstRow, rows, destination]
+                    {
+                        RowPlanes planes(d, layout);
+                        for (int row = 0; row < rows; ++row)
+                        {
+                            for (int mcuX = 0; mcuX < layout.mcusX; ++mcuX)
+                            {
+                                size_t mcu = size_t(row) * layout.mcusX + mcuX;
+                                reconstructMcu(d, layout, band.coefficients.data() + mcu * layout.blocksPerMcu * 64,
+                                               band.extents.data() + mcu * layout.blocksPerMcu, mcuX, planes);
+                            }
+                            convertRow(d, layout, planes, firstRow + row, 0, layout.mcusX, destination);
+                        } },
+                    &band.done);
+    }
+    for (Band &band : bands)
+        jobs.wait(band.done);
+    return ok;
+}
+
+bool decodeJpegScaled(const unsigned char *data, size_t size, int scale, int channels,
+                      unsigned char *destination, size_t capacity, int *width, int *height, JobSystem *jobs)
+{
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        return fail("bad scale");
+    if (channels < 0 || channels > 4)
+        return fail("bad channel count");
+    Decoder d;
+    d.p = data;
+    d.end = data + size;
+    bool supported;
+    if (!readHeaders(d, supported))
+        return false;
+    if (!supported)
+        return fail("unsupported jpeg");
+    Layout layout;
+    planLayout(d, scale, channels, layout);
+    if (size_t(layout.outWidth) * layout.outHeight * layout.outChannels > capacity)
+        return fail("image doesn't fit the destination");
+
+    bool ok;
+    if (jobs && jobs->threadCount() > 1)
+        ok = decodeParallel(d, layout, destination, *jobs);
+    else
+    {
+        BitReader reader{d.p, d.end};
+        ok = decodeMcus(d, layout, reader, 0, layout.mcusX * layout.mcusY, destination);
+    }
+    if (!ok)
+        return false;
+    *width = layout.outWidth;
+    *height = layout.outHeight;
+    return true;
+}
+
+// the standard's example tables (ITU T.81 annex K), which code every baseline symbol
+static const uint8_t STANDARD_DC_COUNTS[2][16] = {{0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0},
+                                                 {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0}};
+static const uint8_t STANDARD_DC_SYMBOLS[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t STANDARD_AC_COUNTS[2][16] = {{0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d},
+                                                 {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77}};
+static const uint8_t STANDARD_AC_SYMBOLS[2][162] = {
+    {0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1,
+     0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26,
+     0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56,
+     0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85,
+     0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa,
+     0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6,
+     0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9,
+     0xfa},
+    {0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42,
+     0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19,
+     0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55,
+     0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83,
+     0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8,
+     0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4,
+     0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9,
+     0xfa}};
+
+// a table's canonical codes by symbol, length 0 for the symbols it lacks
+struct HuffmanCodes
+{
+    uint16_t code[256];
+    uint8_t length[256];
+    HuffmanCodes(const uint8_t counts[16], const uint8_t *symbols)
+    {
+        memset(length, 0, sizeof(length));
+        int code = 0, k = 0;
+        for (int bits = 1; bits <= 16; ++bits, code <<= 1)
+            for (int i = 0; i < counts[bits - 1]; ++i, ++k, ++code)
+            {
+                this->code[symbols[k]] = uint16_t(code);
+                length[symbols[k]] = uint8_t(bits);
+            }
+    }
+};
+
+// entropy-coded data out, 0xFF bytes stuffed
+struct BitWriter
+{
+    std::vector<uint8_t> &out;
+    uint32_t bits = 0;
+    int count = 0;
+
+    void put(uint32_t value, int n)
+    {
+        bits = bits << n | (value & ((1u << n) - 1));
+        count += n;
+        while (count >= 8)
+        {
+            uint8_t byte = uint8_t(bits >> (count - 8));
+            out.push_back(byte);
+            if (byte == 0xFF)
+                out.push_back(0x00);
+            count -= 8;
+        }
+    }
+    // to the byte boundary with 1 bits
+    void flush()
+    {
+        if (count)
+            put((1u << (8 - count)) - 1, 8 - count);
+    }
+};
+
+static int magnitudeBits(int value)
+{
+    int bits = 0;
+    for (value = value < 0 ? -value : value; value; value >>= 1)
+        ++bits;
+    return bits;
+}
+
+// the coefficient's bits after its code: negative values are coded as value - 1, in s bits
+static bool putSymbol(BitWriter &writer, const HuffmanCodes &codes, int symbol)
+{
+    if (!codes.length[symbol])
+        return false;
+    writer.put(codes.code[symbol], codes.length[symbol]);
+    return true;
+}
+
+// one block, quantized coefficients in row major order
+static bool encodeBlock(BitWriter &writer, const int32_t coefficients[64], int &prediction, const HuffmanCodes &dc, const HuffmanCodes &ac)
+{
+    int difference = coefficients[0] - prediction;
+    prediction = coefficients[0];
+    int s = magnitudeBits(difference);
+    if (!putSymbol(writer, dc, s))
+        return false;
+    if (s)
+        writer.put(uint32_t(difference < 0 ? difference - 1 : difference), s);
+    int run = 0;
+    for (int k = 1; k < 64; ++k)
+    {
+        int value = coefficients[ZIGZAG[k]];
+        if (!value)
+        {
+            ++run;
+            continue;
+        }
+        for (; run > 15; run -= 16)
+            if (!putSymbol(writer, ac, 0xF0))
+                return false;
+        s = magnitudeBits(value);
+        if (s > 10 || !putSymbol(writer, ac, run << 4 | s))
+            return false;
+        writer.put(uint32_t(value < 0 ? value - 1 : value), s);
+        run = 0;
+    }
+    return !run || putSymbol(writer, ac, 0x00);
+}
+
+static void putSegment(std::vector<uint8_t> &out, int marker, const std::vector<uint8_t> &payload)
+{
+    out.push_back(0xFF);
+    out.push_back(uint8_t(marker));
+    out.push_back(uint8_t((payload.size() + 2) >> 8));
+    out.push_back(uint8_t(payload.size() + 2));
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+// the file again, its scan re-coded from the quantized coefficients with a restart marker every
+// interval MCUs. missingSymbol is set if the tables lack a symbol the restarts need (DC
+// differences grow where the prediction starts over); the standard tables have them all.
+static bool recodeScan(const Decoder &d, const uint8_t *data, int mcuCount, int interval, bool standardTables,
+                       std::vector<uint8_t> &out, bool &missingSymbol)
+{
+    missingSymbol = false;
+    out.assign({0xFF, 0xD8});
+    // the headers, without the restart interval (and the huffman tables if they are replaced)
+    for (const uint8_t *q = data + 2; q < d.scan;)
+    {
+        while (q[1] == 0xFF)
+            ++q; // fill
+        int marker = q[1];
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+        {
+            q += 2;
+            continue;
+        }
+        int length = read16(q + 2);
+        if (marker != 0xDD && !(standardTables && marker == 0xC4))
+            out.insert(out.end(), q, q + 2 + length);
+        q += 2 + length;
+    }
+    if (standardTables)
+        for (int table = 0; table < (d.componentCount > 1 ? 2 : 1); ++table)
+        {
+            std::vector<uint8_t> payload{uint8_t(table)};
+            payload.insert(payload.end(), STANDARD_DC_COUNTS[table], STANDARD_DC_COUNTS[table] + 16);
+            payload.insert(payload.end(), STANDARD_DC_SYMBOLS, STANDARD_DC_SYMBOLS + 12);
+            payload.push_back(uint8_t(0x10 | table));
+            payload.insert(payload.end(), STANDARD_AC_COUNTS[table], STANDARD_AC_COUNTS[table] + 16);
+            payload.insert(payload.end(), STANDARD_AC_SYMBOLS[table], STANDARD_AC_SYMBOLS[table] + 162);
+            putSegment(out, 0xC4, payload);
+        }
+    putSegment(out, 0xDD, {uint8_t(interval >> 8), uint8_t(interval)});
+    if (standardTables)
+    {
+        // luminance tables for the first component, chrominance for the others
+        std::vector<uint8_t> payload{uint8_t(d.componentCount)};
+        for (int i = 0; i < d.componentCount; ++i)
+        {
+            payload.push_back(uint8_t(d.components[i].id));
+            payload.push_back(i ? 0x11 : 0x00);
+        }
+        payload.insert(payload.end(), {0, 63, 0});
+        putSegment(out, 0xDA, payload);
+    }
+    else
+        out.insert(out.end(), d.scan, d.p);
+
+    std::vector<HuffmanCodes> dcCodes, acCodes;
+    for (int i = 0; i < d.componentCount; ++i)
+    {
+        const Component &c = d.components[i];
+        int table = i ? 1 : 0;
+        if (standardTables)
+        {
+            dcCodes.emplace_back(STANDARD_DC_COUNTS[table], STANDARD_DC_SYMBOLS);
+            acCodes.emplace_back(STANDARD_AC_COUNTS[table], STANDARD_AC_SYMBOLS[table]);
+        }
+        else
+        {
+            dcCodes.emplace_back(d.dc[c.dcTable].counts, d.dc[c.dcTable].symbols);
+            acCodes.emplace_back(d.ac[c.acTable].counts, d.ac[c.acTable].symbols);
+        }
+    }
+
+    BitReader reader{d.p, d.end};
+    BitWriter writer{out};
+    int inPredictions[3] = {0, 0, 0}, outPredictions[3] = {0, 0, 0};
+    int32_t coefficients[64];
+    for (int mcu = 0; mcu < mcuCount; ++mcu)
+    {
+        if (d.restartInterval && mcu && mcu % d.restartInterval == 0)
+        {
+            reader.restart();
+            inPredictions[0] = inPredictions[1] = inPredictions[2] = 0;
+        }
+        if (mcu && mcu % interval == 0)
+        {
+            writer.flush();
+            out.push_back(0xFF);
+            out.push_back(uint8_t(0xD0 + (mcu / interval - 1) % 8));
+            outPredictions[0] = outPredictions[1] = outPredictions[2] = 0;
+        }
+        for (int i = 0; i < d.componentCount; ++i)
+            for (int block = 0; block < d.components[i].h * d.components[i].v; ++block)
+            {
+                int extent;
+                if (!decodeBlock(reader, d, d.components[i], inPredictions[i], coefficients, extent))
+                    return false;
+                if (!encodeBlock(writer, coefficients, outPredictions[i], dcCodes[i], acCodes[i]))
+                {
+                    missingSymbol = true;
+                    return fail("huffman table lacks a symbol");
+                }
+            }
+    }
+    writer.flush();
+    out.insert(out.end(), {0xFF, 0xD9});
+    return true;
+}
+
+bool addJpegRestartMarkers(const unsigned char *data, size_t size, int mcuRows, std::vector<unsigned char> &out)
+{
+    Decoder d;
+    d.p = data;
+    d.end = data + size;
+    bool supported;
+    if (!readHeaders(d, supported))
+        return false;
+    if (!supported)
+        return fail("unsupported jpeg");
+    int mcusX = (d.width + 8 * d.hmax - 1) / (8 * d.hmax), mcusY = (d.height + 8 * d.vmax - 1) / (8 * d.vmax);
+    int interval = mcusX * std::max(mcuRows, 1);
+    if (interval > 65535)
+        return fail("restart interval too long");
+    // decoding with unit quantization gives the coefficients as coded
+    for (auto &table : d.quant)
+        std::fill(table, table + 64, uint16_t(1));
+    bool missingSymbol;
+    if (recodeScan(d, data, mcusX * mcusY, interval, false, out, missingSymbol))
+        return true;
+    return missingSymbol && recodeScan(d, data, mcusX * mcusY, interval, true, out, missingSymbol);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+class JobSystem;
+
+// A baseline JPEG decoder that scales in the DCT domain: at 1/2, 1/4 or 1/8 each 8x8 block goes
+// through a 4x4, 2x2 or 1x1 inverse DCT of its lowest frequencies, so the smaller image comes out
+// of the stream directly, without the full size one or a downsampling pass. Huffman-coded 8-bit
+// baseline and extended frames of 1 or 3 components only; anything else (progressive, arithmetic,
+// 12-bit, CMYK) is left to stb_image at full size.
+struct JpegInfo
+{
+    int width = 0, height = 0, components = 0;
+    bool supported = false; // decodeJpegScaled can decode it
+};
+
+// reads the headers up to the first scan
+bool readJpegInfo(const unsigned char *data, size_t size, JpegInfo &info);
+
+// the largest of 1, 2, 4 and 8 that keeps the width at least minWidth, 1 if minWidth is 0
+int jpegScaleFor(int width, int minWidth);
+inline int jpegScaledSize(int size, int scale) { return (size + scale - 1) / scale; }
+
+// decodes at 1/scale of the size (rounded up) into destination, which must hold width * height *
+// channels bytes; channels 0 keeps the file's. Returns false on failure, jpegFailureReason() says why.
+// With jobs, the decode is split across them: runs of restart intervals decode in parallel, near
+// linear in the threads; a file without restart markers gets its inverse DCTs and colour
+// conversion done in parallel behind a single-threaded entropy decode. Chroma is upsampled by
+// repeating samples at full size.
+bool decodeJpegScaled(const unsigned char *data, size_t size, int scale, int channels,
+                      unsigned char *destination, size_t capacity, int *width, int *height, JobSystem *jobs = nullptr);
+const char *jpegFailureReason();
+
+// Writes the same image to out with a restart marker every mcuRows rows of MCUs, so it decodes in
+// parallel. Lossless: the quantized coefficients are coded again as they were, with the file's
+// huffman tables, or the standard ones if those lack a code the restarts need.
+bool addJpegRestartMarkers(const unsigned char *data, size_t size, int mcuRows, std::vector<unsigned char> &out);
@@ -3,6 +3,7 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
 
 #define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
 #include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
@@ -17,27 +18,56 @@
 #include "skybox.h"
 #include "camera.h"
 #include "sphere.h"
+#include "ephemeris.h"
+#include "simulation.h"
+#include "sim_thread.h"
+#include "checkpoint.h"
+#include "eclipse.h"
+#include "conjunction.h"
+#include "render_target.h"
+#include "body_store.h"
+#include "jobs.h"
+#include "command_list.h"
+#include "gpu_orbits.h"
+#include "texture_loader.h"
+#include "virtual_texture.h"
+#include "texture_array.h"
 
 // input handling functions
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 void processInput(GLFWwindow *window);
-void drawSphere(GLuint shaderProgram,
-                GLuint vao,
-                GLsizei indexCount,
-                const glm::mat4 &model,
-                const glm::mat4 &view,
-                const glm::mat4 &projection,
-                GLuint textureID);
+void printOcclusions(double span);
+void printClosestApproaches(double span, double threshold);
+void recordSphereInstances(CommandList &list,
+                           const BodyInstances &instances,
+                           size_t firstBatch,
+                           size_t lastBatch,
+                           const GLuint *vaos,
+                           const GLsizei *indexCounts,
+                           GLuint instanceBuffer,
+                           GLuint layerBuffer,
+                           GLuint sphereProgram,
+                           const VirtualTextures &virtualTextures,
+                           const TextureArrays &textureArrays);
+void recordFeedbackInstances(CommandList &list,
+                             const BodyInstances &instances,
+                             const GLuint *vaos,
+                             const GLsizei *indexCounts,
+                             GLuint instanceBuffer,
+                             GLuint layerBuffer,
+                             const VirtualTextures &virtualTextures);
 const unsigned int SCR_WIDTH = 1920;
 const unsigned int SCR_HEIGHT = 1080;
 
 // camera
-glm::vec3 startingCameraPos = glm::vec3(0.0f, 0.0f, 7.5f);
+glm::dvec3 startingCameraPos = glm::dvec3(0.0, 0.0, 7.5);
 glm::vec3 startingCameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
 glm::vec3 startingCameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 
 Camera camera(startingCameraPos);
+// reverse-Z with an infinite far plane, so only the near plane is left to choose
+const float NEAR_PLANE = 1e-4f;
 
 // set mouse cursor to center of window
 float lastX = SCR_WIDTH / 2.0f;
@@ -48,6 +78,24 @@ bool firstMouse = true;
 float deltaTime = 0.0f; // time between current frame and last frame
 float lastFrame = 0.0f;
 
+// simulation, snapshotted every 10 simulated seconds so the timeline can be scrubbed
+enum SceneBody
+{
+    SUN,
+    MARS,
+    CERES,
+    URANUS
+};
+Simulation simulation;
+CheckpointLog checkpoints(10.0, size_t(256) << 20, "checkpoints.bin");
+// steps the simulation in real time on its own thread, the frame loop reads its snapshots
+SimulationThread simulationThread(simulation, &checkpoints);
+const float SCRUB_SPEED = 600.0f; // simulated seconds per second while [ or ] is held
+// VRAM the atlas of the virtual textured maps may take
+const size_t VIRTUAL_TEXTURE_BUDGET = size_t(64) << 20;
+// largest difference, relative to the distance from the origin, accepted between the orbit shader and the CPU
+const double GPU_ORBIT_TOLERANCE = 1e-4;
+
 std::string loadShaderSource(const std::string &filePath)
 {
     std::ifstream file(filePath);
@@ -95,57 +143,16 @@ GLuint createShaderProgram()
     return shaderProgram;
 }
 
-// Load texture
-GLuint loadTexture(const char *filename)
+int main(int argc, char **argv)
 {
-    // load texture
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(filename, &width, &height, &nrChannels, 0);
-    if (!data)
-    {
-        std::cerr << "Error::Texture could not load texture file:" << filename << std::endl;
-        return 0;
-    }
-
-    // create & bind textures
-    GLuint textureId = 0;
-    glGenTextures(1, &textureId);
-    assert(textureId != 0);
-
-    glBindTexture(GL_TEXTURE_2D, textureId);
-
-    // set filter param
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // upload texture to the PU
-    GLenum format = 0;
-    if (nrChannels == 1)
-    {
-        format = GL_RED;
-    }
-    else if (nrChannels == 3)
-    {
-        format = GL_RGB;
-    }
-    else if (nrChannels == 4)
-    {
-        format = GL_RGBA;
-    }
-
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-
-    // Free resources
+    // --gpu-orbits: scripted bodies are animated by the vertex shader instead of the CPU
+    bool gpuOrbitsRequested = false;
+    for (int i = 1; i < argc; ++i)
+        gpuOrbitsRequested |= std::string(argv[i]) == "--gpu-orbits";
 
-    stbi_image_free(data);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return textureId;
-}
-
-int main()
-{
     // Create a GLFW window and initialize GLEW
     glfwInit();
+    double startupStart = glfwGetTime();
 
 #if defined(PLATFORM_OSX)
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -153,9 +160,9 @@ int main()
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #else
-    // On windows, we set OpenGL version to 2.1, to support more hardware
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    // 3.3 matches the shaders and has float depth buffers, glClipControl is checked for after glewInit
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 #endif
 
     // Create Window and rendering context using GLFW, resolution is 800x600
@@ -180,7 +187,22 @@ int main()
         glfwTerminate();
         return -1;
     }
-    // Create Skybox
+
+    // depth goes from 1 at the near plane to 0 at infinity, into a 32-bit float buffer
+    enableReverseZ();
+    int framebufferWidth, framebufferHeight;
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    RenderTarget renderTarget;
+    bool offscreen = createRenderTarget(renderTarget, framebufferWidth, framebufferHeight); // falls back to the window's own depth buffer
+    glClearDepth(0.0);
+    double startupWindow = glfwGetTime();
+
+    // every image is known at this point: decode them all on the job system while the rest of
+    // the scene is set up, uploads happen on a thread with a shared context as the decodes land.
+    // Nothing waits for them: until a texture is resident its 1x1 average color is bound instead.
+    TextureLoader textures(defaultJobSystem(), bestTextureCompression());
+    textures.loadManifest("assets.manifest");
+    textures.startUploadThread(window);
     std::vector<std::string> faces{
         "skybox/right.png",
         "skybox/left.png",
@@ -188,7 +210,26 @@ int main()
         "skybox/bottom.png",
         "skybox/front.png",
         "skybox/back.png"};
-    unsigned int cubemapTexture = loadSkyBox(faces);
+    // the most screen pixels each body is expected to cover across, 0 if the camera can fill the
+    // screen with it. The camera isn't expected to get close to ceres, its texture decodes smaller.
+    // A hero body may also have a tile file of a much larger map (see tools/vt_build), streamed as
+    // a virtual texture when it exists; the ordinary texture then only serves the gpu orbit draws.
+    // Once resident, the other textures of bodies on the CPU path move into texture arrays (see
+    // texture_array.h), one per size, so those bodies draw together.
+    struct BodyTexture
+    {
+        const char *file;
+        int maxScreenPixels;
+        const char *tiles;
+    };
+    const BodyTexture bodyTextureFiles[] = {{"Textures/sun.jpg", 0, nullptr}, {"Textures/mars.jpg", 0, "Textures/mars.tiles"}, {"Textures/ceres.jpg", 256, nullptr}, {"Textures/uranus.jpg", 0, nullptr}};
+    TextureHandle cubemapTexture = textures.loadCubemap(faces);
+    GLuint skyboxTexture = textures.bindable(cubemapTexture);
+    std::vector<TextureHandle> bodyTextures;
+    for (const BodyTexture &body : bodyTextureFiles)
+        bodyTextures.push_back(textures.load2D(body.file, body.maxScreenPixels));
+
+    // Create Skybox
     glDepthMask(GL_FALSE);
     unsigned int skyboxVAO = createSkyboxVAO();
     // Load shaders
@@ -196,65 +237,298 @@ int main()
     glUseProgram(skyboxShader);
     // ... set view and projection matrix
     glBindVertexArray(skyboxVAO);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
     glDrawArrays(GL_TRIANGLES, 0, 36);
     glDepthMask(GL_TRUE);
 
-    // Setup sphere
-    std::vector<float> sphereVertices;
-    std::vector<unsigned int> sphereIndices;
-    generateSphere(sphereVertices, sphereIndices);
-
-    GLuint sphereVAO, sphereVBO, sphereEBO;
-    glGenVertexArrays(1, &sphereVAO);
-    glGenBuffers(1, &sphereVBO);
-    glGenBuffers(1, &sphereEBO);
-
-    glBindVertexArray(sphereVAO);
-    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-    glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), sphereVertices.data(), GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), sphereIndices.data(), GL_STATIC_DRAW);
-
-    // change attribute pointer to 8 floats, due to adding u,v for texture. + 1 more pointer for it too.
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0); // position
-    glEnableVertexAttribArray(0);
-
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(3 * sizeof(float))); // color
-    glEnableVertexAttribArray(1);
-
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float))); // UV
-    glEnableVertexAttribArray(2);
+    // Setup spheres, one mesh per lod from finest to coarsest
+    const int lodSectors[LOD_COUNT] = {36, 18, 8};
+    GLuint sphereVAO[LOD_COUNT];
+    GLsizei sphereIndexCount[LOD_COUNT];
+    // model matrices of the visible bodies, refilled every frame and shared by the lod meshes
+    GLuint instanceVBO;
+    glGenBuffers(1, &instanceVBO);
+    // and their texture array layers
+    GLuint instanceLayerVBO;
+    glGenBuffers(1, &instanceLayerVBO);
+    for (int lod = 0; lod < LOD_COUNT; ++lod)
+    {
+        std::vector<float> sphereVertices;
+        std::vector<unsigned int> sphereIndices;
+        generateSphere(sphereVertices, sphereIndices, lodSectors[lod], lodSectors[lod] / 2);
+        sphereIndexCount[lod] = static_cast<GLsizei>(sphereIndices.size());
+
+        GLuint sphereVBO, sphereEBO;
+        glGenVertexArrays(1, &sphereVAO[lod]);
+        glGenBuffers(1, &sphereVBO);
+        glGenBuffers(1, &sphereEBO);
+
+        glBindVertexArray(sphereVAO[lod]);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+        glBufferData(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(float), sphereVertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(unsigned int), sphereIndices.data(), GL_STATIC_DRAW);
+
+        // change attribute pointer to 8 floats, due to adding u,v for texture. + 1 more pointer for it too.
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)0); // position
+        glEnableVertexAttribArray(0);
+
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(3 * sizeof(float))); // color
+        glEnableVertexAttribArray(1);
+
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(6 * sizeof(float))); // UV
+        glEnableVertexAttribArray(2);
+
+        // a mat4 per instance takes 4 attribute slots, pointed at each batch when drawing
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (int column = 0; column < 4; ++column)
+        {
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(3 + column);
+            glVertexAttribDivisor(3 + column, 1);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceLayerVBO);
+        glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, sizeof(float), (void *)0);
+        glEnableVertexAttribArray(7);
+        glVertexAttribDivisor(7, 1);
+    }
 
     GLuint sphereShader = createShaderProgram();
+    VirtualTextures virtualTextures(defaultJobSystem());
+    virtualTextures.create(VIRTUAL_TEXTURE_BUDGET, framebufferWidth, framebufferHeight);
+    // arrays only used if adding, removing and defragmenting some small textures reads back right
+    TextureArrays textureArrays;
+    if (textureArrays.create())
+    {
+        int wrong = textureArrays.selfCheck();
+        if (wrong == 0)
+            std::cout << "texture arrays: self-check passed" << std::endl;
+        else
+        {
+            std::cerr << "Error::TextureArray self-check found " << wrong << " wrong layers, planets keep a texture each" << std::endl;
+            textureArrays.destroy();
+        }
+    }
 
     // Set up view and projection matrices for camera
     glm::mat4 view = glm::mat4(glm::mat3(glm::lookAt(
-        startingCameraPos,   // eye position
+        glm::vec3(startingCameraPos), // eye position
         startingCameraFront, // center position
         startingCameraUp     // up vector
         )));
-    glm::mat4 projection = glm::perspective(glm::radians(45.0f),
-                                            1920.0f / 1080.0f,
-                                            0.1f, 100.0f);
-    int viewLoc = glGetUniformLocation(skyboxShader, "view");
-    int projLoc = glGetUniformLocation(skyboxShader, "projection");
-
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, &view[0][0]);
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, &projection[0][0]);
+    glm::mat4 projection = reverseInfinitePerspective(glm::radians(45.0f),
+                                                      1920.0f / 1080.0f,
+                                                      NEAR_PLANE);
+    GLint skyboxViewLoc = glGetUniformLocation(skyboxShader, "view");
+    GLint skyboxProjLoc = glGetUniformLocation(skyboxShader, "projection");
+
+    glUniformMatrix4fv(skyboxViewLoc, 1, GL_FALSE, &view[0][0]);
+    glUniformMatrix4fv(skyboxProjLoc, 1, GL_FALSE, &projection[0][0]);
+
+    // scene bodies, parents before their satellites, and their textures
+    simulation.bodies = {
+        // name, parent, orbit radius, orbit speed, spin speed, radius, gm
+        {"sun", -1, 0.0, 0.0, glm::radians(25.0), 3.0, 0.0}, // spin the sun. (Praise the sun \[T]/ )
+        {"mars", SUN, 10.0, glm::radians(10.0), glm::radians(-60.0), 1.0, 0.0},
+        {"ceres", MARS, 3.0, glm::radians(50.0), glm::radians(90.0), 0.3, 0.0},
+        {"uranus", SUN, 20.0, glm::radians(3.0), glm::radians(-40.0), 2.0, 0.0}};
+    simulation.reset();
+    checkpoints.record(simulation);
+    const size_t bodyCount = simulation.bodies.size();
+
+    // precomputed trajectories (see tools/ephem_convert.cpp), bodies found in the file replay them instead of their scripted orbit
+    Ephemeris ephemeris;
+    ephemeris.open("ephemeris/scene.eph");
+
+    // orbital parameters uploaded once, used only if the GPU agrees with the CPU over the first
+    // rebase interval and after a jump of a day
+    GpuOrbits gpuOrbits;
+    bool gpuOrbitMode = false;
+    if (gpuOrbitsRequested && gpuOrbits.create(simulation.bodies, 0.0))
+    {
+        double worst = 0.0;
+        for (double time : {0.0, 599.0, 86400.0, 86999.0})
+        {
+            double difference = gpuOrbits.selfCheck(simulation, time);
+            worst = difference < 0.0 ? difference : std::max(worst, difference);
+            if (difference < 0.0)
+                break;
+        }
+        gpuOrbitMode = worst >= 0.0 && worst < GPU_ORBIT_TOLERANCE;
+        if (gpuOrbitMode)
+            std::cout << "gpu orbits: largest difference from the CPU " << worst << std::endl;
+        else
+            std::cerr << "Error::GpuOrbits GPU and CPU disagree (" << worst << "), orbits stay on the CPU" << std::endl;
+    }
 
-    // spin the sun. (Praise the sun \[T]/ ) part 1 variable
-    float sunRotation = 0.0f; // start at 0, first frame.
+    // one row per body in the store, orbiting bodies hang off their parent's handle. Bodies replaying
+    // an ephemeris are roots since the file holds world positions. In gpu orbit mode, scripted bodies
+    // whose whole parent chain is scripted only keep what the draw needs.
+    BodyStore bodies;
+    std::vector<BodyHandle> bodyHandles(bodyCount);
+    std::vector<bool> gpuBody(bodyCount, false);
+    std::vector<int> bodyVirtualTexture(bodyCount, -1);
+    std::vector<int> bodyArrayEntry(bodyCount, -1); // in textureArrays, once resident
+    for (size_t i = 0; i < bodyCount; ++i)
+    {
+        const SimBody &body = simulation.bodies[i];
+        int ephemerisBody = ephemeris.findBody(body.name);
+        gpuBody[i] = gpuOrbitMode && ephemerisBody < 0 && (body.parent < 0 || gpuBody[body.parent]);
+        uint32_t components = gpuBody[i] ? COMPONENT_GPU_ORBIT | COMPONENT_RENDER
+                                         : (ephemerisBody >= 0 ? COMPONENT_EPHEMERIS : COMPONENT_ORBIT) | COMPONENT_SPIN | COMPONENT_RENDER | COMPONENT_BOUNDS;
+        bodyHandles[i] = bodies.create(components);
+        BodyArchetype &archetype = bodies.archetypeOf(bodyHandles[i]);
+        size_t row = bodies.rowOf(bodyHandles[i]);
+        archetype.simulationBody[row] = static_cast<int>(i);
+        archetype.scale[row] = body.radius;
+        archetype.texture[row] = textures.bindable(bodyTextures[i]); // the placeholder until resident
+        if (gpuBody[i])
+            continue;
+        if (bodyTextureFiles[i].tiles)
+            bodyVirtualTexture[i] = virtualTextures.add(bodyTextureFiles[i].tiles);
+        if (bodyVirtualTexture[i] >= 0)
+            archetype.texture[row] = virtualTextures.indirection(bodyVirtualTexture[i]);
+        if (ephemerisBody >= 0)
+            archetype.ephemerisBody[row] = ephemerisBody;
+        else
+        {
+            archetype.parent[row] = body.parent >= 0 ? bodyHandles[body.parent] : BodyHandle();
+            archetype.orbitRadius[row] = body.orbitRadius;
+        }
+        archetype.boundRadius[row] = body.radius; // unit sphere mesh
+    }
 
-    // Texture for sun
-    GLuint sunTextureID = loadTexture("Textures/sun.jpg");
-    GLuint ceresTextureID = loadTexture("Textures/ceres.jpg");
-    GLuint marsTextureID = loadTexture("Textures/mars.jpg");
+    // the gpu orbit draws only change when a texture becomes resident, they are recorded then;
+    // only the uniforms are set per frame
+    CommandList gpuOrbitFrame, gpuOrbitCommands;
+    auto recordGpuOrbitCommands = [&]
+    {
+        gpuOrbitCommands.clear();
+        for (const BodyArchetype &archetype : bodies.archetypes)
+        {
+            if (!archetype.has(COMPONENT_GPU_ORBIT | COMPONENT_RENDER))
+                continue;
+            for (size_t row = 0; row < archetype.size(); ++row)
+            {
+                gpuOrbitCommands.bindVertexArray(sphereVAO[0]);
+                gpuOrbitCommands.bindTexture(TEXTURE_TARGET_2D, 0, archetype.texture[row]);
+                gpuOrbitCommands.uniformInt(gpuOrbits.firstBodyLocation(), archetype.simulationBody[row]);
+                gpuOrbitCommands.drawElementsInstanced(static_cast<uint32_t>(sphereIndexCount[0]), 1);
+            }
+        }
+    };
+    recordGpuOrbitCommands();
+    glUseProgram(sphereShader);
+    glUniform1i(glGetUniformLocation(sphereShader, "baseTexture"), 0);
+    GLint sphereViewLoc = glGetUniformLocation(sphereShader, "view");
+    GLint sphereProjLoc = glGetUniformLocation(sphereShader, "projection");
+
+    // per-frame stages as a job graph: transforms first, then culling, lod selection and update
+    // scheduling side by side, then the instance matrices and the body draws, recorded into command lists over
+    // several threads. The skybox pass is recorded alongside. Only the main thread, which keeps
+    // the GL context, replays the lists.
+    JobSystem &jobs = defaultJobSystem();
+    BodyInstances instances;
+    CommandList skyboxCommands, feedbackCommands;
+    std::vector<CommandList> bodyCommands(jobs.threadCount());
+    glm::mat4 frameView(1.0f), frameProjection(1.0f), frameViewProjection(1.0f);
+    glm::dvec3 frameCameraPosition(0.0);
+    double framePixelsPerRadian = 1.0;
+    JobGraph frameGraph;
+    const SimSnapshot *frameSnapshot = nullptr;
+    int transformStage = frameGraph.add([&]
+                                        {
+                                            bodies.syncSimulation(*frameSnapshot);
+                                            bodies.updateTransforms(&ephemeris, frameSnapshot->time); });
+    int cullStage = frameGraph.add([&]
+                                   { bodies.cull(frameViewProjection, frameCameraPosition); },
+                                   {transformStage});
+    int lodStage = frameGraph.add([&]
+                                  { bodies.selectLod(frameCameraPosition); },
+                                  {transformStage});
+    frameGraph.add([&]
+                   { bodies.scheduleUpdates(frameCameraPosition, framePixelsPerRadian); },
+                   {transformStage});
+    int instanceStage = frameGraph.add([&]
+                                       { bodies.fillInstances(frameCameraPosition, instances); },
+                                       {cullStage, lodStage});
+    frameGraph.add([&]
+                   {
+                       // each list takes a contiguous range of batches, replaying them in list order keeps the batch order
+                       size_t listCount = bodyCommands.size(), batchCount = instances.batches.size();
+                       jobs.parallelFor(0, listCount, 1, [&](size_t first, size_t last)
+                                        {
+                                            for (size_t i = first; i < last; ++i)
+                                            {
+                                                CommandList &list = bodyCommands[i];
+                                                list.clear();
+                                                if (i == 0)
+                                                {
+                                                    if (virtualTextures.size() > 0)
+                                                    {
+                                                        list.useProgram(virtualTextures.program());
+                                                        list.uniformMatrix(virtualTextures.viewLocation(), frameView);
+                                                        list.uniformMatrix(virtualTextures.projectionLocation(), frameProjection);
+                                                        list.bindTexture(TEXTURE_TARGET_2D, 1, virtualTextures.atlasTexture());
+                                                    }
+                                                    if (textureArrays.supported())
+                                                    {
+                                                        list.useProgram(textureArrays.program());
+                                                        list.uniformMatrix(textureArrays.viewLocation(), frameView);
+                                                        list.uniformMatrix(textureArrays.projectionLocation(), frameProjection);
+                                                    }
+                                                    list.useProgram(sphereShader);
+                                                    list.uniformMatrix(sphereViewLoc, frameView);
+                                                    list.uniformMatrix(sphereProjLoc, frameProjection);
+                                                }
+                                                recordSphereInstances(list, instances, batchCount * i / listCount, batchCount * (i + 1) / listCount,
+                                                                      sphereVAO, sphereIndexCount, instanceVBO, instanceLayerVBO, sphereShader,
+                                                                      virtualTextures, textureArrays);
+                                            } }); },
+                   {instanceStage});
+    frameGraph.add([&]
+                   {
+                       feedbackCommands.clear();
+                       if (virtualTextures.size() > 0)
+                       {
+                           feedbackCommands.useProgram(virtualTextures.feedbackProgram());
+                           feedbackCommands.uniformMatrix(virtualTextures.feedbackViewLocation(), frameView);
+                           feedbackCommands.uniformMatrix(virtualTextures.feedbackProjectionLocation(), frameProjection);
+                           recordFeedbackInstances(feedbackCommands, instances, sphereVAO, sphereIndexCount, instanceVBO, instanceLayerVBO, virtualTextures);
+                       } },
+                   {instanceStage});
+    frameGraph.add([&]
+                   {
+                       // the skybox sits at depth 0 (infinitely far), GEQUAL lets it pass the cleared depth
+                       skyboxCommands.clear();
+                       skyboxCommands.depthState(DEPTH_GREATER_EQUAL, false);
+                       skyboxCommands.useProgram(skyboxShader);
+                       skyboxCommands.uniformMatrix(skyboxViewLoc, glm::mat4(glm::mat3(frameView))); // remove translation
+                       skyboxCommands.uniformMatrix(skyboxProjLoc, frameProjection);
+                       skyboxCommands.bindVertexArray(skyboxVAO);
+                       skyboxCommands.bindTexture(TEXTURE_TARGET_CUBE, 0, skyboxTexture);
+                       skyboxCommands.drawArrays(36);
+                       skyboxCommands.depthState(DEPTH_GREATER, true); // restore reverse-Z test
+                   });
 
     // depth and face cull
     glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_GREATER); // reverse-Z, nearer is bigger
     glDisable(GL_CULL_FACE);
 
+    double startupScene = glfwGetTime();
+    bool firstFrame = true;
+    bool texturesPending = true;
+    uint32_t arrayGeneration = textureArrays.generation();
+
+    simulationThread.start();
+    // rates, reported in the window title once a second
+    double rateStart = glfwGetTime();
+    uint64_t rateSteps = simulationThread.steps();
+    int rateFrames = 0;
+    float rateWorstFrame = 0.0f;
+    ReplayStats replayStats;
+
     // Main Loop
     while (!glfwWindowShouldClose(window))
     {
@@ -265,78 +539,144 @@ int main()
 
         processInput(window);
 
-        projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        GLuint projectionMatrixLocation = glGetUniformLocation(skyboxShader, "projection");
-        glUniformMatrix4fv(projectionMatrixLocation, 1, GL_FALSE, &projection[0][0]);
-
-        view = camera.GetViewMatrix();
-        GLuint viewMatrixLocation = glGetUniformLocation(skyboxShader, "view");
-        glUniformMatrix4fv(viewMatrixLocation, 1, GL_FALSE, &view[0][0]);
-
+        // newest complete simulation state, never waits for a step in progress
+        frameSnapshot = &simulationThread.latest();
+        rateFrames++;
+        rateWorstFrame = std::max(rateWorstFrame, deltaTime);
+        if (currentFrame - rateStart >= 1.0)
+        {
+            double elapsed = currentFrame - rateStart;
+            uint64_t steps = simulationThread.steps();
+            std::ostringstream title;
+            title << "SPACE - sim " << static_cast<int>((steps - rateSteps) / elapsed + 0.5) << " steps/s, render "
+                  << static_cast<int>(rateFrames / elapsed + 0.5) << " fps, replay "
+                  << static_cast<int>(replayStats.commands ? replayStats.seconds * 1e9 / replayStats.commands + 0.5 : 0) << " ns/command, worst frame "
+                  << static_cast<int>(rateWorstFrame * 1e3f + 0.5f) << " ms";
+            if (virtualTextures.size() > 0)
+                title << ", tiles " << virtualTextures.residentPages() << "/" << virtualTextures.pageCount();
+            glfwSetWindowTitle(window, title.str().c_str());
+            rateStart = currentFrame;
+            rateSteps = steps;
+            rateFrames = 0;
+            rateWorstFrame = 0.0f;
+            replayStats = ReplayStats();
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, renderTarget.framebuffer);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        // Calculate matrices
-        projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 skyboxView = glm::mat4(glm::mat3(view)); // remove translation
-
-        // Binding textures
-        glUseProgram(sphereShader);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, sunTextureID);
-        glUniform1i(glGetUniformLocation(sphereShader, "baseTexture"), 0);
-
-        // Draw Skybox
-        glDepthFunc(GL_LEQUAL); // ensure skybox depth passes
-        glDepthMask(GL_FALSE);
-        glUseProgram(skyboxShader);
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "view"), 1, GL_FALSE, glm::value_ptr(skyboxView));
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-        glBindVertexArray(skyboxVAO);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS); // restore default
-
-        // sun
-        sunRotation += deltaTime * glm::radians(25.0f);
-        glm::mat4 sunModel = glm::rotate(glm::mat4(1.0f), sunRotation, glm::vec3(0.0f, 1.0f, 0.0f));
-        sunModel = glm::scale(sunModel, glm::vec3(3.0f));
-        drawSphere(sphereShader, sphereVAO, static_cast<GLsizei>(sphereIndices.size()), sunModel, view, projection, sunTextureID);
-
-        // mars
-        float marsOrbitSpeed = glm::radians(10.0f);
-        float marsOrbitAngle = currentFrame * marsOrbitSpeed;
-        float marsOrbitRadius = 10.0f;
-
-        static float marsRotation = 0.0f;
-        marsRotation += deltaTime * glm::radians(-60.0f);
-
-        glm::mat4 marsModel = glm::rotate(glm::mat4(1.0f), marsOrbitAngle, glm::vec3(0.0f, 1.0f, 0.0f)); // orbit sun
-        marsModel = glm::translate(marsModel, glm::vec3(marsOrbitRadius, 0.0f, 0.0f));                   // move away from sun
-        marsModel = glm::rotate(marsModel, marsRotation, glm::vec3(0.0f, 1.0f, 0.0f));                   // self-rotation
-        drawSphere(sphereShader, sphereVAO, static_cast<GLsizei>(sphereIndices.size()), marsModel, view, projection, marsTextureID);
-
-        // ceres
-        float ceresOrbitSpeed = glm::radians(50.0f);
-        float ceresOrbitAngle = currentFrame * ceresOrbitSpeed;
-        float ceresOrbitRadius = 3.0f;
-
-        static float ceresRotation = 0.0f;
-        ceresRotation += deltaTime * glm::radians(90.0f);
-
-        glm::mat4 ceresModel = glm::rotate(glm::mat4(1.0f), marsOrbitAngle, glm::vec3(0.0f, 1.0f, 0.0f)); // follow Mars
-        ceresModel = glm::translate(ceresModel, glm::vec3(marsOrbitRadius, 0.0f, 0.0f));                  // move next to Mars
-        ceresModel = glm::rotate(ceresModel, ceresOrbitAngle, glm::vec3(0.0f, 1.0f, 0.0f));               // orbit Mars
-        ceresModel = glm::translate(ceresModel, glm::vec3(ceresOrbitRadius, 0.0f, 0.0f));                 // move away from mars
-        ceresModel = glm::rotate(ceresModel, ceresRotation, glm::vec3(0.0f, 1.0f, 0.0f));                 // self-rotation
-        ceresModel = glm::scale(ceresModel, glm::vec3(0.3f));
-        drawSphere(sphereShader, sphereVAO, static_cast<GLsizei>(sphereIndices.size()), ceresModel, view, projection, ceresTextureID);
-
+        // Calculate matrices, once per frame
+        projection = reverseInfinitePerspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, NEAR_PLANE);
+        view = camera.GetViewMatrix();
+        frameView = view;
+        frameProjection = projection;
+        frameViewProjection = projection * view;
+        frameCameraPosition = camera.Position;
+        framePixelsPerRadian = SCR_HEIGHT / (2.0 * tan(glm::radians(double(camera.Zoom)) / 2.0));
+
+        // only polls the upload fences, textures swap in on the frame their upload has completed.
+        // A body's resident texture is copied into its texture array and deleted, the body then
+        // follows its layer whenever the arrays move layers around.
+        if (texturesPending || textureArrays.generation() != arrayGeneration)
+        {
+            bool wasPending = texturesPending;
+            if (texturesPending)
+            {
+                texturesPending = textures.update() > 0;
+                for (size_t i = 0; i < bodyCount; ++i)
+                {
+                    if (bodyVirtualTexture[i] >= 0 || gpuBody[i] || bodyArrayEntry[i] >= 0 || !textures.resident(bodyTextures[i].texture))
+                        continue;
+                    bodyArrayEntry[i] = textureArrays.add(bodyTextures[i].texture);
+                    if (bodyArrayEntry[i] >= 0)
+                        textures.release(bodyTextures[i]);
+                }
+            }
+            arrayGeneration = textureArrays.generation();
+            for (size_t i = 0; i < bodyCount; ++i)
+            {
+                if (bodyVirtualTexture[i] >= 0)
+                    continue;
+                BodyArchetype &archetype = bodies.archetypeOf(bodyHandles[i]);
+                size_t row = bodies.rowOf(bodyHandles[i]);
+                if (bodyArrayEntry[i] >= 0)
+                {
+                    archetype.texture[row] = textureArrays.texture(bodyArrayEntry[i]);
+                    archetype.textureLayer[row] = textureArrays.layer(bodyArrayEntry[i]);
+                }
+                else
+                    archetype.texture[row] = textures.bindable(bodyTextures[i]);
+            }
+            skyboxTexture = textures.bindable(cubemapTexture);
+            recordGpuOrbitCommands();
+            if (wasPending && !texturesPending)
+            {
+                std::cout << "textures resident " << (glfwGetTime() - startupStart) * 1e3 << " ms after start" << std::endl;
+                textures.printTimings(std::cout);
+            }
+        }
+        // tiles asked for by the feedback of a frame or two ago
+        virtualTextures.update();
+        frameGraph.run(jobs);
+
+        if (gpuOrbitMode)
+        {
+            gpuOrbitFrame.clear();
+            gpuOrbitFrame.useProgram(gpuOrbits.program());
+            gpuOrbitFrame.uniformMatrix(gpuOrbits.viewLocation(), view);
+            gpuOrbitFrame.uniformMatrix(gpuOrbits.projectionLocation(), projection);
+            gpuOrbitFrame.uniformFloat(gpuOrbits.timeLocation(), gpuOrbits.shaderTime(frameSnapshot->time));
+            glm::vec3 orbitOrigin, orbitCamera;
+            GpuOrbits::splitCamera(camera.Position, orbitOrigin, orbitCamera);
+            gpuOrbitFrame.uniformVec3(gpuOrbits.originLocation(), orbitOrigin);
+            gpuOrbitFrame.uniformVec3(gpuOrbits.cameraLocation(), orbitCamera);
+        }
+
+        // the instance matrices go up first, then the passes in order
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.models.size() * sizeof(glm::mat4), instances.models.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceLayerVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.layers.size() * sizeof(float), instances.layers.data(), GL_STREAM_DRAW);
+        replayCommands(skyboxCommands, &replayStats);
+        for (const CommandList &list : bodyCommands)
+            replayCommands(list, &replayStats);
+        if (virtualTextures.size() > 0)
+        {
+            virtualTextures.beginFeedback();
+            replayCommands(feedbackCommands, &replayStats);
+            virtualTextures.endFeedback();
+        }
+        if (gpuOrbitMode)
+        {
+            replayCommands(gpuOrbitFrame, &replayStats);
+            replayCommands(gpuOrbitCommands, &replayStats);
+        }
+
+        if (offscreen)
+            blitToWindow(renderTarget);
         glfwSwapBuffers(window);
         glfwPollEvents();
+
+        if (firstFrame)
+        {
+            double startupFrame = glfwGetTime();
+            std::cout << "startup: window and GL " << (startupWindow - startupStart) * 1e3 << " ms, scene setup "
+                      << (startupScene - startupWindow) * 1e3 << " ms, first frame " << (startupFrame - startupScene) * 1e3
+                      << " ms, total " << (startupFrame - startupStart) * 1e3 << " ms" << std::endl;
+            firstFrame = false;
+        }
     }
 
+    simulationThread.stop();
+    textures.stop();
+    if (virtualTextures.size() > 0)
+        virtualTextures.printStats(std::cout);
+    virtualTextures.destroy();
+    if (textureArrays.supported())
+        textureArrays.printStats(std::cout);
+    textureArrays.destroy();
+    gpuOrbits.destroy();
+    destroyRenderTarget(renderTarget);
     // Shutdown GLFW
     glfwTerminate();
 
@@ -358,6 +698,78 @@ void processInput(GLFWwindow *window)
         camera.ProcessKeyboard(LEFT, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         camera.ProcessKeyboard(RIGHT, deltaTime);
+
+    // timeline scrubbing, [ rewinds and ] fast-forwards
+    if (glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS)
+        simulationThread.seek(simulationThread.latest().time - SCRUB_SPEED * deltaTime);
+    if (glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS)
+        simulationThread.seek(simulationThread.latest().time + SCRUB_SPEED * deltaTime);
+
+    // list the eclipses and occultations of the next simulated minute, once per key press
+    static bool occlusionKeyDown = false;
+    bool occlusionKey = glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS;
+    if (occlusionKey && !occlusionKeyDown)
+        printOcclusions(60.0);
+    occlusionKeyDown = occlusionKey;
+
+    // closest approaches of the next simulated minute
+    static bool approachKeyDown = false;
+    bool approachKey = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (approachKey && !approachKeyDown)
+        printClosestApproaches(60.0, 2.0);
+    approachKeyDown = approachKey;
+}
+
+// prints every time two bodies' surfaces come within threshold of each other over the next span seconds
+// ------------------------------------------------------------------------------------------------------
+void printClosestApproaches(double span, double threshold)
+{
+    std::vector<TrajectoryBody> bodies;
+    for (size_t i = 0; i < simulation.bodies.size(); ++i)
+        bodies.push_back({simulation.bodies[i].radius, simulation.maxSpeed(static_cast<int>(i))});
+
+    ApproachQuery query;
+    query.startTime = simulationThread.latest().time;
+    query.endTime = query.startTime + span;
+    query.threshold = threshold;
+
+    std::vector<ApproachEvent> events = findClosestApproaches(bodies, [](int body, double t)
+                                                              { return simulation.bodyPositionAt(body, t); },
+                                                              query);
+    std::cout << "closest approaches, t = " << query.startTime << " to " << query.endTime << std::endl;
+    for (const ApproachEvent &event : events)
+        std::cout << "  " << simulation.bodies[event.a].name << " - " << simulation.bodies[event.b].name
+                  << " at " << event.time << ", distance " << event.distance << std::endl;
+}
+
+// prints the occultations seen from the camera and the eclipses cast by the sun over the next span seconds
+// ---------------------------------------------------------------------------------------------------------
+void printOcclusions(double span)
+{
+    std::vector<TrajectoryBody> bodies;
+    for (size_t i = 0; i < simulation.bodies.size(); ++i)
+        bodies.push_back({simulation.bodies[i].radius, simulation.maxSpeed(static_cast<int>(i))});
+    BodyPositionFunction position = [](int body, double t)
+    { return simulation.bodyPositionAt(body, t); };
+
+    OcclusionQuery query;
+    query.startTime = simulationThread.latest().time;
+    query.endTime = query.startTime + span;
+    query.observerPosition = glm::dvec3(camera.Position);
+
+    const char *kinds[] = {"partial", "total", "annular"};
+    std::vector<OcclusionEvent> occultations = findOcclusions(bodies, position, query);
+    std::cout << "occultations seen from the camera, t = " << query.startTime << " to " << query.endTime << std::endl;
+    for (const OcclusionEvent &event : occultations)
+        std::cout << "  " << simulation.bodies[event.front].name << " in front of " << simulation.bodies[event.back].name
+                  << " (" << kinds[event.kind] << ") " << event.start << " - " << event.end << ", max " << event.maximum << std::endl;
+
+    query.observerBody = SUN;
+    std::vector<OcclusionEvent> eclipses = findOcclusions(bodies, position, query);
+    std::cout << "eclipses" << std::endl;
+    for (const OcclusionEvent &event : eclipses)
+        std::cout << "  " << simulation.bodies[event.front].name << " shadows " << simulation.bodies[event.back].name
+                  << " (" << kinds[event.kind] << ") " << event.start << " - " << event.end << ", max " << event.maximum << std::endl;
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -390,27 +802,56 @@ void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(static_cast<float>(yoffset));
 }
 
-void drawSphere(GLuint shaderProgram,
-                GLuint vao,
-                GLsizei indexCount,
-                const glm::mat4 &model,
-                const glm::mat4 &view,
-                const glm::mat4 &projection,
-                GLuint textureID)
+// records the draws of batches [firstBatch, lastBatch): per batch the lod mesh, its model matrices
+// in the instance buffer (GL 3.3 has no base instance, so the attributes are pointed there instead)
+// and its texture, then one instanced draw. Batches of a virtual textured map use its program,
+// batches of a texture array its program and the layers next to the matrices.
+void recordSphereInstances(CommandList &list,
+                           const BodyInstances &instances,
+                           size_t firstBatch,
+                           size_t lastBatch,
+                           const GLuint *vaos,
+                           const GLsizei *indexCounts,
+                           GLuint instanceBuffer,
+                           GLuint layerBuffer,
+                           GLuint sphereProgram,
+                           const VirtualTextures &virtualTextures,
+                           const TextureArrays &textureArrays)
 {
-    glUseProgram(shaderProgram);
-
-    // Set transformation matrices
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
-
-    // Texture binding (if 0, acts like "no texture")
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glUniform1i(glGetUniformLocation(shaderProgram, "baseTexture"), 0);
+    for (size_t i = firstBatch; i < lastBatch; ++i)
+    {
+        const BodyInstances::Batch &batch = instances.batches[i];
+        bool array = textureArrays.contains(batch.texture);
+        list.useProgram(array ? textureArrays.program() : virtualTextures.find(batch.texture) >= 0 ? virtualTextures.program() : sphereProgram);
+        list.bindVertexArray(vaos[batch.lod]);
+        list.instanceMatrices(instanceBuffer, 3, batch.first * sizeof(glm::mat4));
+        // every batch, so the attribute never reads past the end of the buffer
+        list.instanceFloats(layerBuffer, 7, batch.first * sizeof(float));
+        // Texture binding (if 0, acts like "no texture")
+        list.bindTexture(array ? TEXTURE_TARGET_2D_ARRAY : TEXTURE_TARGET_2D, 0, batch.texture);
+        list.drawElementsInstanced(static_cast<uint32_t>(indexCounts[batch.lod]), batch.count);
+    }
+}
 
-    // Draw the sphere
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
+// the feedback pass of the virtual textures: every batch, so ordinary bodies still hide what's
+// behind them, tagged with its map (0 for none). Only maps sample their texture.
+void recordFeedbackInstances(CommandList &list,
+                             const BodyInstances &instances,
+                             const GLuint *vaos,
+                             const GLsizei *indexCounts,
+                             GLuint instanceBuffer,
+                             GLuint layerBuffer,
+                             const VirtualTextures &virtualTextures)
+{
+    for (const BodyInstances::Batch &batch : instances.batches)
+    {
+        list.bindVertexArray(vaos[batch.lod]);
+        list.instanceMatrices(instanceBuffer, 3, batch.first * sizeof(glm::mat4));
+        list.instanceFloats(layerBuffer, 7, batch.first * sizeof(float));
+        int map = virtualTextures.find(batch.texture);
+        if (map >= 0)
+            list.bindTexture(TEXTURE_TARGET_2D, 0, batch.texture);
+        list.uniformInt(virtualTextures.feedbackBodyLocation(), map + 1);
+        list.drawElementsInstanced(static_cast<uint32_t>(indexCounts[batch.lod]), batch.count);
+    }
 }
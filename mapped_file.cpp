@@ -0,0 +1,151 @@
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapped_file.h"
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::openRead(const std::string &path)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER size;
+    GetFileSizeEx(file, &size);
+    fileHandle = file;
+    mappingSize = static_cast<size_t>(size.QuadPart);
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close();
+        return false;
+    }
+    mappingSize = static_cast<size_t>(info.st_size);
+#endif
+    if (mappingSize == 0 || !map(false))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::create(const std::string &path, size_t size)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Error::MappedFile could not create file:" << path << std::endl;
+        return false;
+    }
+    fileHandle = file;
+#else
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        std::cerr << "Error::MappedFile could not create file:" << path << std::endl;
+        return false;
+    }
+#endif
+    writable = true;
+    if (!resize(size))
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool MappedFile::resize(size_t size)
+{
+    if (!writable || size == 0)
+        return false;
+
+    unmap();
+#ifdef _WIN32
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(fileHandle, end, NULL, FILE_BEGIN) || !SetEndOfFile(fileHandle))
+        return false;
+#else
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        return false;
+#endif
+    mappingSize = size;
+    return map(true);
+}
+
+bool MappedFile::map(bool write)
+{
+#ifdef _WIN32
+    HANDLE fileMapping = CreateFileMappingA(fileHandle, NULL, write ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+    void *view = fileMapping ? MapViewOfFile(fileMapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (!view)
+    {
+        if (fileMapping)
+            CloseHandle(fileMapping);
+        std::cerr << "Error::MappedFile could not map file" << std::endl;
+        return false;
+    }
+    mappingHandle = fileMapping;
+#else
+    void *view = mmap(NULL, mappingSize, write ? PROT_READ | PROT_WRITE : PROT_READ, write ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        std::cerr << "Error::MappedFile could not map file" << std::endl;
+        return false;
+    }
+#endif
+    mapping = view;
+    return true;
+}
+
+void MappedFile::unmap()
+{
+    if (!mapping)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(mappingHandle);
+    mappingHandle = nullptr;
+#else
+    munmap(mapping, mappingSize);
+#endif
+    mapping = nullptr;
+}
+
+void MappedFile::close()
+{
+    unmap();
+#ifdef _WIN32
+    if (fileHandle)
+        CloseHandle(fileHandle);
+    fileHandle = nullptr;
+#else
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+#endif
+    mappingSize = 0;
+    writable = false;
+}
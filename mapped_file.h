@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// A file mapped into memory, either read-only or as a growable read-write scratch file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // maps an existing file read-only, returns false if it is missing or empty
+    bool openRead(const std::string &path);
+    // creates (or truncates) a file of the given size and maps it read-write
+    bool create(const std::string &path, size_t size);
+    // grows or shrinks a read-write mapping, the base address may change
+    bool resize(size_t size);
+    void close();
+
+    bool isOpen() const { return mapping != nullptr; }
+    const char *data() const { return static_cast<const char *>(mapping); }
+    char *data() { return static_cast<char *>(mapping); }
+    size_t size() const { return mappingSize; }
+
+private:
+    bool map(bool writable);
+    void unmap();
+
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    bool writable = false;
+#ifdef _WIN32
+    void *fileHandle = nullptr;
+    void *mappingHandle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,381 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <sys/stat.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "mipmaps.h"
+#include "jobs.h"
+
+int MipChain::mipLevelCount(int width, int height)
+{
+    int levels = 1;
+    for (int size = std::max(width, height); size > 1; size >>= 1)
+        levels++;
+    return levels;
+}
+
+size_t MipChain::levelOffset(int width, int height, int channels, int level, TextureCompression compression)
+{
+    size_t offset = 0;
+    for (int l = 0; l < level; ++l)
+    {
+        size_t w = levelWidth(width, l), h = levelWidth(height, l);
+        if (compression == COMPRESSION_NONE)
+            offset += w * h * size_t(channels);
+        else
+            offset += ((w + 3) / 4) * ((h + 3) / 4) * (compression == COMPRESSION_BC1 ? 8 : 16); // partial blocks at the edges
+    }
+    return offset;
+}
+
+// sRGB <-> linear. Decoding has one entry per byte; encoding is looked up from the linear value
+// quantized to 14 bits, which is within half a step of the exact curve even near black.
+const int LINEAR_STEPS = 16384;
+
+struct SrgbTables
+{
+    float toLinear[256];
+    unsigned char toSrgb[LINEAR_STEPS + 1];
+
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            double s = i / 255.0;
+            toLinear[i] = static_cast<float>(s <= 0.04045 ? s / 12.92 : pow((s + 0.055) / 1.055, 2.4));
+        }
+        for (int i = 0; i <= LINEAR_STEPS; ++i)
+        {
+            double l = double(i) / LINEAR_STEPS;
+            double s = l <= 0.0031308 ? l * 12.92 : 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+            toSrgb[i] = static_cast<unsigned char>(lround(s * 255.0));
+        }
+    }
+};
+
+static const SrgbTables &srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+static bool isAlpha(int channel, int channels)
+{
+    return (channels == 2 && channel == 1) || (channels == 4 && channel == 3);
+}
+
+// one float plane per channel
+struct Planes
+{
+    int width = 0, height = 0;
+    std::vector<std::vector<float>> channel;
+
+    void resize(int w, int h, int channels)
+    {
+        width = w;
+        height = h;
+        channel.resize(channels);
+        for (std::vector<float> &plane : channel)
+            plane.resize(size_t(w) * size_t(h));
+    }
+};
+
+// 8 taps for a 2:1 reduction: input pixel 2x - 3 + k for output pixel x, half-width 4 input pixels
+struct KaiserWeights
+{
+    float tap[8];
+
+    KaiserWeights()
+    {
+        const double beta = 4.0, halfWidth = 4.0;
+        auto besselI0 = [](double x)
+        {
+            double sum = 1.0, term = 1.0;
+            for (int k = 1; k < 32; ++k)
+            {
+                term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                sum += term;
+            }
+            return sum;
+        };
+        double total = 0.0, weight[8];
+        for (int k = 0; k < 8; ++k)
+        {
+            // distance from the output pixel's center (input coordinate 2x + 1) to input pixel 2x - 3 + k's
+            double d = k - 3.5;
+            double t = d / 2.0; // in output pixels, the sinc cuts off at the output's Nyquist
+            double sinc = std::fabs(t) < 1e-9 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+            double r = d / halfWidth;
+            weight[k] = sinc * besselI0(beta * sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(beta);
+            total += weight[k];
+        }
+        for (int k = 0; k < 8; ++k)
+            tap[k] = static_cast<float>(weight[k] / total);
+    }
+};
+
+static const KaiserWeights &kaiserWeights()
+{
+    static const KaiserWeights weights;
+    return weights;
+}
+
+// output rows [first, last) of a box reduction, edges clamped for odd sizes
+static void boxRows(const float *in, int inWidth, int inHeight, float *out, int outWidth, int first, int last)
+{
+    for (int y = first; y < last; ++y)
+    {
+        const float *row0 = in + size_t(std::min(2 * y, inHeight - 1)) * inWidth;
+        const float *row1 = in + size_t(std::min(2 * y + 1, inHeight - 1)) * inWidth;
+        float *dst = out + size_t(y) * outWidth;
+        int x = 0;
+#if defined(__AVX2__)
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        for (; 2 * (x + 8) <= inWidth; x += 8)
+        {
+            __m256 lo = _mm256_add_ps(_mm256_loadu_ps(row0 + 2 * x), _mm256_loadu_ps(row1 + 2 * x));
+            __m256 hi = _mm256_add_ps(_mm256_loadu_ps(row0 + 2 * x + 8), _mm256_loadu_ps(row1 + 2 * x + 8));
+            // hadd pairs up within 128-bit lanes, the permute puts the four quarters back in order
+            __m256 pairs = _mm256_hadd_ps(lo, hi);
+            pairs = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(pairs), _MM_SHUFFLE(3, 1, 2, 0)));
+            _mm256_storeu_ps(dst + x, _mm256_mul_ps(pairs, quarter));
+        }
+#endif
+        for (; x < outWidth; ++x)
+        {
+            int x0 = std::min(2 * x, inWidth - 1), x1 = std::min(2 * x + 1, inWidth - 1);
+            dst[x] = 0.25f * (row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+        }
+    }
+}
+
+// output rows [first, last) of a separable Kaiser reduction: 8 input rows blended into scratch,
+// then 8 taps across. Edges clamped.
+static void kaiserRows(const float *in, int inWidth, int inHeight, float *out, int outWidth, int first, int last, std::vector<float> &scratch)
+{
+    const float *w = kaiserWeights().tap;
+    scratch.resize(inWidth);
+    float *blended = scratch.data();
+    for (int y = first; y < last; ++y)
+    {
+        const float *rows[8];
+        for (int k = 0; k < 8; ++k)
+            rows[k] = in + size_t(std::clamp(2 * y - 3 + k, 0, inHeight - 1)) * inWidth;
+
+        int i = 0;
+#if defined(__AVX2__)
+        for (; i + 8 <= inWidth; i += 8)
+        {
+            __m256 sum = _mm256_mul_ps(_mm256_set1_ps(w[0]), _mm256_loadu_ps(rows[0] + i));
+            for (int k = 1; k < 8; ++k)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(w[k]), _mm256_loadu_ps(rows[k] + i)));
+            _mm256_storeu_ps(blended + i, sum);
+        }
+#endif
+        for (; i < inWidth; ++i)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 8; ++k)
+                sum += w[k] * rows[k][i];
+            blended[i] = sum;
+        }
+
+        float *dst = out + size_t(y) * outWidth;
+        auto scalar = [&](int x)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < 8; ++k)
+                sum += w[k] * blended[std::clamp(2 * x - 3 + k, 0, inWidth - 1)];
+            dst[x] = sum;
+        };
+        // the first two outputs reach left of the image
+        int x = 0;
+        for (; x < std::min(2, outWidth); ++x)
+            scalar(x);
+#if defined(__AVX2__)
+        // 8 outputs read inputs 2x - 3 to 2x + 19: every other one of 16 consecutive floats per tap
+        for (; 2 * x + 20 <= inWidth; x += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < 8; ++k)
+            {
+                const float *src = blended + 2 * x - 3 + k;
+                __m256 evens = _mm256_shuffle_ps(_mm256_loadu_ps(src), _mm256_loadu_ps(src + 8), _MM_SHUFFLE(2, 0, 2, 0));
+                evens = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(evens), _MM_SHUFFLE(3, 1, 2, 0)));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(w[k]), evens));
+            }
+            _mm256_storeu_ps(dst + x, sum);
+        }
+#endif
+        for (; x < outWidth; ++x)
+            scalar(x);
+    }
+}
+
+void buildMipChain(const unsigned char *pixels, int width, int height, int channels, MipFilter filter, JobSystem &jobs, MipChain &out)
+{
+    out.width = width;
+    out.height = height;
+    out.channels = channels;
+    out.data.resize(MipChain::levelOffset(width, height, channels, out.levels()));
+    memcpy(out.data.data(), pixels, size_t(width) * size_t(height) * size_t(channels));
+    buildMipLevels(out.data.data(), width, height, channels, filter, jobs);
+}
+
+void buildMipLevels(unsigned char *chain, int width, int height, int channels, MipFilter filter, JobSystem &jobs)
+{
+    const SrgbTables &tables = srgbTables();
+    const int levels = MipChain::mipLevelCount(width, height);
+    const unsigned char *pixels = chain;
+
+    // rows per job: about 16k pixels
+    auto grainFor = [](int rowWidth)
+    { return size_t(std::max(1, 16384 / std::max(1, rowWidth))); };
+
+    Planes current, next;
+    current.resize(width, height, channels);
+    jobs.parallelFor(0, size_t(height), grainFor(width), [&](size_t first, size_t last)
+                     {
+                         for (size_t y = first; y < last; ++y)
+                         {
+                             const unsigned char *src = pixels + y * width * channels;
+                             for (int c = 0; c < channels; ++c)
+                             {
+                                 float *dst = current.channel[c].data() + y * width;
+                                 if (isAlpha(c, channels))
+                                     for (int x = 0; x < width; ++x)
+                                         dst[x] = src[x * channels + c] * (1.0f / 255.0f);
+                                 else
+                                     for (int x = 0; x < width; ++x)
+                                         dst[x] = tables.toLinear[src[x * channels + c]];
+                             }
+                         } });
+
+    // each level from the one above it: levels run in order, the rows of a level in parallel
+    for (int level = 1; level < levels; ++level)
+    {
+        int w = MipChain::levelWidth(width, level), h = MipChain::levelWidth(height, level);
+        next.resize(w, h, channels);
+        jobs.parallelFor(0, size_t(h), grainFor(current.width), [&](size_t first, size_t last)
+                         {
+                             std::vector<float> scratch;
+                             for (int c = 0; c < channels; ++c)
+                             {
+                                 if (filter == MIP_FILTER_KAISER)
+                                     kaiserRows(current.channel[c].data(), current.width, current.height, next.channel[c].data(), w, int(first), int(last), scratch);
+                                 else
+                                     boxRows(current.channel[c].data(), current.width, current.height, next.channel[c].data(), w, int(first), int(last));
+                             }
+                         });
+
+        unsigned char *levelData = chain + MipChain::levelOffset(width, height, channels, level);
+        jobs.parallelFor(0, size_t(h), grainFor(w), [&](size_t first, size_t last)
+                         {
+                             for (size_t y = first; y < last; ++y)
+                             {
+                                 unsigned char *dst = levelData + y * w * channels;
+                                 for (int c = 0; c < channels; ++c)
+                                 {
+                                     // the Kaiser lobes can overshoot [0, 1]
+                                     const float *src = next.channel[c].data() + y * w;
+                                     bool alpha = isAlpha(c, channels);
+                                     for (int x = 0; x < w; ++x)
+                                     {
+                                         float v = std::min(std::max(src[x], 0.0f), 1.0f);
+                                         dst[x * channels + c] = alpha ? static_cast<unsigned char>(v * 255.0f + 0.5f)
+                                                                       : tables.toSrgb[static_cast<int>(v * LINEAR_STEPS + 0.5f)];
+                                     }
+                                 }
+                             } });
+        std::swap(current, next);
+    }
+}
+
+std::string mipCachePath(const std::string &source)
+{
+    return source + ".mips";
+}
+
+static bool sourceStamp(const std::string &source, uint64_t &size, int64_t &time)
+{
+    struct stat info;
+    if (stat(source.c_str(), &info) != 0)
+        return false;
+    size = static_cast<uint64_t>(info.st_size);
+    time = static_cast<int64_t>(info.st_mtime);
+    return true;
+}
+
+bool mipCacheValid(const std::string &source, MipFilter filter, TextureCompression compression, MipCacheHeader &header)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!sourceStamp(source, sourceSize, sourceTime))
+        return false;
+    FILE *file = fopen(mipCachePath(source).c_str(), "rb");
+    if (!file)
+        return false;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1;
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fclose(file);
+    return valid && memcmp(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC)) == 0 && header.version == MIP_CACHE_VERSION &&
+           header.filter == filter && header.compression == compression && header.sourceSize == sourceSize && header.sourceTime == sourceTime &&
+           header.levels == uint32_t(MipChain::mipLevelCount(header.width, header.height)) &&
+           header.dataSize == MipChain::levelOffset(header.width, header.height, header.channels, header.levels, compression) &&
+           uint64_t(fileSize) == sizeof(header) + header.dataSize; // not cut short
+}
+
+bool readMipCache(const std::string &source, unsigned char *destination, size_t size)
+{
+    FILE *file = fopen(mipCachePath(source).c_str(), "rb");
+    if (!file)
+        return false;
+    bool read = fseek(file, sizeof(MipCacheHeader), SEEK_SET) == 0 && fread(destination, 1, size, file) == size;
+    fclose(file);
+    return read;
+}
+
+bool writeMipCache(const std::string &source, MipFilter filter, const MipChain &chain, const unsigned char *data)
+{
+    size_t dataSize = data ? MipChain::levelOffset(chain.width, chain.height, chain.channels, chain.levels(), chain.compression) : chain.data.size();
+    if (!data)
+        data = chain.data.data();
+    MipCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MIP_CACHE_MAGIC, sizeof(MIP_CACHE_MAGIC));
+    header.version = MIP_CACHE_VERSION;
+    header.filter = filter;
+    header.width = chain.width;
+    header.height = chain.height;
+    header.channels = chain.channels;
+    header.levels = chain.levels();
+    header.compression = chain.compression;
+    header.dataSize = dataSize;
+    header.psnr = chain.psnr;
+    if (!sourceStamp(source, header.sourceSize, header.sourceTime))
+        return false;
+
+    std::string path = mipCachePath(source);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        std::cerr << "Error::Mipmaps could not write cache " << path << std::endl;
+        return false;
+    }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(data, 1, dataSize, file) == dataSize;
+    written = fclose(file) == 0 && written;
+    if (!written)
+    {
+        std::cerr << "Error::Mipmaps could not write cache " << path << std::endl;
+        remove(path.c_str()); // a partial file would be rejected anyway
+    }
+    return written;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class JobSystem;
+
+enum MipFilter : uint32_t
+{
+    MIP_FILTER_BOX = 0,   // 2x2 average, the cheapest
+    MIP_FILTER_KAISER = 1 // 8x8 Kaiser-windowed sinc, sharper and less aliasing than the box
+};
+
+// How the levels are stored, see block_compress.h
+enum TextureCompression : uint32_t
+{
+    COMPRESSION_NONE = 0, // 8 bits per channel
+    COMPRESSION_BC1 = 1,  // 4x4 blocks of 8 bytes, RGB
+    COMPRESSION_BC7 = 2   // 4x4 blocks of 16 bytes, RGBA
+};
+
+// Every level of an 8-bit image down to 1x1, packed back to back from level 0 (rows tightly
+// packed, upload with GL_UNPACK_ALIGNMENT 1), or every level block-compressed. Filtering happens
+// in linear light: colour channels are sRGB, alpha (the last of 2 or 4 channels) is linear already.
+struct MipChain
+{
+    int width = 0, height = 0, channels = 0;
+    TextureCompression compression = COMPRESSION_NONE;
+    double psnr = 0.0; // of level 0 after compression, in dB
+    std::vector<unsigned char> data;
+
+    int levels() const { return mipLevelCount(width, height); }
+    static int mipLevelCount(int width, int height);
+    static int levelWidth(int width, int level) { return width >> level > 0 ? width >> level : 1; }
+    // where a level starts in data, and the size of the whole chain for level == levels
+    static size_t levelOffset(int width, int height, int channels, int level, TextureCompression compression = COMPRESSION_NONE);
+};
+
+// builds the chain of pixels (width * height * channels, tightly packed), rows of each level are
+// split over jobs. Level 0 is a copy of pixels.
+void buildMipChain(const unsigned char *pixels, int width, int height, int channels, MipFilter filter, JobSystem &jobs, MipChain &out);
+// same, in place: level 0 is already at the start of chain (MipChain::levelOffset(..., levels)
+// bytes), the levels after it are filled in. Level 0 is read once, the other levels only written.
+void buildMipLevels(unsigned char *chain, int width, int height, int channels, MipFilter filter, JobSystem &jobs);
+
+// Mip chains are cached next to their image (path + ".mips") and rebuilt only when the image
+// changes, by its size and modification time, or when a different filter or compression is asked for.
+// Layout (little-endian): MipCacheHeader, then the chain as in MipChain::data.
+const char MIP_CACHE_MAGIC[8] = {'S', 'P', 'C', 'M', 'I', 'P', '0', '1'};
+const uint32_t MIP_CACHE_VERSION = 2;
+
+struct MipCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t filter;
+    uint32_t width, height, channels;
+    uint32_t levels;
+    uint32_t compression;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    uint64_t dataSize;
+    double psnr;
+};
+
+std::string mipCachePath(const std::string &source);
+// true if the cache of source is up to date and was built with filter and compression, header is filled in
+bool mipCacheValid(const std::string &source, MipFilter filter, TextureCompression compression, MipCacheHeader &header);
+// reads the chain of a valid cache into destination (header.dataSize bytes)
+bool readMipCache(const std::string &source, unsigned char *destination, size_t size);
+// the chain's bytes are chain.data, or data when given (a chain built elsewhere, chain then only describes it)
+bool writeMipCache(const std::string &source, MipFilter filter, const MipChain &chain, const unsigned char *data = nullptr);
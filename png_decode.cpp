@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "png_decode.h"
+#include "stb_image.h"
+#include "jobs.h"
+
+static thread_local const char *failureReason = "";
+
+static bool fail(const char *reason)
+{
+    failureReason = reason;
+    return false;
+}
+
+const char *pngFailureReason()
+{
+    return failureReason;
+}
+
+static uint32_t read32(const uint8_t *p)
+{
+    return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+struct Png
+{
+    int width = 0, height = 0, components = 0;
+    bool supported = false, transparency = false;
+    std::vector<const uint8_t *> idat; // the compressed stream, in pieces
+    std::vector<uint32_t> idatSize;
+};
+
+// the header and where the IDAT chunks are; supported is false, with the size filled in, for a
+// file decodePng can't do
+static bool readChunks(const uint8_t *data, size_t size, Png &png)
+{
+    static const uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    if (size < 8 + 25 || memcmp(data, SIGNATURE, 8) != 0)
+        return fail("not a png");
+    const uint8_t *p = data + 8, *end = data + size;
+    bool header = false;
+    while (end - p >= 12)
+    {
+        uint32_t length = read32(p);
+        const uint8_t *type = p + 4, *chunk = p + 8;
+        if (length > uint32_t(end - chunk) - 4)
+            return fail("truncated");
+        if (memcmp(type, "IHDR", 4) == 0)
+        {
+            if (length < 13)
+                return fail("bad header");
+            header = true;
+            png.width = int(std::min(read32(chunk), uint32_t(INT_MAX)));
+            png.height = int(std::min(read32(chunk + 4), uint32_t(INT_MAX)));
+            int depth = chunk[8], colour = chunk[9], interlace = chunk[12];
+            png.components = colour == 0 ? 1 : colour == 4 ? 2 : colour == 2 ? 3 : colour == 6 ? 4 : 0;
+            png.supported = png.width > 0 && png.height > 0 && depth == 8 && png.components && chunk[10] == 0 && chunk[11] == 0 && interlace == 0;
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            png.idat.push_back(chunk);
+            png.idatSize.push_back(length);
+        }
+        else if (memcmp(type, "tRNS", 4) == 0)
+            png.transparency = true;
+        else if (memcmp(type, "IEND", 4) == 0)
+            break;
+        p = chunk + length + 4; // past the CRC
+    }
+    if (!header)
+        return fail("no header");
+    png.supported = png.supported && !png.transparency; // stb_image makes that a colour key to alpha
+    return true;
+}
+
+bool readPngInfo(const unsigned char *data, size_t size, PngInfo &info)
+{
+    Png png;
+    if (!readChunks(data, size, png))
+        return false;
+    info.width = png.width;
+    info.height = png.height;
+    info.components = png.components;
+    info.supported = png.supported;
+    return true;
+}
+
+static inline uint8_t paeth(int left, int up, int upLeft)
+{
+    int estimate = left + up - upLeft;
+    int a = abs(estimate - left), b = abs(estimate - up), c = abs(estimate - upLeft);
+    return uint8_t(a <= b && a <= c ? left : b <= c ? up : upLeft);
+}
+
+// one row in place, previous is the row above already unfiltered (null for the first)
+static bool unfilterRow(int filter, uint8_t *row, const uint8_t *previous, size_t length, int bpp)
+{
+    switch (filter)
+    {
+    case 0: // none
+        return true;
+    case 1: // sub
+        for (size_t i = bpp; i < length; ++i)
+            row[i] = uint8_t(row[i] + row[i - bpp]);
+        return true;
+    case 2: // up
+        if (previous)
+            for (size_t i = 0; i < length; ++i)
+                row[i] = uint8_t(row[i] + previous[i]);
+        return true;
+    case 3: // average
+        for (size_t i = 0; i < length; ++i)
+        {
+            int left = i >= size_t(bpp) ? row[i - bpp] : 0, up = previous ? previous[i] : 0;
+            row[i] = uint8_t(row[i] + ((left + up) >> 1));
+        }
+        return true;
+    case 4: // paeth
+        for (size_t i = 0; i < length; ++i)
+        {
+            int left = i >= size_t(bpp) ? row[i - bpp] : 0, up = previous ? previous[i] : 0;
+            int upLeft = previous && i >= size_t(bpp) ? previous[i - bpp] : 0;
+            row[i] = uint8_t(row[i] + paeth(left, up, upLeft));
+        }
+        return true;
+    }
+    return fail("bad filter");
+}
+
+// a row of the file's components to channels, as stb_image converts them
+static void convertRow(const uint8_t *in, int components, uint8_t *out, int channels, int width)
+{
+    if (components == channels)
+    {
+        memcpy(out, in, size_t(width) * channels);
+        return;
+    }
+    for (int x = 0; x < width; ++x, in += components, out += channels)
+    {
+        int r = in[0], g = components >= 3 ? in[1] : r, b = components >= 3 ? in[2] : r;
+        int alpha = components == 2 ? in[1] : components == 4 ? in[3] : 255;
+        if (channels <= 2)
+        {
+            out[0] = uint8_t(components >= 3 ? (r * 77 + g * 150 + b * 29) >> 8 : r);
+            if (channels == 2)
+                out[1] = uint8_t(alpha);
+        }
+        else
+        {
+            out[0] = uint8_t(r);
+            out[1] = uint8_t(g);
+            out[2] = uint8_t(b);
+            if (channels == 4)
+                out[3] = uint8_t(alpha);
+        }
+    }
+}
+
+bool decodePng(const unsigned char *data, size_t size, int channels,
+               unsigned char *destination, size_t capacity, int *width, int *height, JobSystem *jobs)
+{
+    if (channels < 0 || channels > 4)
+        return fail("bad channel count");
+    Png png;
+    if (!readChunks(data, size, png))
+        return false;
+    if (!png.supported)
+        return fail("unsupported png");
+    int outChannels = channels ? channels : png.components;
+    if (size_t(png.width) * png.height * outChannels > capacity)
+        return fail("image doesn't fit the destination");
+    size_t rowBytes = size_t(png.width) * png.components, stride = rowBytes + 1; // each row starts with its filter
+    size_t rawSize = stride * png.height;
+    if (rawSize > size_t(INT_MAX))
+        return fail("too large");
+
+    // one piece of compressed stream to inflate, IDAT chunks are usually split at a fixed size
+    std::vector<uint8_t> joined;
+    const uint8_t *compressed = png.idat.empty() ? nullptr : png.idat[0];
+    size_t compressedSize = png.idat.empty() ? 0 : png.idatSize[0];
+    if (png.idat.size() > 1)
+    {
+        for (size_t i = 0; i < png.idat.size(); ++i)
+            joined.insert(joined.end(), png.idat[i], png.idat[i] + png.idatSize[i]);
+        compressed = joined.data();
+        compressedSize = joined.size();
+    }
+    if (!compressed || compressedSize > size_t(INT_MAX))
+        return fail("no image data");
+    std::vector<uint8_t> raw(rawSize);
+    int inflated = stbi_zlib_decode_buffer(reinterpret_cast<char *>(raw.data()), int(rawSize),
+                                           reinterpret_cast<const char *>(compressed), int(compressedSize));
+    if (inflated != int(rawSize))
+        return fail("corrupt image data");
+    std::vector<uint8_t>().swap(joined);
+
+    // runs of rows starting at a row that doesn't read the one above, merged into pieces of work
+    // big enough to be worth a job
+    int threads = jobs ? jobs->threadCount() : 1;
+    int minimumRows = std::max(16, png.height / (threads * 4));
+    std::vector<int> starts{0};
+    for (int y = 1; y < png.height; ++y)
+        if (raw[y * stride] <= 1 && y - starts.back() >= minimumRows)
+            starts.push_back(y);
+    starts.push_back(png.height);
+
+    int bpp = png.components;
+    std::atomic<bool> ok{true};
+    auto unfilterRows = [&](size_t first, size_t last)
+    {
+        for (size_t run = first; run < last; ++run)
+            for (int y = starts[run]; y < starts[run + 1]; ++y)
+            {
+                uint8_t *row = raw.data() + y * stride;
+                // the run's first row never reads the previous, which another job may be writing
+                const uint8_t *previous = y > starts[run] ? row - stride + 1 : nullptr;
+                if (!unfilterRow(row[0], row + 1, previous, rowBytes, bpp))
+                {
+                    ok = false;
+                    return;
+                }
+                convertRow(row + 1, png.components, destination + size_t(y) * png.width * outChannels, outChannels, png.width);
+            }
+    };
+    if (jobs && starts.size() > 2)
+        jobs->parallelFor(0, starts.size() - 1, 1, unfilterRows);
+    else
+        unfilterRows(0, starts.size() - 1);
+    if (!ok)
+        return fail("bad filter");
+    *width = png.width;
+    *height = png.height;
+    return true;
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+
+class JobSystem;
+
+// A PNG decoder that splits the rows across jobs. Inflating is serial: deflate blocks share a
+// 32 KB window and aren't byte aligned, so the stream can only be split where the encoder flushed
+// it fully, which ours don't. Unfiltering is split instead: a row filtered with None or Sub doesn't
+// read the row above, so the image falls into runs that unfilter (and convert) independently.
+// 8-bit gray, gray + alpha, RGB and RGBA, not interlaced and without a tRNS colour key; the rest is
+// left to stb_image.
+struct PngInfo
+{
+    int width = 0, height = 0, components = 0;
+    bool supported = false; // decodePng can decode it
+};
+
+bool readPngInfo(const unsigned char *data, size_t size, PngInfo &info);
+
+// decodes into destination, which must hold width * height * channels bytes; channels 0 keeps the
+// file's. Returns false on failure, pngFailureReason() says why.
+bool decodePng(const unsigned char *data, size_t size, int channels,
+               unsigned char *destination, size_t capacity, int *width, int *height, JobSystem *jobs = nullptr);
+const char *pngFailureReason();
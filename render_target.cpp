@@ -0,0 +1,75 @@
+#include <iostream>
+#include <cmath>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include "render_target.h"
+
+bool createRenderTarget(RenderTarget &target, int width, int height)
+{
+    target.width = width;
+    target.height = height;
+
+    glGenRenderbuffers(1, &target.color);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+    glGenRenderbuffers(1, &target.depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, target.depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &target.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target.color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, target.depth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Error::RenderTarget framebuffer incomplete, status 0x" << std::hex << status << std::dec << std::endl;
+        destroyRenderTarget(target);
+        return false;
+    }
+    return true;
+}
+
+void destroyRenderTarget(RenderTarget &target)
+{
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteRenderbuffers(1, &target.color);
+    glDeleteRenderbuffers(1, &target.depth);
+    target = RenderTarget();
+}
+
+void blitToWindow(const RenderTarget &target)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, target.framebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, target.width, target.height, 0, 0, target.width, target.height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool enableReverseZ()
+{
+    if (!GLEW_VERSION_4_5 && !GLEW_ARB_clip_control)
+    {
+        std::cerr << "Error::RenderTarget glClipControl not supported, depth precision is reduced" << std::endl;
+        return false;
+    }
+    glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+    return true;
+}
+
+glm::mat4 reverseInfinitePerspective(float fovy, float aspect, float zNear)
+{
+    float f = 1.0f / tanf(0.5f * fovy);
+    glm::mat4 projection(0.0f);
+    projection[0][0] = f / aspect;
+    projection[1][1] = f;
+    projection[2][3] = -1.0f; // w = -z
+    projection[3][2] = zNear; // z = near, so depth = near / -z
+    return projection;
+}
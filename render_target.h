@@ -0,0 +1,26 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Offscreen color buffer with a 32-bit float depth attachment, the scene is drawn into it and
+// then blitted to the window (the default framebuffer usually only offers 24-bit integer depth)
+struct RenderTarget
+{
+    GLuint framebuffer = 0;
+    GLuint color = 0;
+    GLuint depth = 0;
+    int width = 0;
+    int height = 0;
+};
+
+bool createRenderTarget(RenderTarget &target, int width, int height);
+void destroyRenderTarget(RenderTarget &target);
+void blitToWindow(const RenderTarget &target);
+
+// Reverse-Z: depth 1 at the near plane falling to 0 at infinity. Floats are densest near 0,
+// which cancels the 1/z falloff of perspective depth, so precision stays roughly constant in
+// relative terms from the near plane out to any distance. Returns false when glClipControl is
+// missing; depth then lands in [0.5, 1] and ordering still works, with less precision.
+bool enableReverseZ();
+// infinite far plane, for use with enableReverseZ(): clear depth to 0 and test with GL_GREATER
+glm::mat4 reverseInfinitePerspective(float fovy, float aspect, float zNear);
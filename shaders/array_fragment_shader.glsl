@@ -0,0 +1,13 @@
+#version 330 core
+in vec3 vertexColor;
+in vec2 text;
+flat in float layer;
+
+out vec4 FragColor;
+// every planet texture of one size, a layer each
+uniform sampler2DArray baseTextures;
+
+void main() {
+    vec4 tex = texture(baseTextures, vec3(text, layer));
+    FragColor = tex * vec4(vertexColor, 1.0);
+}
@@ -0,0 +1,16 @@
+// #version and orbit_common.glsl are prepended when compiling
+layout (local_size_x = 64) in;
+
+layout (std430, binding = 1) writeonly buffer Models
+{
+    mat4 models[];
+};
+
+uniform float time;
+uniform int count;
+
+void main() {
+    int body = int(gl_GlobalInvocationID.x);
+    if (body < count)
+        models[body] = orbitModel(body, time);
+}
@@ -0,0 +1,47 @@
+// circular orbits evaluated on the GPU, shared by the orbit vertex shader and the self-check.
+// Same transform as the CPU hierarchy: each ancestor turns by its orbit angle and moves out by its
+// radius, then the body spins and is scaled. Angles are phase + speed * time, time counted from an
+// origin the CPU moves forward now and then so the float products stay small.
+struct Orbit
+{
+    float radius;
+    float speed;     // radians per second
+    float phase;     // orbit angle at the time origin
+    float spinSpeed;
+    float spinPhase;
+    float scale;
+    int parent;      // -1 for a root
+    int pad;
+};
+
+layout (std430, binding = 0) readonly buffer Orbits
+{
+    Orbit orbits[];
+};
+
+const int MAX_ORBIT_DEPTH = 16;
+
+mat4 orbitModel(int body, float time)
+{
+    // accumulated angle of the body's frame, then peel the links off on the way up
+    float total = 0.0;
+    int depth = 0;
+    for (int i = body; i >= 0 && depth < MAX_ORBIT_DEPTH; i = orbits[i].parent, ++depth)
+        total += orbits[i].phase + orbits[i].speed * time;
+
+    float spin = total + orbits[body].spinPhase + orbits[body].spinSpeed * time;
+    vec3 position = vec3(0.0);
+    depth = 0;
+    for (int i = body; i >= 0 && depth < MAX_ORBIT_DEPTH; i = orbits[i].parent, ++depth)
+    {
+        position += vec3(cos(total), 0.0, -sin(total)) * orbits[i].radius;
+        total -= orbits[i].phase + orbits[i].speed * time;
+    }
+
+    float s = orbits[body].scale;
+    float c = cos(spin), n = sin(spin);
+    return mat4(vec4(c * s, 0.0, -n * s, 0.0),
+                vec4(0.0, s, 0.0, 0.0),
+                vec4(n * s, 0.0, c * s, 0.0),
+                vec4(position, 1.0));
+}
@@ -0,0 +1,25 @@
+// #version and orbit_common.glsl are prepended when compiling
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aColor;
+layout (location = 2) in vec2 aText;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float time;     // seconds since the time origin
+uniform vec3 origin;    // float point next to the camera the model is measured from
+uniform vec3 camera;    // camera position relative to origin, the model is made camera-relative
+uniform int firstBody;  // body of instance 0, the following instances take the following bodies
+
+out vec3 vertexColor;
+out vec2 text;
+
+void main() {
+    mat4 model = orbitModel(firstBody + gl_InstanceID, time);
+    // near the camera the position and origin are close, so their difference is exact in float;
+    // precise keeps the compiler from folding the two subtractions back into one
+    precise vec3 relative = model[3].xyz - origin;
+    model[3].xyz = relative - camera;
+    vertexColor = aColor;
+    text = aText;
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
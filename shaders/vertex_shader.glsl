@@ -3,17 +3,22 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aColor;
 // add another one in vec2 (2d, uv), for textures
 layout (location = 2) in vec2 aText;
+// per instance, camera-relative
+layout (location = 3) in mat4 model;
+// per instance, the layer of the texture array (see array_fragment_shader.glsl)
+layout (location = 7) in float aLayer;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
 out vec3 vertexColor;
 // here as well
 out vec2 text;
+flat out float layer;
 
 void main() {
     vertexColor = aColor;
     text = aText;
+    layer = aLayer;
     gl_Position = projection * view * model * vec4(aPos, 1.0);
 }
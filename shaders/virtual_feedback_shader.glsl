@@ -0,0 +1,18 @@
+// #version and virtual_texture.glsl are prepended when compiling
+in vec3 vertexColor;
+in vec2 text;
+
+// tile x, y, level and body, 0 where no map is wanted
+out uvec4 feedback;
+uniform sampler2D baseTexture;
+uniform int body;        // map index + 1, 0 for bodies with an ordinary texture
+uniform float levelBias; // the feedback buffer is smaller than the screen, its derivatives larger
+
+void main() {
+    if (body == 0) {
+        feedback = uvec4(0u);
+        return;
+    }
+    ivec3 tile = virtualTile(baseTexture, text, levelBias);
+    feedback = uvec4(uvec3(tile), uint(body));
+}
@@ -0,0 +1,11 @@
+// #version and virtual_texture.glsl are prepended when compiling
+in vec3 vertexColor;
+in vec2 text;
+
+out vec4 FragColor;
+// the indirection texture of the body's map
+uniform sampler2D baseTexture;
+
+void main() {
+    FragColor = virtualTexture(baseTexture, text) * vec4(vertexColor, 1.0);
+}
@@ -0,0 +1,42 @@
+// Virtual texture lookups, see virtual_texture.h. #version is prepended when compiling, this
+// file comes before the fragment shader of the draws and of the feedback pass.
+// The indirection texture has a texel per tile and a mip level per virtual level: the atlas page
+// holding the tile in rg, the level that page holds in b (coarser than asked while it streams in).
+uniform sampler2D atlas;
+uniform vec4 atlasLayout; // tile size, border, page size, atlas size, in texels
+
+// the level whose texels come closest to one per pixel, bias moves it (negative is finer)
+int virtualLevel(vec2 uv, vec2 size, float bias, int levels) {
+    vec2 dx = dFdx(uv), dy = dFdy(uv);
+    // u wraps around at the seam of the sphere, go the short way
+    dx.x -= round(dx.x);
+    dy.x -= round(dy.x);
+    dx *= size;
+    dy *= size;
+    float level = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + bias;
+    return clamp(int(floor(level)), 0, levels - 1);
+}
+
+// the tile uv wants, xy among the tiles of level z
+ivec3 virtualTile(sampler2D indirection, vec2 uv, float bias) {
+    ivec2 tiles = textureSize(indirection, 0);
+    vec2 size = vec2(tiles) * atlasLayout.x;
+    int levels = int(log2(float(max(tiles.x, tiles.y))) + 0.5) + 1;
+    int level = virtualLevel(uv, size, bias, levels);
+    vec2 texel = vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0)) * size / exp2(float(level));
+    ivec2 tile = min(ivec2(texel / atlasLayout.x), max(tiles >> level, ivec2(1)) - 1);
+    return ivec3(tile, level);
+}
+
+// bilinear from the page of the tile, or of the ancestor standing in for it
+vec4 virtualTexture(sampler2D indirection, vec2 uv) {
+    ivec3 wanted = virtualTile(indirection, uv, 0.0);
+    vec4 entry = texelFetch(indirection, wanted.xy, wanted.z) * 255.0;
+    int held = int(entry.b + 0.5);
+    vec2 size = vec2(textureSize(indirection, 0)) * atlasLayout.x;
+    vec2 texel = vec2(fract(uv.x), clamp(uv.y, 0.0, 1.0)) * size / exp2(float(held));
+    // the border takes the last texel's filtering at the edges
+    vec2 inTile = texel - vec2(wanted.xy >> (held - wanted.z)) * atlasLayout.x;
+    vec2 atlasTexel = floor(entry.rg + 0.5) * atlasLayout.z + atlasLayout.y + inTile;
+    return textureLod(atlas, atlasTexel / atlasLayout.w, 0.0);
+}
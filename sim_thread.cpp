@@ -0,0 +1,70 @@
+#include <chrono>
+
+#include "sim_thread.h"
+#include "checkpoint.h"
+
+SimulationThread::SimulationThread(Simulation &simulation, CheckpointLog *log)
+    : simulation(simulation), log(log)
+{
+}
+
+SimulationThread::~SimulationThread()
+{
+    stop();
+}
+
+void SimulationThread::start()
+{
+    if (running)
+        return;
+    // the reader gets the starting state right away
+    publish();
+    running = true;
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop()
+{
+    running = false;
+    if (thread.joinable())
+        thread.join();
+}
+
+void SimulationThread::seek(double time)
+{
+    seekTime.store(time, std::memory_order_relaxed);
+    seekPending.store(true, std::memory_order_release);
+}
+
+void SimulationThread::publish()
+{
+    simulation.snapshot(snapshots.back());
+    snapshots.publish();
+}
+
+void SimulationThread::run()
+{
+    using Clock = std::chrono::steady_clock;
+    const auto stepDuration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(simulation.stepSize));
+    Clock::time_point last = Clock::now();
+    while (running)
+    {
+        if (seekPending.exchange(false, std::memory_order_acquire) && log)
+        {
+            log->seek(simulation, seekTime.load(std::memory_order_relaxed));
+            publish();
+        }
+
+        Clock::time_point now = Clock::now();
+        int taken = simulation.advance(std::chrono::duration<double>(now - last).count(), log);
+        last = now;
+        if (taken > 0)
+        {
+            stepCount.fetch_add(taken, std::memory_order_relaxed);
+            publish();
+        }
+
+        // less than a step is left in the accumulator, so one is due by then
+        std::this_thread::sleep_until(now + stepDuration);
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "simulation.h"
+
+class CheckpointLog;
+
+// Hands the newest value from one writer thread to one reader thread, neither ever waits or locks.
+// Of the three slots the writer owns one, the reader owns one and the middle one is swapped
+// atomically: the writer publishes by swapping its filled slot into the middle, the reader swaps
+// the middle into its own slot whenever it holds something newer.
+template <class T>
+class TripleBuffer
+{
+public:
+    // writer: fill back(), then publish() it
+    T &back() { return slots[backIndex]; }
+    void publish() { backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX; }
+
+    // reader: the newest published value, the same one as last time if nothing was published since
+    const T &consume()
+    {
+        if (middle.load(std::memory_order_relaxed) & FRESH)
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        return slots[frontIndex];
+    }
+
+private:
+    static const int INDEX = 3, FRESH = 4;
+
+    T slots[3];
+    int backIndex = 0;
+    int frontIndex = 1;
+    std::atomic<int> middle{2};
+};
+
+// Runs a Simulation on its own thread in real time, publishing a snapshot of the bodies after every
+// batch of steps. A slow frame doesn't slow the simulation and a heavy step doesn't stall rendering.
+// While the thread runs it is the only one touching the simulation's state (the bodies are read-only)
+// and the checkpoint log.
+class SimulationThread
+{
+public:
+    explicit SimulationThread(Simulation &simulation, CheckpointLog *log = nullptr);
+    ~SimulationThread();
+    SimulationThread(const SimulationThread &) = delete;
+    SimulationThread &operator=(const SimulationThread &) = delete;
+
+    void start();
+    void stop();
+
+    // reading thread only: the newest complete snapshot
+    const SimSnapshot &latest() { return snapshots.consume(); }
+    // moves the simulation to time through the checkpoint log before its next step (timeline scrubbing)
+    void seek(double time);
+    // steps taken by the thread so far, seeks not included
+    uint64_t steps() const { return stepCount.load(std::memory_order_relaxed); }
+
+private:
+    void run();
+    void publish();
+
+    Simulation &simulation;
+    CheckpointLog *log;
+    TripleBuffer<SimSnapshot> snapshots;
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<uint64_t> stepCount{0};
+    // latest seek request, newer requests replace older ones
+    std::atomic<bool> seekPending{false};
+    std::atomic<double> seekTime{0.0};
+};
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cmath>
+
+#include <glm/gtc/constants.hpp> // Include for glm::two_pi
+
+#include "simulation.h"
+#include "checkpoint.h"
+#include "jobs.h"
+
+// keeps gravity finite when a particle passes through a body's center
+static const double SOFTENING = 1e-4;
+// particles per job when kicking
+static const size_t KICK_GRAIN = 4096;
+
+void Simulation::reset()
+{
+    state.step = 0;
+    state.time = 0.0;
+    state.orbitAngle.assign(bodies.size(), 0.0);
+    state.spinAngle.assign(bodies.size(), 0.0);
+    accumulator = 0.0;
+}
+
+glm::dvec3 Simulation::bodyPosition(int body) const
+{
+    return bodyPosition(state, body);
+}
+
+// Orbits are measured in the parent's rotating frame (glm::rotate then translate down the chain),
+// so a satellite's direction is the sum of the orbit angles from the root down to it.
+// Walking up from the body, total holds that sum for the current link.
+glm::dvec3 Simulation::bodyPosition(const SimState &s, int body) const
+{
+    double total = 0.0;
+    for (int i = body; i >= 0; i = bodies[i].parent)
+        total += s.orbitAngle[i];
+
+    glm::dvec3 position(0.0);
+    for (int i = body; i >= 0; i = bodies[i].parent)
+    {
+        position += glm::dvec3(cos(total), 0.0, -sin(total)) * bodies[i].orbitRadius;
+        total -= s.orbitAngle[i];
+    }
+    return position;
+}
+
+glm::dvec3 Simulation::bodyPositionAt(int body, double time) const
+{
+    double total = 0.0;
+    for (int i = body; i >= 0; i = bodies[i].parent)
+        total += bodies[i].orbitSpeed * time;
+
+    glm::dvec3 position(0.0);
+    for (int i = body; i >= 0; i = bodies[i].parent)
+    {
+        position += glm::dvec3(cos(total), 0.0, -sin(total)) * bodies[i].orbitRadius;
+        total -= bodies[i].orbitSpeed * time;
+    }
+    return position;
+}
+
+double Simulation::maxSpeed(int body) const
+{
+    // each link turns at the sum of the angular speeds above and including it
+    double turning = 0.0;
+    for (int i = body; i >= 0; i = bodies[i].parent)
+        turning += fabs(bodies[i].orbitSpeed);
+
+    double speed = 0.0;
+    for (int i = body; i >= 0; i = bodies[i].parent)
+    {
+        speed += bodies[i].orbitRadius * turning;
+        turning -= fabs(bodies[i].orbitSpeed);
+    }
+    return speed;
+}
+
+glm::dvec3 Simulation::gravity(const std::vector<glm::dvec3> &centers, const glm::dvec3 &position) const
+{
+    glm::dvec3 acceleration(0.0);
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        if (bodies[i].gm == 0.0)
+            continue;
+        glm::dvec3 d = centers[i] - position;
+        double r2 = glm::dot(d, d) + SOFTENING;
+        acceleration += d * (bodies[i].gm / (r2 * sqrt(r2)));
+    }
+    return acceleration;
+}
+
+void Simulation::step()
+{
+    const double h = stepSize;
+    const size_t particleCount = state.particlePosition.size();
+    JobSystem &jobs = defaultJobSystem();
+
+    std::vector<glm::dvec3> centers(bodies.size());
+    if (particleCount > 0)
+    {
+        // kick with the field at the start of the step, then drift
+        for (size_t i = 0; i < bodies.size(); ++i)
+            centers[i] = bodyPosition(state, static_cast<int>(i));
+        jobs.parallelFor(0, particleCount, KICK_GRAIN, [&](size_t first, size_t last)
+                         {
+                             for (size_t p = first; p < last; ++p)
+                             {
+                                 state.particleVelocity[p] += gravity(centers, state.particlePosition[p]) * (0.5 * h);
+                                 state.particlePosition[p] += state.particleVelocity[p] * h;
+                             }
+                         });
+    }
+
+    // scripted bodies, angles are kept in [0, 2pi) so they stay precise over long runs
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        state.orbitAngle[i] = fmod(state.orbitAngle[i] + bodies[i].orbitSpeed * h, glm::two_pi<double>());
+        state.spinAngle[i] = fmod(state.spinAngle[i] + bodies[i].spinSpeed * h, glm::two_pi<double>());
+    }
+    state.step++;
+    state.time = state.step * h;
+
+    for (size_t i = 0; i < bodies.size(); ++i)
+        centers[i] = bodyPosition(state, static_cast<int>(i));
+    collide(centers);
+
+    if (!state.particlePosition.empty())
+    {
+        // kick with the field at the end of the step (leapfrog)
+        jobs.parallelFor(0, state.particlePosition.size(), KICK_GRAIN, [&](size_t first, size_t last)
+                         {
+                             for (size_t p = first; p < last; ++p)
+                                 state.particleVelocity[p] += gravity(centers, state.particlePosition[p]) * (0.5 * h);
+                         });
+    }
+}
+
+void Simulation::collide(const std::vector<glm::dvec3> &centers)
+{
+    const size_t bodyCount = bodies.size();
+    bodyRadii.resize(bodyCount);
+    for (size_t i = 0; i < bodyCount; ++i)
+        bodyRadii[i] = bodies[i].radius;
+    broadphase.update(centers.data(), bodyRadii.data(), bodyCount,
+                      state.particlePosition.data(), particleRadius, state.particlePosition.size());
+
+    // a particle touching a body hits it and is gone, contacts are sorted so each particle shows up once per body
+    absorbed.clear();
+    for (const ContactEvent &contact : broadphase.contacts())
+    {
+        if (contact.a < bodyCount && contact.b >= bodyCount)
+            absorbed.push_back(contact.b);
+    }
+    if (absorbed.empty())
+        return;
+
+    // swap-remove from the back so the remaining indices stay valid
+    std::sort(absorbed.begin(), absorbed.end());
+    absorbed.erase(std::unique(absorbed.begin(), absorbed.end()), absorbed.end());
+    std::reverse(absorbed.begin(), absorbed.end());
+    for (uint32_t id : absorbed)
+    {
+        size_t p = id - bodyCount;
+        state.particlePosition[p] = state.particlePosition.back();
+        state.particleVelocity[p] = state.particleVelocity.back();
+        state.particlePosition.pop_back();
+        state.particleVelocity.pop_back();
+    }
+    broadphase.swapRemove(absorbed);
+    impactCount += absorbed.size();
+}
+
+void Simulation::snapshot(SimSnapshot &out) const
+{
+    out.step = state.step;
+    out.time = state.time;
+    out.orbitAngle.assign(state.orbitAngle.begin(), state.orbitAngle.end());
+    out.spinAngle.assign(state.spinAngle.begin(), state.spinAngle.end());
+}
+
+void Simulation::snapshotAt(double time, SimSnapshot &out) const
+{
+    out.step = static_cast<uint64_t>(llround(time / stepSize));
+    out.time = time;
+    out.orbitAngle.resize(bodies.size());
+    out.spinAngle.resize(bodies.size());
+    for (size_t i = 0; i < bodies.size(); ++i)
+    {
+        out.orbitAngle[i] = fmod(bodies[i].orbitSpeed * time, glm::two_pi<double>());
+        out.spinAngle[i] = fmod(bodies[i].spinSpeed * time, glm::two_pi<double>());
+    }
+}
+
+int Simulation::advance(double deltaTime, CheckpointLog *log)
+{
+    int steps = 0;
+    accumulator += deltaTime;
+    while (accumulator >= stepSize)
+    {
+        step();
+        if (log)
+            log->record(*this);
+        accumulator -= stepSize;
+        steps++;
+    }
+    return steps;
+}
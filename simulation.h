@@ -0,0 +1,93 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "broadphase.h"
+
+class CheckpointLog;
+
+// A scripted body: circular orbit around its parent in the xz plane plus a spin around the y axis
+struct SimBody
+{
+    std::string name;
+    int parent;         // index of the body it orbits, -1 for none
+    double orbitRadius; // distance from the parent
+    double orbitSpeed;  // radians per second, in the parent's frame which turns with the parent's own orbit
+    double spinSpeed;   // radians per second
+    double radius;      // render scale
+    double gm;          // gravitational parameter pulling on particles, 0 for none
+};
+
+// Everything that changes while the simulation runs. Restoring a state and stepping forward
+// reproduces the same trajectory, which the checkpoint log relies on.
+struct SimState
+{
+    uint64_t step = 0;
+    double time = 0.0;
+    std::vector<double> orbitAngle;
+    std::vector<double> spinAngle;
+    // free particles moving under the gravity of the bodies
+    std::vector<glm::dvec3> particlePosition;
+    std::vector<glm::dvec3> particleVelocity;
+};
+
+// The body part of a SimState, copied out after each batch of steps for other threads to read
+struct SimSnapshot
+{
+    uint64_t step = 0;
+    double time = 0.0;
+    std::vector<double> orbitAngle;
+    std::vector<double> spinAngle;
+};
+
+// Fixed step simulation of the scene
+class Simulation
+{
+public:
+    std::vector<SimBody> bodies;
+    SimState state;
+    double stepSize = 1.0 / 120.0;
+    double particleRadius = 0.01; // particles touching a body are absorbed by it
+
+    // puts every body back at its starting angle, keeps the particles
+    void reset();
+    // takes one fixed step
+    void step();
+    // takes as many fixed steps as fit in the accumulated frame time, recording checkpoints on the way
+    int advance(double deltaTime, CheckpointLog *log = nullptr);
+
+    // copies the current body state, reusing out's storage
+    void snapshot(SimSnapshot &out) const;
+    // closed form body state at any time, as if stepped from reset()
+    void snapshotAt(double time, SimSnapshot &out) const;
+
+    // world position of a body's center, following its parent chain
+    glm::dvec3 bodyPosition(int body) const;
+    glm::dvec3 bodyPosition(const SimState &s, int body) const;
+    // closed form position of a scripted body at any time, as if stepped from reset()
+    glm::dvec3 bodyPositionAt(int body, double time) const;
+    // upper bound on a body's speed, for conservative time bracketing
+    double maxSpeed(int body) const;
+
+    // touching pairs found by the last step. Ids 0..bodies.size()-1 are bodies, the rest are
+    // particles offset by bodies.size(), numbered as they were before absorbed particles were removed
+    const std::vector<ContactEvent> &contacts() const { return broadphase.contacts(); }
+    // particles absorbed since the simulation was created
+    uint64_t impacts() const { return impactCount; }
+    // the particle arrays were replaced (e.g. a checkpoint was restored), the broadphase starts over
+    void invalidateBroadphase() { broadphase.invalidate(); }
+
+private:
+    glm::dvec3 gravity(const std::vector<glm::dvec3> &centers, const glm::dvec3 &position) const;
+
+    void collide(const std::vector<glm::dvec3> &centers);
+
+    double accumulator = 0.0;
+    SweepAndPrune broadphase;
+    std::vector<double> bodyRadii;
+    std::vector<uint32_t> absorbed;
+    uint64_t impactCount = 0;
+};
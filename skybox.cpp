@@ -8,8 +8,6 @@
                         // initializing OpenGL and binding inputs
 
 #include <glm/glm.hpp>  // GLM is an optimized math library with syntax to similar to OpenGL Shading Language
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
 #include "skybox.h"
 const char* getSkyboxVertexShaderSource()
 {
@@ -22,7 +20,8 @@ const char* getSkyboxVertexShaderSource()
     "void main()\n"
     "{\n"
     " TexCoords = aPos;\n"
-    " gl_Position = projection * view * vec4(aPos, 1.0);\n"
+    " vec4 position = projection * view * vec4(aPos, 1.0);\n"
+    " gl_Position = vec4(position.xy, 0.0, position.w);\n" // depth 0, infinitely far with reverse-Z
     "}";
 
 }
@@ -147,38 +146,3 @@ int compileAndLinkSkyboxShaders()
     
     return shaderProgram;
 }
-
-unsigned int loadSkyBox(std::vector<std::string> faces){
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    //This loop is used to load each face of the cubemap and set the texture parameters.
-    // Each face is loaded with the same texture parameters, but different image data.
-    //It does it in order of right, left, top, bottom, front, back.
-    int width, height, nrChannels;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 
-                        0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-            );
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
-    }
-    //Clamp the edges of each new face to the adjacent face, so there is no seams.
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-    return textureID;
-} 
\ No newline at end of file
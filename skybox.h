@@ -7,4 +7,3 @@ const char* getSkyboxVertexShaderSource();
 const char* getSkyboxFragmentShaderSource();
 GLuint createSkyboxVAO();
 int compileAndLinkSkyboxShaders();
-unsigned int loadSkyBox(std::vector<std::string> faces);
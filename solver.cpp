@@ -0,0 +1,168 @@
+#include <cmath>
+#include <algorithm>
+
+#include "solver.h"
+
+static const int MAX_ITERATIONS = 100;
+static const double EPSILON = 1e-15;
+
+double brentRoot(const std::function<double(double)> &f, double a, double b, double fa, double fb, double tolerance)
+{
+    if (fa == 0.0)
+        return a;
+    if (fb == 0.0)
+        return b;
+
+    double c = a, fc = fa;
+    double d = b - a, e = d;
+    for (int i = 0; i < MAX_ITERATIONS; ++i)
+    {
+        if ((fb > 0.0) == (fc > 0.0))
+        {
+            // keep the root between b and c
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (fabs(fc) < fabs(fb))
+        {
+            a = b;
+            b = c;
+            c = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+
+        double tol = 2.0 * EPSILON * fabs(b) + 0.5 * tolerance;
+        double m = 0.5 * (c - b);
+        if (fabs(m) <= tol || fb == 0.0)
+            return b;
+
+        if (fabs(e) >= tol && fabs(fa) > fabs(fb))
+        {
+            // inverse quadratic interpolation (secant when only two points are distinct)
+            double s = fb / fa, p, q;
+            if (a == c)
+            {
+                p = 2.0 * m * s;
+                q = 1.0 - s;
+            }
+            else
+            {
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2.0 * m * q * (q - r) - (b - a) * (r - 1.0));
+                q = (q - 1.0) * (r - 1.0) * (s - 1.0);
+            }
+            if (p > 0.0)
+                q = -q;
+            else
+                p = -p;
+            if (2.0 * p < std::min(3.0 * m * q - fabs(tol * q), fabs(e * q)))
+            {
+                e = d;
+                d = p / q;
+            }
+            else
+            {
+                d = m;
+                e = m;
+            }
+        }
+        else
+        {
+            // bisection
+            d = m;
+            e = m;
+        }
+
+        a = b;
+        fa = fb;
+        b += fabs(d) > tol ? d : (m > 0.0 ? tol : -tol);
+        fb = f(b);
+    }
+    return b;
+}
+
+double brentMinimize(const std::function<double(double)> &f, double a, double b, double tolerance, double &xMin)
+{
+    const double golden = 0.3819660112501051; // (3 - sqrt(5)) / 2
+    double x = a + golden * (b - a);
+    double w = x, v = x;
+    double fx = f(x), fw = fx, fv = fx;
+    double d = 0.0, e = 0.0;
+
+    for (int i = 0; i < MAX_ITERATIONS; ++i)
+    {
+        double m = 0.5 * (a + b);
+        double tol = EPSILON * fabs(x) + 0.5 * tolerance;
+        if (fabs(x - m) <= 2.0 * tol - 0.5 * (b - a))
+            break;
+
+        bool goldenStep = true;
+        if (fabs(e) > tol)
+        {
+            // parabola through x, w, v
+            double r = (x - w) * (fx - fv);
+            double q = (x - v) * (fx - fw);
+            double p = (x - v) * q - (x - w) * r;
+            q = 2.0 * (q - r);
+            if (q > 0.0)
+                p = -p;
+            else
+                q = -q;
+            if (fabs(p) < fabs(0.5 * q * e) && p > q * (a - x) && p < q * (b - x))
+            {
+                e = d;
+                d = p / q;
+                double u = x + d;
+                if (u - a < 2.0 * tol || b - u < 2.0 * tol)
+                    d = x < m ? tol : -tol;
+                goldenStep = false;
+            }
+        }
+        if (goldenStep)
+        {
+            e = (x < m ? b : a) - x;
+            d = golden * e;
+        }
+
+        double u = x + (fabs(d) >= tol ? d : (d > 0.0 ? tol : -tol));
+        double fu = f(u);
+        if (fu <= fx)
+        {
+            if (u < x)
+                b = x;
+            else
+                a = x;
+            v = w;
+            fv = fw;
+            w = x;
+            fw = fx;
+            x = u;
+            fx = fu;
+        }
+        else
+        {
+            if (u < x)
+                a = u;
+            else
+                b = u;
+            if (fu <= fw || w == x)
+            {
+                v = w;
+                fv = fw;
+                w = u;
+                fw = fu;
+            }
+            else if (fu <= fv || v == x || v == w)
+            {
+                v = u;
+                fv = fu;
+            }
+        }
+    }
+    xMin = x;
+    return fx;
+}
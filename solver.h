@@ -0,0 +1,10 @@
+#pragma once
+#include <functional>
+
+// Brent's root finder. f(a) and f(b) (passed in as fa, fb) must have opposite signs.
+// Returns x in [a, b] with f(x) ~ 0, to within tolerance in x.
+double brentRoot(const std::function<double(double)> &f, double a, double b, double fa, double fb, double tolerance);
+
+// Brent's minimizer (golden section + parabolic interpolation) on [a, b].
+// Returns the minimum value and writes its location to xMin.
+double brentMinimize(const std::function<double(double)> &f, double a, double b, double tolerance, double &xMin);
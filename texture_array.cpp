@@ -0,0 +1,402 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include "texture_array.h"
+
+const int TextureArrays::MIN_LAYERS; // std::max takes it by reference
+
+static std::string readShaderFile(const char *path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Error::TextureArray could not open shader file: " << path << std::endl;
+        return "";
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static GLuint compileShader(GLenum type, const std::string &source, const char *name)
+{
+    const char *code = source.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Error::TextureArray " << name << " failed to compile: " << log << std::endl;
+    }
+    return shader;
+}
+
+bool TextureArrays::create()
+{
+    if (!GLEW_VERSION_4_3 && !GLEW_ARB_copy_image)
+    {
+        std::cerr << "Error::TextureArray glCopyImageSubData not supported, planets keep a texture each" << std::endl;
+        return false;
+    }
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, readShaderFile("shaders/vertex_shader.glsl"), "shaders/vertex_shader.glsl");
+    GLuint fragment = compileShader(GL_FRAGMENT_SHADER, readShaderFile("shaders/array_fragment_shader.glsl"), "shaders/array_fragment_shader.glsl");
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Error::TextureArray shaders/array_fragment_shader.glsl failed to link: " << log << std::endl;
+        glDeleteProgram(program);
+        return false;
+    }
+    drawProgram = program;
+    drawViewLoc = glGetUniformLocation(drawProgram, "view");
+    drawProjectionLoc = glGetUniformLocation(drawProgram, "projection");
+    glUseProgram(drawProgram);
+    glUniform1i(glGetUniformLocation(drawProgram, "baseTextures"), 0);
+    glUseProgram(0);
+    return true;
+}
+
+void TextureArrays::destroy()
+{
+    for (Array &array : arrays)
+    {
+        if (array.texture)
+            glDeleteTextures(1, &array.texture);
+    }
+    arrays.clear();
+    entries.clear();
+    freeEntries.clear();
+    if (drawProgram)
+        glDeleteProgram(drawProgram);
+    drawProgram = 0;
+}
+
+// the shape of a 2D texture's levels as the loader left them, false if it has no image
+bool TextureArrays::readShape(GLuint texture, Shape &shape) const
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    GLint maxLevel = 0, compressed = GL_FALSE;
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, &maxLevel);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &shape.width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &shape.height);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &shape.internalFormat);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_COMPRESSED, &compressed);
+    shape.compressed = compressed == GL_TRUE;
+    shape.levelBytes.clear();
+    for (GLint level = 0; level <= maxLevel; ++level)
+    {
+        GLint width = 0, height = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_HEIGHT, &height);
+        if (width == 0 || height == 0)
+            break;
+        GLint bytes = 0;
+        if (shape.compressed)
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, level, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+        else
+            bytes = width * height * 4; // drivers pad RGB8 to 4 bytes a texel
+        shape.levelBytes.push_back(size_t(bytes));
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    shape.levels = GLint(shape.levelBytes.size());
+    return shape.levels > 0;
+}
+
+GLuint TextureArrays::allocate(const Shape &shape, int layers) const
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, shape.levels - 1);
+    // no data: with a pixel buffer bound the null pointer would be an offset into it
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    for (GLint level = 0; level < shape.levels; ++level)
+    {
+        GLsizei width = std::max(1, shape.width >> level), height = std::max(1, shape.height >> level);
+        if (shape.compressed)
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GLenum(shape.internalFormat), width, height, layers, 0,
+                                   GLsizei(shape.levelBytes[level] * layers), NULL);
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, shape.internalFormat, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    return texture;
+}
+
+// every level of one layer (layer 0 of a 2D texture), on the GPU
+static void copyLayer(GLuint source, GLenum sourceTarget, int sourceLayer, GLuint destination, int destinationLayer, GLint width, GLint height, GLint levels)
+{
+    for (GLint level = 0; level < levels; ++level)
+        glCopyImageSubData(source, sourceTarget, level, 0, 0, sourceLayer,
+                           destination, GL_TEXTURE_2D_ARRAY, level, 0, 0, destinationLayer,
+                           std::max(1, width >> level), std::max(1, height >> level), 1);
+}
+
+// a new texture of capacity layers holding the same layers at the same places; the layers at or
+// above capacity must be free. 0 layers gives the texture back.
+void TextureArrays::resize(Array &array, int capacity)
+{
+    GLuint texture = capacity > 0 ? allocate(array.shape, capacity) : 0;
+    if (texture && array.texture)
+    {
+        for (int layer = 0; layer < std::min(array.capacity, capacity); ++layer)
+        {
+            if (array.layerEntry[layer] >= 0)
+                copyLayer(array.texture, GL_TEXTURE_2D_ARRAY, layer, texture, layer, array.shape.width, array.shape.height, array.shape.levels);
+        }
+    }
+    if (array.texture)
+        glDeleteTextures(1, &array.texture);
+    array.texture = texture;
+    array.capacity = capacity;
+    array.layerEntry.resize(capacity, -1);
+    resizes++;
+    changes++;
+}
+
+void TextureArrays::moveLayer(Array &array, int from, int to)
+{
+    copyLayer(array.texture, GL_TEXTURE_2D_ARRAY, from, array.texture, to, array.shape.width, array.shape.height, array.shape.levels);
+    int entry = array.layerEntry[from];
+    array.layerEntry[to] = entry;
+    array.layerEntry[from] = -1;
+    entries[entry].layer = to;
+    moves++;
+    changes++;
+}
+
+int TextureArrays::add(GLuint texture)
+{
+    Shape shape;
+    if (!supported() || !readShape(texture, shape))
+        return -1;
+
+    size_t a = 0;
+    while (a < arrays.size() && !arrays[a].shape.matches(shape))
+        a++;
+    if (a == arrays.size())
+    {
+        arrays.push_back(Array());
+        arrays.back().shape = shape;
+    }
+    Array &array = arrays[a];
+    if (array.used == array.capacity)
+        resize(array, std::max(MIN_LAYERS, array.capacity * 2));
+    int layer = int(std::find(array.layerEntry.begin(), array.layerEntry.end(), -1) - array.layerEntry.begin());
+    copyLayer(texture, GL_TEXTURE_2D, 0, array.texture, layer, shape.width, shape.height, shape.levels);
+
+    int entry;
+    if (!freeEntries.empty())
+    {
+        entry = freeEntries.back();
+        freeEntries.pop_back();
+    }
+    else
+    {
+        entry = int(entries.size());
+        entries.push_back(Entry());
+    }
+    entries[entry] = {int(a), layer};
+    array.layerEntry[layer] = entry;
+    array.used++;
+    copiedLayers++;
+    changes++;
+    return entry;
+}
+
+void TextureArrays::remove(int entry)
+{
+    Entry &removed = entries[entry];
+    Array &array = arrays[removed.array];
+    array.layerEntry[removed.layer] = -1;
+    array.used--;
+    removed = Entry();
+    freeEntries.push_back(entry);
+}
+
+void TextureArrays::defragment()
+{
+    for (Array &array : arrays)
+    {
+        // the highest layer in use into the lowest free one, until the used ones are at the bottom
+        int low = 0, high = array.capacity - 1;
+        while (true)
+        {
+            while (low < array.capacity && array.layerEntry[low] >= 0)
+                low++;
+            while (high >= 0 && array.layerEntry[high] < 0)
+                high--;
+            if (low >= high)
+                break;
+            moveLayer(array, high, low);
+        }
+        // halving only at a quarter leaves room to add again without growing straight back
+        int capacity = array.capacity;
+        while (capacity > MIN_LAYERS && array.used <= capacity / 4)
+            capacity /= 2;
+        if (array.used == 0)
+            capacity = 0;
+        if (capacity != array.capacity)
+            resize(array, capacity);
+    }
+}
+
+bool TextureArrays::contains(GLuint texture) const
+{
+    if (texture == 0)
+        return false;
+    for (const Array &array : arrays)
+    {
+        if (array.texture == texture)
+            return true;
+    }
+    return false;
+}
+
+// texel of check texture index at level, every level of every texture different
+static void checkTexel(int index, int level, unsigned char texel[4])
+{
+    texel[0] = static_cast<unsigned char>(index * 16 + level);
+    texel[1] = static_cast<unsigned char>(255 - index);
+    texel[2] = static_cast<unsigned char>(level * 40);
+    texel[3] = 255;
+}
+
+int TextureArrays::selfCheck()
+{
+    const int SIZE = 16, LEVELS = 5, TEXTURES = 10;
+    if (!supported())
+        return -1;
+
+    std::vector<GLuint> sources(TEXTURES);
+    glGenTextures(TEXTURES, sources.data());
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    for (int index = 0; index < TEXTURES; ++index)
+    {
+        glBindTexture(GL_TEXTURE_2D, sources[index]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, LEVELS - 1);
+        for (int level = 0; level < LEVELS; ++level)
+        {
+            int size = SIZE >> level;
+            unsigned char texel[4];
+            checkTexel(index, level, texel);
+            std::vector<unsigned char> pixels(size_t(size) * size * 4);
+            for (size_t i = 0; i < pixels.size(); ++i)
+                pixels[i] = texel[i % 4];
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // nine grow the array from 4 to 16 layers, keeping three of them then halves it to 8
+    // after moving them down, the tenth goes into a freed layer
+    std::vector<int> entryOf(TEXTURES, -1);
+    for (int index = 0; index < TEXTURES - 1; ++index)
+        entryOf[index] = add(sources[index]);
+    for (int index : {0, 2, 3, 5, 6, 7})
+    {
+        remove(entryOf[index]);
+        entryOf[index] = -1;
+    }
+    defragment();
+    entryOf[TEXTURES - 1] = add(sources[TEXTURES - 1]);
+    glDeleteTextures(TEXTURES, sources.data());
+
+    int wrong = 0;
+    for (int index = 0; index < TEXTURES; ++index)
+    {
+        if (entryOf[index] < 0 && (index == 1 || index == 4 || index >= 8))
+            wrong++;
+    }
+    if (arrays.size() != 1 || arrays[0].capacity != 8 || arrays[0].used != 4)
+        wrong++;
+
+    for (int level = 0; level < LEVELS && !arrays.empty(); ++level)
+    {
+        int size = SIZE >> level;
+        size_t layerBytes = size_t(size) * size * 4;
+        std::vector<unsigned char> pixels(layerBytes * arrays[0].capacity);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[0].texture);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        for (int index = 0; index < TEXTURES; ++index)
+        {
+            if (entryOf[index] < 0)
+                continue;
+            unsigned char texel[4];
+            checkTexel(index, level, texel);
+            const unsigned char *layer = pixels.data() + layerBytes * size_t(this->layer(entryOf[index]));
+            for (size_t i = 0; i < layerBytes; ++i)
+            {
+                if (layer[i] != texel[i % 4])
+                {
+                    wrong++;
+                    break;
+                }
+            }
+        }
+    }
+
+    // everything out again: the array gives its texture back
+    for (int entry : entryOf)
+    {
+        if (entry >= 0)
+            remove(entry);
+    }
+    defragment();
+    if (!arrays.empty() && arrays[0].texture != 0)
+        wrong++;
+    arrays.clear();
+    entries.clear();
+    freeEntries.clear();
+    copiedLayers = resizes = moves = 0;
+    changes++;
+    return wrong;
+}
+
+void TextureArrays::printStats(std::ostream &out) const
+{
+    size_t used = 0, capacity = 0, bytes = 0;
+    for (const Array &array : arrays)
+    {
+        used += array.used;
+        capacity += array.capacity;
+        for (size_t levelBytes : array.shape.levelBytes)
+            bytes += levelBytes * array.capacity;
+    }
+    out << "texture arrays: " << arrays.size() << " arrays, " << used << " of " << capacity << " layers used ("
+        << bytes / (1024.0 * 1024.0) << " MB), " << copiedLayers << " textures copied in, " << resizes << " resizes, "
+        << moves << " layers moved" << std::endl;
+    for (const Array &array : arrays)
+    {
+        size_t layerBytes = 0;
+        for (size_t levelBytes : array.shape.levelBytes)
+            layerBytes += levelBytes;
+        out << "  " << array.shape.width << "x" << array.shape.height << " " << array.shape.levels << " levels"
+            << (array.shape.compressed ? " compressed" : "") << ", " << array.used << " of " << array.capacity << " layers ("
+            << layerBytes * array.capacity / (1024.0 * 1024.0) << " MB)" << std::endl;
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Planet textures of the same shape (size, mip levels and format) live in the layers of one
+// GL_TEXTURE_2D_ARRAY, so the bodies using them share a binding and draw as one instanced batch,
+// each instance picking its layer. A texture joins once it is resident: its whole mip chain is
+// copied into a free layer on the GPU (glCopyImageSubData, GL 4.3 or ARB_copy_image) and the 2D
+// texture may then be deleted. A full array doubles its layers, copying the ones it holds once;
+// removing an entry only frees its layer for the next add. defragment() moves the top layers down
+// into the holes and halves arrays that are at most a quarter used.
+// Entries are stable, where an entry lives (texture() and layer()) changes when its array grows,
+// is defragmented or shrinks; generation() counts those changes.
+class TextureArrays
+{
+public:
+    static const int MIN_LAYERS = 4;
+
+    ~TextureArrays() { destroy(); }
+
+    // GL thread: the program drawing from the arrays, false without copy image support
+    bool create();
+    void destroy();
+    bool supported() const { return drawProgram != 0; }
+
+    // GL thread: copies every level of a resident 2D texture into a layer, returns its entry or -1
+    // if the texture has no image or arrays are not supported
+    int add(GLuint texture);
+    // GL thread: frees the layer of an entry
+    void remove(int entry);
+    // GL thread: packs the layers of every array to the bottom and gives back unused layers
+    void defragment();
+
+    GLuint texture(int entry) const { return arrays[entries[entry].array].texture; }
+    int layer(int entry) const { return entries[entry].layer; }
+    uint32_t generation() const { return changes; }
+    // texture is one of the arrays. Any thread, arrays only change between frames.
+    bool contains(GLuint texture) const;
+
+    // draws from an array: it on unit 0, the layer of each instance from its attribute
+    GLuint program() const { return drawProgram; }
+    GLint viewLocation() const { return drawViewLoc; }
+    GLint projectionLocation() const { return drawProjectionLoc; }
+
+    void printStats(std::ostream &out) const;
+    // GL thread, before the first add: adds, removes, defragments and adds again a set of small
+    // patterned textures, reads every layer back and compares it. Returns the number of wrong
+    // layers (or capacities), negative if arrays are not supported. Leaves no arrays behind.
+    int selfCheck();
+
+private:
+    struct Shape
+    {
+        GLint width = 0, height = 0, levels = 0;
+        GLint internalFormat = 0;
+        bool compressed = false;
+        std::vector<size_t> levelBytes; // one layer's
+
+        bool matches(const Shape &other) const
+        {
+            return width == other.width && height == other.height && levels == other.levels && internalFormat == other.internalFormat;
+        }
+    };
+
+    struct Array
+    {
+        Shape shape;
+        GLuint texture = 0;
+        int capacity = 0;
+        std::vector<int> layerEntry; // per layer: its entry or -1
+        int used = 0;
+    };
+
+    struct Entry
+    {
+        int array = -1, layer = -1;
+    };
+
+    bool readShape(GLuint texture, Shape &shape) const;
+    GLuint allocate(const Shape &shape, int layers) const;
+    void resize(Array &array, int capacity);
+    void moveLayer(Array &array, int from, int to);
+
+    std::vector<Array> arrays;
+    std::vector<Entry> entries;
+    std::vector<int> freeEntries;
+    uint32_t changes = 0;
+    uint64_t copiedLayers = 0, resizes = 0, moves = 0;
+
+    GLuint drawProgram = 0;
+    GLint drawViewLoc = -1, drawProjectionLoc = -1;
+};
@@ -0,0 +1,538 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include <GLFW/glfw3.h>
+
+#include "stb_image.h"
+#include "texture_loader.h"
+#include "block_compress.h"
+#include "jpeg_decode.h"
+#include "png_decode.h"
+#include "mapped_file.h"
+#include "jobs.h"
+
+static double now()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TextureCompression bestTextureCompression()
+{
+    if (GLEW_ARB_texture_compression_bptc)
+        return COMPRESSION_BC7;
+    if (GLEW_EXT_texture_compression_s3tc)
+        return COMPRESSION_BC1;
+    return COMPRESSION_NONE;
+}
+
+TextureLoader::TextureLoader(JobSystem &jobs, TextureCompression compression, MipFilter mipFilter)
+    : jobs(jobs), compression(compression), mipFilter(mipFilter)
+{
+}
+
+TextureLoader::~TextureLoader()
+{
+    // decodes and uploads still running hold pointers to their requests
+    stop();
+    for (Request *request : requests)
+        delete request;
+}
+
+void TextureLoader::stop()
+{
+    finish();
+    if (!uploadThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    decoded.notify_all();
+    uploadThread.join();
+    glfwDestroyWindow(uploadWindow);
+    uploadWindow = nullptr;
+}
+
+bool TextureLoader::startUploadThread(GLFWwindow *share)
+{
+    // windows (and so contexts) can only be created on the main thread
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    uploadWindow = glfwCreateWindow(1, 1, "uploads", NULL, share);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!uploadWindow)
+    {
+        std::cerr << "Error::Texture could not create the upload context, uploading on the GL thread" << std::endl;
+        return false;
+    }
+    uploadThread = std::thread(&TextureLoader::uploadLoop, this);
+    return true;
+}
+
+bool TextureLoader::loadManifest(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Error::Texture could not open asset manifest " << path << ", placeholders are grey" << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string image;
+        int r, g, b;
+        if (fields >> image >> r >> g >> b)
+            manifest[image] = {static_cast<unsigned char>(r), static_cast<unsigned char>(g), static_cast<unsigned char>(b)};
+    }
+    return true;
+}
+
+std::array<unsigned char, 3> TextureLoader::placeholderColor(const std::string &path) const
+{
+    auto entry = manifest.find(path);
+    return entry != manifest.end() ? entry->second : std::array<unsigned char, 3>{128, 128, 128};
+}
+
+void TextureLoader::submit(Request *pending)
+{
+    if (firstRequest < 0.0)
+        firstRequest = now();
+    pendingImages[pending->texture]++;
+    // the header first: the GL side maps a pixel buffer of the chain's size, then the decode fills it
+    jobs.submit([this, pending]
+                {
+                    Request &request = *pending;
+                    double start = now();
+                    bool known = stbi_info(request.path.c_str(), &request.width, &request.height, &request.fileChannels);
+                    MappedFile file;
+                    if (known && file.openRead(request.path))
+                    {
+                        // a baseline JPEG (decoded smaller straight away if it may be) or an 8-bit PNG
+                        // gets our decoders, which split it across the jobs; the rest goes to stb_image
+                        const unsigned char *data = reinterpret_cast<const unsigned char *>(file.data());
+                        JpegInfo jpeg;
+                        PngInfo png;
+                        if (readJpegInfo(data, file.size(), jpeg) && jpeg.supported)
+                        {
+                            request.codec = CODEC_JPEG;
+                            request.scale = jpegScaleFor(request.width, request.minWidth);
+                            request.width = jpegScaledSize(request.width, request.scale);
+                            request.height = jpegScaledSize(request.height, request.scale);
+                        }
+                        else if (readPngInfo(data, file.size(), png) && png.supported)
+                            request.codec = CODEC_PNG;
+                    }
+                    MipCacheHeader cache;
+                    int channels = request.channels ? request.channels : request.fileChannels;
+                    request.cached = known && mipCacheValid(request.path, mipFilter, compression, cache) && int(cache.width) == request.width &&
+                                     int(cache.height) == request.height && int(cache.channels) == channels;
+                    if (request.cached)
+                        request.psnr = cache.psnr;
+                    request.decodeSeconds = now() - start;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        (known ? sized : ready).push_back(pending);
+                    }
+                    decoded.notify_all(); });
+}
+
+void TextureLoader::mapBuffers(const std::vector<Request *> &batch)
+{
+    for (Request *pending : batch)
+    {
+        Request &request = *pending;
+        double start = now();
+        int channels = request.channels ? request.channels : request.fileChannels;
+        request.bufferSize = MipChain::levelOffset(request.width, request.height, channels, MipChain::mipLevelCount(request.width, request.height), compression);
+        glGenBuffers(1, &request.buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, request.bufferSize, NULL, GL_STREAM_DRAW);
+        // uncompressed, a missed chain is built in the buffer from the level 0 decoded into it, which
+        // reads it back: the read bit keeps that legal and gets memory the CPU reads at full speed
+        GLbitfield access = compression == COMPRESSION_NONE ? GL_MAP_READ_BIT | GL_MAP_WRITE_BIT : GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT;
+        request.mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, request.bufferSize, access));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (!request.mapped)
+        {
+            // build the chain on the heap and upload from there
+            glDeleteBuffers(1, &request.buffer);
+            request.buffer = 0;
+        }
+        request.uploadSeconds += now() - start;
+
+        jobs.submit([this, pending]
+                    {
+                        Request &request = *pending;
+                        double start = now();
+                        if (!request.mapped)
+                            request.heapChain.resize(request.bufferSize);
+                        unsigned char *destination = request.mapped ? request.mapped : request.heapChain.data();
+                        request.decodedOk = request.cached && readMipCache(request.path, destination, request.bufferSize);
+                        request.decodeSeconds += now() - start;
+                        if (request.decodedOk)
+                            request.cached = true;
+                        else
+                        {
+                            // not cached (or the cache went away meanwhile): decode, build, compress and cache the chain.
+                            // Uncompressed, level 0 of the chain is the image: it is decoded straight into its
+                            // place and the chain built around it, no heap image and no copy.
+                            request.cached = false;
+                            start = now();
+                            bool inPlace = compression == COMPRESSION_NONE;
+                            int width = 0, height = 0, fileChannels = 0;
+                            unsigned char *pixels = nullptr;
+                            std::vector<unsigned char> image;
+                            if (request.codec != CODEC_STB)
+                            {
+                                MappedFile file;
+                                size_t levelBytes = size_t(request.width) * request.height * (request.channels ? request.channels : request.fileChannels);
+                                if (!inPlace)
+                                    image.resize(levelBytes);
+                                unsigned char *into = inPlace ? destination : image.data();
+                                fileChannels = request.fileChannels;
+                                bool ok = file.openRead(request.path);
+                                const unsigned char *data = reinterpret_cast<const unsigned char *>(file.data());
+                                if (ok && request.codec == CODEC_JPEG)
+                                    ok = decodeJpegScaled(data, file.size(), request.scale, request.channels, into, levelBytes, &width, &height, &jobs);
+                                else if (ok)
+                                    ok = decodePng(data, file.size(), request.channels, into, levelBytes, &width, &height, &jobs);
+                                if (ok)
+                                    pixels = into;
+                                else
+                                    std::cerr << "Error::Texture could not decode " << request.path << ": "
+                                              << (request.codec == CODEC_JPEG ? jpegFailureReason() : pngFailureReason()) << std::endl;
+                            }
+                            else
+                                pixels = stbi_load(request.path.c_str(), &width, &height, &fileChannels, request.channels);
+                            request.decodeSeconds += now() - start;
+                            int channels = request.channels ? request.channels : fileChannels;
+                            if (pixels && width == request.width && height == request.height && channels == (request.channels ? request.channels : request.fileChannels))
+                            {
+                                start = now();
+                                MipChain chain;
+                                if (inPlace)
+                                {
+                                    // stb_image decodes to its own memory
+                                    if (pixels != destination)
+                                        memcpy(destination, pixels, size_t(width) * height * channels);
+                                    chain.width = width;
+                                    chain.height = height;
+                                    chain.channels = channels;
+                                    buildMipLevels(destination, width, height, channels, mipFilter, jobs);
+                                    writeMipCache(request.path, mipFilter, chain, destination);
+                                }
+                                else
+                                {
+                                    buildMipChain(pixels, width, height, channels, mipFilter, jobs, chain);
+                                    MipChain compressed;
+                                    compressMipChain(chain, compression, jobs, compressed);
+                                    std::swap(chain, compressed);
+                                    request.psnr = chain.psnr;
+                                    writeMipCache(request.path, mipFilter, chain);
+                                    if (request.mapped)
+                                        memcpy(request.mapped, chain.data.data(), chain.data.size()); // only ever written, fine for write-combined memory
+                                    else
+                                        request.heapChain.swap(chain.data);
+                                }
+                                request.mipSeconds = now() - start;
+                                request.decodedOk = true;
+                            }
+                            if (request.codec == CODEC_STB)
+                                stbi_image_free(pixels);
+                        }
+                        {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            ready.push_back(pending);
+                        }
+                        decoded.notify_all(); });
+    }
+}
+
+// one pixel textures are tiny, they are made on the spot
+static void uploadPixel(GLenum target, const std::array<unsigned char, 3> &color)
+{
+    unsigned char pixel[4] = {color[0], color[1], color[2], 255}; // padded to the default unpack alignment
+    glTexImage2D(target, 0, GL_RGB, 1, 1, 0, GL_RGB, GL_UNSIGNED_BYTE, pixel);
+}
+
+TextureHandle TextureLoader::load2D(const std::string &path, int maxScreenPixels)
+{
+    TextureHandle handle;
+    // create & bind textures
+    GLuint names[2];
+    glGenTextures(2, names);
+    handle.texture = names[0];
+    handle.placeholder = names[1];
+    glBindTexture(GL_TEXTURE_2D, handle.texture);
+    // set filter param, trilinear between the mip levels
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, handle.placeholder);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    uploadPixel(GL_TEXTURE_2D, placeholderColor(path));
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    requests.push_back(new Request(path, handle.texture, GL_TEXTURE_2D, 0, int(std::ceil(3.14159265358979 * maxScreenPixels))));
+    submit(requests.back());
+    return handle;
+}
+
+TextureHandle TextureLoader::loadCubemap(const std::vector<std::string> &faces)
+{
+    TextureHandle handle;
+    GLuint names[2];
+    glGenTextures(2, names);
+    handle.texture = names[0];
+    handle.placeholder = names[1];
+    glBindTexture(GL_TEXTURE_CUBE_MAP, handle.texture);
+    //Clamp the edges of each new face to the adjacent face, so there is no seams.
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, handle.placeholder);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    for (size_t i = 0; i < faces.size(); ++i)
+        uploadPixel(GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i), placeholderColor(faces[i]));
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    // faces are uploaded as RGB, whatever the files hold
+    for (size_t i = 0; i < faces.size(); ++i)
+    {
+        requests.push_back(new Request(faces[i], handle.texture, GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i), 3));
+        submit(requests.back());
+    }
+    return handle;
+}
+
+void TextureLoader::upload(Request &request)
+{
+    double start = now();
+    bool cubeFace = request.target != GL_TEXTURE_2D;
+    // unmapping hands the pixels back to GL, the upload then copies from buffer memory without the CPU
+    bool intact = true;
+    if (request.buffer)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, request.buffer);
+        intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE; // false if the memory was lost meanwhile (e.g. a mode switch)
+        request.mapped = nullptr;
+    }
+    if (!request.decodedOk || !intact)
+    {
+        if (request.buffer)
+        {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            glDeleteBuffers(1, &request.buffer);
+            request.buffer = 0;
+        }
+        if (cubeFace)
+            std::cout << "Cubemap tex failed to load at path: " << request.path << std::endl;
+        else
+            std::cerr << "Error::Texture could not load texture file:" << request.path << std::endl;
+        return;
+    }
+
+    int channels = request.channels ? request.channels : request.fileChannels;
+    GLenum format = channels == 1 ? GL_RED : channels == 4 ? GL_RGBA : GL_RGB;
+    int levels = MipChain::mipLevelCount(request.width, request.height);
+    glBindTexture(cubeFace ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, request.texture);
+    glTexParameteri(cubeFace ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    // levels are tightly packed; with a pixel buffer bound, the data pointer is an offset into it
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    const unsigned char *base = request.buffer ? nullptr : request.heapChain.data();
+    GLenum compressedFormat = compression == COMPRESSION_BC7 ? GL_COMPRESSED_RGBA_BPTC_UNORM_ARB : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    for (int level = 0; level < levels; ++level)
+    {
+        int width = MipChain::levelWidth(request.width, level), height = MipChain::levelWidth(request.height, level);
+        size_t offset = MipChain::levelOffset(request.width, request.height, channels, level, compression);
+        if (compression == COMPRESSION_NONE)
+            glTexImage2D(request.target, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, base + offset);
+        else
+            glCompressedTexImage2D(request.target, level, compressedFormat, width, height, 0,
+                                   GLsizei(MipChain::levelOffset(request.width, request.height, channels, level + 1, compression) - offset), base + offset);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(cubeFace ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, 0);
+
+    if (request.buffer)
+    {
+        // deleting is deferred by GL until the upload has read it
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &request.buffer);
+        request.buffer = 0;
+    }
+    std::vector<unsigned char>().swap(request.heapChain);
+    request.uploadSeconds += now() - start;
+}
+
+void TextureLoader::markResident(Request &request)
+{
+    GLuint texture = request.texture;
+    auto pending = pendingImages.find(texture);
+    if (pending != pendingImages.end() && --pending->second == 0)
+    {
+        pendingImages.erase(pending);
+        if (released.erase(texture))
+            forget(texture);
+    }
+    residentCount++;
+    lastResident = now();
+}
+
+void TextureLoader::release(TextureHandle &handle)
+{
+    if (handle.placeholder)
+        glDeleteTextures(1, &handle.placeholder);
+    if (handle.texture)
+    {
+        if (resident(handle.texture))
+            forget(handle.texture);
+        else
+            released.insert(handle.texture); // its images are still being uploaded into it
+    }
+    handle = TextureHandle();
+}
+
+// the texture's requests are all resident, nothing else reads their names any more
+void TextureLoader::forget(GLuint texture)
+{
+    glDeleteTextures(1, &texture);
+    for (Request *request : requests)
+    {
+        if (request->texture == texture)
+            request->texture = 0;
+    }
+}
+
+void TextureLoader::uploadLoop()
+{
+    glfwMakeContextCurrent(uploadWindow);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        decoded.wait(lock, [this]
+                     { return stopping || !ready.empty() || !sized.empty(); });
+        if (ready.empty() && sized.empty())
+            break;
+        std::vector<Request *> toMap, batch;
+        toMap.swap(sized);
+        batch.swap(ready);
+        lock.unlock();
+
+        mapBuffers(toMap);
+
+        // the fence signals once the upload commands have completed, the flush makes sure it gets there
+        std::vector<Fenced> done;
+        for (Request *request : batch)
+        {
+            upload(*request);
+            done.push_back({request, glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0)});
+        }
+        glFlush();
+
+        lock.lock();
+        fenced.insert(fenced.end(), done.begin(), done.end());
+    }
+    lock.unlock();
+    glfwMakeContextCurrent(NULL);
+}
+
+size_t TextureLoader::update()
+{
+    if (!uploadThread.joinable())
+    {
+        std::vector<Request *> toMap, batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            toMap.swap(sized);
+            batch.swap(ready);
+        }
+        mapBuffers(toMap);
+        for (Request *request : batch)
+        {
+            upload(*request);
+            markResident(*request);
+        }
+        return requests.size() - residentCount;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiting.insert(waiting.end(), fenced.begin(), fenced.end());
+        fenced.clear();
+    }
+    // a zero timeout only asks whether the fence has signaled
+    auto signaled = [this](const Fenced &entry)
+    {
+        GLenum status = glClientWaitSync(entry.fence, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            return false;
+        glDeleteSync(entry.fence);
+        markResident(*entry.request);
+        return true;
+    };
+    waiting.erase(std::remove_if(waiting.begin(), waiting.end(), signaled), waiting.end());
+    return requests.size() - residentCount;
+}
+
+void TextureLoader::finish()
+{
+    while (update() > 0)
+    {
+        // lend a hand with the decoding, otherwise give the other threads the core
+        if (!jobs.runPending())
+            std::this_thread::yield();
+    }
+}
+
+void TextureLoader::printTimings(std::ostream &out) const
+{
+    double decodeTotal = 0.0, mipTotal = 0.0, uploadTotal = 0.0, slowest = 0.0;
+    size_t gpuBytes = 0, uncompressedBytes = 0;
+    for (const Request *request : requests)
+    {
+        out << "  " << std::left << std::setw(28) << request->path << std::right << std::fixed << std::setprecision(1)
+            << (request->cached ? " read   " : " decode ") << std::setw(7) << request->decodeSeconds * 1e3 << " ms";
+        if (request->scale > 1)
+            out << " at 1/" << request->scale << " (" << request->width << "x" << request->height << ")";
+        out << ", mips ";
+        if (request->cached)
+            out << " from the cache";
+        else
+            out << std::setw(6) << request->mipSeconds * 1e3 << " ms";
+        out << ", upload " << std::setw(6) << request->uploadSeconds * 1e3 << " ms";
+        if (compression != COMPRESSION_NONE)
+            out << ", " << (compression == COMPRESSION_BC7 ? "bc7 " : "bc1 ") << request->psnr << " dB";
+        out << std::endl;
+        gpuBytes += request->bufferSize;
+        uncompressedBytes += MipChain::levelOffset(request->width, request->height, 4, MipChain::mipLevelCount(request->width, request->height)); // RGB is stored as RGBA
+        decodeTotal += request->decodeSeconds;
+        mipTotal += request->mipSeconds;
+        uploadTotal += request->uploadSeconds;
+        slowest = std::max(slowest, request->decodeSeconds);
+    }
+    double wall = firstRequest >= 0.0 ? lastResident - firstRequest : 0.0;
+    out << "  " << requests.size() << " images: decode " << decodeTotal * 1e3 << " ms summed (slowest "
+        << slowest * 1e3 << " ms), mips " << mipTotal * 1e3 << " ms, upload " << uploadTotal * 1e3 << " ms" << (uploadThread.joinable() ? " on the upload thread" : "")
+        << ", first request to last resident " << wall * 1e3 << " ms" << std::endl;
+    out << "  texture memory " << gpuBytes / (1024.0 * 1024.0) << " MB";
+    if (compression != COMPRESSION_NONE)
+        out << ", " << uncompressedBytes / (1024.0 * 1024.0) << " MB as RGBA8";
+    out << std::endl;
+    out << std::defaultfloat;
+}
@@ -0,0 +1,146 @@
+#pragma once
+#include <condition_variable>
+#include <cstddef>
+#include <array>
+#include <map>
+#include <mutex>
+#include <set>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "mipmaps.h"
+
+class JobSystem;
+struct GLFWwindow;
+
+// What a load hands out right away: the texture, which fills in later, and a 1x1 stand-in of the
+// image's average color (from the asset manifest) to bind until the texture is resident
+struct TextureHandle
+{
+    GLuint texture = 0;
+    GLuint placeholder = 0;
+};
+
+// GL thread, after glewInit: BC7 if the driver has it, else BC1, else none
+TextureCompression bestTextureCompression();
+
+// Decodes images on the job system and uploads them as each one finishes, either on the GL thread
+// or on an upload thread with its own context shared with the window's. Texture names are handed
+// out when requested; a texture may only be sampled once resident() says its pixels are in.
+// Every texture has a full mip chain and trilinear filtering, block-compressed if the driver can
+// (see block_compress.h). Each image gets a mapped pixel unpack buffer the size of its chain; an up
+// to date chain is read from its cache (see mipmaps.h) straight into it. Otherwise the image is
+// decoded, the chain built, compressed and cached, then copied in; without compression the image is
+// decoded straight into the buffer as level 0 and the chain built there. The upload reads from the buffer,
+// glTexImage2D makes no copy of client memory. Baseline JPEGs and 8-bit PNGs are decoded by our own
+// decoders with the work of one image split across the job system (see jpeg_decode.h, png_decode.h),
+// so a single large texture doesn't sit on one core; other files go through stb_image.
+class TextureLoader
+{
+public:
+    TextureLoader(JobSystem &jobs, TextureCompression compression, MipFilter mipFilter = MIP_FILTER_KAISER);
+    ~TextureLoader();
+
+    // uploads move to a thread with a hidden context sharing share's objects. Each upload is
+    // followed by a fence, the GL thread only polls the fences. Call on the GL thread, before any load.
+    bool startUploadThread(GLFWwindow *share);
+    // GL thread, before the shared context goes away: waits for the images in flight, ends the upload thread
+    void stop();
+
+    // placeholder colors by path, written by tools/asset_manifest. Images it doesn't list get grey
+    // placeholders. Call before the loads.
+    bool loadManifest(const std::string &path);
+
+    // a 2D texture with trilinear filtering, filled in once its image is decoded. A sphere map of a
+    // body never covering more than maxScreenPixels across needs about pi times that in width (its
+    // equator wraps the whole circumference); a JPEG that large at 1/2, 1/4 or 1/8 of its size is
+    // decoded at that size directly (see jpeg_decode.h). 0 keeps the full size.
+    TextureHandle load2D(const std::string &path, int maxScreenPixels = 0);
+    // a cube map from six faces in the order right, left, top, bottom, front, back
+    TextureHandle loadCubemap(const std::vector<std::string> &faces);
+
+    // GL thread, never blocks: uploads the images decoded so far (or collects the finished uploads
+    // of the upload thread), returns how many images are not resident yet
+    size_t update();
+    // GL thread: keeps updating, decoding on this thread too, until every image is resident
+    void finish();
+    // GL thread: every image of texture is uploaded and visible to this context
+    bool resident(GLuint texture) const { return pendingImages.find(texture) == pendingImages.end(); }
+    // GL thread: what to bind for handle this frame, the texture once resident, its placeholder until then
+    GLuint bindable(const TextureHandle &handle) const { return resident(handle.texture) ? handle.texture : handle.placeholder; }
+    // GL thread: deletes the texture and its placeholder and zeroes handle. A texture still loading
+    // is deleted once its upload is resident, the loader never touches the name after that.
+    void release(TextureHandle &handle);
+
+    // per image decode, mip chain and upload times, compression quality, and the totals
+    void printTimings(std::ostream &out) const;
+
+private:
+    enum Codec
+    {
+        CODEC_STB, // stb_image, one thread
+        CODEC_JPEG,
+        CODEC_PNG,
+    };
+
+    struct Request
+    {
+        Request(const std::string &path, GLuint texture, GLenum target, int channels, int minWidth = 0)
+            : path(path), texture(texture), target(target), channels(channels), minWidth(minWidth) {}
+
+        std::string path;
+        GLuint texture;
+        GLenum target; // GL_TEXTURE_2D or a cube map face
+        int channels;  // 0 keeps the file's
+        int minWidth = 0; // decoded at a fraction of the size that keeps this width, 0 for full size
+        int scale = 1;
+        Codec codec = CODEC_STB;
+        std::vector<unsigned char> heapChain; // when the buffer couldn't be mapped
+        GLuint buffer = 0;                    // pixel unpack buffer, the whole mip chain
+        unsigned char *mapped = nullptr;
+        size_t bufferSize = 0;
+        bool cached = false, decodedOk = false;
+        int width = 0, height = 0, fileChannels = 0;
+        double decodeSeconds = 0.0, mipSeconds = 0.0, uploadSeconds = 0.0;
+        double psnr = 0.0; // level 0 after compression
+    };
+
+    struct Fenced
+    {
+        Request *request;
+        GLsync fence;
+    };
+
+    std::array<unsigned char, 3> placeholderColor(const std::string &path) const;
+    void submit(Request *pending);
+    void mapBuffers(const std::vector<Request *> &batch);
+    void upload(Request &request);
+    void markResident(Request &request);
+    void forget(GLuint texture);
+    void uploadLoop();
+
+    JobSystem &jobs;
+    TextureCompression compression;
+    MipFilter mipFilter;
+    std::vector<Request *> requests; // GL thread only, jobs and the upload thread are handed the Request * itself
+    std::map<std::string, std::array<unsigned char, 3>> manifest;
+    std::map<GLuint, int> pendingImages; // texture -> images not resident yet
+    std::set<GLuint> released;           // pending textures to delete once resident
+    size_t residentCount = 0;
+    double firstRequest = -1.0, lastResident = 0.0; // seconds on the loader's clock
+
+    std::mutex mutex;
+    std::condition_variable decoded;
+    std::vector<Request *> sized;   // size known, no pixel buffer yet
+    std::vector<Request *> ready;   // decoded, not uploaded yet
+    std::vector<Fenced> fenced;  // uploaded by the upload thread, fence not seen by the GL thread yet
+    std::vector<Fenced> waiting; // GL thread: fences not signaled yet
+
+    GLFWwindow *uploadWindow = nullptr;
+    std::thread uploadThread;
+    bool stopping = false;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#include "mipmaps.h"
+
+// Tile file of a virtual texture, written by tools/vt_build and streamed by VirtualTextures.
+// Every level of the image, from level 0 down to the one that fits in a single tile, is cut into
+// tileSize squares. Each tile is stored as a page with border texels copied from its neighbours
+// (u wraps around the sphere, v clamps at the poles), so bilinear filtering inside a page of the
+// atlas never reads another tile; a border of 4 also keeps pages on block boundaries when they are
+// block-compressed. Pages all have the same size, so where a tile is stored is computed, not looked up.
+// Width and height must be the tile size times a power of two.
+// Layout (little-endian): TileFileHeader, then the pages of level 0 row by row, level 1, and so on.
+const char TILE_FILE_MAGIC[8] = {'S', 'P', 'C', 'T', 'I', 'L', 'E', '1'};
+const uint32_t TILE_FILE_VERSION = 1;
+
+struct TileFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t width, height; // level 0, in texels
+    uint32_t tileSize, border;
+    uint32_t levels;
+    uint32_t compression; // TextureCompression, COMPRESSION_NONE pages are RGBA8
+    uint32_t reserved;
+    uint64_t pageBytes;
+};
+
+// a tile with its border on every side
+inline int tilePageSize(const TileFileHeader &header) { return int(header.tileSize + 2 * header.border); }
+
+inline size_t tilePageBytes(int pageSize, TextureCompression compression)
+{
+    size_t blocks = size_t(pageSize / 4) * size_t(pageSize / 4);
+    return compression == COMPRESSION_BC1 ? blocks * 8 : compression == COMPRESSION_BC7 ? blocks * 16 : size_t(pageSize) * pageSize * 4;
+}
+
+// tiles across (or down, given the height) a level
+inline int tilesAt(uint32_t size, uint32_t tileSize, int level)
+{
+    int tiles = int(size / tileSize) >> level;
+    return tiles > 0 ? tiles : 1;
+}
+
+// levels down to a single tile
+inline int tileLevelCount(uint32_t width, uint32_t height, uint32_t tileSize)
+{
+    int levels = 1;
+    while (tilesAt(width, tileSize, levels - 1) > 1 || tilesAt(height, tileSize, levels - 1) > 1)
+        levels++;
+    return levels;
+}
+
+// where the page of tile (x, y) of level starts in the file
+inline uint64_t tilePageOffset(const TileFileHeader &header, int level, int x, int y)
+{
+    uint64_t index = 0;
+    for (int l = 0; l < level; ++l)
+        index += uint64_t(tilesAt(header.width, header.tileSize, l)) * tilesAt(header.height, header.tileSize, l);
+    index += uint64_t(y) * tilesAt(header.width, header.tileSize, level) + x;
+    return sizeof(TileFileHeader) + index * header.pageBytes;
+}
@@ -0,0 +1,114 @@
+// Orbit/spin model matrices: the SIMD affine kernel against the glm rotate/translate/scale chain.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o affine_bench tools/affine_bench.cpp affine.cpp
+//
+// usage:
+// ./affine_bench [bodies=100000] [repeats=50]
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "../affine.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 100000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 50;
+    std::mt19937_64 rng(11);
+    std::uniform_real_distribution<double> angle(0.0, glm::two_pi<double>()), radius(1.0, 50.0), size(0.1, 3.0);
+
+    // suns, planets and moons: every body orbits an earlier one except the first 1%
+    OrbitArrays bodies;
+    bodies.resize(count);
+    size_t roots = std::max<size_t>(1, count / 100);
+    for (size_t i = 0; i < count; ++i)
+    {
+        bodies.parent[i] = i < roots ? -1 : static_cast<int>(rng() % i);
+        bodies.orbitAngle[i] = angle(rng);
+        bodies.orbitRadius[i] = i < roots ? 0.0 : radius(rng);
+        bodies.spinAngle[i] = angle(rng);
+        bodies.scale[i] = size(rng);
+    }
+    glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 1000.0f) *
+                               glm::lookAt(glm::vec3(0.0f, 30.0f, 120.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    // sincos accuracy
+    {
+        std::vector<double> angles(count), s(count), c(count);
+        std::uniform_real_distribution<double> wide(-1e3, 1e3);
+        for (double &a : angles)
+            a = wide(rng);
+        sincosArray(angles.data(), count, s.data(), c.data());
+        double worst = 0.0;
+        for (size_t i = 0; i < count; ++i)
+            worst = std::max({worst, fabs(s[i] - sin(angles[i])), fabs(c[i] - cos(angles[i]))});
+        printf("sincos: largest error against libm %.3g\n", worst);
+    }
+
+    // the glm chain, as main() used to build each model: parent frame, rotate, translate, rotate, scale
+    std::vector<glm::mat4> frames(count), chainModels(count), chainMVPs(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            int p = bodies.parent[i];
+            glm::mat4 frame = p >= 0 ? frames[p] : glm::mat4(1.0f);
+            frame = glm::rotate(frame, static_cast<float>(bodies.orbitAngle[i]), glm::vec3(0.0f, 1.0f, 0.0f));
+            frame = glm::translate(frame, glm::vec3(static_cast<float>(bodies.orbitRadius[i]), 0.0f, 0.0f));
+            frames[i] = frame;
+            glm::mat4 model = glm::rotate(frame, static_cast<float>(bodies.spinAngle[i]), glm::vec3(0.0f, 1.0f, 0.0f));
+            chainModels[i] = glm::scale(model, glm::vec3(static_cast<float>(bodies.scale[i])));
+            chainMVPs[i] = viewProjection * chainModels[i];
+        }
+    }
+    double chainSeconds = secondsSince(start) / repeats;
+
+    // the kernel
+    OrbitWorkspace work;
+    std::vector<float> models(16 * count), mvps(16 * count);
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        composeOrbitModels(bodies, glm::dvec3(0.0), models.data(), work);
+    double modelSeconds = secondsSince(start) / repeats;
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repeats; ++r)
+        composeOrbitModelViewProjections(bodies, glm::dvec3(0.0), viewProjection, mvps.data(), work);
+    double mvpSeconds = secondsSince(start) / repeats;
+
+    // the chain rounds to float at every step, the kernel only at the end
+    double modelDifference = 0.0, mvpDifference = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                modelDifference = std::max(modelDifference, double(fabs(chainModels[i][c][k] - models[16 * i + 4 * c + k])));
+                mvpDifference = std::max(mvpDifference, double(fabs(chainMVPs[i][c][k] - mvps[16 * i + 4 * c + k])));
+            }
+        }
+    }
+
+    printf("%zu bodies\n", count);
+    printf("glm chain (model + mvp): %.2f ms, %.1f ns per body\n", chainSeconds * 1e3, chainSeconds * 1e9 / count);
+    printf("kernel models:           %.2f ms, %.1f ns per body (%.1fx)\n", modelSeconds * 1e3, modelSeconds * 1e9 / count, chainSeconds / modelSeconds);
+    printf("kernel mvps:             %.2f ms, %.1f ns per body (%.1fx)\n", mvpSeconds * 1e3, mvpSeconds * 1e9 / count, chainSeconds / mvpSeconds);
+    printf("largest difference from the chain: model %.3g, mvp %.3g\n", modelDifference, mvpDifference);
+    return 0;
+}
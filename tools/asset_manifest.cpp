@@ -0,0 +1,71 @@
+// Writes the asset manifest: the average color of every image, the placeholder TextureLoader
+// shows until the image itself is resident. The average is taken in linear light, an sRGB average
+// comes out too dark.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o asset_manifest tools/asset_manifest.cpp image_decode.cpp
+//
+// usage (paths as the program loads them):
+// ./asset_manifest assets.manifest Textures/*.jpg skybox/*.png
+#include <iostream>
+#include <fstream>
+#include <cmath>
+#include <cstdio>
+
+#include "../stb_image.h"
+
+static double toLinear(double srgb)
+{
+    return srgb <= 0.04045 ? srgb / 12.92 : pow((srgb + 0.055) / 1.055, 2.4);
+}
+
+static double toSrgb(double linear)
+{
+    return linear <= 0.0031308 ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: asset_manifest output image..." << std::endl;
+        return 1;
+    }
+    std::ofstream out(argv[1]);
+    if (!out)
+    {
+        std::cerr << "Error::Manifest could not write " << argv[1] << std::endl;
+        return 1;
+    }
+    out << "# written by tools/asset_manifest: average sRGB color of each image, shown until it is loaded" << std::endl;
+    out << "# path r g b" << std::endl;
+
+    double linear[256];
+    for (int i = 0; i < 256; ++i)
+        linear[i] = toLinear(i / 255.0);
+    int failed = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        int width = 0, height = 0, channels = 0;
+        unsigned char *pixels = stbi_load(argv[i], &width, &height, &channels, 3);
+        if (!pixels)
+        {
+            std::cerr << "Error::Manifest could not load " << argv[i] << ": " << stbi_failure_reason() << std::endl;
+            failed++;
+            continue;
+        }
+        double sum[3] = {0.0, 0.0, 0.0};
+        size_t count = size_t(width) * size_t(height);
+        for (size_t p = 0; p < count; ++p)
+            for (int c = 0; c < 3; ++c)
+                sum[c] += linear[pixels[3 * p + c]];
+        stbi_image_free(pixels);
+
+        out << argv[i];
+        for (int c = 0; c < 3; ++c)
+            out << " " << static_cast<int>(lround(toSrgb(sum[c] / count) * 255.0));
+        out << std::endl;
+    }
+    printf("%d images written to %s\n", argc - 2 - failed, argv[1]);
+    return failed ? 1 : 0;
+}
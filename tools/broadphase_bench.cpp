@@ -0,0 +1,103 @@
+// Sweep and prune throughput, on its own and inside the simulation step.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -pthread -o broadphase_bench tools/broadphase_bench.cpp broadphase.cpp simulation.cpp checkpoint.cpp jobs.cpp mapped_file.cpp
+//
+// usage:
+// ./broadphase_bench [spheres=1000000] [steps=120]
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+#include <glm/gtc/constants.hpp>
+
+#include "../broadphase.h"
+#include "../simulation.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// a thin belt of particles on circular orbits around a central mass, with two moons crossing it
+static void fillBelt(Simulation &simulation, size_t count, std::mt19937_64 &rng)
+{
+    simulation.bodies = {
+        {"sun", -1, 0.0, 0.0, 0.0, 1.0, 1.0},
+        {"moon a", 0, 20.0, 0.011, 0.0, 0.3, 0.0},
+        {"moon b", 0, 26.0, -0.007, 0.0, 0.4, 0.0},
+    };
+    simulation.particleRadius = 0.002;
+    simulation.reset();
+
+    std::uniform_real_distribution<double> radius(15.0, 30.0), angle(0.0, glm::two_pi<double>()), height(-0.2, 0.2);
+    simulation.state.particlePosition.resize(count);
+    simulation.state.particleVelocity.resize(count);
+    for (size_t p = 0; p < count; ++p)
+    {
+        double r = radius(rng), a = angle(rng);
+        double speed = sqrt(simulation.bodies[0].gm / r);
+        simulation.state.particlePosition[p] = glm::dvec3(r * cos(a), height(rng), -r * sin(a));
+        simulation.state.particleVelocity[p] = glm::dvec3(-sin(a), 0.0, -cos(a)) * speed;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t count = argc > 1 ? strtoull(argv[1], nullptr, 10) : 1000000;
+    int steps = argc > 2 ? atoi(argv[2]) : 120;
+    std::mt19937_64 rng(7);
+
+    // broadphase alone: spheres jittering in a box, at a density that keeps a few contacts per sphere
+    {
+        double side = cbrt(double(count)) * 0.1;
+        std::uniform_real_distribution<double> place(0.0, side), jitter(-0.002, 0.002), size(0.005, 0.03);
+        std::vector<glm::dvec3> centers(count);
+        std::vector<double> radii(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            centers[i] = glm::dvec3(place(rng), place(rng), place(rng));
+            radii[i] = size(rng);
+        }
+
+        SweepAndPrune broadphase;
+        auto start = std::chrono::steady_clock::now();
+        broadphase.update(centers.data(), radii.data(), count);
+        printf("initial sort + sweep: %.1f ms, %zu contacts\n", secondsSince(start) * 1e3, broadphase.contacts().size());
+
+        double total = 0.0;
+        size_t swaps = 0, contacts = 0, began = 0;
+        for (int s = 0; s < steps; ++s)
+        {
+            for (glm::dvec3 &c : centers)
+                c += glm::dvec3(jitter(rng), jitter(rng), jitter(rng));
+            start = std::chrono::steady_clock::now();
+            broadphase.update(centers.data(), radii.data(), count);
+            total += secondsSince(start);
+            swaps += broadphase.lastSwaps();
+            contacts += broadphase.contacts().size();
+            for (const ContactEvent &contact : broadphase.contacts())
+                began += contact.began;
+        }
+        printf("%zu spheres: %.2f ms per update (%.0f updates/s), %.0f swaps, %.0f contacts, %.0f new per update\n",
+               count, total / steps * 1e3, steps / total, double(swaps) / steps, double(contacts) / steps, double(began) / steps);
+    }
+
+    // whole simulation step: gravity, broadphase and particles absorbed by the moons
+    {
+        Simulation simulation;
+        fillBelt(simulation, count, rng);
+        auto start = std::chrono::steady_clock::now();
+        for (int s = 0; s < steps; ++s)
+            simulation.step();
+        double total = secondsSince(start);
+        printf("simulation with %zu particles: %.2f ms per step (%.0f steps/s, target %.0f), %llu impacts\n",
+               count, total / steps * 1e3, steps / total, 1.0 / simulation.stepSize,
+               (unsigned long long)simulation.impacts());
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Times the occultation search on a large synthetic scene: thousands of small bodies on
+// circular orbits around a central star, seen from a fixed camera and from the star.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -pthread -o eclipse_bench tools/eclipse_bench.cpp eclipse.cpp solver.cpp jobs.cpp
+//
+// usage:
+// ./eclipse_bench [bodies=3000] [span=100] [slabLength=0, derived from the bodies]
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+#include "../eclipse.h"
+
+struct Orbit
+{
+    double radius;
+    double speed;
+    double phase;
+    double inclination;
+};
+
+int main(int argc, char **argv)
+{
+    int bodyCount = argc > 1 ? atoi(argv[1]) : 3000;
+    double span = argc > 2 ? atof(argv[2]) : 100.0;
+    double slabLength = argc > 3 ? atof(argv[3]) : 0.0;
+
+    // body 0 is the star at the origin
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<Orbit> orbits(bodyCount + 1);
+    std::vector<TrajectoryBody> bodies(bodyCount + 1);
+    orbits[0] = {0.0, 0.0, 0.0, 0.0};
+    bodies[0] = {3.0, 0.0};
+    for (int i = 1; i <= bodyCount; ++i)
+    {
+        double radius = 20.0 + 100.0 * unit(rng);
+        orbits[i] = {radius, 30.0 / sqrt(radius * radius * radius), 6.283 * unit(rng), 0.05 * (unit(rng) - 0.5)};
+        bodies[i] = {0.05 + 0.2 * unit(rng), radius * orbits[i].speed};
+    }
+
+    BodyPositionFunction position = [&orbits](int body, double t)
+    {
+        const Orbit &o = orbits[body];
+        double angle = o.phase + o.speed * t;
+        return glm::dvec3(o.radius * cos(angle), o.radius * sin(angle) * sin(o.inclination), -o.radius * sin(angle) * cos(o.inclination));
+    };
+
+    OcclusionQuery query;
+    query.startTime = 0.0;
+    query.endTime = span;
+    query.slabLength = slabLength;
+
+    query.observerPosition = glm::dvec3(0.0, 30.0, 150.0);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<OcclusionEvent> occultations = findOcclusions(bodies, position, query);
+    double cameraSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    query.observerBody = 0;
+    start = std::chrono::steady_clock::now();
+    std::vector<OcclusionEvent> eclipses = findOcclusions(bodies, position, query);
+    double starSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d bodies over %g time units (%zu pairs)\n", bodyCount, span, size_t(bodyCount) * (bodyCount - 1) / 2);
+    printf("occultations seen from the camera: %zu in %.3f s\n", occultations.size(), cameraSeconds);
+    printf("eclipses seen from the star:       %zu in %.3f s\n", eclipses.size(), starSeconds);
+    return 0;
+}
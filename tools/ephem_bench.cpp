@@ -0,0 +1,116 @@
+// Measures ephemeris lookups per second for random time access.
+// Without an argument a synthetic ephemeris of circular orbits is generated first.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o ephem_bench tools/ephem_bench.cpp ephemeris.cpp mapped_file.cpp
+//
+// usage:
+// ./ephem_bench [file.eph] [lookups=1000000]
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+
+#include "../ephemeris.h"
+
+// writes bodyCount circular orbits covering intervalCount unit intervals
+static bool writeSyntheticEphemeris(const std::string &path, uint32_t bodyCount, uint64_t intervalCount, uint32_t coefficientCount)
+{
+    const uint32_t bodyStride = (bodyCount + EPHEMERIS_BODY_ALIGN - 1) / EPHEMERIS_BODY_ALIGN * EPHEMERIS_BODY_ALIGN;
+    std::vector<std::string> names(bodyCount);
+    std::vector<double> coefficients(intervalCount * 3 * coefficientCount * bodyStride, 0.0);
+    std::vector<double> samples[3];
+    for (int axis = 0; axis < 3; ++axis)
+        samples[axis].resize(coefficientCount);
+    std::vector<double> fitted(coefficientCount);
+
+    for (uint32_t b = 0; b < bodyCount; ++b)
+    {
+        names[b] = "body" + std::to_string(b);
+        double radius = 1.0 + b * 0.01;
+        double speed = 1.0 / std::sqrt(radius * radius * radius);
+        for (uint64_t k = 0; k < intervalCount; ++k)
+        {
+            for (uint32_t n = 0; n < coefficientCount; ++n)
+            {
+                double t = k + 0.5 + 0.5 * chebyshevNode(n, coefficientCount);
+                samples[0][n] = radius * std::cos(speed * t);
+                samples[1][n] = 0.0;
+                samples[2][n] = radius * std::sin(speed * t);
+            }
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                fitChebyshev(samples[axis].data(), coefficientCount, fitted.data());
+                for (uint32_t j = 0; j < coefficientCount; ++j)
+                    coefficients[((k * 3 + axis) * coefficientCount + j) * bodyStride + b] = fitted[j];
+            }
+        }
+    }
+
+    std::string error;
+    if (!writeEphemeris(path, names, coefficientCount, intervalCount, 0.0, 1.0, coefficients, error))
+    {
+        std::cerr << "Error::Ephemeris " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    std::string path = argc > 1 ? argv[1] : "ephem_bench.eph";
+    long lookups = argc > 2 ? atol(argv[2]) : 1000000;
+
+    if (argc < 2 && !writeSyntheticEphemeris(path, 1024, 256, 12))
+        return 1;
+
+    Ephemeris ephemeris;
+    if (!ephemeris.open(path))
+    {
+        std::cerr << "Error::Ephemeris could not open " << path << std::endl;
+        return 1;
+    }
+
+    const uint32_t bodyCount = ephemeris.bodyCount();
+    std::mt19937_64 rng(42);
+    std::uniform_real_distribution<double> randomTime(ephemeris.startTime(), ephemeris.endTime());
+    std::uniform_int_distribution<uint32_t> randomBody(0, bodyCount - 1);
+
+    std::vector<double> times(lookups);
+    std::vector<uint32_t> bodies(lookups);
+    for (long i = 0; i < lookups; ++i)
+    {
+        times[i] = randomTime(rng);
+        bodies[i] = randomBody(rng);
+    }
+
+    // single body lookups at random times
+    double checksum = 0.0;
+    auto start = std::chrono::steady_clock::now();
+    for (long i = 0; i < lookups; ++i)
+        checksum += ephemeris.position(bodies[i], times[i]).x;
+    double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // whole-scene batches at random times, position and velocity
+    const uint32_t stride = ephemeris.bodyStride();
+    std::vector<double> out(stride * 6);
+    long batches = std::max(1L, lookups / static_cast<long>(bodyCount));
+    start = std::chrono::steady_clock::now();
+    for (long i = 0; i < batches; ++i)
+    {
+        ephemeris.evaluate(times[i], &out[0], &out[stride], &out[2 * stride],
+                           &out[3 * stride], &out[4 * stride], &out[5 * stride]);
+        checksum += out[i % bodyCount];
+    }
+    double batchSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%u bodies, %ld random lookups (checksum %g)\n", bodyCount, lookups, checksum);
+    printf("single body position:    %12.0f lookups/s\n", lookups / singleSeconds);
+    printf("batched position+velocity: %10.0f body lookups/s (%0.0f batches/s)\n",
+           batches * double(bodyCount) / batchSeconds, batches / batchSeconds);
+    return 0;
+}
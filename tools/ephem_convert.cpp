@@ -0,0 +1,46 @@
+// Converts a plain text trajectory table into a binary Chebyshev ephemeris.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o ephem_convert tools/ephem_convert.cpp ephemeris.cpp mapped_file.cpp
+//
+// usage:
+// ./ephem_convert table.csv out.eph [intervalLength=1.0] [degree=10]
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "../ephemeris.h"
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " table.csv out.eph [intervalLength=1.0] [degree=10]" << std::endl;
+        std::cerr << "table lines: body,time,x,y,z[,vx,vy,vz]" << std::endl;
+        return 1;
+    }
+
+    double intervalLength = argc > 3 ? atof(argv[3]) : 1.0;
+    int degree = argc > 4 ? atoi(argv[4]) : 10;
+
+    std::string error;
+    if (!convertTrajectoryTable(argv[1], argv[2], intervalLength, degree, error))
+    {
+        std::cerr << "Error::Ephemeris " << error << std::endl;
+        return 1;
+    }
+
+    // read the result back through the same path the renderer uses
+    Ephemeris ephemeris;
+    if (!ephemeris.open(argv[2]))
+        return 1;
+
+    std::cout << "wrote " << argv[2] << ": " << ephemeris.bodyCount() << " bodies, t = ["
+              << ephemeris.startTime() << ", " << ephemeris.endTime() << "], degree " << degree << std::endl;
+    for (uint32_t i = 0; i < ephemeris.bodyCount(); ++i)
+    {
+        glm::dvec3 p = ephemeris.position(i, ephemeris.startTime());
+        std::cout << "  " << ephemeris.bodyName(i) << " starts at (" << p.x << ", " << p.y << ", " << p.z << ")" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+// Adds restart markers to a baseline JPEG without touching its pixels, so the loader can decode
+// it on every core (see decodeJpegScaled). One marker per row of MCUs by default; images that
+// already have them are re-marked.
+//
+// to compile (from the repository root):
+// g++ -O2 -o jpeg_restart tools/jpeg_restart.cpp jpeg_decode.cpp jobs.cpp -pthread
+//
+// usage:
+// ./jpeg_restart in.jpg out.jpg [mcu rows per interval]
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../jpeg_decode.h"
+
+static bool readFile(const char *path, std::vector<unsigned char> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+    fseek(file, 0, SEEK_END);
+    data.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    return read == data.size();
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: jpeg_restart in.jpg out.jpg [mcu rows per interval]" << std::endl;
+        return 1;
+    }
+    int rows = argc >= 4 ? atoi(argv[3]) : 1;
+    std::vector<unsigned char> data, out;
+    if (!readFile(argv[1], data))
+    {
+        std::cerr << "Error::Restart could not read " << argv[1] << std::endl;
+        return 1;
+    }
+    if (!addJpegRestartMarkers(data.data(), data.size(), rows, out))
+    {
+        std::cerr << "Error::Restart " << argv[1] << ": " << jpegFailureReason() << std::endl;
+        return 1;
+    }
+    FILE *file = fopen(argv[2], "wb");
+    if (!file || fwrite(out.data(), 1, out.size(), file) != out.size())
+    {
+        std::cerr << "Error::Restart could not write " << argv[2] << std::endl;
+        if (file)
+            fclose(file);
+        return 1;
+    }
+    fclose(file);
+    std::cout << argv[1] << " " << data.size() << " bytes -> " << argv[2] << " " << out.size() << " bytes, a restart marker every "
+              << rows << " MCU row" << (rows == 1 ? "" : "s") << std::endl;
+    return 0;
+}
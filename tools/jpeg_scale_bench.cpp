@@ -0,0 +1,101 @@
+// Decoding a JPEG at 1/2, 1/4 or 1/8 of its size in the DCT domain (see jpeg_decode.h) against
+// the full size stbi_load. Run one mode per process: peak RSS is a high-water mark. The file is
+// read into memory first in every mode, its size is printed.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o jpeg_scale_bench tools/jpeg_scale_bench.cpp jpeg_decode.cpp image_decode.cpp jobs.cpp -pthread
+//
+// usage:
+// ./jpeg_scale_bench stbi|2|4|8 image.jpg [runs]
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "../stb_image.h"
+#include "../jpeg_decode.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double peakResidentMB()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kilobytes on linux
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc >= 3 ? atoi(argv[1]) : 0;
+    bool full = argc >= 3 && strcmp(argv[1], "stbi") == 0;
+    if (!full && scale != 2 && scale != 4 && scale != 8)
+    {
+        std::cerr << "usage: jpeg_scale_bench stbi|2|4|8 image.jpg [runs]" << std::endl;
+        return 1;
+    }
+    int runs = argc >= 4 ? atoi(argv[3]) : 5;
+
+    FILE *file = fopen(argv[2], "rb");
+    if (!file)
+    {
+        std::cerr << "Error::Bench could not open " << argv[2] << std::endl;
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    std::vector<unsigned char> data(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    if (read != data.size())
+    {
+        std::cerr << "Error::Bench could not read " << argv[2] << std::endl;
+        return 1;
+    }
+    std::cout << argv[2] << ", " << data.size() / (1024.0 * 1024.0) << " MB file, "
+              << (full ? "stbi_load" : "scaled decode") << std::endl;
+
+    double best = 1e30;
+    int width = 0, height = 0, channels = 0;
+    for (int run = 0; run < runs; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (full)
+        {
+            unsigned char *pixels = stbi_load_from_memory(data.data(), int(data.size()), &width, &height, &channels, 0);
+            if (!pixels)
+            {
+                std::cerr << "Error::Bench " << stbi_failure_reason() << std::endl;
+                return 1;
+            }
+            stbi_image_free(pixels);
+        }
+        else
+        {
+            JpegInfo info;
+            if (!readJpegInfo(data.data(), data.size(), info) || !info.supported)
+            {
+                std::cerr << "Error::Bench not a JPEG the scaled decoder handles" << std::endl;
+                return 1;
+            }
+            channels = info.components;
+            std::vector<unsigned char> pixels(size_t(jpegScaledSize(info.width, scale)) * jpegScaledSize(info.height, scale) * channels);
+            if (!decodeJpegScaled(data.data(), data.size(), scale, 0, pixels.data(), pixels.size(), &width, &height))
+            {
+                std::cerr << "Error::Bench " << jpegFailureReason() << std::endl;
+                return 1;
+            }
+        }
+        double seconds = secondsSince(start);
+        best = seconds < best ? seconds : best;
+    }
+    std::cout << "  " << width << "x" << height << "x" << channels << ", best of " << runs << " " << best * 1e3
+              << " ms, peak RSS " << peakResidentMB() << " MB" << std::endl;
+    return 0;
+}
@@ -0,0 +1,165 @@
+// Decoding one large JPEG or PNG with its work split across a job system (see jpeg_decode.h and
+// png_decode.h) against stbi_load on one thread. Give the thread count to see the scaling; a JPEG
+// with restart markers (tools/jpeg_restart) splits further than one without. The file is read into
+// memory first.
+// fuzz mode feeds the parallel decoders truncated and byte-flipped copies of the file instead (runs
+// is the number of copies, fixed seed); build it with -fsanitize=address,undefined to check that
+// malformed files are rejected without reading or writing out of bounds.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o parallel_decode_bench tools/parallel_decode_bench.cpp jpeg_decode.cpp png_decode.cpp image_decode.cpp jobs.cpp -pthread
+//
+// usage:
+// ./parallel_decode_bench stbi|ours|fuzz image.jpg|image.png [threads] [runs]
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../stb_image.h"
+#include "../jpeg_decode.h"
+#include "../png_decode.h"
+#include "../jobs.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// decodes a corrupted copy with whichever parallel decoder its headers ask for, true if it was accepted.
+// Headers claiming more than this many bytes of pixels are turned away, as a caller would.
+static const size_t MAX_FUZZ_PIXEL_BYTES = size_t(256) << 20;
+
+static bool decodeCorrupted(const std::vector<unsigned char> &data, JobSystem &jobs)
+{
+    JpegInfo jpeg;
+    PngInfo png;
+    int width = 0, height = 0;
+    std::vector<unsigned char> pixels;
+    if (readJpegInfo(data.data(), data.size(), jpeg) && jpeg.supported)
+    {
+        if (size_t(jpeg.width) * jpeg.height * jpeg.components > MAX_FUZZ_PIXEL_BYTES)
+            return false;
+        pixels.resize(size_t(jpeg.width) * jpeg.height * jpeg.components);
+        return decodeJpegScaled(data.data(), data.size(), 1, 0, pixels.data(), pixels.size(), &width, &height, &jobs);
+    }
+    if (readPngInfo(data.data(), data.size(), png) && png.supported)
+    {
+        if (size_t(png.width) * png.height * png.components > MAX_FUZZ_PIXEL_BYTES)
+            return false;
+        pixels.resize(size_t(png.width) * png.height * png.components);
+        return decodePng(data.data(), data.size(), 0, pixels.data(), pixels.size(), &width, &height, &jobs);
+    }
+    return false;
+}
+
+// every other copy cut short, the rest with a few bytes overwritten, most of them in the headers
+static int fuzz(const std::vector<unsigned char> &data, JobSystem &jobs, int copies)
+{
+    std::mt19937 random(12345);
+    int accepted = 0;
+    for (int copy = 0; copy < copies; ++copy)
+    {
+        std::vector<unsigned char> corrupted = data;
+        if (copy % 2 == 0)
+            corrupted.resize(random() % data.size());
+        else
+        {
+            int flips = 1 + int(random() % 8);
+            size_t headers = std::min(data.size(), size_t(1024));
+            for (int i = 0; i < flips; ++i)
+                corrupted[(i % 2 ? random() % data.size() : random() % headers)] = uint8_t(random());
+        }
+        accepted += decodeCorrupted(corrupted, jobs) ? 1 : 0;
+    }
+    std::cout << "  " << copies << " corrupted copies, " << accepted << " decoded, " << copies - accepted << " rejected" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    bool stbi = argc >= 3 && strcmp(argv[1], "stbi") == 0;
+    bool fuzzing = argc >= 3 && strcmp(argv[1], "fuzz") == 0;
+    if (argc < 3 || (!stbi && !fuzzing && strcmp(argv[1], "ours") != 0))
+    {
+        std::cerr << "usage: parallel_decode_bench stbi|ours|fuzz image.jpg|image.png [threads] [runs]" << std::endl;
+        return 1;
+    }
+    int threads = argc >= 4 ? atoi(argv[3]) : 0; // 0 is one per core
+    int runs = argc >= 5 ? atoi(argv[4]) : 5;
+
+    FILE *file = fopen(argv[2], "rb");
+    if (!file)
+    {
+        std::cerr << "Error::Bench could not open " << argv[2] << std::endl;
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    std::vector<unsigned char> data(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    if (read != data.size())
+    {
+        std::cerr << "Error::Bench could not read " << argv[2] << std::endl;
+        return 1;
+    }
+
+    JpegInfo jpeg;
+    PngInfo png;
+    bool isJpeg = readJpegInfo(data.data(), data.size(), jpeg) && jpeg.supported;
+    bool isPng = !isJpeg && readPngInfo(data.data(), data.size(), png) && png.supported;
+    if (!stbi && !isJpeg && !isPng)
+    {
+        std::cerr << "Error::Bench not a JPEG or PNG the parallel decoders handle" << std::endl;
+        return 1;
+    }
+    JobSystem jobs(stbi ? 1 : threads);
+    if (fuzzing)
+    {
+        std::cout << argv[2] << ", fuzzing the parallel decoders on " << jobs.threadCount() << " threads" << std::endl;
+        return fuzz(data, jobs, argc >= 5 ? runs : 200);
+    }
+    std::cout << argv[2] << ", " << data.size() / (1024.0 * 1024.0) << " MB file, "
+              << (stbi ? "stbi_load on one thread" : isJpeg ? "parallel jpeg decode" : "parallel png decode");
+    if (!stbi)
+        std::cout << " on " << jobs.threadCount() << " threads";
+    std::cout << std::endl;
+
+    double best = 1e30;
+    int width = 0, height = 0, channels = 0;
+    std::vector<unsigned char> pixels;
+    for (int run = 0; run < runs; ++run)
+    {
+        auto start = std::chrono::steady_clock::now();
+        if (stbi)
+        {
+            unsigned char *decoded = stbi_load_from_memory(data.data(), int(data.size()), &width, &height, &channels, 0);
+            if (!decoded)
+            {
+                std::cerr << "Error::Bench " << stbi_failure_reason() << std::endl;
+                return 1;
+            }
+            stbi_image_free(decoded);
+        }
+        else
+        {
+            channels = isJpeg ? jpeg.components : png.components;
+            pixels.resize(size_t(isJpeg ? jpeg.width : png.width) * (isJpeg ? jpeg.height : png.height) * channels);
+            bool ok = isJpeg ? decodeJpegScaled(data.data(), data.size(), 1, 0, pixels.data(), pixels.size(), &width, &height, &jobs)
+                             : decodePng(data.data(), data.size(), 0, pixels.data(), pixels.size(), &width, &height, &jobs);
+            if (!ok)
+            {
+                std::cerr << "Error::Bench " << (isJpeg ? jpegFailureReason() : pngFailureReason()) << std::endl;
+                return 1;
+            }
+        }
+        double seconds = secondsSince(start);
+        best = seconds < best ? seconds : best;
+    }
+    std::cout << "  " << width << "x" << height << "x" << channels << ", best of " << runs << " " << best * 1e3 << " ms" << std::endl;
+    return 0;
+}
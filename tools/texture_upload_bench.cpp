@@ -0,0 +1,176 @@
+// Texture upload of an uncompressed mip chain, as TextureLoader does it on a cache miss: decoding
+// to the heap, building the chain on the heap and glTexImage2D from client memory, against
+// decoding straight into a mapped pixel unpack buffer as level 0, building the rest of the chain
+// in place and uploading from the buffer. Run one mode per process: peak RSS is a high-water mark.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o texture_upload_bench tools/texture_upload_bench.cpp jpeg_decode.cpp png_decode.cpp mipmaps.cpp image_decode.cpp jobs.cpp -lGL -lGLEW -lglfw -pthread
+//
+// usage:
+// ./texture_upload_bench heap|pbo image...
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <sys/resource.h>
+
+#define GLEW_STATIC 1
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "../stb_image.h"
+#include "../jpeg_decode.h"
+#include "../png_decode.h"
+#include "../mipmaps.h"
+#include "../jobs.h"
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double peakResidentMB()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0; // kilobytes on linux
+}
+
+// level 0 into destination (width * height * channels bytes) the way the loader decodes it:
+// baseline JPEGs and 8-bit PNGs with our decoders, the rest with stb_image and a copy
+static bool decodeInto(const std::vector<unsigned char> &file, int width, int height, int channels, unsigned char *destination, JobSystem &jobs)
+{
+    size_t size = size_t(width) * height * channels;
+    JpegInfo jpeg;
+    PngInfo png;
+    int w = 0, h = 0;
+    if (readJpegInfo(file.data(), file.size(), jpeg) && jpeg.supported)
+        return decodeJpegScaled(file.data(), file.size(), 1, 0, destination, size, &w, &h, &jobs);
+    if (readPngInfo(file.data(), file.size(), png) && png.supported)
+        return decodePng(file.data(), file.size(), 0, destination, size, &w, &h, &jobs);
+    int n = 0;
+    unsigned char *pixels = stbi_load_from_memory(file.data(), int(file.size()), &w, &h, &n, 0);
+    if (pixels && w == width && h == height && n == channels)
+        memcpy(destination, pixels, size);
+    stbi_image_free(pixels);
+    return pixels && w == width && h == height && n == channels;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || (strcmp(argv[1], "heap") && strcmp(argv[1], "pbo")))
+    {
+        std::cerr << "usage: texture_upload_bench heap|pbo image..." << std::endl;
+        return 1;
+    }
+    bool pbo = strcmp(argv[1], "pbo") == 0;
+
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(1, 1, "texture_upload_bench", NULL, NULL);
+    if (!window)
+    {
+        std::cerr << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    glfwMakeContextCurrent(window);
+    glewExperimental = true;
+    if (glewInit() != GLEW_OK)
+    {
+        std::cerr << "Failed to create GLEW" << std::endl;
+        glfwTerminate();
+        return 1;
+    }
+    JobSystem jobs;
+    printf("%s, peak rss after GL setup %.0f MB\n", pbo ? "decode and build in a pixel buffer" : "decode and build on the heap", peakResidentMB());
+
+    for (int i = 2; i < argc; ++i)
+    {
+        const char *path = argv[i];
+        int width = 0, height = 0, channels = 0;
+        FILE *in = fopen(path, "rb");
+        std::vector<unsigned char> file;
+        if (in)
+        {
+            fseek(in, 0, SEEK_END);
+            file.resize(size_t(ftell(in)));
+            fseek(in, 0, SEEK_SET);
+            file.resize(fread(file.data(), 1, file.size(), in));
+            fclose(in);
+        }
+        if (file.empty() || !stbi_info_from_memory(file.data(), int(file.size()), &width, &height, &channels))
+        {
+            std::cerr << "Error::Texture could not load texture file:" << path << std::endl;
+            continue;
+        }
+        GLenum format = channels == 1 ? GL_RED : channels == 2 ? GL_RG : channels == 4 ? GL_RGBA : GL_RGB;
+        int levels = MipChain::mipLevelCount(width, height);
+        size_t chainSize = MipChain::levelOffset(width, height, channels, levels);
+        GLuint texture = 0;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        // decode: until level 0 is in memory; mips: the rest of the chain; upload: until the texture is complete on the GPU
+        double decodeSeconds = 0.0, mipSeconds = 0.0, uploadSeconds = 0.0;
+        bool uploaded = false;
+        auto start = std::chrono::steady_clock::now();
+        const unsigned char *base = nullptr;
+        std::vector<unsigned char> image;
+        MipChain chain;
+        GLuint buffer = 0;
+        if (pbo)
+        {
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, chainSize, NULL, GL_STREAM_DRAW);
+            unsigned char *mapped = static_cast<unsigned char *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, chainSize, GL_MAP_READ_BIT | GL_MAP_WRITE_BIT));
+            bool decoded = mapped && decodeInto(file, width, height, channels, mapped, jobs);
+            decodeSeconds = secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            if (decoded)
+                buildMipLevels(mapped, width, height, channels, MIP_FILTER_KAISER, jobs);
+            mipSeconds = secondsSince(start);
+            uploaded = mapped && glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE && decoded;
+        }
+        else
+        {
+            image.resize(size_t(width) * height * channels);
+            bool decoded = decodeInto(file, width, height, channels, image.data(), jobs);
+            decodeSeconds = secondsSince(start);
+            start = std::chrono::steady_clock::now();
+            if (decoded)
+                buildMipChain(image.data(), width, height, channels, MIP_FILTER_KAISER, jobs, chain);
+            mipSeconds = secondsSince(start);
+            base = chain.data.data();
+            uploaded = decoded;
+        }
+        start = std::chrono::steady_clock::now();
+        // with the pixel buffer bound, base is null and the offsets point into it
+        for (int level = 0; uploaded && level < levels; ++level)
+            glTexImage2D(GL_TEXTURE_2D, level, format, MipChain::levelWidth(width, level), MipChain::levelWidth(height, level), 0, format,
+                         GL_UNSIGNED_BYTE, base + MipChain::levelOffset(width, height, channels, level));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (buffer)
+            glDeleteBuffers(1, &buffer);
+        glFinish();
+        uploadSeconds = secondsSince(start);
+        if (!uploaded)
+            std::cerr << "Error::Texture could not load texture file:" << path << std::endl;
+        glDeleteTextures(1, &texture);
+
+        printf("%s %dx%dx%d (%.0f MB chain): decode %.1f ms, mips %.1f ms, upload %.1f ms, peak rss %.0f MB\n", path, width, height, channels,
+               chainSize / (1024.0 * 1024.0), decodeSeconds * 1e3, mipSeconds * 1e3, uploadSeconds * 1e3, peakResidentMB());
+    }
+
+    glfwTerminate();
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Cuts a large surface map into the tile file a virtual texture streams from (see tile_file.h and
+// virtual_texture.h). The mip chain is built as for ordinary textures (gamma-correct Kaiser
+// filter), then every level down to a single tile is cut into pages with their borders and
+// block-compressed. Building takes about 4 GB of memory for a 16k map, 16 GB for a 32k one.
+//
+// to compile (from the repository root):
+// g++ -O2 -march=native -o vt_build tools/vt_build.cpp mipmaps.cpp block_compress.cpp jpeg_decode.cpp image_decode.cpp jobs.cpp mapped_file.cpp -pthread
+//
+// usage (bc1 and a tile size of 128 by default):
+// ./vt_build mars_16k.jpg Textures/mars.tiles [bc1|bc7|none] [tile size]
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../stb_image.h"
+#include "../jpeg_decode.h"
+#include "../block_compress.h"
+#include "../tile_file.h"
+#include "../jobs.h"
+
+static const int BORDER = 4;
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool powerOfTwo(uint32_t n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+// the page of tile (tx, ty): RGBA, u wrapping and v clamping into the level for the border
+static void gatherPage(const unsigned char *level, int width, int height, int tileSize, int tx, int ty, unsigned char *rgba)
+{
+    int pageSize = tileSize + 2 * BORDER;
+    for (int py = 0; py < pageSize; ++py)
+    {
+        int y = std::min(std::max(ty * tileSize + py - BORDER, 0), height - 1);
+        for (int px = 0; px < pageSize; ++px)
+        {
+            int x = ((tx * tileSize + px - BORDER) % width + width) % width;
+            const unsigned char *in = level + (size_t(y) * width + x) * 3;
+            unsigned char *out = rgba + (size_t(py) * pageSize + px) * 4;
+            out[0] = in[0];
+            out[1] = in[1];
+            out[2] = in[2];
+            out[3] = 255;
+        }
+    }
+}
+
+// blocks in row order, as glCompressedTexSubImage2D takes them
+static void compressPage(const unsigned char *rgba, int pageSize, TextureCompression compression, unsigned char *out)
+{
+    if (compression == COMPRESSION_NONE)
+    {
+        memcpy(out, rgba, size_t(pageSize) * pageSize * 4);
+        return;
+    }
+    size_t blockBytes = compression == COMPRESSION_BC1 ? 8 : 16;
+    unsigned char block[64];
+    for (int by = 0; by < pageSize / 4; ++by)
+        for (int bx = 0; bx < pageSize / 4; ++bx)
+        {
+            for (int row = 0; row < 4; ++row)
+                memcpy(block + row * 16, rgba + (size_t(by * 4 + row) * pageSize + bx * 4) * 4, 16);
+            if (compression == COMPRESSION_BC1)
+                compressBlockBC1(block, out);
+            else
+                compressBlockBC7(block, out);
+            out += blockBytes;
+        }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: vt_build image output.tiles [bc1|bc7|none] [tile size]" << std::endl;
+        return 1;
+    }
+    std::string mode = argc >= 4 ? argv[3] : "bc1";
+    TextureCompression compression = mode == "bc7" ? COMPRESSION_BC7 : mode == "none" ? COMPRESSION_NONE : COMPRESSION_BC1;
+    int tileSize = argc >= 5 ? atoi(argv[4]) : 128;
+    if ((mode != "bc1" && mode != "bc7" && mode != "none") || tileSize < 4 || tileSize % 4 != 0)
+    {
+        std::cerr << "Error::TileBuild the compression is bc1, bc7 or none and the tile size a multiple of 4" << std::endl;
+        return 1;
+    }
+    JobSystem jobs;
+    auto start = std::chrono::steady_clock::now();
+
+    // decode, our parallel decoder for baseline JPEGs
+    FILE *file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        std::cerr << "Error::TileBuild could not open " << argv[1] << std::endl;
+        return 1;
+    }
+    fseek(file, 0, SEEK_END);
+    std::vector<unsigned char> data(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(data.data(), 1, data.size(), file);
+    fclose(file);
+    if (read != data.size())
+    {
+        std::cerr << "Error::TileBuild could not read " << argv[1] << std::endl;
+        return 1;
+    }
+    int width = 0, height = 0;
+    std::vector<unsigned char> pixels;
+    JpegInfo jpeg;
+    if (readJpegInfo(data.data(), data.size(), jpeg) && jpeg.supported)
+    {
+        pixels.resize(size_t(jpeg.width) * jpeg.height * 3);
+        if (!decodeJpegScaled(data.data(), data.size(), 1, 3, pixels.data(), pixels.size(), &width, &height, &jobs))
+        {
+            std::cerr << "Error::TileBuild " << argv[1] << ": " << jpegFailureReason() << std::endl;
+            return 1;
+        }
+    }
+    else
+    {
+        int channels;
+        unsigned char *decoded = stbi_load_from_memory(data.data(), int(data.size()), &width, &height, &channels, 3);
+        if (!decoded)
+        {
+            std::cerr << "Error::TileBuild " << argv[1] << ": " << stbi_failure_reason() << std::endl;
+            return 1;
+        }
+        pixels.assign(decoded, decoded + size_t(width) * height * 3);
+        stbi_image_free(decoded);
+    }
+    std::vector<unsigned char>().swap(data);
+    if (width % tileSize != 0 || height % tileSize != 0 || !powerOfTwo(width / tileSize) || !powerOfTwo(height / tileSize))
+    {
+        std::cerr << "Error::TileBuild " << width << "x" << height << " is not the tile size (" << tileSize << ") times a power of two" << std::endl;
+        return 1;
+    }
+    std::cout << argv[1] << " " << width << "x" << height << " decoded in " << secondsSince(start) << " s" << std::endl;
+
+    start = std::chrono::steady_clock::now();
+    MipChain chain;
+    buildMipChain(pixels.data(), width, height, 3, MIP_FILTER_KAISER, jobs, chain);
+    std::vector<unsigned char>().swap(pixels);
+    std::cout << "mip chain built in " << secondsSince(start) << " s" << std::endl;
+
+    TileFileHeader header = {};
+    memcpy(header.magic, TILE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TILE_FILE_VERSION;
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.tileSize = uint32_t(tileSize);
+    header.border = BORDER;
+    header.levels = uint32_t(tileLevelCount(header.width, header.height, header.tileSize));
+    header.compression = compression;
+    int pageSize = tilePageSize(header);
+    header.pageBytes = tilePageBytes(pageSize, compression);
+
+    FILE *out = fopen(argv[2], "wb");
+    if (!out || fwrite(&header, sizeof(header), 1, out) != 1)
+    {
+        std::cerr << "Error::TileBuild could not write " << argv[2] << std::endl;
+        if (out)
+            fclose(out);
+        return 1;
+    }
+    // a level's pages at a time, rows of tiles split over the jobs
+    start = std::chrono::steady_clock::now();
+    size_t pageCount = 0;
+    for (int level = 0; level < int(header.levels); ++level)
+    {
+        int levelWidth = MipChain::levelWidth(width, level), levelHeight = MipChain::levelWidth(height, level);
+        const unsigned char *levelPixels = chain.data.data() + MipChain::levelOffset(width, height, 3, level);
+        int tilesX = tilesAt(header.width, header.tileSize, level), tilesY = tilesAt(header.height, header.tileSize, level);
+        std::vector<unsigned char> pages(size_t(tilesX) * tilesY * header.pageBytes);
+        jobs.parallelFor(0, size_t(tilesY), 1, [&](size_t first, size_t last)
+                         {
+                             std::vector<unsigned char> rgba(size_t(pageSize) * pageSize * 4);
+                             for (size_t ty = first; ty < last; ++ty)
+                                 for (int tx = 0; tx < tilesX; ++tx)
+                                 {
+                                     gatherPage(levelPixels, levelWidth, levelHeight, tileSize, tx, int(ty), rgba.data());
+                                     compressPage(rgba.data(), pageSize, compression, pages.data() + (ty * tilesX + tx) * header.pageBytes);
+                                 } });
+        if (fwrite(pages.data(), 1, pages.size(), out) != pages.size())
+        {
+            std::cerr << "Error::TileBuild could not write " << argv[2] << std::endl;
+            fclose(out);
+            return 1;
+        }
+        pageCount += size_t(tilesX) * tilesY;
+    }
+    fclose(out);
+    std::cout << argv[2] << ": " << header.levels << " levels, " << pageCount << " pages of " << pageSize << "x" << pageSize << " ("
+              << header.pageBytes << " bytes), " << (sizeof(header) + pageCount * header.pageBytes) / (1024.0 * 1024.0) << " MB, cut in "
+              << secondsSince(start) << " s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <functional>
+
+#include <glm/glm.hpp>
+
+// position of a body at time t, used by the queries that search the scene's future
+typedef std::function<glm::dvec3(int body, double t)> BodyPositionFunction;
+
+// what the time-window queries need to know about a body besides its position
+struct TrajectoryBody
+{
+    double radius;
+    double maxSpeed; // upper bound on |velocity|, keeps the time bracketing conservative
+};
@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cassert>
+
+#include "transform.h"
+
+int TransformHierarchy::add(int parent, const glm::dvec3 &translation, const glm::dquat &rotation, const glm::dvec3 &scale)
+{
+    int node = static_cast<int>(parents.size());
+    assert(parent < node); // keeps the order topological
+    parents.push_back(parent);
+    translations.push_back(translation);
+    rotations.push_back(rotation);
+    scales.push_back(scale);
+    worlds.push_back(glm::dmat4(1.0));
+    dirty.push_back(1);
+    anyDirty = true;
+    return node;
+}
+
+void TransformHierarchy::setLocal(int node, const glm::dvec3 &translation, const glm::dquat &rotation, const glm::dvec3 &scale)
+{
+    translations[node] = translation;
+    rotations[node] = rotation;
+    scales[node] = scale;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+void TransformHierarchy::setTranslation(int node, const glm::dvec3 &translation)
+{
+    translations[node] = translation;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+void TransformHierarchy::setRotation(int node, const glm::dquat &rotation)
+{
+    rotations[node] = rotation;
+    dirty[node] = 1;
+    anyDirty = true;
+}
+
+size_t TransformHierarchy::update()
+{
+    if (!anyDirty)
+        return 0;
+
+    // parents come first, so a parent recomputed in this pass has already passed its flag down
+    size_t updated = 0;
+    for (size_t i = 0; i < parents.size(); ++i)
+    {
+        int parent = parents[i];
+        if (parent >= 0 && dirty[parent])
+            dirty[i] = 1;
+        if (!dirty[i])
+            continue;
+
+        // T * R * S without the general 4x4 products
+        glm::dmat3 rotation = glm::mat3_cast(rotations[i]);
+        glm::dmat4 local(1.0);
+        for (int c = 0; c < 3; ++c)
+            local[c] = glm::dvec4(rotation[c] * scales[i][c], 0.0);
+        local[3] = glm::dvec4(translations[i], 1.0);
+
+        worlds[i] = parent >= 0 ? worlds[parent] * local : local;
+        updated++;
+    }
+
+    std::fill(dirty.begin(), dirty.end(), 0);
+    anyDirty = false;
+    return updated;
+}
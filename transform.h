@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Transform hierarchy flattened into arrays. Nodes are added after their parent, so the arrays
+// are in topological order and one pass in index order sees every parent before its children.
+// Each node has a local translation, rotation and scale (applied scale first) and a world matrix
+// in double precision; only dirty nodes and their descendants are recomputed, each exactly once.
+class TransformHierarchy
+{
+public:
+    // adds a node under parent (-1 for a root, otherwise an existing node), returns its index
+    int add(int parent, const glm::dvec3 &translation = glm::dvec3(0.0),
+            const glm::dquat &rotation = glm::dquat(1.0, 0.0, 0.0, 0.0),
+            const glm::dvec3 &scale = glm::dvec3(1.0));
+
+    void setLocal(int node, const glm::dvec3 &translation, const glm::dquat &rotation, const glm::dvec3 &scale);
+    void setTranslation(int node, const glm::dvec3 &translation);
+    void setRotation(int node, const glm::dquat &rotation);
+
+    // recomputes the world matrices that changed, returns how many were
+    size_t update();
+
+    size_t size() const { return parents.size(); }
+    int parent(int node) const { return parents[node]; }
+    const glm::dmat4 &world(int node) const { return worlds[node]; }
+    glm::dvec3 worldPosition(int node) const { return glm::dvec3(worlds[node][3].x, worlds[node][3].y, worlds[node][3].z); }
+
+private:
+    std::vector<int> parents;
+    std::vector<glm::dvec3> translations;
+    std::vector<glm::dquat> rotations;
+    std::vector<glm::dvec3> scales;
+    std::vector<glm::dmat4> worlds;
+    std::vector<uint8_t> dirty;
+    bool anyDirty = false;
+};
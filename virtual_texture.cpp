@@ -0,0 +1,559 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#define GLEW_STATIC 1 // This allows linking with Static Library on Windows, without DLL
+#include <GL/glew.h>  // Include GLEW - OpenGL Extension Wrangler
+
+#include "virtual_texture.h"
+
+static const char *GLSL_VERSION = "#version 330 core\n";
+
+static std::string readShaderFile(const char *path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        std::cerr << "Error::VirtualTexture could not open shader file: " << path << std::endl;
+        return "";
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+static GLuint compileShader(GLenum type, const std::string &source, const char *name)
+{
+    const char *code = source.c_str();
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &code, NULL);
+    glCompileShader(shader);
+
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Error::VirtualTexture " << name << " failed to compile: " << log << std::endl;
+    }
+    return shader;
+}
+
+// the sphere vertex shader, and the fragment shader at path after the shared lookups
+static GLuint linkMapProgram(const char *fragmentPath)
+{
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, readShaderFile("shaders/vertex_shader.glsl"), "shaders/vertex_shader.glsl");
+    GLuint fragment = compileShader(GL_FRAGMENT_SHADER, GLSL_VERSION + readShaderFile("shaders/virtual_texture.glsl") + readShaderFile(fragmentPath), fragmentPath);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vertex);
+    glAttachShader(program, fragment);
+    glLinkProgram(program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint ok = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok)
+    {
+        char log[1024];
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Error::VirtualTexture " << fragmentPath << " failed to link: " << log << std::endl;
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static uint64_t tileKey(int map, int level, int x, int y)
+{
+    return uint64_t(map) << 48 | uint64_t(level) << 40 | uint64_t(y) << 20 | uint64_t(x);
+}
+
+bool VirtualTextures::create(size_t budgetBytes, int screenWidth, int screenHeight)
+{
+    budget = budgetBytes;
+    drawProgram = linkMapProgram("shaders/virtual_fragment_shader.glsl");
+    feedbackProgramId = linkMapProgram("shaders/virtual_feedback_shader.glsl");
+    if (!drawProgram || !feedbackProgramId)
+    {
+        destroy();
+        return false;
+    }
+    drawViewLoc = glGetUniformLocation(drawProgram, "view");
+    drawProjectionLoc = glGetUniformLocation(drawProgram, "projection");
+    drawLayoutLoc = glGetUniformLocation(drawProgram, "atlasLayout");
+    feedbackViewLoc = glGetUniformLocation(feedbackProgramId, "view");
+    feedbackProjectionLoc = glGetUniformLocation(feedbackProgramId, "projection");
+    feedbackBodyLoc = glGetUniformLocation(feedbackProgramId, "body");
+    feedbackLayoutLoc = glGetUniformLocation(feedbackProgramId, "atlasLayout");
+    for (GLuint program : {drawProgram, feedbackProgramId})
+    {
+        glUseProgram(program);
+        glUniform1i(glGetUniformLocation(program, "baseTexture"), 0);
+        glUniform1i(glGetUniformLocation(program, "atlas"), 1);
+    }
+    // a feedback texel covers FEEDBACK_DIVISOR screen pixels across
+    glUseProgram(feedbackProgramId);
+    glUniform1f(glGetUniformLocation(feedbackProgramId, "levelBias"), -std::log2(float(FEEDBACK_DIVISOR)));
+    glUseProgram(0);
+
+    // tile, level and body per texel, with its own depth so only what's in front asks for tiles
+    feedbackWidth = std::max(1, screenWidth / FEEDBACK_DIVISOR);
+    feedbackHeight = std::max(1, screenHeight / FEEDBACK_DIVISOR);
+    glGenRenderbuffers(1, &feedbackColor);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA16UI, feedbackWidth, feedbackHeight);
+    glGenRenderbuffers(1, &feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, feedbackWidth, feedbackHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, feedbackColor);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, feedbackDepth);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Error::VirtualTexture feedback framebuffer incomplete, status 0x" << std::hex << status << std::dec << std::endl;
+        destroy();
+        return false;
+    }
+
+    glGenBuffers(FEEDBACK_BUFFERS, readbackBuffers);
+    for (GLuint buffer : readbackBuffers)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size_t(feedbackWidth) * feedbackHeight * 4 * sizeof(uint16_t), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    return true;
+}
+
+void VirtualTextures::destroy()
+{
+    if (!drawProgram && !feedbackProgramId && !feedbackFramebuffer)
+        return; // never created, or destroyed already
+    // the loads read the mappings
+    if (loadsInFlight > 0)
+        jobs.wait(loads);
+    loadsInFlight = 0;
+    loaded.clear();
+    for (std::unique_ptr<Map> &map : maps)
+        glDeleteTextures(1, &map->indirection);
+    maps.clear();
+    for (int i = 0; i < FEEDBACK_BUFFERS; ++i)
+    {
+        if (readbackFences[i])
+            glDeleteSync(readbackFences[i]);
+        readbackFences[i] = 0;
+    }
+    glDeleteBuffers(FEEDBACK_BUFFERS, readbackBuffers);
+    std::fill(readbackBuffers, readbackBuffers + FEEDBACK_BUFFERS, 0);
+    glDeleteFramebuffers(1, &feedbackFramebuffer);
+    glDeleteRenderbuffers(1, &feedbackColor);
+    glDeleteRenderbuffers(1, &feedbackDepth);
+    feedbackFramebuffer = feedbackColor = feedbackDepth = 0;
+    glDeleteTextures(1, &atlas);
+    atlas = 0;
+    pages.clear();
+    freePages.clear();
+    recentPages.clear();
+    glDeleteProgram(drawProgram);
+    glDeleteProgram(feedbackProgramId);
+    drawProgram = feedbackProgramId = 0;
+}
+
+bool VirtualTextures::createAtlas(const TileFileHeader &header)
+{
+    TextureCompression compression = TextureCompression(header.compression);
+    if (compression == COMPRESSION_BC7 && !GLEW_ARB_texture_compression_bptc)
+        return false;
+    if (compression == COMPRESSION_BC1 && !GLEW_EXT_texture_compression_s3tc)
+        return false;
+    atlasFormat = compression == COMPRESSION_BC7 ? GL_COMPRESSED_RGBA_BPTC_UNORM_ARB : compression == COMPRESSION_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8;
+    layout = header;
+    pageSize = tilePageSize(header);
+
+    // as many pages as the budget holds, square; page coordinates go in 8 bits of the indirection
+    GLint maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    pagesAcross = int(std::sqrt(double(budget / header.pageBytes)));
+    pagesAcross = std::min(std::min(pagesAcross, maxSize / pageSize), 256);
+    if (pagesAcross < 2)
+    {
+        std::cerr << "Error::VirtualTexture a budget of " << budget / (1024.0 * 1024.0) << " MB holds too few pages" << std::endl;
+        return false;
+    }
+    int atlasSize = pagesAcross * pageSize;
+    glGenTextures(1, &atlas);
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    if (compression == COMPRESSION_NONE)
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    else
+        glCompressedTexImage2D(GL_TEXTURE_2D, 0, atlasFormat, atlasSize, atlasSize, 0,
+                               GLsizei(size_t(pagesAcross) * pagesAcross * header.pageBytes), NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pages.assign(size_t(pagesAcross) * pagesAcross, Page());
+    freePages.clear();
+    for (int page = int(pages.size()) - 1; page >= 0; --page)
+        freePages.push_back(page);
+
+    GLfloat atlasLayout[4] = {float(header.tileSize), float(header.border), float(pageSize), float(atlasSize)};
+    glUseProgram(drawProgram);
+    glUniform4fv(drawLayoutLoc, 1, atlasLayout);
+    glUseProgram(feedbackProgramId);
+    glUniform4fv(feedbackLayoutLoc, 1, atlasLayout);
+    glUseProgram(0);
+    return true;
+}
+
+int VirtualTextures::add(const std::string &path)
+{
+    if (!drawProgram)
+        return -1;
+    std::unique_ptr<Map> map(new Map);
+    map->path = path;
+    if (!map->file.openRead(path))
+        return -1;
+    const TileFileHeader *header = reinterpret_cast<const TileFileHeader *>(map->file.data());
+    bool valid = map->file.size() >= sizeof(TileFileHeader) &&
+                 memcmp(header->magic, TILE_FILE_MAGIC, sizeof(TILE_FILE_MAGIC)) == 0 &&
+                 header->version == TILE_FILE_VERSION &&
+                 header->tileSize >= 4 && header->tileSize % 4 == 0 && header->border % 4 == 0 &&
+                 header->compression <= COMPRESSION_BC7 &&
+                 header->levels == uint32_t(tileLevelCount(header->width, header->height, header->tileSize)) &&
+                 header->pageBytes == tilePageBytes(tilePageSize(*header), TextureCompression(header->compression)) &&
+                 tilePageOffset(*header, int(header->levels), 0, 0) <= map->file.size();
+    if (!valid)
+    {
+        std::cerr << "Error::VirtualTexture " << path << " is not a tile file of this version" << std::endl;
+        return -1;
+    }
+    map->header = *header;
+    if (!atlas && !createAtlas(*header))
+    {
+        std::cerr << "Error::VirtualTexture no atlas for " << path << " (compression not supported, or no budget)" << std::endl;
+        return -1;
+    }
+    if (header->tileSize != layout.tileSize || header->border != layout.border || header->compression != layout.compression)
+    {
+        std::cerr << "Error::VirtualTexture " << path << " doesn't share the tile size, border and compression of " << maps[0]->path << std::endl;
+        return -1;
+    }
+
+    // the indirection texture, a level per virtual level
+    int levels = int(header->levels);
+    map->page.resize(levels);
+    map->state.resize(levels);
+    glGenTextures(1, &map->indirection);
+    glBindTexture(GL_TEXTURE_2D, map->indirection);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    for (int level = 0; level < levels; ++level)
+    {
+        int tilesX = tilesAt(header->width, header->tileSize, level), tilesY = tilesAt(header->height, header->tileSize, level);
+        map->page[level].assign(size_t(tilesX) * tilesY, -1);
+        map->state[level].assign(size_t(tilesX) * tilesY, TILE_ABSENT);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, tilesX, tilesY, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // the coarsest level right away, for good
+    if (freePages.empty())
+    {
+        std::cerr << "Error::VirtualTexture no free page for the coarsest level of " << path << std::endl;
+        glDeleteTextures(1, &map->indirection);
+        return -1;
+    }
+    int index = int(maps.size());
+    maps.push_back(std::move(map));
+    int page = freePages.back();
+    freePages.pop_back();
+    pages[page].pinned = true;
+    uploadPage(page, reinterpret_cast<const unsigned char *>(maps[index]->file.data()) + tilePageOffset(*header, levels - 1, 0, 0));
+    placeTile(page, index, levels - 1, 0, 0);
+    rebuildIndirection(*maps[index]);
+    return index;
+}
+
+int VirtualTextures::find(GLuint texture) const
+{
+    for (size_t i = 0; i < maps.size(); ++i)
+        if (maps[i]->indirection == texture)
+            return int(i);
+    return -1;
+}
+
+void VirtualTextures::beginFeedback()
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &savedFramebuffer);
+    glGetIntegerv(GL_VIEWPORT, savedViewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, feedbackFramebuffer);
+    glViewport(0, 0, feedbackWidth, feedbackHeight);
+    const GLuint none[4] = {0, 0, 0, 0};
+    const GLfloat farthest = 0.0f; // reverse-Z
+    glClearBufferuiv(GL_COLOR, 0, none);
+    glClearBufferfv(GL_DEPTH, 0, &farthest);
+}
+
+void VirtualTextures::endFeedback()
+{
+    // a buffer whose previous read back hasn't been looked at yet is left alone, this frame's feedback is dropped
+    int slot = nextReadback;
+    if (!readbackFences[slot])
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+        glReadPixels(0, 0, feedbackWidth, feedbackHeight, GL_RGBA_INTEGER, GL_UNSIGNED_SHORT, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        nextReadback = (slot + 1) % FEEDBACK_BUFFERS;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, savedFramebuffer);
+    glViewport(savedViewport[0], savedViewport[1], savedViewport[2], savedViewport[3]);
+}
+
+int VirtualTextures::takePage()
+{
+    if (!freePages.empty())
+    {
+        int page = freePages.back();
+        freePages.pop_back();
+        return page;
+    }
+    // the least recently seen, unless the latest feedback still wants it
+    if (recentPages.empty() || pages[recentPages.back()].lastSeen >= feedbackFrame)
+        return -1;
+    int page = recentPages.back();
+    recentPages.pop_back();
+    Page &old = pages[page];
+    Map &map = *maps[old.map];
+    size_t tile = size_t(old.y) * tilesAt(map.header.width, map.header.tileSize, old.level) + old.x;
+    map.page[old.level][tile] = -1;
+    map.state[old.level][tile] = TILE_ABSENT;
+    map.dirty = true;
+    old.map = -1;
+    evictionCount++;
+    return page;
+}
+
+void VirtualTextures::uploadPage(int page, const unsigned char *data)
+{
+    int x = (page % pagesAcross) * pageSize, y = (page / pagesAcross) * pageSize;
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    if (layout.compression == COMPRESSION_NONE)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pageSize, pageSize, GL_RGBA, GL_UNSIGNED_BYTE, data);
+    else
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, 0, x, y, pageSize, pageSize, atlasFormat, GLsizei(layout.pageBytes), data);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    uploadCount++;
+}
+
+void VirtualTextures::placeTile(int page, int mapIndex, int level, int x, int y)
+{
+    Map &map = *maps[mapIndex];
+    size_t tile = size_t(y) * tilesAt(map.header.width, map.header.tileSize, level) + x;
+    map.page[level][tile] = page;
+    map.state[level][tile] = TILE_RESIDENT;
+    map.dirty = true;
+    Page &entry = pages[page];
+    entry.map = mapIndex;
+    entry.level = level;
+    entry.x = x;
+    entry.y = y;
+    entry.lastSeen = feedbackFrame;
+    if (!entry.pinned)
+    {
+        recentPages.push_front(page);
+        entry.recent = recentPages.begin();
+    }
+}
+
+void VirtualTextures::readFeedback(const uint16_t *pixels, size_t count)
+{
+    feedbackCount++;
+    feedbackFrame = frame;
+    // the distinct tiles asked for, then with their ancestors
+    std::vector<uint64_t> wanted;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const uint16_t *pixel = pixels + i * 4;
+        if (pixel[3] > 0 && pixel[3] <= maps.size())
+            wanted.push_back(tileKey(pixel[3] - 1, pixel[2], pixel[0], pixel[1]));
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    size_t visible = wanted.size();
+    for (size_t i = 0; i < visible; ++i)
+    {
+        int mapIndex = int(wanted[i] >> 48), level = int(wanted[i] >> 40 & 0xFF), y = int(wanted[i] >> 20 & 0xFFFFF), x = int(wanted[i] & 0xFFFFF);
+        for (int up = level + 1; up < int(maps[mapIndex]->header.levels); ++up)
+            wanted.push_back(tileKey(mapIndex, up, x >> (up - level), y >> (up - level)));
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+    // resident tiles move to the front of the lru list, missing ones queue coarsest first
+    std::vector<uint64_t> missing;
+    for (uint64_t key : wanted)
+    {
+        int mapIndex = int(key >> 48), level = int(key >> 40 & 0xFF), y = int(key >> 20 & 0xFFFFF), x = int(key & 0xFFFFF);
+        Map &map = *maps[mapIndex];
+        if (level >= int(map.header.levels) || x >= tilesAt(map.header.width, map.header.tileSize, level) ||
+            y >= tilesAt(map.header.height, map.header.tileSize, level))
+            continue;
+        size_t tile = size_t(y) * tilesAt(map.header.width, map.header.tileSize, level) + x;
+        if (map.state[level][tile] == TILE_RESIDENT)
+        {
+            Page &page = pages[map.page[level][tile]];
+            page.lastSeen = feedbackFrame;
+            if (!page.pinned)
+                recentPages.splice(recentPages.begin(), recentPages, page.recent);
+        }
+        else if (map.state[level][tile] == TILE_ABSENT)
+            missing.push_back(key);
+    }
+    std::stable_sort(missing.begin(), missing.end(), [](uint64_t a, uint64_t b)
+                     { return (a >> 40 & 0xFF) > (b >> 40 & 0xFF); });
+
+    // copying out of the mapping faults the pages of the file in, off the GL thread
+    for (uint64_t key : missing)
+    {
+        if (loadsInFlight >= LOADS_IN_FLIGHT)
+        {
+            deferredCount += 1;
+            continue;
+        }
+        int mapIndex = int(key >> 48), level = int(key >> 40 & 0xFF), y = int(key >> 20 & 0xFFFFF), x = int(key & 0xFFFFF);
+        Map *map = maps[mapIndex].get();
+        map->state[level][size_t(y) * tilesAt(map->header.width, map->header.tileSize, level) + x] = TILE_LOADING;
+        loadsInFlight++;
+        jobs.submit([this, map, mapIndex, level, x, y]
+                    {
+                        const unsigned char *source = reinterpret_cast<const unsigned char *>(map->file.data()) + tilePageOffset(map->header, level, x, y);
+                        LoadedTile tile{mapIndex, level, x, y, std::vector<unsigned char>(source, source + map->header.pageBytes)};
+                        std::lock_guard<std::mutex> lock(mutex);
+                        loaded.push_back(std::move(tile)); },
+                    &loads);
+    }
+}
+
+void VirtualTextures::rebuildIndirection(Map &map)
+{
+    // coarsest first: a tile without a page takes its parent's entry
+    int levels = int(map.header.levels);
+    std::vector<std::vector<uint8_t>> entries(levels);
+    glBindTexture(GL_TEXTURE_2D, map.indirection);
+    for (int level = levels - 1; level >= 0; --level)
+    {
+        int tilesX = tilesAt(map.header.width, map.header.tileSize, level), tilesY = tilesAt(map.header.height, map.header.tileSize, level);
+        int parentTilesX = level + 1 < levels ? tilesAt(map.header.width, map.header.tileSize, level + 1) : 1;
+        entries[level].resize(size_t(tilesX) * tilesY * 4);
+        for (int y = 0; y < tilesY; ++y)
+            for (int x = 0; x < tilesX; ++x)
+            {
+                uint8_t *entry = &entries[level][(size_t(y) * tilesX + x) * 4];
+                int page = map.page[level][size_t(y) * tilesX + x];
+                if (page >= 0)
+                {
+                    entry[0] = uint8_t(page % pagesAcross);
+                    entry[1] = uint8_t(page / pagesAcross);
+                    entry[2] = uint8_t(level);
+                    entry[3] = 255;
+                }
+                else if (level + 1 < levels)
+                    memcpy(entry, &entries[level + 1][(size_t(y >> 1) * parentTilesX + (x >> 1)) * 4], 4);
+                else
+                    memset(entry, 0, 4);
+            }
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, tilesX, tilesY, GL_RGBA, GL_UNSIGNED_BYTE, entries[level].data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    map.dirty = false;
+}
+
+void VirtualTextures::update()
+{
+    frame++;
+    if (maps.empty())
+        return;
+
+    // feedback whose read back has completed, oldest first
+    for (int i = 0; i < FEEDBACK_BUFFERS; ++i)
+    {
+        int slot = (nextReadback + i) % FEEDBACK_BUFFERS;
+        if (!readbackFences[slot])
+            continue;
+        GLenum status = glClientWaitSync(readbackFences[slot], 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            continue;
+        glDeleteSync(readbackFences[slot]);
+        readbackFences[slot] = 0;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readbackBuffers[slot]);
+        size_t count = size_t(feedbackWidth) * feedbackHeight;
+        const uint16_t *pixels = static_cast<const uint16_t *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, count * 4 * sizeof(uint16_t), GL_MAP_READ_BIT));
+        if (pixels)
+            readFeedback(pixels, count);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // a few uploads a frame; a tile with no page to go to is dropped, the feedback asks again
+    std::vector<LoadedTile> batch;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = std::min(loaded.size(), size_t(UPLOADS_PER_FRAME));
+        batch.assign(std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.begin() + count));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    for (LoadedTile &tile : batch)
+    {
+        loadsInFlight--;
+        Map &map = *maps[tile.map];
+        size_t index = size_t(tile.y) * tilesAt(map.header.width, map.header.tileSize, tile.level) + tile.x;
+        int page = takePage();
+        if (page < 0)
+        {
+            map.state[tile.level][index] = TILE_ABSENT;
+            deferredCount++;
+            continue;
+        }
+        uploadPage(page, tile.data.data());
+        placeTile(page, tile.map, tile.level, tile.x, tile.y);
+    }
+
+    for (std::unique_ptr<Map> &map : maps)
+        if (map->dirty)
+            rebuildIndirection(*map);
+}
+
+void VirtualTextures::printStats(std::ostream &out) const
+{
+    double pageMB = layout.pageBytes / (1024.0 * 1024.0);
+    out << "virtual textures: " << maps.size() << " maps, " << residentPages() << " of " << pageCount() << " pages resident ("
+        << pageCount() * pageMB << " MB atlas), " << uploadCount << " tiles uploaded, " << evictionCount << " evicted, "
+        << deferredCount << " deferred, " << feedbackCount << " feedback read backs" << std::endl;
+    for (const std::unique_ptr<Map> &map : maps)
+    {
+        size_t resident = 0, total = 0;
+        for (const std::vector<uint8_t> &level : map->state)
+        {
+            resident += std::count(level.begin(), level.end(), uint8_t(TILE_RESIDENT));
+            total += level.size();
+        }
+        out << "  " << map->path << " " << map->header.width << "x" << map->header.height << ", " << resident << " of " << total
+            << " tiles resident (" << resident * pageMB << " of " << total * pageMB << " MB)" << std::endl;
+    }
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "tile_file.h"
+#include "mapped_file.h"
+#include "jobs.h"
+
+// Virtual texturing for surface maps too large to keep resident, 16k and up. Each map is a tile
+// file (see tile_file.h) that stays memory-mapped; only the tiles the camera sees, at the level it
+// sees them, live in the pages of one physical atlas texture sized to a fixed VRAM budget.
+// A map's indirection texture has a texel per tile and a mip level per virtual level, pointing at
+// the page that holds the tile or, until it streams in, its nearest resident ancestor. The single
+// tile of the coarsest level is loaded when the map is added and never evicted, so there is always
+// something to draw.
+// Every frame a feedback pass draws the bodies into a framebuffer 1/FEEDBACK_DIVISOR the size of
+// the screen, writing the tile, level and map each pixel wants; it is read back without stalling a
+// couple of frames later. The tiles it names, and their ancestors so detail refines coarse to fine,
+// are copied out of the mapping on the job system and uploaded on the GL thread, a few per frame,
+// into the least recently seen page. Pages seen in the latest feedback are never evicted: when the
+// budget is too small for the view, the extra tiles wait and coarser ones stand in.
+class VirtualTextures
+{
+public:
+    static const int FEEDBACK_DIVISOR = 8;
+    static const int UPLOADS_PER_FRAME = 16;
+    static const int LOADS_IN_FLIGHT = 64;
+
+    explicit VirtualTextures(JobSystem &jobs) : jobs(jobs) {}
+    ~VirtualTextures() { destroy(); }
+
+    // GL thread: the programs and the feedback framebuffer for a screenWidth x screenHeight view.
+    // The atlas, made when the first map is added, takes at most budgetBytes.
+    bool create(size_t budgetBytes, int screenWidth, int screenHeight);
+    // GL thread: waits for the loads in flight, frees everything
+    void destroy();
+
+    // GL thread: maps a tile file, returns the map's index or -1 if it is missing or unusable.
+    // The first map decides the tile size, border and compression of the atlas, the others must match.
+    int add(const std::string &path);
+    size_t size() const { return maps.size(); }
+    // the indirection texture of a map, what its draws bind to unit 0
+    GLuint indirection(int index) const { return maps[index]->indirection; }
+    // the map whose indirection texture this is, -1 for an ordinary texture. Any thread, maps are
+    // only added between frames.
+    int find(GLuint texture) const;
+
+    // draws of a map: its indirection texture on unit 0, the atlas on unit 1
+    GLuint program() const { return drawProgram; }
+    GLint viewLocation() const { return drawViewLoc; }
+    GLint projectionLocation() const { return drawProjectionLoc; }
+    GLuint atlasTexture() const { return atlas; }
+    // the feedback pass draws every body, ordinary ones with body 0 since they still hide what's behind them
+    GLuint feedbackProgram() const { return feedbackProgramId; }
+    GLint feedbackViewLocation() const { return feedbackViewLoc; }
+    GLint feedbackProjectionLocation() const { return feedbackProjectionLoc; }
+    GLint feedbackBodyLocation() const { return feedbackBodyLoc; } // map index + 1
+
+    // GL thread, around the feedback draws: binds and clears the feedback framebuffer / starts its
+    // read back into a pixel pack buffer and restores the framebuffer and viewport
+    void beginFeedback();
+    void endFeedback();
+    // GL thread, once a frame, never blocks: reads the feedback that has landed, queues the tiles
+    // it asks for, uploads loaded ones and updates the indirection textures that changed
+    void update();
+
+    size_t pageCount() const { return pages.size(); }
+    size_t residentPages() const { return pages.size() - freePages.size(); }
+    void printStats(std::ostream &out) const;
+
+private:
+    enum TileState : uint8_t
+    {
+        TILE_ABSENT,
+        TILE_LOADING,
+        TILE_RESIDENT
+    };
+
+    struct Map
+    {
+        std::string path;
+        MappedFile file;
+        TileFileHeader header;
+        GLuint indirection = 0;
+        std::vector<std::vector<int>> page;       // per level, per tile: its page or -1
+        std::vector<std::vector<uint8_t>> state;  // per level, per tile: TileState
+        bool dirty = false;                       // indirection texture out of date
+    };
+
+    struct Page
+    {
+        int map = -1, level = 0, x = 0, y = 0;
+        uint32_t lastSeen = 0; // frame of the feedback that last asked for it
+        bool pinned = false;
+        std::list<int>::iterator recent; // place in the lru list, unless pinned
+    };
+
+    struct LoadedTile
+    {
+        int map, level, x, y;
+        std::vector<unsigned char> data;
+    };
+
+    bool createAtlas(const TileFileHeader &header);
+    int takePage();
+    void uploadPage(int page, const unsigned char *data);
+    void placeTile(int page, int map, int level, int x, int y);
+    void readFeedback(const uint16_t *pixels, size_t count);
+    void rebuildIndirection(Map &map);
+
+    JobSystem &jobs;
+    size_t budget = 0;
+    std::vector<std::unique_ptr<Map>> maps;
+
+    // the atlas, square, in pages of one tile with its border
+    GLuint atlas = 0;
+    GLenum atlasFormat = 0;
+    TileFileHeader layout = {}; // tile size, border and compression every map must share
+    int pageSize = 0, pagesAcross = 0;
+    std::vector<Page> pages;
+    std::vector<int> freePages;
+    std::list<int> recentPages; // most recently seen first
+
+    GLuint drawProgram = 0, feedbackProgramId = 0;
+    GLint drawViewLoc = -1, drawProjectionLoc = -1, drawLayoutLoc = -1;
+    GLint feedbackViewLoc = -1, feedbackProjectionLoc = -1, feedbackBodyLoc = -1, feedbackLayoutLoc = -1;
+
+    // feedback, read back through a ring of pixel pack buffers
+    static const int FEEDBACK_BUFFERS = 3;
+    GLuint feedbackFramebuffer = 0, feedbackColor = 0, feedbackDepth = 0;
+    int feedbackWidth = 0, feedbackHeight = 0;
+    GLuint readbackBuffers[FEEDBACK_BUFFERS] = {};
+    GLsync readbackFences[FEEDBACK_BUFFERS] = {};
+    int nextReadback = 0;
+    GLint savedFramebuffer = 0, savedViewport[4] = {};
+    uint32_t frame = 0, feedbackFrame = 0;
+
+    // tile loads on the job system
+    JobCounter loads;
+    int loadsInFlight = 0;
+    std::mutex mutex;
+    std::vector<LoadedTile> loaded;
+
+    // totals for printStats
+    uint64_t uploadCount = 0, evictionCount = 0, deferredCount = 0, feedbackCount = 0;
+};